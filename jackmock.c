@@ -0,0 +1,840 @@
+/**
+  * jackmock - in-process stand-in for the parts of libjack used by pyjack
+  *
+  * This source code is released under the terms of the GNU LGPL v2.1.
+  * See LICENSE for the full text of these terms.
+  *
+  * The mock "server" lives inside the process. A simulated clock drives
+  * the process callbacks (or process threads) of all active clients, either
+  * from a background thread running at a configurable multiple of realtime,
+  * or synchronously from jackmock_run(). Xruns, buffer-size changes, port
+  * registrations and server shutdowns can be injected at any time.
+  *
+  * Build pyjack against it with: PYJACK_MOCK=1 python setup.py build
+  * The environment variables PYJACK_MOCK_RATE, PYJACK_MOCK_BUFFER_SIZE,
+  * PYJACK_MOCK_SPEED (0: only advance through jackmock_run()) and
+  * PYJACK_MOCK_START_FRAME set the initial state of the server.
+  */
+
+#define _GNU_SOURCE
+#include "jackmock.h"
+#include <jack/transport.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <regex.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#define MOCK_MAX_CLIENTS     64
+#define MOCK_MAX_PORTS     1024
+#define MOCK_MAX_CONNECTIONS 4096
+#define MOCK_NAME_SIZE      256
+#define MOCK_MAX_BUFFER    8192
+
+struct _jack_port {
+    int            id;
+    int            used;
+    unsigned long  flags;
+    char           name[MOCK_NAME_SIZE];
+    char           type[64];
+    jack_client_t* owner;           // NULL for the "system" ports
+    float          buffer[MOCK_MAX_BUFFER];
+    float*         loop;            // delay line for system:playback -> system:capture
+    jack_latency_range_t latency[2];
+};
+
+struct _jack_client {
+    int            used;
+    int            zombie;
+    int            active;
+    char           name[MOCK_NAME_SIZE];
+    JackProcessCallback            process;            void* process_arg;
+    JackThreadCallback             thread;             void* thread_arg;
+    JackThreadInitCallback         thread_init;        void* thread_init_arg;
+    JackShutdownCallback           shutdown;           void* shutdown_arg;
+    JackBufferSizeCallback         buffer_size;        void* buffer_size_arg;
+    JackSampleRateCallback         sample_rate;        void* sample_rate_arg;
+    JackGraphOrderCallback         graph_order;        void* graph_order_arg;
+    JackXRunCallback               xrun;               void* xrun_arg;
+    JackPortRegistrationCallback   port_registration;  void* port_registration_arg;
+    JackClientRegistrationCallback client_registration; void* client_registration_arg;
+    JackPortConnectCallback        port_connect;       void* port_connect_arg;
+    JackFreewheelCallback          freewheel;          void* freewheel_arg;
+    JackLatencyCallback            latency;            void* latency_arg;
+    int            thread_initialized;
+    pthread_t      pthread;
+    int            has_pthread;
+    sem_t          cycle_start;
+    sem_t          cycle_done;
+    jack_nframes_t cycle_frames;
+};
+
+typedef struct {
+    jack_port_id_t src, dst;
+} mock_connection_t;
+
+static struct {
+    pthread_mutex_t lock;
+    int             initialized;
+    int             down;
+    jack_nframes_t  sample_rate;
+    jack_nframes_t  buffer_size;
+    jack_nframes_t  frames;             // frame time at the start of the current cycle
+    jack_time_t     usecs;              // simulated time at the start of the current cycle
+    jack_nframes_t  loopback;           // latency between system:playback_N and system:capture_N
+    double          speed;              // multiple of realtime for the background clock (0: manual)
+    int             freewheel;          // the cycle times are not estimated while freewheeling
+    int             clock_running;
+    pthread_t       clock;
+    jack_client_t   clients[MOCK_MAX_CLIENTS];
+    jack_port_t     ports[MOCK_MAX_PORTS];
+    mock_connection_t connections[MOCK_MAX_CONNECTIONS];
+    int             num_connections;
+} server;
+
+static void mock_init(void)
+{
+    pthread_mutexattr_t attr;
+    const char* env;
+    int i;
+    if (server.initialized) return;
+    server.initialized = 1;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&server.lock, &attr);
+    server.sample_rate = 48000;
+    server.buffer_size = 256;
+    server.speed = 1.0;
+    if ((env = getenv("PYJACK_MOCK_RATE"))) server.sample_rate = atoi(env);
+    if ((env = getenv("PYJACK_MOCK_BUFFER_SIZE"))) server.buffer_size = atoi(env);
+    if ((env = getenv("PYJACK_MOCK_SPEED"))) server.speed = atof(env);
+    if ((env = getenv("PYJACK_MOCK_START_FRAME"))) server.frames = strtoul(env, NULL, 0);
+    for (i = 1; i <= 2; i++) {
+        char name[MOCK_NAME_SIZE];
+        snprintf(name, sizeof(name), "system:capture_%d", i);
+        jackmock_add_port(name, JackPortIsOutput | JackPortIsPhysical | JackPortIsTerminal);
+        snprintf(name, sizeof(name), "system:playback_%d", i);
+        jackmock_add_port(name, JackPortIsInput | JackPortIsPhysical | JackPortIsTerminal);
+    }
+}
+
+static void mock_lock(void)   { mock_init(); pthread_mutex_lock(&server.lock); }
+static void mock_unlock(void) { pthread_mutex_unlock(&server.lock); }
+
+static jack_port_t* mock_find_port(const char* name)
+{
+    int i;
+    for (i = 0; i < MOCK_MAX_PORTS; i++)
+        if (server.ports[i].used && !strcmp(server.ports[i].name, name))
+            return &server.ports[i];
+    return NULL;
+}
+
+static jack_port_t* mock_new_port(jack_client_t* owner, const char* name, const char* type, unsigned long flags)
+{
+    int i;
+    for (i = 0; i < MOCK_MAX_PORTS; i++) {
+        jack_port_t* p = &server.ports[i];
+        if (p->used) continue;
+        memset(p, 0, sizeof(*p));
+        p->id = i;
+        p->used = 1;
+        p->flags = flags;
+        p->owner = owner;
+        snprintf(p->name, sizeof(p->name), "%s", name);
+        snprintf(p->type, sizeof(p->type), "%s", type);
+        return p;
+    }
+    return NULL;
+}
+
+/* ------------------------------------------------------------------ */
+/* notifications; never called with the server lock held              */
+
+#define MOCK_FOREACH_CLIENT(c) \
+    for (c = server.clients; c < server.clients + MOCK_MAX_CLIENTS; c++) if (c->used && !c->zombie)
+
+static void notify_port_registration(jack_port_id_t id, int reg)
+{
+    jack_client_t* c;
+    MOCK_FOREACH_CLIENT(c)
+        if (c->port_registration) c->port_registration(id, reg, c->port_registration_arg);
+}
+
+static void notify_graph(jack_port_id_t a, jack_port_id_t b, int connect)
+{
+    jack_client_t* c;
+    MOCK_FOREACH_CLIENT(c)
+        if (c->port_connect) c->port_connect(a, b, connect, c->port_connect_arg);
+    MOCK_FOREACH_CLIENT(c)
+        if (c->graph_order) c->graph_order(c->graph_order_arg);
+}
+
+static void notify_latency(void)
+{
+    jack_client_t* c;
+    MOCK_FOREACH_CLIENT(c) {
+        if (!c->latency) continue;
+        c->latency(JackCaptureLatency, c->latency_arg);
+        c->latency(JackPlaybackLatency, c->latency_arg);
+    }
+}
+
+/* ------------------------------------------------------------------ */
+/* the clock                                                           */
+
+static void mock_gather_inputs(jack_client_t* owner)
+{
+    int i, k;
+    for (i = 0; i < MOCK_MAX_PORTS; i++) {
+        jack_port_t* dst = &server.ports[i];
+        if (!dst->used || dst->owner != owner || !(dst->flags & JackPortIsInput)) continue;
+        memset(dst->buffer, 0, server.buffer_size * sizeof(float));
+        for (k = 0; k < server.num_connections; k++) {
+            jack_nframes_t j;
+            const float* src;
+            if (server.connections[k].dst != (jack_port_id_t)i) continue;
+            src = server.ports[server.connections[k].src].buffer;
+            for (j = 0; j < server.buffer_size; j++)
+                dst->buffer[j] += src[j];
+        }
+    }
+}
+
+static void mock_cycle_client(jack_client_t* c)
+{
+    if (c->thread) {
+        c->cycle_frames = server.buffer_size;
+        sem_post(&c->cycle_start);
+        sem_wait(&c->cycle_done);
+        return;
+    }
+    if (!c->thread_initialized) {
+        c->thread_initialized = 1;
+        if (c->thread_init) c->thread_init(c->thread_init_arg);
+    }
+    if (c->process) c->process(server.buffer_size, c->process_arg);
+}
+
+static void mock_cycle(void)
+{
+    jack_client_t* c;
+    int i;
+    mock_lock();
+    // jackmock_shutdown() may have stopped the process threads since the caller looked
+    if (server.down) {
+        mock_unlock();
+        return;
+    }
+    // system:capture_N plays back whatever system:playback_N got `loopback` frames ago
+    for (i = 0; i < MOCK_MAX_PORTS; i++) {
+        jack_port_t* p = &server.ports[i];
+        char name[MOCK_NAME_SIZE + 16];
+        jack_port_t* play;
+        jack_nframes_t j;
+        if (!p->used || p->owner || !(p->flags & JackPortIsOutput)) continue;
+        memset(p->buffer, 0, server.buffer_size * sizeof(float));
+        if (!server.loopback || strncmp(p->name, "system:capture_", 15)) continue;
+        snprintf(name, sizeof(name), "system:playback_%s", p->name + 15);
+        play = mock_find_port(name);
+        if (!play || !play->loop) continue;
+        for (j = 0; j < server.buffer_size; j++)
+            p->buffer[j] = play->loop[j];
+    }
+    MOCK_FOREACH_CLIENT(c) {
+        if (!c->active) continue;
+        mock_gather_inputs(c);
+        mock_cycle_client(c);
+    }
+    mock_gather_inputs(NULL);
+    for (i = 0; i < MOCK_MAX_PORTS; i++) {
+        jack_port_t* p = &server.ports[i];
+        if (!p->used || p->owner || !(p->flags & JackPortIsInput) || !server.loopback) continue;
+        if (!p->loop) p->loop = calloc(server.loopback + MOCK_MAX_BUFFER, sizeof(float));
+        memmove(p->loop, p->loop + server.buffer_size, server.loopback * sizeof(float));
+        memcpy(p->loop + server.loopback, p->buffer, server.buffer_size * sizeof(float));
+    }
+    server.frames += server.buffer_size;
+    server.usecs = (jack_time_t)((double)server.frames * 1e6 / server.sample_rate);
+    mock_unlock();
+}
+
+static void* mock_clock(void* arg)
+{
+    struct timespec next;
+    (void)arg;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (server.clock_running) {
+        double speed = server.speed;
+        if (speed > 0) {
+            long ns = (long)(1e9 * server.buffer_size / server.sample_rate / speed);
+            next.tv_nsec += ns;
+            while (next.tv_nsec >= 1000000000L) { next.tv_nsec -= 1000000000L; next.tv_sec++; }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        } else {
+            struct timespec idle = { 0, 1000000L };
+            nanosleep(&idle, NULL);
+            clock_gettime(CLOCK_MONOTONIC, &next);
+            continue;
+        }
+        // the speed may have dropped to 0 while this thread slept
+        mock_lock();
+        if (!server.down && server.speed > 0) mock_cycle();
+        mock_unlock();
+    }
+    return NULL;
+}
+
+static void mock_start_clock(void)
+{
+    if (server.clock_running) return;
+    server.clock_running = 1;
+    pthread_create(&server.clock, NULL, mock_clock, NULL);
+}
+
+/* ------------------------------------------------------------------ */
+/* control API                                                         */
+
+int jackmock_run(unsigned int cycles, double speed)
+{
+    unsigned int i;
+    mock_init();
+    for (i = 0; i < cycles && !server.down; i++) {
+        if (speed > 0) {
+            struct timespec ts;
+            double s = (double)server.buffer_size / server.sample_rate / speed;
+            ts.tv_sec = (time_t)s;
+            ts.tv_nsec = (long)((s - ts.tv_sec) * 1e9);
+            nanosleep(&ts, NULL);
+        }
+        mock_cycle();
+    }
+    return i;
+}
+
+void jackmock_set_speed(double speed)
+{
+    // under the lock, so that no cycle of the clock is under way once the speed is 0
+    mock_lock();
+    server.speed = speed;
+    mock_unlock();
+    if (speed > 0) mock_start_clock();
+}
+
+void jackmock_xrun(void)
+{
+    jack_client_t* c;
+    mock_init();
+    MOCK_FOREACH_CLIENT(c)
+        if (c->active && c->xrun) c->xrun(c->xrun_arg);
+}
+
+int jackmock_set_buffer_size(jack_nframes_t n)
+{
+    jack_client_t* c;
+    // JACK2 takes periods that are not a power of two with some backends
+    if (n == 0 || n > MOCK_MAX_BUFFER) return -1;
+    mock_lock();
+    server.buffer_size = n;
+    MOCK_FOREACH_CLIENT(c)
+        if (c->buffer_size) c->buffer_size(n, c->buffer_size_arg);
+    mock_unlock();
+    return 0;
+}
+
+void jackmock_set_sample_rate(jack_nframes_t sr)
+{
+    jack_client_t* c;
+    mock_init();
+    server.sample_rate = sr;
+    MOCK_FOREACH_CLIENT(c)
+        if (c->sample_rate) c->sample_rate(sr, c->sample_rate_arg);
+}
+
+void jackmock_shutdown(void)
+{
+    jack_client_t* c;
+    int i;
+    mock_lock();
+    server.down = 1;
+    mock_unlock();
+    MOCK_FOREACH_CLIENT(c) {
+        if (c->has_pthread) {
+            pthread_cancel(c->pthread);
+            pthread_join(c->pthread, NULL);
+            c->has_pthread = 0;
+        }
+        c->active = 0;
+        c->zombie = 1;
+        if (c->shutdown) c->shutdown(c->shutdown_arg);
+    }
+    mock_lock();
+    for (i = 0; i < MOCK_MAX_PORTS; i++)
+        if (server.ports[i].owner) server.ports[i].used = 0;
+    server.num_connections = 0;
+    mock_unlock();
+}
+
+void jackmock_restart(void)
+{
+    mock_lock();
+    server.down = 0;
+    mock_unlock();
+}
+
+void jackmock_set_loopback(jack_nframes_t latency)
+{
+    int i;
+    mock_lock();
+    server.loopback = latency;
+    for (i = 0; i < MOCK_MAX_PORTS; i++) {
+        free(server.ports[i].loop);
+        server.ports[i].loop = NULL;
+    }
+    mock_unlock();
+}
+
+void jackmock_set_freewheel(int onoff)
+{
+    jack_client_t* c;
+    mock_init();
+    server.freewheel = onoff;
+    MOCK_FOREACH_CLIENT(c)
+        if (c->freewheel) c->freewheel(onoff, c->freewheel_arg);
+}
+
+jack_port_t* jackmock_add_port(const char* name, unsigned long flags)
+{
+    jack_port_t* p;
+    mock_lock();
+    p = mock_new_port(NULL, name, JACK_DEFAULT_AUDIO_TYPE, flags);
+    mock_unlock();
+    if (p) notify_port_registration(p->id, 1);
+    return p;
+}
+
+/* ------------------------------------------------------------------ */
+/* libjack API                                                         */
+
+jack_client_t* jack_client_open(const char* client_name, jack_options_t options, jack_status_t* status, ...)
+{
+    jack_client_t* c;
+    int i;
+    (void)options;
+    mock_lock();
+    if (server.down) {
+        mock_unlock();
+        if (status) *status = JackFailure | JackServerFailed;
+        return NULL;
+    }
+    for (i = 0; i < MOCK_MAX_CLIENTS; i++) {
+        c = &server.clients[i];
+        if (c->used) continue;
+        memset(c, 0, sizeof(*c));
+        c->used = 1;
+        snprintf(c->name, sizeof(c->name), "%s", client_name);
+        sem_init(&c->cycle_start, 0, 0);
+        sem_init(&c->cycle_done, 0, 0);
+        mock_unlock();
+        if (status) *status = 0;
+        return c;
+    }
+    mock_unlock();
+    if (status) *status = JackFailure;
+    return NULL;
+}
+
+int jack_client_close(jack_client_t* client)
+{
+    int i;
+    if (client->active) jack_deactivate(client);
+    mock_lock();
+    for (i = 0; i < MOCK_MAX_PORTS; i++) {
+        if (server.ports[i].used && server.ports[i].owner == client) {
+            int k;
+            for (k = server.num_connections - 1; k >= 0; k--)
+                if (server.connections[k].src == (jack_port_id_t)i || server.connections[k].dst == (jack_port_id_t)i)
+                    server.connections[k] = server.connections[--server.num_connections];
+            server.ports[i].used = 0;
+        }
+    }
+    sem_destroy(&client->cycle_start);
+    sem_destroy(&client->cycle_done);
+    client->used = 0;
+    mock_unlock();
+    return 0;
+}
+
+char* jack_get_client_name(jack_client_t* client) { return client->name; }
+
+static void* mock_process_thread(void* arg)
+{
+    jack_client_t* c = (jack_client_t*)arg;
+    if (c->thread_init) c->thread_init(c->thread_init_arg);
+    return c->thread(c->thread_arg);
+}
+
+int jack_activate(jack_client_t* client)
+{
+    if (client->zombie) return -1;
+    mock_lock();
+    if (client->thread && !client->has_pthread) {
+        pthread_create(&client->pthread, NULL, mock_process_thread, client);
+        client->has_pthread = 1;
+    }
+    client->active = 1;
+    mock_unlock();
+    notify_latency();
+    if (server.speed > 0) mock_start_clock();
+    return 0;
+}
+
+int jack_deactivate(jack_client_t* client)
+{
+    mock_lock();
+    client->active = 0;
+    if (client->has_pthread) {
+        pthread_cancel(client->pthread);
+        pthread_join(client->pthread, NULL);
+        client->has_pthread = 0;
+    }
+    client->thread_initialized = 0;
+    mock_unlock();
+    return 0;
+}
+
+jack_native_thread_t jack_client_thread_id(jack_client_t* client) { return client->pthread; }
+int jack_is_realtime(jack_client_t* client) { (void)client; return 0; }
+
+jack_nframes_t jack_cycle_wait(jack_client_t* client)
+{
+    sem_wait(&client->cycle_start);
+    return client->cycle_frames;
+}
+
+void jack_cycle_signal(jack_client_t* client, int status)
+{
+    (void)status;
+    sem_post(&client->cycle_done);
+}
+
+#define MOCK_SETCALLBACK(fun, field, type)                              \
+    int fun(jack_client_t* client, type cb, void* arg) {               \
+        if (client->active) return -1;                                  \
+        client->field = cb; client->field##_arg = arg; return 0;        \
+    }
+MOCK_SETCALLBACK(jack_set_thread_init_callback, thread_init, JackThreadInitCallback)
+MOCK_SETCALLBACK(jack_set_freewheel_callback, freewheel, JackFreewheelCallback)
+MOCK_SETCALLBACK(jack_set_buffer_size_callback, buffer_size, JackBufferSizeCallback)
+MOCK_SETCALLBACK(jack_set_sample_rate_callback, sample_rate, JackSampleRateCallback)
+MOCK_SETCALLBACK(jack_set_client_registration_callback, client_registration, JackClientRegistrationCallback)
+MOCK_SETCALLBACK(jack_set_port_registration_callback, port_registration, JackPortRegistrationCallback)
+MOCK_SETCALLBACK(jack_set_port_connect_callback, port_connect, JackPortConnectCallback)
+MOCK_SETCALLBACK(jack_set_graph_order_callback, graph_order, JackGraphOrderCallback)
+MOCK_SETCALLBACK(jack_set_xrun_callback, xrun, JackXRunCallback)
+MOCK_SETCALLBACK(jack_set_latency_callback, latency, JackLatencyCallback)
+
+int jack_set_process_callback(jack_client_t* client, JackProcessCallback cb, void* arg)
+{
+    if (client->active || client->thread) return -1;
+    client->process = cb;
+    client->process_arg = arg;
+    return 0;
+}
+
+int jack_set_process_thread(jack_client_t* client, JackThreadCallback cb, void* arg)
+{
+    if (client->active || client->process) return -1;
+    client->thread = cb;
+    client->thread_arg = arg;
+    return 0;
+}
+
+void jack_on_shutdown(jack_client_t* client, JackShutdownCallback cb, void* arg)
+{
+    client->shutdown = cb;
+    client->shutdown_arg = arg;
+}
+
+void jack_on_info_shutdown(jack_client_t* client, JackInfoShutdownCallback cb, void* arg)
+{
+    (void)client; (void)cb; (void)arg;
+}
+
+int jack_set_freewheel(jack_client_t* client, int onoff)
+{
+    (void)client;
+    jackmock_set_freewheel(onoff);
+    return 0;
+}
+
+int jack_set_buffer_size(jack_client_t* client, jack_nframes_t nframes)
+{
+    (void)client;
+    return jackmock_set_buffer_size(nframes);
+}
+
+jack_nframes_t jack_get_sample_rate(jack_client_t* client) { (void)client; return server.sample_rate; }
+jack_nframes_t jack_get_buffer_size(jack_client_t* client) { (void)client; return server.buffer_size; }
+float jack_cpu_load(jack_client_t* client) { (void)client; return 0.f; }
+
+jack_port_t* jack_port_register(jack_client_t* client, const char* port_name, const char* port_type,
+                                unsigned long flags, unsigned long buffer_size)
+{
+    char name[2 * MOCK_NAME_SIZE];
+    jack_port_t* p;
+    (void)buffer_size;
+    snprintf(name, sizeof(name), "%s:%s", client->name, port_name);
+    mock_lock();
+    if (mock_find_port(name)) {
+        mock_unlock();
+        return NULL;
+    }
+    p = mock_new_port(client, name, port_type, flags);
+    mock_unlock();
+    if (p) notify_port_registration(p->id, 1);
+    return p;
+}
+
+int jack_port_unregister(jack_client_t* client, jack_port_t* port)
+{
+    int k;
+    if (port->owner != client) return -1;
+    mock_lock();
+    for (k = server.num_connections - 1; k >= 0; k--)
+        if (server.connections[k].src == (jack_port_id_t)port->id || server.connections[k].dst == (jack_port_id_t)port->id)
+            server.connections[k] = server.connections[--server.num_connections];
+    port->used = 0;
+    mock_unlock();
+    notify_port_registration(port->id, 0);
+    return 0;
+}
+
+void* jack_port_get_buffer(jack_port_t* port, jack_nframes_t nframes) { (void)nframes; return port->buffer; }
+const char* jack_port_name(const jack_port_t* port) { return port->name; }
+const char* jack_port_short_name(const jack_port_t* port)
+{
+    const char* s = strchr(port->name, ':');
+    return s ? s + 1 : port->name;
+}
+int jack_port_flags(const jack_port_t* port) { return (int)port->flags; }
+const char* jack_port_type(const jack_port_t* port) { return port->type; }
+jack_port_type_id_t jack_port_type_id(const jack_port_t* port) { return strcmp(port->type, JACK_DEFAULT_AUDIO_TYPE) ? 1 : 0; }
+int jack_port_is_mine(const jack_client_t* client, const jack_port_t* port) { return port->owner == client; }
+
+static const char** mock_connections(const jack_port_t* port)
+{
+    const char** list = calloc(server.num_connections + 1, sizeof(char*));
+    int k, n = 0;
+    for (k = 0; k < server.num_connections; k++) {
+        if (server.connections[k].src == (jack_port_id_t)port->id)
+            list[n++] = server.ports[server.connections[k].dst].name;
+        else if (server.connections[k].dst == (jack_port_id_t)port->id)
+            list[n++] = server.ports[server.connections[k].src].name;
+    }
+    if (!n) {
+        free(list);
+        return NULL;
+    }
+    return list;
+}
+
+int jack_port_connected(const jack_port_t* port)
+{
+    int k, n = 0;
+    for (k = 0; k < server.num_connections; k++)
+        if (server.connections[k].src == (jack_port_id_t)port->id || server.connections[k].dst == (jack_port_id_t)port->id)
+            n++;
+    return n;
+}
+
+const char** jack_port_get_connections(const jack_port_t* port) { return mock_connections(port); }
+const char** jack_port_get_all_connections(const jack_client_t* client, const jack_port_t* port)
+{
+    (void)client;
+    return mock_connections(port);
+}
+
+void jack_port_get_latency_range(jack_port_t* port, jack_latency_callback_mode_t mode, jack_latency_range_t* range)
+{
+    *range = port->latency[mode];
+}
+
+void jack_port_set_latency_range(jack_port_t* port, jack_latency_callback_mode_t mode, jack_latency_range_t* range)
+{
+    port->latency[mode] = *range;
+}
+
+int jack_recompute_total_latencies(jack_client_t* client)
+{
+    (void)client;
+    notify_latency();
+    return 0;
+}
+
+static int mock_connect(const char* source_port, const char* destination_port, int connect)
+{
+    jack_port_t *src, *dst;
+    int k;
+    mock_lock();
+    src = mock_find_port(source_port);
+    dst = mock_find_port(destination_port);
+    if (!src || !dst || !(src->flags & JackPortIsOutput) || !(dst->flags & JackPortIsInput)) {
+        mock_unlock();
+        return -1;
+    }
+    for (k = 0; k < server.num_connections; k++) {
+        if (server.connections[k].src != (jack_port_id_t)src->id || server.connections[k].dst != (jack_port_id_t)dst->id)
+            continue;
+        if (connect) {
+            mock_unlock();
+            return 17; /* EEXIST */
+        }
+        server.connections[k] = server.connections[--server.num_connections];
+        mock_unlock();
+        notify_graph(src->id, dst->id, 0);
+        return 0;
+    }
+    if (!connect || server.num_connections >= MOCK_MAX_CONNECTIONS) {
+        mock_unlock();
+        return -1;
+    }
+    server.connections[server.num_connections].src = src->id;
+    server.connections[server.num_connections].dst = dst->id;
+    server.num_connections++;
+    mock_unlock();
+    notify_graph(src->id, dst->id, 1);
+    return 0;
+}
+
+int jack_connect(jack_client_t* client, const char* source_port, const char* destination_port)
+{
+    (void)client;
+    return mock_connect(source_port, destination_port, 1);
+}
+
+int jack_disconnect(jack_client_t* client, const char* source_port, const char* destination_port)
+{
+    (void)client;
+    return mock_connect(source_port, destination_port, 0);
+}
+
+const char** jack_get_ports(jack_client_t* client, const char* port_name_pattern,
+                            const char* type_name_pattern, unsigned long flags)
+{
+    regex_t port_re, type_re;
+    int have_port = port_name_pattern && *port_name_pattern;
+    int have_type = type_name_pattern && *type_name_pattern;
+    const char** list;
+    int i, n = 0;
+    (void)client;
+    if (have_port && regcomp(&port_re, port_name_pattern, REG_EXTENDED | REG_NOSUB)) return NULL;
+    if (have_type && regcomp(&type_re, type_name_pattern, REG_EXTENDED | REG_NOSUB)) {
+        if (have_port) regfree(&port_re);
+        return NULL;
+    }
+    list = calloc(MOCK_MAX_PORTS + 1, sizeof(char*));
+    mock_lock();
+    for (i = 0; i < MOCK_MAX_PORTS; i++) {
+        jack_port_t* p = &server.ports[i];
+        if (!p->used) continue;
+        if (flags && (p->flags & flags) != flags) continue;
+        if (have_port && regexec(&port_re, p->name, 0, NULL, 0)) continue;
+        if (have_type && regexec(&type_re, p->type, 0, NULL, 0)) continue;
+        list[n++] = p->name;
+    }
+    mock_unlock();
+    if (have_port) regfree(&port_re);
+    if (have_type) regfree(&type_re);
+    if (!n) {
+        free(list);
+        return NULL;
+    }
+    return list;
+}
+
+jack_port_t* jack_port_by_name(jack_client_t* client, const char* port_name)
+{
+    (void)client;
+    mock_init();
+    return mock_find_port(port_name);
+}
+
+jack_port_t* jack_port_by_id(jack_client_t* client, jack_port_id_t port_id)
+{
+    (void)client;
+    if (port_id >= MOCK_MAX_PORTS || !server.ports[port_id].used) return NULL;
+    return &server.ports[port_id];
+}
+
+jack_nframes_t jack_frames_since_cycle_start(const jack_client_t* client) { (void)client; return 0; }
+jack_nframes_t jack_frame_time(const jack_client_t* client) { (void)client; return server.frames; }
+jack_nframes_t jack_last_frame_time(const jack_client_t* client) { (void)client; return server.frames; }
+
+int jack_get_cycle_times(const jack_client_t* client, jack_nframes_t* current_frames, jack_time_t* current_usecs,
+                         jack_time_t* next_usecs, float* period_usecs)
+{
+    (void)client;
+    *period_usecs = (float)(1e6 * server.buffer_size / server.sample_rate);
+    *current_frames = server.frames;
+    *current_usecs = server.usecs;
+    *next_usecs = server.usecs + (jack_time_t)*period_usecs;
+    if (server.freewheel) {
+        // like jackd, whose time estimate stands still while freewheeling
+        *period_usecs = 0;
+        *next_usecs = server.usecs;
+    }
+    return 0;
+}
+
+jack_time_t jack_frames_to_time(const jack_client_t* client, jack_nframes_t frames)
+{
+    (void)client;
+    return server.usecs + (jack_time_t)((double)(int32_t)(frames - server.frames) * 1e6 / server.sample_rate);
+}
+
+jack_nframes_t jack_time_to_frames(const jack_client_t* client, jack_time_t usecs)
+{
+    (void)client;
+    return server.frames + (jack_nframes_t)(((double)usecs - (double)server.usecs) * server.sample_rate / 1e6);
+}
+
+jack_time_t jack_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (jack_time_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void jack_free(void* ptr) { free(ptr); }
+
+void jack_get_version(int* major_ptr, int* minor_ptr, int* micro_ptr, int* proto_ptr)
+{
+    *major_ptr = 1; *minor_ptr = 9; *micro_ptr = 0; *proto_ptr = 0;
+}
+
+const char* jack_get_version_string(void) { return "jackmock"; }
+
+/* transport */
+static jack_transport_state_t mock_transport_state = JackTransportStopped;
+static jack_nframes_t mock_transport_frame = 0;
+
+jack_transport_state_t jack_transport_query(const jack_client_t* client, jack_position_t* pos)
+{
+    (void)client;
+    if (pos) {
+        pos->frame = mock_transport_frame;
+        pos->frame_rate = server.sample_rate;
+        pos->usecs = server.usecs;
+    }
+    return mock_transport_state;
+}
+jack_nframes_t jack_get_current_transport_frame(const jack_client_t* client) { (void)client; return mock_transport_frame; }
+int jack_transport_locate(jack_client_t* client, jack_nframes_t frame) { (void)client; mock_transport_frame = frame; return 0; }
+void jack_transport_start(jack_client_t* client) { (void)client; mock_transport_state = JackTransportRolling; }
+void jack_transport_stop(jack_client_t* client) { (void)client; mock_transport_state = JackTransportStopped; }
+int jack_set_sync_timeout(jack_client_t* client, jack_time_t timeout) { (void)client; (void)timeout; return 0; }
@@ -0,0 +1,37 @@
+/**
+  * jackmock - in-process stand-in for the parts of libjack used by pyjack
+  *
+  * This source code is released under the terms of the GNU LGPL v2.1.
+  * See LICENSE for the full text of these terms.
+  *
+  * Besides the libjack API, the mock server exports these functions to
+  * drive and disturb it from tests.
+  */
+#ifndef PYJACK_JACKMOCK_H
+#define PYJACK_JACKMOCK_H
+
+#include <jack/jack.h>
+
+// Run the given number of cycles now, at speed times realtime (0: as fast as possible);
+// returns the number of cycles run (less if the server was shut down)
+int  jackmock_run(unsigned int cycles, double speed);
+// Set the speed of the background clock as a multiple of realtime (0: stop it)
+void jackmock_set_speed(double speed);
+// Report an xrun to all active clients
+void jackmock_xrun(void);
+// Change the buffer size (up to 8192 frames, not necessarily a power of two); returns 0 on success
+int  jackmock_set_buffer_size(jack_nframes_t n);
+// Change the sample rate
+void jackmock_set_sample_rate(jack_nframes_t sr);
+// Shut the server down; all clients get their shutdown callback and become zombies
+void jackmock_shutdown(void);
+// Accept new clients again after jackmock_shutdown()
+void jackmock_restart(void);
+// Feed system:playback_N back into system:capture_N with the given latency in frames (0: off)
+void jackmock_set_loopback(jack_nframes_t latency);
+// Start (1) or stop (0) freewheeling, as jack_set_freewheel() does
+void jackmock_set_freewheel(int onoff);
+// Register a port owned by nobody (like the system ports), e.g. to inject registrations
+jack_port_t * jackmock_add_port(const char* name, unsigned long flags);
+
+#endif
@@ -12,20 +12,46 @@
 // Python includes
 #define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
 #include "Python.h"
+#include "structmember.h"
 #include "numpy/arrayobject.h"
 
 // Jack
 #include <jack/jack.h>
 #include <jack/transport.h>
+#ifdef PYJACK_MOCK
+#include "jackmock.h"
+#endif
+#define PYJACK_CAPI_IMPLEMENTATION
+#include "pyjack_capi.h"
+
+// LADSPA plugin hosting (setup.py defines HAVE_LADSPA when ladspa.h is found)
+#ifdef HAVE_LADSPA
+#include <ladspa.h>
+#include <dlfcn.h>
+#endif
 
 // C standard
 #include <stdio.h>
+#include <stdint.h>
+#include <math.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <semaphore.h>
+#if defined(__SSE__) || defined(__x86_64__)
+#include <xmmintrin.h>
+#endif
 
 /* python compat macros */
 #ifndef PyVarObject_HEAD_INIT
@@ -46,17 +72,24 @@
 # define PYJACK_MOD_DEF(ob, name, doc, methods)   \
   ob = Py_InitModule3(name, methods, doc)
 #endif
+// per-object locks of free-threaded builds (3.13+); with a GIL they lock nothing
+#ifndef Py_BEGIN_CRITICAL_SECTION
+# define Py_BEGIN_CRITICAL_SECTION(op) {
+# define Py_END_CRITICAL_SECTION() }
+#endif
 
-#if PY_MAJOR_VERSION >= 3
-static void* pyjack_importarray(void) {
-  import_array();
-  return NULL;
-}
-#else
-static void pyjack_importarray(void) {
-  import_array();
+// numpy is imported on first use, by the functions returning arrays.
+// Its C API table (PyArray_API) is one per process, which is why the module only supports
+// interpreters that share the main GIL.
+static int pyjack_numpy(void) {
+  static int imported = 0;
+  if (!imported) {
+    if (_import_array() < 0)
+      return -1;
+    imported = 1;
+  }
+  return 0;
 }
-#endif
 
 
 
@@ -74,14 +107,449 @@ TODO's:
 
 // Global shared data for jack
 
-/* uncomment the next line for latency callbacks */
-// #define WANT_LATENCY_CALLBACK
+/* setup.py defines WANT_LATENCY_CALLBACK if jack.h has the latency range API (jack_set_latency_callback) */
 
 #define PYJACK_MAX_PORTS 256
 #define W 0
 #define R 1
+
+// What to play when python did not deliver output in time
+#define PYJACK_UNDERRUN_SILENCE 0                   // play silence
+#define PYJACK_UNDERRUN_REPEAT  1                   // repeat the last period (for a limited time), then silence
+#define PYJACK_UNDERRUN_FADE    2                   // fade out from the last sample played, and the next period back in
+
+// Polyphase resampler between the JACK rate and a python-side working rate
+#define PYJACK_RESAMPLE_ZEROS 16                    // zero crossings of the sinc on each side
+#define PYJACK_RESAMPLE_MAX_FACTOR 1024             // upper bound for the reduced L and M
+typedef struct {
+    int            rate_from;                       // source sample rate
+    int            rate_to;                         // destination sample rate
+    int            L;                               // interpolation factor
+    int            M;                               // decimation factor
+    int            taps;                            // filter taps per phase
+    int            phase;                           // phase of the next output sample (>= L: need more input)
+    int            pos;                             // write position in the delay lines
+    int            block_pos;                       // fill/drain position within the python-side block
+    double         delay;                           // group delay in samples at L * rate_from
+    float*         coeffs;                          // L * taps polyphase coefficients, oldest sample first
+    float*         history;                         // PYJACK_MAX_PORTS delay lines of 2*taps samples each
+} pyjack_resampler_t;
+
+// Shared-memory export of input ports to other processes
+#define PYJACK_MAX_EXPORTS 8
+#define PYJACK_STREAM_MAGIC "PYJKSTRM"
+#define PYJACK_STREAM_VERSION 2
+typedef struct {
+    char           magic[8];                        // PYJACK_STREAM_MAGIC
+    uint32_t       version;                         // PYJACK_STREAM_VERSION
+    uint32_t       channels;                        // number of exported ports
+    uint32_t       capacity;                        // ring size in frames per channel (a power of two)
+    uint32_t       sample_rate;                     // JACK sample rate
+    uint64_t       write_frames;                    // total frames written; stored after the data
+    uint32_t       frame_time;                      // JACK frame time of the next frame to be written
+    uint32_t       seq;                             // odd while the writer updates write_frames and frame_time
+    uint32_t       period;                          // most frames the writer writes past write_frames at once
+    uint32_t       reserved[5];                     // pad the header to 64 bytes
+} pyjack_stream_header_t;                           // followed by float[channels][capacity]
+
+typedef struct {
+    char           name[256];                       // shared memory object name (without the leading '/')
+    int            channels;                        // number of exported ports
+    jack_port_t*   ports[PYJACK_MAX_PORTS];         // exported ports (NULL once unregistered)
+    size_t         map_size;                        // size of the mapping
+    pyjack_stream_header_t* header;                 // the mapping
+    float*         data;                            // ring data, right after the header
+    int            locked;                          // the mapping is locked into RAM
+} pyjack_export_t;
+
+// Timing of the current cycle, published by the RT thread under a sequence lock
+typedef struct {
+    uint32_t       seq;                             // odd while the RT thread is writing
+    jack_nframes_t nframes;                         // frames in the cycle
+    jack_nframes_t current_frames;                  // frame time at the start of the cycle
+    jack_time_t    current_usecs;                   // estimated start time of the cycle
+    jack_time_t    next_usecs;                      // estimated start time of the next cycle
+    float          period_usecs;                    // filtered period duration
+} pyjack_cycle_times_t;
+
+// Header of every input block sent to python; only the active channels follow, in order
+typedef struct {
+    uint32_t       nframes;                         // frames per channel
+    uint32_t       frame_time;                      // JACK frame time just after the block
+    uint32_t       channels;                        // number of input ports
+    uint32_t       active_count;                    // number of channels in the block
+    uint32_t       active[PYJACK_MAX_PORTS / 32];   // bit c set: channel c is in the block, otherwise it is silent
+} pyjack_block_header_t;
+
+// Session files: what process() and check_events() returned, for replaying without a server
+#define PYJACK_SESSION_MAGIC "PYJKSESS"
+#define PYJACK_SESSION_VERSION 1
+enum {
+    PYJACK_EVENT_GRAPH_ORDER       = 1 << 0,
+    PYJACK_EVENT_PORT_REGISTRATION = 1 << 1,
+    PYJACK_EVENT_BUFFER_SIZE       = 1 << 2,
+    PYJACK_EVENT_SAMPLE_RATE       = 1 << 3,
+    PYJACK_EVENT_XRUN              = 1 << 4,
+    PYJACK_EVENT_SHUTDOWN          = 1 << 5,
+    PYJACK_EVENT_HANGUP            = 1 << 6,
+    PYJACK_EVENT_RECONNECT         = 1 << 7
+};
+#define PYJACK_SESSION_INPUT_SYNC  1                // process() raised InputSyncError
+#define PYJACK_SESSION_OUTPUT_SYNC 2                // process() raised OutputSyncError
+typedef struct {
+    char           magic[8];                        // PYJACK_SESSION_MAGIC
+    uint32_t       version;                         // PYJACK_SESSION_VERSION
+    uint32_t       sample_rate;                     // JACK sample rate
+    uint32_t       inputs;                          // number of input ports
+    uint32_t       outputs;                         // number of output ports
+    uint32_t       buffer_size;                     // JACK buffer size when the capture started
+    uint32_t       reserved[9];                     // pad the header to 64 bytes
+} pyjack_session_header_t;
+
+typedef struct {
+    pyjack_block_header_t block;                    // input block as received by process() (zeroed if it was rejected)
+    uint32_t       events;                          // PYJACK_EVENT_* that occured since the previous record
+    uint32_t       status;                          // PYJACK_SESSION_* errors raised by the call
+    uint32_t       buffer_size;                     // JACK buffer size
+    uint32_t       input_frames;                    // frames per input channel the call expected
+    uint32_t       output_frames;                   // frames per output channel the call expected
+    uint32_t       reserved[3];
+} pyjack_session_record_t;                          // followed by float[block.active_count][block.nframes]
+
+// Spectrum analyzer: the RT thread fills a ring, a worker thread runs the FFTs
+#define PYJACK_ANALYZER_MIN_FFT 16
+#define PYJACK_ANALYZER_MAX_FFT 65536
+typedef struct {
+    int            channels;                        // number of analyzed ports
+    jack_port_t*   ports[PYJACK_MAX_PORTS];         // analyzed ports (NULL once unregistered)
+    int            fft_size;                        // frames per FFT (a power of two)
+    int            bins;                            // fft_size / 2 + 1
+    int            hop;                             // frames between two FFTs
+    float          averaging;                       // weight of the previous spectrum in the running average
+    float*         ring;                            // float[channels][ring_size], written by the RT thread
+    uint32_t       ring_size;                       // ring size in frames (a power of two)
+    uint32_t       write_frames;                    // frames written by the RT thread
+    jack_nframes_t write_frame_time;                // JACK frame time of the next frame to be written
+    uint32_t       hop_pending;                     // frames written since the worker was last woken (RT)
+    uint32_t       read_frames;                     // start of the next FFT (worker)
+    float*         window;                          // analysis window, scaled to unity gain for a full-scale sine
+    float*         re;                              // FFT work buffers
+    float*         im;
+    float*         cos_table;                       // twiddle factors
+    float*         sin_table;
+    int*           bitrev;                          // bit-reversal permutation
+    float*         average;                         // float[channels][bins] running average
+    float*         spectra[2];                      // double-buffered results, float[channels][bins] each
+    jack_nframes_t frame_time[2];                   // JACK frame time just after the last analyzed frame
+    uint32_t       generation;                      // number of published spectra; spectra[generation & 1] is the latest
+    uint32_t       overruns;                        // number of times the worker fell behind and skipped data
+    sem_t          wakeup;                          // posted by the RT thread when a hop of data is ready
+    pthread_t      thread;                          // worker
+    int            running;                         // cleared to stop the worker
+} pyjack_analyzer_t;
+
+// Always-on history of some input ports, written by the RT thread.
+// A quarter of the ring is kept as a guard against the frames the RT thread may be writing.
+typedef struct {
+    int            channels;                        // number of recorded ports
+    jack_port_t*   ports[PYJACK_MAX_PORTS];         // recorded ports (NULL once unregistered)
+    float*         ring;                            // float[channels][ring_size]
+    uint32_t       ring_size;                       // ring size in frames (a power of two)
+    uint32_t       seq;                             // sequence lock over the three fields below (odd while writing)
+    uint64_t       write_frames;                    // frames written so far
+    uint64_t       valid_from;                      // first frame still on the frame time line (reset by large jumps)
+    jack_nframes_t write_frame_time;                // JACK frame time of the next frame to be written
+    unsigned long  gaps;                            // number of frame time jumps (zero filled or reset)
+} pyjack_history_t;
+
+// Rings between the process thread and a thread of another extension (see pyjack_capi.h)
+#define PYJACK_MAX_TAPS 8
+struct pyjack_tap {
+    struct pyjack_client* client;                   // owner (a reference is held unless it is the global client)
+    int            direction;                       // PYJACK_TAP_INPUT or PYJACK_TAP_OUTPUT
+    int            channels;                        // number of ports
+    jack_port_t*   ports[PYJACK_MAX_PORTS];         // ports (NULL once unregistered)
+    float*         ring;                            // float[channels][ring_size]
+    uint32_t       ring_size;                       // ring size in frames (a power of two)
+    uint32_t       seq;                             // sequence lock over the RT side's position and frame_time
+    uint64_t       write_frames;                    // frames written (RT for input taps)
+    uint64_t       read_frames;                     // frames read (RT for output taps)
+    jack_nframes_t frame_time;                      // input: frame time of frame write_frames; output: of the next cycle
+    uint64_t       xruns;                           // periods dropped (input) or played short (output)
+    uint32_t       peaks[PYJACK_MAX_PORTS];         // peak levels since the last tap_peak(), as float bits
+};
+
+// Clips scheduled for playback on the output ports, mixed in by the RT thread
+#define PYJACK_MAX_VOICES 64
+enum {
+    PYJACK_VOICE_FREE,                              // slot unused (python owns it)
+    PYJACK_VOICE_QUEUED,                            // waiting for its start frame (RT owns it)
+    PYJACK_VOICE_PLAYING,                           // being mixed in (RT owns it)
+    PYJACK_VOICE_CANCEL,                            // cancelled by python, to be released by the RT thread
+    PYJACK_VOICE_DONE                               // finished or released; python frees the clip
+};
+typedef struct {
+    uint32_t       state;                           // PYJACK_VOICE_*
+    uint32_t       id;                              // handle returned by schedule()
+    jack_port_t*   port;                            // output port to mix into
+    jack_nframes_t at_frame;                        // frame time of the first sample
+    float          gain;                            // linear gain
+    float*         data;                            // the clip (rt_alloc)
+    uint32_t       length;                          // frames in the clip
+} pyjack_voice_t;
+
+// Named control parameters, moved to their targets per sample by the RT thread
+#define PYJACK_MAX_PARAMS 64
+#define PYJACK_PARAM_NAME 32
+#define PYJACK_MAX_GAINS 64
+typedef struct {
+    uint32_t       active;                          // slot in use (the RT thread skips it otherwise)
+    char           name[PYJACK_PARAM_NAME];         // parameter name
+    float          default_ramp;                    // ramp time in seconds when set_param() gives none
+    int            default_exponential;             // ramp shape when set_param() gives none
+    // target, written by python under a sequence lock
+    uint32_t       seq;                             // odd while python writes the target
+    float          target;                          // value to reach
+    uint32_t       ramp_frames;                     // frames to get there (0: jump)
+    int            exponential;                     // ramp in equal ratios rather than equal steps
+    // RT side
+    uint32_t       seen;                            // seq of the last target taken over
+    float          end;                             // target of the running ramp
+    float          step;                            // per-sample increment (linear) or factor (exponential)
+    uint32_t       remaining;                       // samples left in the running ramp
+    int            ramp_exponential;                // shape of the running ramp
+    float          current;                         // value at the end of the last cycle
+    float          value;                           // current, published for python
+    int            constant;                        // current held over the whole last cycle (curve is stale)
+    float*         curve;                           // per-sample values of the last cycle (rt_alloc)
+    jack_nframes_t curve_size;                      // frames in curve
+} pyjack_param_t;
+
+// Output port gains following a parameter
+typedef struct {
+    jack_port_t*   port;                            // output port (NULL: slot unused)
+    int            param;                           // index in params
+} pyjack_gain_t;
+
+// Round-trip measurement: the RT thread plays a test signal on an output port
+// and records an input port from the same cycle on
+enum {
+    PYJACK_MEASURE_ARMED,                           // waiting for the next cycle
+    PYJACK_MEASURE_RUNNING,                         // playing and recording
+    PYJACK_MEASURE_DONE                             // recording complete
+};
+typedef struct {
+    uint32_t       state;                           // PYJACK_MEASURE_*
+    jack_port_t*   out_port;                        // port the signal is played on (nothing else is, meanwhile)
+    jack_port_t*   in_port;                         // port recorded
+    float*         signal;                          // test signal
+    uint32_t       length;                          // frames in signal
+    uint32_t       played;                          // frames played so far (RT)
+    float*         record;                          // recording
+    uint32_t       capacity;                        // frames to record: length plus the longest latency looked for
+    uint32_t       recorded;                        // frames recorded so far (RT)
+} pyjack_measure_t;
+
+// Partitioned FFT convolution of a port with an impulse response. The head of the response,
+// 2 * tail_size frames, is convolved by the RT thread in partitions of one period; the tail by a
+// worker thread in partitions of tail_size frames, with tail_size frames of time to deliver each.
+#define PYJACK_MAX_CONVOLVERS 32
+#define PYJACK_CONVOLVER_SLOTS 4
+typedef struct {
+    float*         ir;                              // impulse response (kept to repartition it)
+    uint32_t       length;                          // frames in ir
+    int            head_parts;                      // partitions of the head
+    float*         head_re;                         // their spectra, float[head_parts][size + 1]
+    float*         head_im;
+    int            tail_parts;                      // partitions of the tail
+    float*         tail_re;                         // their spectra, float[tail_parts][tail_size + 1]
+    float*         tail_im;
+    float*         out;                             // tail output blocks, float[PYJACK_CONVOLVER_SLOTS][tail_size]
+    uint64_t       tags[PYJACK_CONVOLVER_SLOTS];    // block number + 1 each slot holds (0: being written)
+} pyjack_kernel_t;
+
+enum {
+    PYJACK_SWAP_NONE,                               // kernels[active] is used
+    PYJACK_SWAP_PENDING,                            // python installed a new kernel, waiting for its tail
+    PYJACK_SWAP_FADING                              // the RT thread crossfades into the new kernel
+};
+typedef struct {
+    uint32_t       id;                              // handle returned by add_convolver()
+    jack_port_t*   in_port;                         // port convolved
+    int            in_is_output;                    // in_port is an output port, read as mixed so far
+    jack_port_t*   out_port;                        // output port the result goes to
+    int            mix;                             // add to out_port instead of replacing it
+    int            size;                            // head partition size: the period size
+    int            tail_size;                       // tail partition size (a multiple of size)
+    uint32_t       head_length;                     // frames of the response in the head: 2 * tail_size
+    uint32_t       max_length;                      // longest response the convolver takes
+    int            max_tail_parts;                  // partitions of the tail of such a response
+    pyjack_kernel_t kernels[2];                     // impulse responses: the one in use, and the next one
+    uint32_t       active;                          // index of the kernel in use
+    uint32_t       swap;                            // PYJACK_SWAP_*
+    uint32_t       fade_length;                     // crossfade length in frames
+    uint32_t       fade_pos;                        // frames into the crossfade (RT)
+    uint64_t       late;                            // periods played without their tail (worker late)
+    // RT side
+    float*         re;                              // FFT work buffers (2 * size)
+    float*         im;
+    float*         acc_re;                          // accumulated spectrum (size + 1)
+    float*         acc_im;
+    float*         prev;                            // previous period of in_port
+    float*         y[2];                            // output of each kernel
+    float*         copy;                            // tail output, copied out of the kernel
+    float*         cos_table;                       // twiddle factors and bit reversal of 2 * size
+    float*         sin_table;
+    int*           bitrev;
+    float*         fdl_re;                          // spectra of the last periods, float[fdl_mask + 1][size + 1]
+    float*         fdl_im;
+    uint32_t       fdl_mask;
+    uint64_t       blocks;                          // periods transformed (RT)
+    float*         ring;                            // input of the worker, float[ring_size]
+    uint32_t       ring_size;                       // a power of two, at least 4 * tail_size
+    uint64_t       frames;                          // frames written into ring
+    // worker side
+    float*         w_re;                            // FFT work buffers (2 * tail_size)
+    float*         w_im;
+    float*         w_acc_re;                        // accumulated spectrum (tail_size + 1)
+    float*         w_acc_im;
+    float*         w_prev;                          // previous block of input
+    float*         w_cos_table;                     // twiddle factors and bit reversal of 2 * tail_size
+    float*         w_sin_table;
+    int*           w_bitrev;
+    float*         w_fdl_re;                        // spectra of the last blocks, float[w_fdl_mask + 1][tail_size + 1]
+    float*         w_fdl_im;
+    uint32_t       w_fdl_mask;
+    uint64_t       w_frames;                        // frames of ring transformed
+    uint64_t       overruns;                        // blocks of input the worker skipped
+    pthread_mutex_t lock;                           // held by the worker while it works, and by python to change kernels
+    sem_t          wakeup;                          // posted by the RT thread when a block of input is ready
+    pthread_t      thread;                          // worker (only when the response may have a tail)
+    int            running;                         // cleared to stop the worker
+} pyjack_convolver_t;
+
+#ifdef HAVE_LADSPA
+// LADSPA plugins run by the RT thread on the client's ports
+#define PYJACK_MAX_PLUGINS 16
+#define PYJACK_PLUGIN_AUDIO 16
+typedef struct {
+    const char*    name;                            // port name (owned by the plugin library)
+    unsigned long  index;                           // LADSPA port index
+    int            output;                          // written by the plugin rather than read
+    float          value;                           // what the plugin reads or wrote (RT)
+    float          target;                          // value set by python
+    int            param;                           // index of the parameter the control follows (-1: none)
+    float          published;                       // value, published for python
+} pyjack_control_t;
+
+typedef struct {
+    uint32_t       id;                              // handle returned by add_plugin()
+    void*          library;                         // dlopen() handle
+    const LADSPA_Descriptor* descriptor;
+    LADSPA_Handle  instance;
+    int            inputs;                          // audio inputs
+    unsigned long  input_index[PYJACK_PLUGIN_AUDIO]; // their LADSPA port indexes
+    jack_port_t*   input_ports[PYJACK_PLUGIN_AUDIO]; // client ports they read
+    int            input_is_output[PYJACK_PLUGIN_AUDIO]; // the port is an output port, read as mixed so far
+    int            outputs;                         // audio outputs
+    unsigned long  output_index[PYJACK_PLUGIN_AUDIO]; // their LADSPA port indexes
+    jack_port_t*   output_ports[PYJACK_PLUGIN_AUDIO]; // output ports they are written to
+    int            mix;                             // add to the output ports instead of replacing them
+    float*         scratch;                         // float[outputs + 1][scratch_size]: outputs, then silence
+    jack_nframes_t scratch_size;                    // frames per row of scratch
+    int            num_controls;                    // control ports
+    pyjack_control_t* controls;                     // control ports (rt_alloc)
+} pyjack_plugin_t;
+
+// Plugins in running order; replaced as a whole when a plugin is added or removed
+typedef struct {
+    int            count;
+    pyjack_plugin_t* plugins[PYJACK_MAX_PLUGINS];
+} pyjack_chain_t;
+#endif
+
+// What is needed to restore a client after the server restarts (set_auto_reconnect).
+// The port names are kept up to date by register_port() and unregister_port(), the
+// connections of our ports by the port connect notifications.
+#define PYJACK_PORT_NAME_SIZE 320                   // room for "client:port" names
+typedef struct {
+    char           name[PYJACK_PORT_NAME_SIZE];     // client name to reconnect under
+    double         interval;                        // seconds between two attempts to reach the server
+    char           input_names[PYJACK_MAX_PORTS][PYJACK_PORT_NAME_SIZE]; // short names of the input ports
+    char           output_names[PYJACK_MAX_PORTS][PYJACK_PORT_NAME_SIZE]; // short names of the output ports
+    int            input_flags[PYJACK_MAX_PORTS];   // their flags
+    int            output_flags[PYJACK_MAX_PORTS];
+    pthread_mutex_t lock;                           // guards the connections (notification thread)
+    char         (*connections)[2][PYJACK_PORT_NAME_SIZE]; // source and destination of each connection
+    int            num_connections;
+    int            max_connections;                 // allocated entries of connections
+    jack_time_t    down_usecs;                      // when the server went away (0: it is up)
+    jack_time_t    last_downtime;                   // usecs between the last shutdown and the restored client
+    unsigned long  reconnects;                      // number of times the client was restored
+    unsigned long  attempts;                        // number of times the server was polled
+    sem_t          wakeup;                          // posted to stop the worker early
+    pthread_t      thread;                          // worker polling for the server
+    int            running;                         // cleared to stop the worker
+} pyjack_reconnect_t;
+
+// Header in front of every buffer the RT thread touches (see rt_alloc()).
+// Each buffer is mapped on its own pages, so that locking and unlocking it leaves others alone.
+#define PYJACK_CACHE_LINE 64
+#define PYJACK_HUGE_PAGE (2 * 1024 * 1024)
+typedef struct pyjack_rtmem {
+    struct pyjack_rtmem* prev;
+    struct pyjack_rtmem* next;
+    size_t         size;                            // usable size
+    size_t         span;                            // size of the whole block, header included
+    int            huge;                            // mapped with MAP_HUGETLB
+    int            locked;                          // mlock() succeeded
+} __attribute__((aligned(PYJACK_CACHE_LINE))) pyjack_rtmem_t;
+
+// Trace ring: fixed-size, lock-free, written by the RT, notification and python threads
+enum {
+    PYJACK_TRACE_CYCLE,                             // process cycle (B/E)
+    PYJACK_TRACE_POST_CYCLE,                        // work after jack_cycle_signal (B/E)
+    PYJACK_TRACE_INPUT_WRITE,                       // input block sent to python
+    PYJACK_TRACE_INPUT_OVERFLOW,                    // input block dropped, python is behind
+    PYJACK_TRACE_OUTPUT_READ,                       // output block received from python
+    PYJACK_TRACE_UNDERRUN,                          // output block missing
+    PYJACK_TRACE_PROCESS,                           // process() call (B/E)
+    PYJACK_TRACE_INPUT_WAIT,                        // process() waiting for input (X)
+    PYJACK_TRACE_GIL_WAIT,                          // process() waiting for the GIL (X)
+    PYJACK_TRACE_INPUT_SYNC,                        // process() raised InputSyncError
+    PYJACK_TRACE_OUTPUT_SYNC,                       // process() raised OutputSyncError
+    PYJACK_TRACE_XRUN,                              // xrun notification
+    PYJACK_TRACE_BUFFER_SIZE,                       // buffer size notification
+    PYJACK_TRACE_GRAPH_ORDER,                       // graph order notification
+    PYJACK_TRACE_SHUTDOWN,                          // server shutdown
+    PYJACK_TRACE_RECONNECT,                         // server down until the client was restored (X)
+    PYJACK_TRACE_TYPES
+};
+enum {
+    PYJACK_THREAD_RT = 1,                           // jack process thread
+    PYJACK_THREAD_NOTIFY,                           // jack notification thread
+    PYJACK_THREAD_PYTHON                            // python thread calling process()
+};
+#define PYJACK_TRACE_DEFAULT_CAPACITY 65536
+typedef struct {
+    uint64_t       time;                            // jack_get_time() in usecs
+    uint32_t       arg;                             // event argument (duration in usecs for 'X' events)
+    uint32_t       seq;                             // index + 1 once the record is complete, 0 while it is written
+    uint16_t       type;                            // PYJACK_TRACE_*
+    uint8_t        thread;                          // PYJACK_THREAD_*
+    char           phase;                           // Chrome trace phase: 'B', 'E', 'i' or 'X'
+    uint32_t       reserved;
+} pyjack_trace_record_t;
+
 typedef struct {
+    uint32_t       head;                            // index of the next record to be claimed
+    uint32_t       mask;                            // capacity - 1
+    pyjack_trace_record_t records[];
+} pyjack_trace_t;
+
+typedef struct pyjack_client {
     PyObject_HEAD
+    struct pyjack_state* state;                     // state of the module (interpreter) the client belongs to
     jack_client_t* pjc;                             // Client handle
     int            buffer_size;                     // Buffer size
     int            num_inputs;                      // Number of input ports registered
@@ -96,19 +564,104 @@ typedef struct {
     float*         output_buffer_0;                 // buffer used to send audio via slink...
     float*         input_buffer_1;                  // buffer used to transmit audio via slink...
     float*         output_buffer_1;                 // buffer used to send audio via slink...
-    int            input_buffer_size;               // buffer_size * num_inputs * sizeof(sample_t)
-    int            output_buffer_size;              // buffer_size * num_outputs * sizeof(sample_t)
+    int            input_buffer_size;               // input_frames * num_inputs * sizeof(sample_t)
+    int            output_buffer_size;              // output_frames * num_outputs * sizeof(sample_t)
+    int            input_buffer_1_size;             // allocated size of input_buffer_1 (grown by process())
+    int            output_buffer_1_size;            // allocated size of output_buffer_1 (grown by process())
+    int            input_frames;                    // frames per input block on the python side
+    int            output_frames;                   // frames per output block on the python side
+    pyjack_resampler_t* input_resampler;            // JACK rate -> python rate (NULL: no resampling)
+    pyjack_resampler_t* output_resampler;           // python rate -> JACK rate (NULL: no resampling)
+    int            input_rate;                      // python-side input rate (0: the JACK rate)
+    int            output_rate;                     // python-side output rate (0: the JACK rate)
+    int            resampling_rate;                 // JACK rate the resamplers were built for (0: none)
+    int            resampling_failed;               // JACK rate the resampling ratios do not support (0: none)
+    pyjack_block_header_t input_header;             // header of the input block being sent (RT)
+    pyjack_block_header_t input_header_1;           // header of the last input block received by python
+    float          silence_threshold;               // peak level below which an input channel counts as silent (0: off)
+    float          silence_hold_time;               // seconds a channel stays active after its last non-silent block
+    int            silence_hold;                    // silence_hold_time in python-side input frames
+    int            silence_countdown[PYJACK_MAX_PORTS]; // frames each input channel stays active for (RT)
     int            iosync;                          // true when the python side synchronizing properly...
+    int            input_waiting;                   // process() is receiving into input_buffer_1 without the GIL
     int            event_graph_ordering;            // true when a graph ordering event has occured
     int            event_port_registration;         // true when a port registration event has occured
-    int            event_buffer_size;               // true when a buffer size change has occured
+    int            event_buffer_size;               // the new buffer size when a buffer size change has occured
     int            event_sample_rate;               // true when a sample rate change has occured
     int            event_xrun;                      // true when a xrun occurs
     int            event_shutdown;                  // true when the jack server is shutdown
     int            event_hangup;                    // true when client got hangup signal
+    int            event_reconnect;                 // number of times the client was restored after a server restart
+    uint32_t       session_events;                  // PYJACK_EVENT_* since the last captured process() call
+    FILE*          capture;                         // session file written by process() (NULL: not capturing)
+    int            capture_error;                   // errno of a failed session write, reported once (0: none)
+    FILE*          replay;                          // session file process() reads from instead of jack (NULL: live)
+    unsigned long  session_records;                 // number of records captured or replayed
+    uint32_t       replay_sample_rate;              // sample rate of the replayed session
+    int            replay_pending;                  // replay_record has been read, but not returned yet
+    int            replayed;                        // a session was replayed; detach() frees the buffers
+    pyjack_session_record_t replay_record;          // the record being replayed
     int            active;                          // indicates if the client is currently process-enabled
+    unsigned int   cycles;                          // number of process cycles started so far
+    int            ports_held;                      // calls changing the ports; the RT thread skips its cycles meanwhile
+    pyjack_cycle_times_t cycle_times;               // timing of the last cycle
+    int            mem_lock;                        // lock RT buffers into RAM
+    int            mem_hugepages;                   // back large RT buffers with huge pages
+    struct pyjack_rtmem* mem_blocks;                // list of RT buffers
+    size_t         mem_allocated;                   // bytes allocated for RT buffers
+    size_t         mem_locked;                      // bytes of RT memory (including the client itself) locked into RAM
+    int            mem_client_locked;               // the client itself is locked (pages_lock())
+    unsigned long  mem_lock_failures;               // number of RT buffers that could not be locked
+    float*         output_last;                     // last period played on the output ports
+    int            output_started;                  // true once python has delivered output
+    int            underrun_policy;                 // one of PYJACK_UNDERRUN_*
+    int            underrun_fade;                   // fade length in frames (PYJACK_UNDERRUN_FADE)
+    int            underrun_repeat;                 // most frames to repeat before falling silent (PYJACK_UNDERRUN_REPEAT)
+    int            underrun;                        // true while output is missing
+    int            underrun_fade_pos;               // frames into the current dropout
+    int            underrun_fade_in;                // frames left to fade back in after a dropout
+    unsigned long  underrun_periods;                // number of periods with missing output
+    unsigned long  underrun_events;                 // number of dropouts
+    jack_nframes_t underrun_frame_time;             // frame time at which the last dropout started
+    jack_time_t    underrun_usecs;                  // system time at which the last dropout started
+    unsigned int   output_written;                  // number of output blocks sent by python
+    unsigned int   output_read;                     // number of output blocks received by the RT thread
+    unsigned int   output_queue;                    // output blocks still queued after the last one was received
+    pyjack_export_t* exports[PYJACK_MAX_EXPORTS];   // shared memory streams fed by the RT thread
+    pyjack_trace_t* trace;                          // trace ring (NULL: tracing disabled)
+    pyjack_analyzer_t* analyzer;                    // spectrum analyzer (NULL: disabled)
+    pyjack_history_t* history;                      // input history (NULL: disabled)
+    pyjack_measure_t* measure;                      // round-trip measurement in progress (NULL: none)
+    pyjack_tap_t*  taps[PYJACK_MAX_TAPS];           // rings shared with other extensions
+    pyjack_voice_t voices[PYJACK_MAX_VOICES];       // scheduled clips
+    uint32_t       voice_next_id;                   // id of the last scheduled clip
+    pyjack_param_t params[PYJACK_MAX_PARAMS];       // control parameters
+    pyjack_gain_t  gains[PYJACK_MAX_GAINS];         // output port gains bound to parameters
+    pyjack_convolver_t* convolvers[PYJACK_MAX_CONVOLVERS]; // partitioned convolutions
+    uint32_t       convolver_next_id;               // id of the last convolver added
+#ifdef HAVE_LADSPA
+    pyjack_chain_t* chain;                          // LADSPA plugins (NULL: none)
+    uint32_t       plugin_next_id;                  // id of the last plugin added
+#endif
+    pyjack_reconnect_t* reconnect;                  // auto-reconnect state (NULL: never enabled)
+    jack_client_t* zombie;                          // handle of a client the server shut down, until it is closed
+    int            trace_writers;                   // threads currently writing into the trace ring
+    cpu_set_t      thread_affinity;                 // CPUs the process thread may run on
+    int            thread_affinity_set;             // true if thread_affinity should be applied
+    int            thread_rt_priority;              // SCHED_FIFO priority for the process thread (0: keep JACK's)
+    int            thread_flush_denormals;          // flush denormals to zero in the process thread
+    long           thread_id;                       // kernel id of the process thread (0: not started yet)
+    int            thread_policy;                   // scheduling policy the process thread ended up with
+    int            thread_priority;                 // scheduling priority the process thread ended up with
+    int            thread_denormals;                // true if denormals are flushed in the process thread
+    int            thread_affinity_error;           // errno of applying thread_affinity (0: success)
+    int            thread_priority_error;           // errno of applying thread_rt_priority (0: success)
 
     int            doProcessing;                    // indicates whether the process-callback should be enabled
+    int            process_thread;                  // run our own cycle loop (jack_set_process_thread) instead of a process callback
+    int            process_registered;              // true once the process callback/thread has been handed to jack
+    float*         input_stage;                     // JACK-rate copy of the input ports, resampled after the cycle (process thread)
+    unsigned       input_stage_size;                // num_inputs * buffer_size * sizeof(sample_t), or 0
 
     PyObject *     callback_buffer_size; // callback whenever the size of the the buffer is about to change
     PyObject *     callback_client_registration; // callback whenever a port is registered or unregistered
@@ -120,22 +673,198 @@ typedef struct {
     PyObject *     callback_sample_rate; // callback whenever the system sample rate changes
     PyObject *     callback_thread_init; // callback when the thread has been initialized
     PyObject *     callback_xrun; // callback whenever there is an xrun
+    PyObject *     callback_reconnect; // callback when the client was restored after a server restart
 } pyjack_client_t;
 
-pyjack_client_t global_client;
+// Multi-phase init (PEP 489) with per-module state, so that every interpreter has its
+// own global client, exceptions and types; older pythons use one static state
+#if PY_VERSION_HEX >= 0x030B0000
+# define PYJACK_MULTI_PHASE
+#endif
+
+typedef struct pyjack_state {
+    PyObject *     module;                          // the module (borrowed)
+    PyInterpreterState* interp;                     // interpreter the module was loaded into
+    PyTypeObject * ClientType;                      // jack.Client
+    PyTypeObject * StreamReaderType;                // jack.StreamReader
+    PyObject *     Error;                           // jack.Error
+    PyObject *     NotConnectedError;               // jack.NotConnectedError
+    PyObject *     UsageError;                      // jack.UsageError
+    PyObject *     InputSyncError;                  // jack.InputSyncError
+    PyObject *     OutputSyncError;                 // jack.OutputSyncError
+    pyjack_client_t global_client;                  // client of the module-level functions
+} pyjack_state_t;
+
+#ifdef PYJACK_MULTI_PHASE
+static struct PyModuleDef pyjack_moduledef;
+static pyjack_state_t * pyjack_state_of_type(PyTypeObject * type) {
+    PyObject * m = PyType_GetModuleByDef(type, &pyjack_moduledef);
+    return m ? (pyjack_state_t*)PyModule_GetState(m) : NULL;
+}
+static pyjack_state_t * pyjack_state_of_module(PyObject * m) {
+    return (pyjack_state_t*)PyModule_GetState(m);
+}
+#else
+static pyjack_state_t pyjack_static_state;
+# define pyjack_state_of_type(type) (&pyjack_static_state)
+# define pyjack_state_of_module(m) (&pyjack_static_state)
+#endif
+
+// State of the module a method was called on: self is the module, or an object of its types
+static pyjack_state_t * pyjack_state_of(PyObject * self) {
+    if (!self || PyModule_Check(self)) return pyjack_state_of_module(self);
+    return pyjack_state_of_type(Py_TYPE(self));
+}
+
 pyjack_client_t * self_or_global_client(PyObject * self) {
-    if (!self) return & global_client;
-    if (PyModule_Check(self)) return & global_client;
+    if (!self || PyModule_Check(self)) return & pyjack_state_of_module(self)->global_client;
     return (pyjack_client_t*) self;
 }
 
+static int is_global_client(pyjack_client_t * client) {
+    return client == &client->state->global_client;
+}
+
+#ifdef Py_GIL_DISABLED
+// The object whose critical section guards a client: the jack.Client itself,
+// or the module for the global client (the critical section macros of GIL
+// builds discard their argument)
+static PyObject * client_object(pyjack_client_t * client) {
+    return is_global_client(client) ? client->state->module : (PyObject*)client;
+}
+#endif
+
+// Take the GIL of the client's interpreter in a notification thread
+// (PyGILState_Ensure() only knows the main interpreter)
+typedef struct {
+    PyGILState_STATE gstate;
+    PyThreadState * tstate;                         // thread state created for a subinterpreter, or NULL
+    PyThreadState * saved;                          // thread state of another interpreter this thread held
+    int            held;                            // the thread was already running in the interpreter
+} pyjack_gil_t;
+#if PY_VERSION_HEX >= 0x030D0000
+# define pyjack_current_tstate() PyThreadState_GetUnchecked()
+#else
+# define pyjack_current_tstate() _PyThreadState_UncheckedGet()
+#endif
+static void pyjack_gil_ensure(pyjack_client_t * client, pyjack_gil_t * gil) {
+    memset(gil, 0, sizeof(*gil));
+#ifdef PYJACK_MULTI_PHASE
+    if (client->state->interp != PyInterpreterState_Main()) {
+        // e.g. the mock server notifying from a python thread
+        PyThreadState * current = pyjack_current_tstate();
+        if (current && PyThreadState_GetInterpreter(current) == client->state->interp) {
+            gil->held = 1;
+            return;
+        }
+        if (current)
+            gil->saved = PyEval_SaveThread();
+        gil->tstate = PyThreadState_New(client->state->interp);
+        PyEval_RestoreThread(gil->tstate);
+        return;
+    }
+#endif
+    gil->gstate = PyGILState_Ensure();
+}
+static void pyjack_gil_release(pyjack_gil_t * gil) {
+    if (gil->held)
+        return;
+    if (gil->tstate) {
+        PyThreadState_Clear(gil->tstate);
+        PyThreadState_DeleteCurrent();
+        if (gil->saved)
+            PyEval_RestoreThread(gil->saved);
+        return;
+    }
+    PyGILState_Release(gil->gstate);
+}
+
+// New reference to the callback in slot, read under the client's lock, or NULL
+static PyObject * client_callback(pyjack_client_t * client, PyObject ** slot) {
+    PyObject * callback;
+    Py_BEGIN_CRITICAL_SECTION(client_object(client));
+    callback = *slot;
+    Py_XINCREF(callback);
+    Py_END_CRITICAL_SECTION();
+    return callback;
+}
+
+// mlock() does not nest: the pages of a client struct, which it may share with other clients
+// (or the struct of a freed client), are locked by the first struct on them and unlocked by the last
+static pthread_mutex_t page_locks_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct { uintptr_t page; int count; } * page_locks;
+static int page_locks_count, page_locks_max;
+
+static void pages_unlock(const void * addr, size_t size);
+
+// Lock the pages of [addr, addr+size); returns 0 on success
+static int pages_lock(const void * addr, size_t size)
+{
+    uintptr_t pagesize = sysconf(_SC_PAGESIZE);
+    uintptr_t first = (uintptr_t)addr & ~(pagesize - 1);
+    uintptr_t page;
+    int i;
+
+    pthread_mutex_lock(&page_locks_mutex);
+    for (page = first; page < (uintptr_t)addr + size; page += pagesize) {
+        for (i = 0; i < page_locks_count && page_locks[i].page != page; i++);
+        if (i == page_locks_count) {
+            if (page_locks_count == page_locks_max) {
+                int max = page_locks_max ? 2 * page_locks_max : 64;
+                void * grown = realloc(page_locks, max * sizeof(page_locks[0]));
+                if (!grown) break;
+                page_locks = grown;
+                page_locks_max = max;
+            }
+            if (mlock((void*)page, pagesize)) break;
+            page_locks[i].page = page;
+            page_locks[i].count = 0;
+            page_locks_count++;
+        }
+        page_locks[i].count++;
+    }
+    pthread_mutex_unlock(&page_locks_mutex);
+    if (page < (uintptr_t)addr + size) {
+        if (page > first) pages_unlock((void*)first, page - first);
+        return -1;
+    }
+    return 0;
+}
+
+// Undo pages_lock()
+static void pages_unlock(const void * addr, size_t size)
+{
+    uintptr_t pagesize = sysconf(_SC_PAGESIZE);
+    uintptr_t page;
+    int i;
+
+    pthread_mutex_lock(&page_locks_mutex);
+    for (page = (uintptr_t)addr & ~(pagesize - 1); page < (uintptr_t)addr + size; page += pagesize) {
+        for (i = 0; i < page_locks_count && page_locks[i].page != page; i++);
+        if (i == page_locks_count || --page_locks[i].count) continue;
+        munlock((void*)page, pagesize);
+        page_locks[i] = page_locks[--page_locks_count];
+    }
+    pthread_mutex_unlock(&page_locks_mutex);
+}
+
 // Initialize global data
-void pyjack_init(pyjack_client_t * client) {
+void pyjack_init(pyjack_client_t * client, pyjack_state_t * state) {
+    client->state = state;
     // Init everything to to null...
     size_t headsize=(void*)(&client->pjc)-(void*)(client);
     size_t size=sizeof(*client)-headsize;
     memset((void*)(client)+headsize, 0, size );
     client->doProcessing=1;
+    client->underrun_fade=64;
+    client->underrun_repeat=16384;
+    client->mem_lock=1;
+
+    // The RT thread reads the client itself on every cycle
+    if (pages_lock(client, sizeof(*client)) == 0) {
+        client->mem_client_locked = 1;
+        client->mem_locked = sizeof(*client);
+    }
 
     // Initialize unamed, raw datagram-type sockets...
     if (socketpair(PF_UNIX, SOCK_DGRAM, 0, client->input_pipe) == -1) {
@@ -166,6 +895,337 @@ static void free_and_reset(float ** pointer)
     *pointer=0;
 }
 
+/** Allocate memory for the RT thread: cache aligned, zeroed and prefaulted,
+  * locked into RAM if client->mem_lock is set, and backed by huge pages if
+  * client->mem_hugepages is set and the buffer is large enough to use them.
+  * This is never called from the RT thread itself.
+  */
+static void * rt_alloc(pyjack_client_t * client, size_t size)
+{
+    pyjack_rtmem_t * block = NULL;
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    size_t span = (sizeof(pyjack_rtmem_t) + size + pagesize - 1) & ~(pagesize - 1);
+    void * map;
+    int huge = 0;
+
+#ifdef MAP_HUGETLB
+    if (client->mem_hugepages && span >= PYJACK_HUGE_PAGE) {
+        size_t hspan = (span + PYJACK_HUGE_PAGE - 1) & ~(size_t)(PYJACK_HUGE_PAGE - 1);
+        map = mmap(NULL, hspan, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (map != MAP_FAILED) {
+            block = map;
+            span = hspan;
+            huge = 1;
+        }
+    }
+#endif
+    if (!block) {
+        map = mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED)
+            return NULL;
+        block = map;
+    }
+
+    // write every page, so that none of them faults in the RT thread
+    memset(block, 0, span);
+    block->size = size;
+    block->span = span;
+    block->huge = huge;
+    if (client->mem_lock) {
+        block->locked = (mlock(block, span) == 0);
+        if (block->locked)
+            client->mem_locked += span;
+        else
+            client->mem_lock_failures++;
+    }
+    client->mem_allocated += span;
+
+    block->next = client->mem_blocks;
+    if (block->next) block->next->prev = block;
+    client->mem_blocks = block;
+    return block + 1;
+}
+
+static void rt_free(pyjack_client_t * client, void * pointer)
+{
+    pyjack_rtmem_t * block;
+    if (!pointer) return;
+    block = (pyjack_rtmem_t*)pointer - 1;
+
+    if (block->prev) block->prev->next = block->next;
+    else client->mem_blocks = block->next;
+    if (block->next) block->next->prev = block->prev;
+
+    client->mem_allocated -= block->span;
+    if (block->locked)
+        client->mem_locked -= block->span;
+    // unmapping unlocks the pages too
+    munmap(block, block->span);
+}
+
+static void rt_free_and_reset(pyjack_client_t * client, float ** pointer)
+{
+    rt_free(client, *pointer);
+    *pointer = NULL;
+}
+
+// Number of bytes of [addr, addr+size) currently resident in RAM
+static size_t resident_bytes(const void * addr, size_t size)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)addr & ~(uintptr_t)(pagesize - 1);
+    size_t pages = ((uintptr_t)addr + size - start + pagesize - 1) / pagesize;
+    size_t i, resident = 0;
+    unsigned char vec[256];
+
+    while (pages) {
+        size_t chunk = pages < sizeof(vec) ? pages : sizeof(vec);
+        if (mincore((void*)start, chunk * pagesize, vec)) return 0;
+        for (i = 0; i < chunk; i++)
+            if (vec[i] & 1) resident += pagesize;
+        start += chunk * pagesize;
+        pages -= chunk;
+    }
+    return resident;
+}
+
+// Append a record to the trace ring (any thread, lock-free).
+// Writers claim a slot with a single atomic add and overwrite the oldest records.
+static void trace_event(pyjack_client_t * client, int type, char phase, int thread, jack_time_t time, uint32_t arg)
+{
+    pyjack_trace_t * t;
+    pyjack_trace_record_t * rec;
+    uint32_t index;
+
+    // Dekker-style with trace_free(): each side stores, then loads what the other stores,
+    // which only orders with sequential consistency on both sides
+    __atomic_add_fetch(&client->trace_writers, 1, __ATOMIC_SEQ_CST);
+    t = __atomic_load_n(&client->trace, __ATOMIC_SEQ_CST);
+    if (t) {
+        index = __atomic_fetch_add(&t->head, 1, __ATOMIC_RELAXED);
+        rec = &t->records[index & t->mask];
+        __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        rec->time = time;
+        rec->arg = arg;
+        rec->type = type;
+        rec->thread = thread;
+        rec->phase = phase;
+        __atomic_store_n(&rec->seq, index + 1, __ATOMIC_RELEASE);
+    }
+    __atomic_sub_fetch(&client->trace_writers, 1, __ATOMIC_RELEASE);
+}
+
+// Only read the clock when tracing is enabled
+#define TRACE(client, type, phase, thread, arg) do {                               \
+        if (__atomic_load_n(&(client)->trace, __ATOMIC_RELAXED))                  \
+            trace_event((client), (type), (phase), (thread), jack_get_time(), (arg)); \
+    } while (0)
+
+// Unpublish the trace ring and free it once no thread writes into it anymore
+static void trace_free(pyjack_client_t * client)
+{
+    pyjack_trace_t * t = __atomic_exchange_n(&client->trace, NULL, __ATOMIC_SEQ_CST);
+    if (!t) return;
+    while (__atomic_load_n(&client->trace_writers, __ATOMIC_SEQ_CST))
+        sched_yield();
+    rt_free(client, t);
+}
+
+// Stop the worker thread and free the analyzer (once the RT thread cannot reach it anymore)
+static void analyzer_free(pyjack_client_t * client, pyjack_analyzer_t * an)
+{
+    if (!an) return;
+    if (an->running) {
+        __atomic_store_n(&an->running, 0, __ATOMIC_RELEASE);
+        sem_post(&an->wakeup);
+        pthread_join(an->thread, NULL);
+    }
+    sem_destroy(&an->wakeup);
+    rt_free(client, an->ring);
+    free(an->window);
+    free(an->re);
+    free(an->im);
+    free(an->cos_table);
+    free(an->sin_table);
+    free(an->bitrev);
+    free(an->average);
+    free(an->spectra[0]);
+    free(an->spectra[1]);
+    rt_free(client, an);
+}
+
+static void kernel_free(pyjack_client_t * client, pyjack_kernel_t * k)
+{
+    free(k->ir);
+    rt_free(client, k->head_re);
+    rt_free(client, k->head_im);
+    rt_free(client, k->tail_re);
+    rt_free(client, k->tail_im);
+    rt_free(client, k->out);
+    memset(k, 0, sizeof(*k));
+}
+
+// Stop the worker thread and free the convolver (once the RT thread cannot reach it anymore)
+static void convolver_free(pyjack_client_t * client, pyjack_convolver_t * cv)
+{
+    if (!cv) return;
+    if (cv->running) {
+        __atomic_store_n(&cv->running, 0, __ATOMIC_RELEASE);
+        sem_post(&cv->wakeup);
+        pthread_join(cv->thread, NULL);
+    }
+    sem_destroy(&cv->wakeup);
+    pthread_mutex_destroy(&cv->lock);
+    kernel_free(client, &cv->kernels[0]);
+    kernel_free(client, &cv->kernels[1]);
+    rt_free(client, cv->re);
+    rt_free(client, cv->cos_table);
+    rt_free(client, cv->bitrev);
+    rt_free(client, cv->fdl_re);
+    rt_free(client, cv->fdl_im);
+    rt_free(client, cv->ring);
+    free(cv->w_re);
+    free(cv->w_cos_table);
+    free(cv->w_bitrev);
+    free(cv->w_fdl_re);
+    free(cv->w_fdl_im);
+    rt_free(client, cv);
+}
+
+// True if a convolver reads or writes port
+static int convolvers_use_port(pyjack_client_t * client, jack_port_t * port)
+{
+    int i;
+    for (i = 0; i < PYJACK_MAX_CONVOLVERS; i++) {
+        if (client->convolvers[i] && (client->convolvers[i]->in_port == port || client->convolvers[i]->out_port == port))
+            return 1;
+    }
+    return 0;
+}
+
+// Free the clips the RT thread is done with (or all of them, if it is not running)
+static void voices_reclaim(pyjack_client_t * client, int all)
+{
+    int i;
+    for (i = 0; i < PYJACK_MAX_VOICES; i++) {
+        pyjack_voice_t * v = &client->voices[i];
+        uint32_t state = __atomic_load_n(&v->state, __ATOMIC_ACQUIRE);
+        if (state == PYJACK_VOICE_FREE) continue;
+        if (state != PYJACK_VOICE_DONE && !(all || (state == PYJACK_VOICE_CANCEL && !client->active))) continue;
+        rt_free(client, v->data);
+        v->data = NULL;
+        __atomic_store_n(&v->state, PYJACK_VOICE_FREE, __ATOMIC_RELEASE);
+    }
+}
+
+// Cancel a scheduled clip; returns 1 if it had not finished yet
+static int voice_cancel(pyjack_voice_t * v)
+{
+    uint32_t state = PYJACK_VOICE_QUEUED;
+    if (__atomic_compare_exchange_n(&v->state, &state, PYJACK_VOICE_CANCEL, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return 1;
+    return state == PYJACK_VOICE_PLAYING
+        && __atomic_compare_exchange_n(&v->state, &state, PYJACK_VOICE_CANCEL, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+// Drop the gains bound to port (any port if NULL) or to param (any if < 0); returns 1 if any was
+static int gains_unbind(pyjack_client_t * client, jack_port_t * port, int param)
+{
+    int i, found = 0;
+    for (i = 0; i < PYJACK_MAX_GAINS; i++) {
+        pyjack_gain_t * g = &client->gains[i];
+        if (!g->port || (port && g->port != port) || (param >= 0 && g->param != param)) continue;
+        __atomic_store_n(&g->port, NULL, __ATOMIC_RELEASE);
+        found = 1;
+    }
+    return found;
+}
+
+// Give every parameter room for a curve of buffer_size frames (the RT thread must be held)
+static void params_resize(pyjack_client_t * client)
+{
+    int i;
+    for (i = 0; i < PYJACK_MAX_PARAMS; i++) {
+        pyjack_param_t * p = &client->params[i];
+        if (!p->active || p->curve_size >= (jack_nframes_t)client->buffer_size) continue;
+        rt_free(client, p->curve);
+        p->curve = rt_alloc(client, client->buffer_size * sizeof(float));
+        p->curve_size = p->curve ? client->buffer_size : 0;
+        p->constant = 1;
+    }
+}
+
+// Free a parameter the RT thread no longer looks at
+static void param_free(pyjack_client_t * client, pyjack_param_t * p)
+{
+    rt_free(client, p->curve);
+    memset(p, 0, sizeof(*p));
+}
+
+#ifdef HAVE_LADSPA
+// Deactivate and free a plugin the RT thread no longer runs
+static void plugin_free(pyjack_client_t * client, pyjack_plugin_t * pl)
+{
+    if (pl->instance) {
+        if (pl->descriptor->deactivate) pl->descriptor->deactivate(pl->instance);
+        if (pl->descriptor->cleanup) pl->descriptor->cleanup(pl->instance);
+    }
+    if (pl->library) dlclose(pl->library);
+    rt_free(client, pl->scratch);
+    rt_free(client, pl->controls);
+    rt_free(client, pl);
+}
+
+// Give every plugin room for buffer_size frames per output (the RT thread must be held)
+static void plugins_resize(pyjack_client_t * client)
+{
+    int i;
+    if (!client->chain) return;
+    for (i = 0; i < client->chain->count; i++) {
+        pyjack_plugin_t * pl = client->chain->plugins[i];
+        if (pl->scratch_size >= (jack_nframes_t)client->buffer_size) continue;
+        rt_free(client, pl->scratch);
+        pl->scratch = rt_alloc(client, (pl->outputs + 1) * client->buffer_size * sizeof(float));
+        pl->scratch_size = pl->scratch ? client->buffer_size : 0;
+    }
+}
+
+// Release the plugin controls following param (any if < 0); returns 1 if any did
+static int plugins_unbind(pyjack_client_t * client, int param)
+{
+    int i, k, found = 0;
+    if (!client->chain) return 0;
+    for (i = 0; i < client->chain->count; i++) {
+        pyjack_plugin_t * pl = client->chain->plugins[i];
+        for (k = 0; k < pl->num_controls; k++) {
+            pyjack_control_t * c = &pl->controls[k];
+            if (c->param < 0 || (param >= 0 && c->param != param)) continue;
+            // the control keeps the parameter's last value
+            __atomic_store(&c->target, &client->params[c->param].value, __ATOMIC_RELAXED);
+            __atomic_store_n(&c->param, -1, __ATOMIC_RELEASE);
+            found = 1;
+        }
+    }
+    return found;
+}
+
+// True if a plugin reads or writes port
+static int plugins_use_port(pyjack_client_t * client, jack_port_t * port)
+{
+    int i, k;
+    if (!client->chain) return 0;
+    for (i = 0; i < client->chain->count; i++) {
+        pyjack_plugin_t * pl = client->chain->plugins[i];
+        for (k = 0; k < pl->inputs; k++)
+            if (pl->input_ports[k] == port) return 1;
+        for (k = 0; k < pl->outputs; k++)
+            if (pl->output_ports[k] == port) return 1;
+    }
+    return 0;
+}
+#endif
+
 static void close_and_reset(int * fd)
 {
     if (!*fd) return;
@@ -173,17 +1233,121 @@ static void close_and_reset(int * fd)
     *fd=0;
 }
 
+static void resampler_free(pyjack_client_t * client, pyjack_resampler_t ** rs)
+{
+    if (!*rs) return;
+    rt_free(client, (*rs)->coeffs);
+    rt_free(client, (*rs)->history);
+    rt_free(client, *rs);
+    *rs = NULL;
+}
+
+static void export_free(pyjack_client_t * client, pyjack_export_t * ex)
+{
+    if (ex->header) {
+        if (ex->locked) {
+            munlock(ex->header, ex->map_size);
+            client->mem_locked -= ex->map_size;
+        }
+        munmap(ex->header, ex->map_size);
+    }
+    rt_free(client, ex);
+}
+
+// Close the captured or replayed session; returns the number of records
+static unsigned long session_close(pyjack_client_t * client)
+{
+    unsigned long records = client->session_records;
+    if (client->capture) {
+        if (fclose(client->capture) && !client->capture_error)
+            client->capture_error = errno ? errno : EIO;
+        client->capture = NULL;
+    }
+    if (client->replay) {
+        fclose(client->replay);
+        client->replay = NULL;
+        client->replay_pending = 0;
+        client->num_inputs = 0;
+        client->num_outputs = 0;
+        client->buffer_size = 0;
+        client->input_frames = 0;
+        client->output_frames = 0;
+    }
+    client->session_records = 0;
+    return records;
+}
+
 // Finalize global data
 void pyjack_final(pyjack_client_t * client) {
+    int i;
     client->pjc = NULL;
+    client->replayed = 0;
     // Free buffers...
     client->num_inputs = 0;
     client->num_outputs = 0;
     client->buffer_size = 0;
-    free_and_reset(&client->input_buffer_0);
+    rt_free_and_reset(client, &client->input_buffer_0);
     free_and_reset(&client->input_buffer_1);
-    free_and_reset(&client->output_buffer_0);
+    rt_free_and_reset(client, &client->output_buffer_0);
     free_and_reset(&client->output_buffer_1);
+    rt_free_and_reset(client, &client->output_last);
+    rt_free_and_reset(client, &client->input_stage);
+    trace_free(client);
+    analyzer_free(client, client->analyzer);
+    client->analyzer = NULL;
+    if (client->history) {
+        rt_free(client, client->history->ring);
+        rt_free(client, client->history);
+        client->history = NULL;
+    }
+    voices_reclaim(client, 1);
+    gains_unbind(client, NULL, -1);
+    for (i = 0; i < PYJACK_MAX_CONVOLVERS; i++) {
+        convolver_free(client, client->convolvers[i]);
+        client->convolvers[i] = NULL;
+    }
+#ifdef HAVE_LADSPA
+    if (client->chain) {
+        for (i = 0; i < client->chain->count; i++)
+            plugin_free(client, client->chain->plugins[i]);
+        rt_free(client, client->chain);
+        client->chain = NULL;
+    }
+#endif
+    for (i = 0; i < PYJACK_MAX_PARAMS; i++)
+        param_free(client, &client->params[i]);
+    client->input_stage_size = 0;
+    client->process_registered = 0;
+    resampler_free(client, &client->input_resampler);
+    resampler_free(client, &client->output_resampler);
+    client->input_rate = 0;
+    client->output_rate = 0;
+    client->resampling_rate = 0;
+    client->resampling_failed = 0;
+    client->input_buffer_size = 0;
+    client->output_buffer_size = 0;
+    client->input_buffer_1_size = 0;
+    client->output_buffer_1_size = 0;
+    // Remove exported streams...
+    for (i = 0; i < PYJACK_MAX_EXPORTS; i++) {
+        if (!client->exports[i]) continue;
+        char shmname[258];
+        snprintf(shmname, sizeof(shmname), "/%s", client->exports[i]->name);
+        shm_unlink(shmname);
+        export_free(client, client->exports[i]);
+        client->exports[i] = NULL;
+    }
+    // the client is closed, no notification follows the connections any more
+    if (client->reconnect) {
+        pthread_mutex_destroy(&client->reconnect->lock);
+        sem_destroy(&client->reconnect->wakeup);
+        free(client->reconnect->connections);
+        free(client->reconnect);
+        client->reconnect = NULL;
+    }
+    // taps belong to the extensions that opened them; they just stop being fed
+    for (i = 0; i < PYJACK_MAX_TAPS; i++)
+        client->taps[i] = NULL;
     // Close socket...
     close_and_reset(&client->input_pipe[R]);
     close_and_reset(&client->input_pipe[W]);
@@ -191,1121 +1355,6026 @@ void pyjack_final(pyjack_client_t * client) {
     close_and_reset(&client->output_pipe[W]);
 }
 
+// Number of python-side frames corresponding to one JACK period
+static int resampler_frames(const pyjack_resampler_t * rs, int jack_rate_is_source, int buffer_size)
+{
+    int num = jack_rate_is_source ? rs->L : rs->M;
+    int den = jack_rate_is_source ? rs->M : rs->L;
+    int frames = (buffer_size * num + den / 2) / den;
+    return frames > 0 ? frames : 1;
+}
+
 // (Re)initialize socketpair buffers
 void init_pipe_buffers(pyjack_client_t  * client) {
-    // allocate buffers for send and recv
-    unsigned new_input_size = client->num_inputs * client->buffer_size * sizeof(float);
+    client->input_frames = client->input_resampler
+        ? resampler_frames(client->input_resampler, 1, client->buffer_size)
+        : client->buffer_size;
+    client->output_frames = client->output_resampler
+        ? resampler_frames(client->output_resampler, 0, client->buffer_size)
+        : client->buffer_size;
+
+    // allocate buffers for send and recv; process() grows the python-side ones itself,
+    // as it may be waiting on them without the GIL
+    unsigned new_input_size = client->num_inputs * client->input_frames * sizeof(float);
     if(client->input_buffer_size != new_input_size) {
         client->input_buffer_size = new_input_size;
-        client->input_buffer_0 = realloc(client->input_buffer_0, new_input_size);
-        client->input_buffer_1 = realloc(client->input_buffer_1, new_input_size);
+        rt_free(client, client->input_buffer_0);
+        client->input_buffer_0 = rt_alloc(client, new_input_size);
         //printf("Input buffer size %d bytes\n", input_buffer_size);
     }
-    unsigned new_output_size = client->num_outputs * client->buffer_size * sizeof(float);
+    unsigned new_output_size = client->num_outputs * client->output_frames * sizeof(float);
     if(client->output_buffer_size != new_output_size) {
         client->output_buffer_size = new_output_size;
-        client->output_buffer_0 = realloc(client->output_buffer_0, new_output_size);
-        client->output_buffer_1 = realloc(client->output_buffer_1, new_output_size);
+        rt_free(client, client->output_buffer_0);
+        client->output_buffer_0 = rt_alloc(client, new_output_size);
         //printf("Output buffer size %d bytes\n", output_buffer_size);
     }
+    unsigned new_last_size = client->num_outputs * client->buffer_size * sizeof(float);
+    if(!client->output_last || ((pyjack_rtmem_t*)client->output_last - 1)->size != new_last_size) {
+        rt_free(client, client->output_last);
+        client->output_last = rt_alloc(client, new_last_size);
+    }
 
-    // set socket buffers to same size as snd/rcv buffers
-    setsockopt(client->input_pipe[R], SOL_SOCKET, SO_RCVBUF, &client->input_buffer_size, sizeof(int));
-    setsockopt(client->input_pipe[R], SOL_SOCKET, SO_SNDBUF, &client->input_buffer_size, sizeof(int));
-    setsockopt(client->input_pipe[W], SOL_SOCKET, SO_RCVBUF, &client->input_buffer_size, sizeof(int));
-    setsockopt(client->input_pipe[W], SOL_SOCKET, SO_SNDBUF, &client->input_buffer_size, sizeof(int));
+    // the process thread copies the inputs during the cycle and resamples them afterwards
+    unsigned new_stage_size = (client->process_thread && client->input_resampler)
+        ? client->num_inputs * client->buffer_size * sizeof(float) : 0;
+    if(client->input_stage_size != new_stage_size) {
+        client->input_stage_size = new_stage_size;
+        rt_free_and_reset(client, &client->input_stage);
+        if (new_stage_size)
+            client->input_stage = rt_alloc(client, new_stage_size);
+    }
 
-    setsockopt(client->output_pipe[R], SOL_SOCKET, SO_RCVBUF, &client->output_buffer_size, sizeof(int));
-    setsockopt(client->output_pipe[R], SOL_SOCKET, SO_SNDBUF, &client->output_buffer_size, sizeof(int));
-    setsockopt(client->output_pipe[W], SOL_SOCKET, SO_RCVBUF, &client->output_buffer_size, sizeof(int));
-    setsockopt(client->output_pipe[W], SOL_SOCKET, SO_SNDBUF, &client->output_buffer_size, sizeof(int));
-}
+    client->silence_hold = client->silence_hold_time *
+        (client->input_resampler ? client->input_resampler->rate_to : (client->pjc ? jack_get_sample_rate(client->pjc) : 0));
 
-// RT function called by jack
-int pyjack_process(jack_nframes_t n, void* arg) {
+    // set socket buffers to same size as snd/rcv buffers
+    // (a resampled stream may carry two blocks in one period, so leave room for that)
+    int input_sockbuf = (sizeof(pyjack_block_header_t) + client->input_buffer_size) * (client->input_resampler ? 2 : 1);
+    int output_sockbuf = client->output_buffer_size * (client->output_resampler ? 2 : 1);
+    setsockopt(client->input_pipe[R], SOL_SOCKET, SO_RCVBUF, &input_sockbuf, sizeof(int));
+    setsockopt(client->input_pipe[R], SOL_SOCKET, SO_SNDBUF, &input_sockbuf, sizeof(int));
+    setsockopt(client->input_pipe[W], SOL_SOCKET, SO_RCVBUF, &input_sockbuf, sizeof(int));
+    setsockopt(client->input_pipe[W], SOL_SOCKET, SO_SNDBUF, &input_sockbuf, sizeof(int));
+
+    setsockopt(client->output_pipe[R], SOL_SOCKET, SO_RCVBUF, &output_sockbuf, sizeof(int));
+    setsockopt(client->output_pipe[R], SOL_SOCKET, SO_SNDBUF, &output_sockbuf, sizeof(int));
+    setsockopt(client->output_pipe[W], SOL_SOCKET, SO_RCVBUF, &output_sockbuf, sizeof(int));
+    setsockopt(client->output_pipe[W], SOL_SOCKET, SO_SNDBUF, &output_sockbuf, sizeof(int));
+
+    // restart the python-side blocks
+    if (client->input_resampler)
+        client->input_resampler->block_pos = 0;
+    if (client->output_resampler)
+        client->output_resampler->block_pos = client->output_frames;
+}
 
-    pyjack_client_t * client = (pyjack_client_t*) arg;
-    int i, r;
+static int gcd(int a, int b)
+{
+    while (b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
 
-    // Send input data to python side (non-blocking!)
-    if (client->num_inputs) { 
-        for(i = 0; i < client->num_inputs; i++) {
-            memcpy(
-                &client->input_buffer_0[client->buffer_size * i], 
-                jack_port_get_buffer(client->input_ports[i], n), 
-                (client->buffer_size * sizeof(float))
-            );
-        }
+// zeroth order modified Bessel function of the first kind (for the Kaiser window)
+static double bessel_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    int k;
+    for (k = 1; k < 50; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) break;
+    }
+    return sum;
+}
 
-        r = write(client->input_pipe[W], client->input_buffer_0, client->input_buffer_size);
+// Create a polyphase resampler converting from rate_from to rate_to.
+// Returns NULL if the ratio cannot be reduced to factors below PYJACK_RESAMPLE_MAX_FACTOR.
+static pyjack_resampler_t * resampler_new(pyjack_client_t * client, int rate_from, int rate_to)
+{
+    const double beta = 8.6;                        // Kaiser window; ~-90dB stopband
+    int g = gcd(rate_from, rate_to);
+    int L = rate_to / g;
+    int M = rate_from / g;
+    int taps, N, n, p, j;
+    double fc, center, norm;
+    pyjack_resampler_t * rs;
+
+    if (L > PYJACK_RESAMPLE_MAX_FACTOR || M > PYJACK_RESAMPLE_MAX_FACTOR)
+        return NULL;
 
-        if(r < 0) {
-            client->iosync = 0;
-        } else if(r == client->input_buffer_size) {
-            client->iosync = 1;
+    // when decimating, the filter gets longer by the decimation ratio
+    taps = 2 * PYJACK_RESAMPLE_ZEROS * ((M + L - 1) / L);
+    taps = (taps + 3) & ~3;
+    N = taps * L;
+    // cutoff (in cycles per sample at the upsampled rate), slightly below nyquist
+    fc = 0.5 * 0.95 / (L > M ? L : M);
+    center = 0.5 * (N - 1);
+
+    rs = rt_alloc(client, sizeof(*rs));
+    if (!rs) return NULL;
+    rs->coeffs = rt_alloc(client, N * sizeof(float));
+    rs->history = rt_alloc(client, PYJACK_MAX_PORTS * 2 * taps * sizeof(float));
+    if (!rs->coeffs || !rs->history) {
+        resampler_free(client, &rs);
+        return NULL;
+    }
+    rs->rate_from = rate_from;
+    rs->rate_to = rate_to;
+    rs->L = L;
+    rs->M = M;
+    rs->taps = taps;
+    rs->phase = L;
+    rs->delay = center;
+
+    norm = 1.0 / bessel_i0(beta);
+    for (p = 0; p < L; p++) {
+        for (j = 0; j < taps; j++) {
+            double t, h, r;
+            n = (taps - 1 - j) * L + p;
+            t = n - center;
+            h = (t == 0.0) ? 2.0 * fc : sin(2.0 * M_PI * fc * t) / (M_PI * t);
+            r = t / center;
+            h *= bessel_i0(beta * sqrt(r * r < 1.0 ? 1.0 - r * r : 0.0)) * norm;
+            rs->coeffs[p * taps + j] = (float)(h * L);
         }
     }
+    return rs;
+}
 
-    // Read data from python side (non-blocking!)
-    if (client->num_outputs) {
-        r = read(client->output_pipe[R], client->output_buffer_0, client->output_buffer_size);
-        if(r != client->buffer_size * sizeof(float) * client->num_outputs) {
-            //printf("not enough data; skipping output\n");
-            return 0;
-        }
-        for(i = 0; i < client->num_outputs; i++) {
-            memcpy(
-                jack_port_get_buffer(client->output_ports[i], client->buffer_size), 
-                client->output_buffer_0 + (client->buffer_size * i),
-                client->buffer_size * sizeof(float)
-            );
-        }
+// Rebuild the resamplers for a new JACK rate, keeping the python-side rates.
+// Returns -1, keeping the old resamplers, if the new ratios are not supported.
+static int resamplers_rebuild(pyjack_client_t * client, int sr)
+{
+    int input_rate = (client->input_rate && client->input_rate != sr) ? client->input_rate : 0;
+    int output_rate = (client->output_rate && client->output_rate != sr) ? client->output_rate : 0;
+    pyjack_resampler_t * input_rs, * output_rs;
+
+    if (!client->resampling_rate || sr == client->resampling_rate)
+        return 0;
+    input_rs = input_rate ? resampler_new(client, sr, input_rate) : NULL;
+    output_rs = output_rate ? resampler_new(client, output_rate, sr) : NULL;
+    if ((input_rate && !input_rs) || (output_rate && !output_rs)) {
+        resampler_free(client, &input_rs);
+        resampler_free(client, &output_rs);
+        return -1;
     }
 
+    resampler_free(client, &client->input_resampler);
+    resampler_free(client, &client->output_resampler);
+    client->input_resampler = input_rs;
+    client->output_resampler = output_rs;
+    client->resampling_rate = sr;
+    init_pipe_buffers(client);
+    // the queued blocks have the old python-side size
+    while (recv(client->output_pipe[R], NULL, 0, MSG_DONTWAIT) >= 0)
+        client->output_read++;
+    while (recv(client->input_pipe[R], NULL, 0, MSG_DONTWAIT) >= 0)
+        ;
+    client->output_queue = 0;
+    client->output_started = 0;
     return 0;
 }
 
-// Event notification of buffer size change
-int pyjack_buffer_size_changed(jack_nframes_t n, void* arg) {
-    pyjack_client_t * client = (pyjack_client_t*) arg;
-    client->event_buffer_size = 1;
-
-    if(client->callback_buffer_size) {
-      PyObject *result = NULL;
-      PyObject *arglist= Py_BuildValue("(I)", n);
-      result = PyObject_CallObject(client->callback_buffer_size, arglist);
-      Py_DECREF(arglist);
-      if (result != NULL) // LATER: shouldn't we pass the result to jack?
-          Py_DECREF(result);
+// Run the resampler on all channels in lockstep, until either all in_count input
+// samples are consumed or out_count output samples are produced.
+// Returns the number of produced samples; the number of consumed samples is stored in in_used.
+static int resampler_run(pyjack_resampler_t * rs, int channels,
+                         const float ** in, int in_count, int * in_used,
+                         float ** out, int out_count)
+{
+    const int taps = rs->taps;
+    int used = 0, produced = 0, c, j;
+
+    for (;;) {
+        if (rs->phase < rs->L) {
+            const float * h;
+            if (produced == out_count) break;
+            h = rs->coeffs + rs->phase * taps;
+            for (c = 0; c < channels; c++) {
+                // the delay lines are doubled, so the window is contiguous;
+                // four partial sums let the compiler vectorize the dot product
+                const float * x = rs->history + c * 2 * taps + rs->pos;
+                float a0 = 0.f, a1 = 0.f, a2 = 0.f, a3 = 0.f;
+                for (j = 0; j < taps; j += 4) {
+                    a0 += h[j] * x[j];
+                    a1 += h[j + 1] * x[j + 1];
+                    a2 += h[j + 2] * x[j + 2];
+                    a3 += h[j + 3] * x[j + 3];
+                }
+                out[c][produced] = (a0 + a1) + (a2 + a3);
+            }
+            produced++;
+            rs->phase += rs->M;
+        } else {
+            if (used == in_count) break;
+            for (c = 0; c < channels; c++) {
+                float * hist = rs->history + c * 2 * taps;
+                hist[rs->pos] = hist[rs->pos + taps] = in[c][used];
+            }
+            rs->pos = (rs->pos + 1 == taps) ? 0 : rs->pos + 1;
+            used++;
+            rs->phase -= rs->L;
+        }
     }
-    return 0;
+    if (in_used) *in_used = used;
+    return produced;
 }
 
-// Event notification of sample rate change
-int pyjack_sample_rate_changed(jack_nframes_t n, void* arg) {
-    pyjack_client_t * client = (pyjack_client_t*) arg;
-    client->event_sample_rate = 1;
+// Resampler latency in JACK frames
+static double resampler_latency(const pyjack_resampler_t * rs, int jack_rate_is_source)
+{
+    if (!rs) return 0.0;
+    return rs->delay / (jack_rate_is_source ? rs->L : rs->M);
+}
 
-    if(client->callback_sample_rate) {
-      PyObject *result = NULL;
-      PyObject *arglist= Py_BuildValue("(I)", n);
-      result = PyObject_CallObject(client->callback_sample_rate, arglist);
-      Py_DECREF(arglist);
-      if (result != NULL) // LATER: shouldn't we pass the result to jack?
-          Py_DECREF(result);
+// Wait until the RT thread has started a new cycle, so that anything it picked up
+// before this call is no longer in use. Returns immediately if the client is not running.
+static void pyjack_wait_cycle(pyjack_client_t * client)
+{
+    unsigned int start = __atomic_load_n(&client->cycles, __ATOMIC_ACQUIRE);
+    int tries = 0;
+    if (!client->pjc || !client->active || !client->doProcessing) return;
+    Py_BEGIN_ALLOW_THREADS
+    while (__atomic_load_n(&client->cycles, __ATOMIC_ACQUIRE) == start && tries++ < 1000)
+        usleep(1000);
+    Py_END_ALLOW_THREADS
+}
+
+// Keep the RT thread away from the port lists and the pipe buffers while they change.
+// It skips its cycles until ports_release(), leaving the port buffers as they are.
+static void ports_hold(pyjack_client_t * client)
+{
+    __atomic_add_fetch(&client->ports_held, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    pyjack_wait_cycle(client);
+}
+
+static void ports_release(pyjack_client_t * client)
+{
+    __atomic_sub_fetch(&client->ports_held, 1, __ATOMIC_RELEASE);
+}
+
+// Wait until the RT thread has released the cancelled clips; it no longer touches their ports then
+static void voices_wait_cancelled(pyjack_client_t * client)
+{
+    int i, tries = 0, pending = 1;
+    if (!client->pjc || !client->active || !client->doProcessing) return;
+    Py_BEGIN_ALLOW_THREADS
+    while (pending && tries++ < 1000) {
+        pending = 0;
+        for (i = 0; i < PYJACK_MAX_VOICES; i++)
+            if (__atomic_load_n(&client->voices[i].state, __ATOMIC_ACQUIRE) == PYJACK_VOICE_CANCEL)
+                pending = 1;
+        if (pending) usleep(1000);
     }
-    return 0;
+    Py_END_ALLOW_THREADS
 }
 
-// Event notification of graph connect/disconnection
-int pyjack_graph_order(void* arg) {
-    pyjack_client_t * client = (pyjack_client_t*) arg;
-    client->event_graph_ordering = 1;
+// Current period of one of the input ports; read from stage instead of from jack if given (RT)
+static const float * input_source(pyjack_client_t * client, jack_port_t * port, jack_nframes_t n, const float * stage)
+{
+    int k;
+    if (!port) return NULL;
+    if (!stage) return jack_port_get_buffer(port, n);
+    for (k = 0; k < client->num_inputs; k++)
+        if (client->input_ports[k] == port)
+            return stage + client->buffer_size * k;
+    return NULL;
+}
 
-    if(client->callback_graph_order) {
-      PyGILState_STATE state = PyGILState_Ensure();
-      PyObject *result = NULL;
-      result = PyObject_CallObject(client->callback_graph_order, NULL);
-      if (result != NULL) // LATER: shouldn't we pass the result to jack?
-          Py_DECREF(result);
-      PyGILState_Release(state);
+// Copy the exported ports into their shared memory rings (RT).
+// If stage is given, the input ports are read from there instead of from jack.
+static void export_streams(pyjack_client_t * client, jack_nframes_t n, const float * stage)
+{
+    int e, c;
+    for (e = 0; e < PYJACK_MAX_EXPORTS; e++) {
+        pyjack_export_t * ex = __atomic_load_n(&client->exports[e], __ATOMIC_ACQUIRE);
+        if (!ex) continue;
+        pyjack_stream_header_t * hdr = ex->header;
+        uint32_t capacity = hdr->capacity;
+        if (n > capacity) continue;     // cannot happen unless the buffer size grew past the ring
+        uint64_t w = hdr->write_frames;
+        uint32_t pos = (uint32_t)w & (capacity - 1);
+        if (n > hdr->period) {
+            // readers must know how far ahead of write_frames we may be overwriting before we do
+            __atomic_store_n(&hdr->period, n, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        }
+        uint32_t first = (n < capacity - pos) ? n : capacity - pos;
+        for (c = 0; c < ex->channels; c++) {
+            float * dst = ex->data + (size_t)capacity * c;
+            const float * src = input_source(client, __atomic_load_n(&ex->ports[c], __ATOMIC_ACQUIRE), n, stage);
+            if (src) {
+                memcpy(dst + pos, src, first * sizeof(float));
+                memcpy(dst, src + first, (n - first) * sizeof(float));
+            } else {
+                memset(dst + pos, 0, first * sizeof(float));
+                memset(dst, 0, (n - first) * sizeof(float));
+            }
+        }
+        // publish the position and its frame time together
+        __atomic_store_n(&hdr->seq, hdr->seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        __atomic_store_n(&hdr->frame_time, jack_last_frame_time(client->pjc) + n, __ATOMIC_RELAXED);
+        __atomic_store_n(&hdr->write_frames, w + n, __ATOMIC_RELEASE);
+        __atomic_store_n(&hdr->seq, hdr->seq + 1, __ATOMIC_RELEASE);
     }
-    return 0;
 }
 
-// Event notification of xrun
-int pyjack_xrun(void* arg) {
-    pyjack_client_t * client = (pyjack_client_t*) arg;
-    client->event_xrun = 1;
+// Publish the timing of the cycle that just started (RT)
+static void cycle_times_update(pyjack_client_t * client, jack_nframes_t n)
+{
+    pyjack_cycle_times_t * ct = &client->cycle_times;
+    jack_nframes_t frames;
+    jack_time_t current, next;
+    float period;
+    if (jack_get_cycle_times(client->pjc, &frames, &current, &next, &period))
+        return;
+    __atomic_store_n(&ct->seq, ct->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    ct->nframes = n;
+    ct->current_frames = frames;
+    ct->current_usecs = current;
+    ct->next_usecs = next;
+    ct->period_usecs = period;
+    __atomic_store_n(&ct->seq, ct->seq + 1, __ATOMIC_RELEASE);
+}
 
-    if(client->callback_xrun) {
-      PyGILState_STATE state = PyGILState_Ensure();
-      PyObject *result = NULL;
-      result = PyObject_CallObject(client->callback_xrun, NULL);
-      if (result != NULL) // LATER: shouldn't we pass the result to jack?
-          Py_DECREF(result);
-      PyGILState_Release(state);
+// Append the recorded ports to the history ring, zero filling short frame time jumps (RT)
+static void history_feed(pyjack_client_t * client, jack_nframes_t n, const float * stage)
+{
+    pyjack_history_t * h = __atomic_load_n(&client->history, __ATOMIC_ACQUIRE);
+    jack_nframes_t frame_time;
+    uint64_t w, valid_from;
+    uint32_t gap = 0, mask, pos, first;
+    int32_t jump;
+    int c;
+    if (!h || n > h->ring_size / 8) return;
+
+    frame_time = jack_last_frame_time(client->pjc);
+    w = h->write_frames;
+    valid_from = h->valid_from;
+    jump = (int32_t)(frame_time - h->write_frame_time);
+    if (w != valid_from && jump) {
+        h->gaps++;
+        if (jump > 0 && (uint32_t)jump <= h->ring_size / 8) gap = jump;
+        else valid_from = w;
     }
-    return 0;
+
+    mask = h->ring_size - 1;
+    for (c = 0; c < h->channels; c++) {
+        float * dst = h->ring + (size_t)h->ring_size * c;
+        const float * src = input_source(client, __atomic_load_n(&h->ports[c], __ATOMIC_ACQUIRE), n, stage);
+        pos = w & mask;
+        if (gap) {
+            first = (gap < h->ring_size - pos) ? gap : h->ring_size - pos;
+            memset(dst + pos, 0, first * sizeof(float));
+            memset(dst, 0, (gap - first) * sizeof(float));
+            pos = (pos + gap) & mask;
+        }
+        first = (n < h->ring_size - pos) ? n : h->ring_size - pos;
+        if (src) {
+            memcpy(dst + pos, src, first * sizeof(float));
+            memcpy(dst, src + first, (n - first) * sizeof(float));
+        } else {
+            memset(dst + pos, 0, first * sizeof(float));
+            memset(dst, 0, (n - first) * sizeof(float));
+        }
+    }
+
+    __atomic_store_n(&h->seq, h->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    h->write_frames = w + gap + n;
+    h->valid_from = valid_from;
+    h->write_frame_time = frame_time + n;
+    __atomic_store_n(&h->seq, h->seq + 1, __ATOMIC_RELEASE);
 }
 
-// Event notification of port registration or drop
-void pyjack_port_registration(jack_port_id_t pid, int action, void* arg) {
-    pyjack_client_t * client = (pyjack_client_t*) arg;
-    client->event_port_registration = 1;
+// Copy the analyzed ports into the analyzer ring and wake the worker once a hop is ready (RT)
+static void analyzer_feed(pyjack_client_t * client, jack_nframes_t n, const float * stage)
+{
+    pyjack_analyzer_t * an = __atomic_load_n(&client->analyzer, __ATOMIC_ACQUIRE);
+    int c;
+    if (!an || n > an->ring_size / 2) return;
+
+    uint32_t w = an->write_frames;
+    uint32_t pos = w & (an->ring_size - 1);
+    uint32_t first = (n < an->ring_size - pos) ? n : an->ring_size - pos;
+    for (c = 0; c < an->channels; c++) {
+        float * dst = an->ring + (size_t)an->ring_size * c;
+        const float * src = input_source(client, __atomic_load_n(&an->ports[c], __ATOMIC_ACQUIRE), n, stage);
+        if (src) {
+            memcpy(dst + pos, src, first * sizeof(float));
+            memcpy(dst, src + first, (n - first) * sizeof(float));
+        } else {
+            memset(dst + pos, 0, first * sizeof(float));
+            memset(dst, 0, (n - first) * sizeof(float));
+        }
+    }
+    __atomic_store_n(&an->write_frame_time, jack_last_frame_time(client->pjc) + n, __ATOMIC_RELAXED);
+    __atomic_store_n(&an->write_frames, w + n, __ATOMIC_RELEASE);
 
-    if(client->callback_port_registration) {
-      PyGILState_STATE state = PyGILState_Ensure();
-      PyObject *result = NULL;
-      PyObject *arglist= Py_BuildValue("(Ii)", pid, action);
-      result = PyObject_CallObject(client->callback_port_registration, arglist);
-      Py_DECREF(arglist);
-      if (result != NULL)
-          Py_DECREF(result);
-      PyGILState_Release(state);
+    an->hop_pending += n;
+    if (an->hop_pending >= (uint32_t)an->hop) {
+        an->hop_pending = 0;
+        sem_post(&an->wakeup);
     }
 }
 
-// Shutdown handler
-void pyjack_shutdown(void * arg) {
-    pyjack_client_t * client = (pyjack_client_t*) arg;
-    client->event_shutdown = 1;
-    client->pjc = NULL;    
+// Twiddle factors and bit-reversal permutation for fft() of N points (a power of two)
+static void fft_tables(int N, float * cos_table, float * sin_table, int * bitrev)
+{
+    int i, j, bits;
+    for (i = 0; i < N / 2; i++) {
+        cos_table[i] = cos(2.0 * M_PI * i / N);
+        sin_table[i] = sin(2.0 * M_PI * i / N);
+    }
+    for (bits = 0; (1 << bits) < N; bits++);
+    for (i = 0; i < N; i++) {
+        int r = 0;
+        for (j = 0; j < bits; j++)
+            if (i & (1 << j)) r |= 1 << (bits - 1 - j);
+        bitrev[i] = r;
+    }
 }
 
-// SIGHUP handler
-void pyjack_hangup(int signal) {
-    // TODO: what to do with non global clients
-    global_client.event_hangup = 1;
-    global_client.pjc = NULL;
+// In-place radix-2 complex FFT of N points
+static void fft(int N, const float * cos_table, const float * sin_table, const int * bitrev, float * re, float * im)
+{
+    int i, j, k, len, half, step;
+
+    for (i = 0; i < N; i++) {
+        j = bitrev[i];
+        if (j > i) {
+            float t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    for (len = 2; len <= N; len <<= 1) {
+        half = len >> 1;
+        step = N / len;
+        for (i = 0; i < N; i += len) {
+            for (k = 0; k < half; k++) {
+                float wr = cos_table[k * step];
+                float wi = -sin_table[k * step];
+                float * ar = re + i + k, * ai = im + i + k;
+                float * br = ar + half, * bi = ai + half;
+                float tr = *br * wr - *bi * wi;
+                float ti = *br * wi + *bi * wr;
+                *br = *ar - tr;
+                *bi = *ai - ti;
+                *ar += tr;
+                *ai += ti;
+            }
+        }
+    }
 }
 
+// Magnitude spectra of the frames [start, start + fft_size) into the back buffer.
+// Channels are transformed in pairs, as the real and imaginary parts of one complex FFT.
+static void analyzer_run(pyjack_analyzer_t * an, uint32_t start)
+{
+    const int N = an->fft_size, bins = an->bins;
+    float * out = an->spectra[(an->generation + 1) & 1];
+    int c, i, k;
+
+    for (c = 0; c < an->channels; c += 2) {
+        const float * a = an->ring + (size_t)an->ring_size * c;
+        const float * b = (c + 1 < an->channels) ? a + an->ring_size : NULL;
+        for (i = 0; i < N; i++) {
+            uint32_t pos = (start + i) & (an->ring_size - 1);
+            an->re[i] = a[pos] * an->window[i];
+            an->im[i] = b ? b[pos] * an->window[i] : 0.f;
+        }
+        fft(N, an->cos_table, an->sin_table, an->bitrev, an->re, an->im);
+        for (k = 0; k < bins; k++) {
+            int m = (N - k) & (N - 1);
+            // A[k] = (Z[k] + conj(Z[N-k])) / 2,  B[k] = (Z[k] - conj(Z[N-k])) / 2i
+            float ar = 0.5f * (an->re[k] + an->re[m]), ai = 0.5f * (an->im[k] - an->im[m]);
+            float br = 0.5f * (an->im[k] + an->im[m]), bi = 0.5f * (an->re[m] - an->re[k]);
+            // DC and Nyquist have no mirror image
+            float scale = (k == 0 || k == N / 2) ? 0.5f : 1.f;
+            float * avg = an->average + (size_t)bins * c + k;
+            *avg = an->averaging * *avg + (1.f - an->averaging) * scale * sqrtf(ar * ar + ai * ai);
+            out[(size_t)bins * c + k] = *avg;
+            if (b) {
+                avg += bins;
+                *avg = an->averaging * *avg + (1.f - an->averaging) * scale * sqrtf(br * br + bi * bi);
+                out[(size_t)bins * (c + 1) + k] = *avg;
+            }
+        }
+    }
+}
 
-// callback handles
-void pyjack_thread_init(void* arg)
+// Worker thread: analyze every hop the RT thread has delivered, and publish the latest spectra
+static void * analyzer_thread(void * arg)
 {
-    pyjack_client_t * client = (pyjack_client_t*) arg;
-    if(client && client->callback_thread_init) {
-      PyObject *result = NULL;
-      result = PyObject_CallObject(client->callback_thread_init, NULL);
-      if (result != NULL)
-          Py_DECREF(result);
+    pyjack_analyzer_t * an = (pyjack_analyzer_t*) arg;
+    uint32_t written, behind;
+    jack_nframes_t frame_time;
+
+    for (;;) {
+        sem_wait(&an->wakeup);
+        if (!__atomic_load_n(&an->running, __ATOMIC_ACQUIRE)) break;
+        do {
+            frame_time = __atomic_load_n(&an->write_frame_time, __ATOMIC_RELAXED);
+            written = __atomic_load_n(&an->write_frames, __ATOMIC_ACQUIRE);
+        } while (frame_time != __atomic_load_n(&an->write_frame_time, __ATOMIC_RELAXED));
+
+        // the RT thread may overwrite up to half the ring while we work; skip ahead if it got further
+        behind = written - an->read_frames;
+        if (behind > an->ring_size / 2) {
+            an->read_frames += (behind - an->fft_size) / an->hop * an->hop;
+            an->overruns++;
+        }
+        while (written - an->read_frames >= (uint32_t)an->fft_size) {
+            analyzer_run(an, an->read_frames);
+            an->frame_time[(an->generation + 1) & 1] =
+                frame_time - (written - an->read_frames - an->fft_size);
+            an->read_frames += an->hop;
+            __atomic_add_fetch(&an->generation, 1, __ATOMIC_RELEASE);
+        }
     }
+    return NULL;
 }
-static void pyjack_client_registration(const char *name, int reg, void *arg)
+
+// Forward FFT of the overlap-save frame [prev, in] of 2 * size frames; keeps bins 0..size
+static void convolve_forward(int size, const float * cos_table, const float * sin_table, const int * bitrev,
+                             float * re, float * im, const float * prev, const float * in, float * out_re, float * out_im)
 {
-    pyjack_client_t * client = (pyjack_client_t*) arg;
-    if(client && client->callback_client_registration) {
-      PyGILState_STATE state = PyGILState_Ensure();
-      PyObject *result = NULL;
-      PyObject *arglist= Py_BuildValue("(si)", name, reg);
-      result = PyObject_CallObject(client->callback_client_registration, arglist);
-      Py_DECREF(arglist);
-      if (result != NULL)
-          Py_DECREF(result);
-      PyGILState_Release(state);
+    memcpy(re, prev, size * sizeof(float));
+    memcpy(re + size, in, size * sizeof(float));
+    memset(im, 0, 2 * size * sizeof(float));
+    fft(2 * size, cos_table, sin_table, bitrev, re, im);
+    memcpy(out_re, re, (size + 1) * sizeof(float));
+    memcpy(out_im, im, (size + 1) * sizeof(float));
+}
+
+// acc = sum over i < count of fdl[newest - i] * h[i]: partitions of a response times the spectra
+// of the blocks of input they apply to
+static void convolve_partitions(int bins, const float * fdl_re, const float * fdl_im, uint32_t fdl_mask, uint64_t newest,
+                                const float * h_re, const float * h_im, int count, float * acc_re, float * acc_im)
+{
+    int i, b;
+    memset(acc_re, 0, bins * sizeof(float));
+    memset(acc_im, 0, bins * sizeof(float));
+    for (i = 0; i < count; i++) {
+        size_t slot = (size_t)((newest - i) & fdl_mask) * bins;
+        const float * xr = fdl_re + slot, * xi = fdl_im + slot;
+        const float * hr = h_re + (size_t)i * bins, * hi = h_im + (size_t)i * bins;
+        for (b = 0; b < bins; b++) {
+            acc_re[b] += xr[b] * hr[b] - xi[b] * hi[b];
+            acc_im[b] += xr[b] * hi[b] + xi[b] * hr[b];
+        }
     }
 }
-static void pyjack_freewheel(int starting, void *arg)
+
+// Last size frames of the inverse FFT of the spectrum of a real signal, given by its bins 0..size.
+// The forward FFT of the conjugate spectrum is the signal times 2 * size.
+static void convolve_inverse(int size, const float * cos_table, const float * sin_table, const int * bitrev,
+                             const float * acc_re, const float * acc_im, float * re, float * im, float * out)
 {
-    pyjack_client_t * client = (pyjack_client_t*) arg;
-    if(client && client->callback_freewheel) {
-      PyGILState_STATE state = PyGILState_Ensure();
-      PyObject *result = NULL;
-      PyObject *arglist= Py_BuildValue("(i)", starting);
-      result = PyObject_CallObject(client->callback_freewheel, arglist);
-      Py_DECREF(arglist);
-      if (result != NULL)
-          Py_DECREF(result);
-      PyGILState_Release(state);
+    const int N = 2 * size;
+    int i;
+    for (i = 0; i <= size; i++) {
+        re[i] = acc_re[i];
+        im[i] = -acc_im[i];
     }
+    for (; i < N; i++) {
+        re[i] = acc_re[N - i];
+        im[i] = acc_im[N - i];
+    }
+    fft(N, cos_table, sin_table, bitrev, re, im);
+    for (i = 0; i < size; i++)
+        out[i] = re[size + i] / N;
 }
-#ifdef WANT_LATENCY_CALLBACK
-static void pyjack_latency(jack_latency_callback_mode_t mode, void *arg)
+
+// Spectra of the partitions of size frames of data (zero padded to 2 * size)
+static void partition_spectra(int size, const float * cos_table, const float * sin_table, const int * bitrev,
+                              const float * data, uint32_t length, float * re, float * im, float * out_re, float * out_im)
 {
-    pyjack_client_t * client = (pyjack_client_t*) arg;
-    if(client && client->callback_latency) {
-      PyObject *result = NULL;
-      PyObject *arglist= Py_BuildValue("(i)", (int)mode);
-      result = PyObject_CallObject(client->callback_latency, arglist);
-      Py_DECREF(arglist);
-      if (result != NULL) // LATER: shouldn't we pass the result to jack?
-          Py_DECREF(result);
+    uint32_t p, parts = (length + size - 1) / size;
+    for (p = 0; p < parts; p++) {
+        uint32_t count = length - p * size < (uint32_t)size ? length - p * size : (uint32_t)size;
+        memset(re, 0, 2 * size * sizeof(float));
+        memset(im, 0, 2 * size * sizeof(float));
+        memcpy(re, data + (size_t)p * size, count * sizeof(float));
+        fft(2 * size, cos_table, sin_table, bitrev, re, im);
+        memcpy(out_re + (size_t)p * (size + 1), re, (size + 1) * sizeof(float));
+        memcpy(out_im + (size_t)p * (size + 1), im, (size + 1) * sizeof(float));
     }
 }
-#endif /* WANT_LATENCY_CALLBACK */
-void pyjack_port_connect(jack_port_id_t a, jack_port_id_t b, int connect, void *arg)
+
+// Partition an impulse response for a convolver; the kernel takes ir (malloc'ed) over.
+// Returns -1 when out of memory.
+static int kernel_build(pyjack_client_t * client, const pyjack_convolver_t * cv, pyjack_kernel_t * k, float * ir, uint32_t length)
 {
-    pyjack_client_t * client = (pyjack_client_t*) arg;
-    if(client && client->callback_port_connect) {
-      PyGILState_STATE state = PyGILState_Ensure();
-      PyObject *result = NULL;
-      PyObject *arglist= NULL;
-      arglist= Py_BuildValue("(IIi)", (unsigned int)a, (unsigned int)b, connect);
-      result = PyObject_CallObject(client->callback_port_connect, arglist);
-      Py_DECREF(arglist);
-      if (result != NULL)
-          Py_DECREF(result);
-      PyGILState_Release(state);
+    const int size = cv->size, tail_size = cv->tail_size;
+    uint32_t head = length < cv->head_length ? length : cv->head_length;
+    float * re, * im;
+
+    memset(k, 0, sizeof(*k));
+    k->ir = ir;
+    k->length = length;
+    k->head_parts = (head + size - 1) / size;
+    k->tail_parts = (length - head + tail_size - 1) / tail_size;
+    k->head_re = rt_alloc(client, (size_t)k->head_parts * (size + 1) * sizeof(float));
+    k->head_im = rt_alloc(client, (size_t)k->head_parts * (size + 1) * sizeof(float));
+    if (k->tail_parts) {
+        k->tail_re = rt_alloc(client, (size_t)k->tail_parts * (tail_size + 1) * sizeof(float));
+        k->tail_im = rt_alloc(client, (size_t)k->tail_parts * (tail_size + 1) * sizeof(float));
+        k->out = rt_alloc(client, (size_t)PYJACK_CONVOLVER_SLOTS * tail_size * sizeof(float));
+    }
+    re = malloc(2 * tail_size * sizeof(float));
+    im = malloc(2 * tail_size * sizeof(float));
+    if (!k->head_re || !k->head_im || (k->tail_parts && (!k->tail_re || !k->tail_im || !k->out)) || !re || !im) {
+        free(re);
+        free(im);
+        kernel_free(client, k);
+        return -1;
     }
+    partition_spectra(size, cv->cos_table, cv->sin_table, cv->bitrev, ir, head, re, im, k->head_re, k->head_im);
+    if (k->tail_parts)
+        partition_spectra(tail_size, cv->w_cos_table, cv->w_sin_table, cv->w_bitrev, ir + head, length - head,
+                          re, im, k->tail_re, k->tail_im);
+    free(re);
+    free(im);
+    return 0;
 }
 
+// Convolve the latest block of input with the tail of a kernel, into its output slot (worker)
+static void convolver_tail(pyjack_convolver_t * cv, pyjack_kernel_t * k, uint64_t block)
+{
+    const int tail_size = cv->tail_size;
+    uint32_t s = block % PYJACK_CONVOLVER_SLOTS;
+    if (!k->tail_parts) return;
+    convolve_partitions(tail_size + 1, cv->w_fdl_re, cv->w_fdl_im, cv->w_fdl_mask, block,
+                        k->tail_re, k->tail_im, k->tail_parts, cv->w_acc_re, cv->w_acc_im);
+    __atomic_store_n(&k->tags[s], 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    convolve_inverse(tail_size, cv->w_cos_table, cv->w_sin_table, cv->w_bitrev,
+                     cv->w_acc_re, cv->w_acc_im, cv->w_re, cv->w_im, k->out + (size_t)s * tail_size);
+    __atomic_store_n(&k->tags[s], block + 1, __ATOMIC_RELEASE);
+}
 
-// ------------- Python module stuff ---------------------
+// Worker thread of a convolver: transforms each block of input the RT thread hands over,
+// and convolves it with the tails of the kernels in use
+static void * convolver_thread(void * arg)
+{
+    pyjack_convolver_t * cv = (pyjack_convolver_t*) arg;
+    const int tail_size = cv->tail_size;
+    uint64_t frames, latest;
+
+    for (;;) {
+        sem_wait(&cv->wakeup);
+        if (!__atomic_load_n(&cv->running, __ATOMIC_ACQUIRE)) break;
+        pthread_mutex_lock(&cv->lock);
+        frames = __atomic_load_n(&cv->frames, __ATOMIC_ACQUIRE);
+
+        // the RT thread overwrites what is more than ring_size behind: skip to the latest block
+        if (frames - cv->w_frames > cv->ring_size - tail_size) {
+            latest = (frames / tail_size - 1) * tail_size;
+            for (; cv->w_frames < latest; cv->w_frames += tail_size) {
+                size_t slot = (size_t)((cv->w_frames / tail_size) & cv->w_fdl_mask) * (tail_size + 1);
+                memset(cv->w_fdl_re + slot, 0, (tail_size + 1) * sizeof(float));
+                memset(cv->w_fdl_im + slot, 0, (tail_size + 1) * sizeof(float));
+                cv->overruns++;
+            }
+            memset(cv->w_prev, 0, tail_size * sizeof(float));
+        }
+        while (frames - cv->w_frames >= (uint64_t)tail_size) {
+            uint64_t block = cv->w_frames / tail_size;
+            size_t slot = (size_t)(block & cv->w_fdl_mask) * (tail_size + 1);
+            const float * in = cv->ring + (cv->w_frames & (cv->ring_size - 1));
+            // swap before active: the RT thread flips active first when a crossfade ends
+            uint32_t swap = __atomic_load_n(&cv->swap, __ATOMIC_ACQUIRE);
+            uint32_t active = __atomic_load_n(&cv->active, __ATOMIC_ACQUIRE);
+
+            convolve_forward(tail_size, cv->w_cos_table, cv->w_sin_table, cv->w_bitrev, cv->w_re, cv->w_im,
+                             cv->w_prev, in, cv->w_fdl_re + slot, cv->w_fdl_im + slot);
+            memcpy(cv->w_prev, in, tail_size * sizeof(float));
+            convolver_tail(cv, &cv->kernels[active], block);
+            if (swap != PYJACK_SWAP_NONE)
+                convolver_tail(cv, &cv->kernels[!active], block);
+            cv->w_frames += tail_size;
+        }
+        pthread_mutex_unlock(&cv->lock);
+    }
+    return NULL;
+}
 
-// Module exception object
-static PyObject* JackError;
-static PyObject* JackNotConnectedError;
-static PyObject* JackUsageError;
-static PyObject* JackInputSyncError;
-static PyObject* JackOutputSyncError;
+// Next power of two at or above n
+static uint32_t pow2_above(uint32_t n)
+{
+    uint32_t p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
 
-// Attempt to connect to the Jack server
-static PyObject* attach(PyObject* self, PyObject* args)
+// Set up a convolver of in_port into out_port for the current period size, with ir (taken over,
+// malloc'ed) and room for responses of up to max_length frames. Returns NULL on failure.
+static pyjack_convolver_t * convolver_new(pyjack_client_t * client, jack_port_t * in_port, int in_is_output,
+                                          jack_port_t * out_port, int mix, float * ir, uint32_t length, uint32_t max_length)
 {
-    char* cname;
-    if (! PyArg_ParseTuple(args, "s", &cname))
+    const int size = client->buffer_size;
+    pyjack_convolver_t * cv = rt_alloc(client, sizeof(*cv));
+    uint32_t fdl_size;
+    int tail_size;
+    // the FFTs are radix 2, and a partition is one period
+    if (!cv || size < 1 || (size & (size - 1))) {
+        rt_free(client, cv);
+        free(ir);
+        return NULL;
+    }
+    pthread_mutex_init(&cv->lock, NULL);
+    sem_init(&cv->wakeup, 0, 0);
+    cv->in_port = in_port;
+    cv->in_is_output = in_is_output;
+    cv->out_port = out_port;
+    cv->mix = mix;
+
+    // long tail partitions are cheaper per frame; the RT thread covers two of them
+    tail_size = 16 * size;
+    if (tail_size > 8192) tail_size = 8192;
+    if (tail_size < 2 * size) tail_size = 2 * size;
+    cv->size = size;
+    cv->tail_size = tail_size;
+    cv->head_length = 2 * tail_size;
+    cv->max_length = max_length > length ? max_length : length;
+    cv->max_tail_parts = cv->max_length > cv->head_length
+        ? (cv->max_length - cv->head_length + tail_size - 1) / tail_size : 0;
+
+    fdl_size = pow2_above(cv->head_length / size);
+    cv->fdl_mask = fdl_size - 1;
+    cv->re = rt_alloc(client, (10 * size + 2) * sizeof(float));
+    cv->cos_table = rt_alloc(client, 2 * size * sizeof(float));
+    cv->bitrev = rt_alloc(client, 2 * size * sizeof(int));
+    cv->fdl_re = rt_alloc(client, (size_t)fdl_size * (size + 1) * sizeof(float));
+    cv->fdl_im = rt_alloc(client, (size_t)fdl_size * (size + 1) * sizeof(float));
+    if (!cv->re || !cv->cos_table || !cv->bitrev || !cv->fdl_re || !cv->fdl_im)
+        goto fail;
+    cv->im = cv->re + 2 * size;
+    cv->acc_re = cv->im + 2 * size;
+    cv->acc_im = cv->acc_re + size + 1;
+    cv->prev = cv->acc_im + size + 1;
+    cv->y[0] = cv->prev + size;
+    cv->y[1] = cv->y[0] + size;
+    cv->copy = cv->y[1] + size;
+    cv->sin_table = cv->cos_table + size;
+    fft_tables(2 * size, cv->cos_table, cv->sin_table, cv->bitrev);
+
+    // the worker's side, and its tables (needed to partition the tail)
+    if (cv->max_tail_parts) {
+        uint32_t w_fdl_size = pow2_above(cv->max_tail_parts);
+        cv->w_fdl_mask = w_fdl_size - 1;
+        cv->ring_size = pow2_above(4 * tail_size);
+        cv->ring = rt_alloc(client, cv->ring_size * sizeof(float));
+        cv->w_re = calloc(7 * tail_size + 2, sizeof(float));
+        cv->w_cos_table = malloc(2 * tail_size * sizeof(float));
+        cv->w_bitrev = malloc(2 * tail_size * sizeof(int));
+        cv->w_fdl_re = calloc((size_t)w_fdl_size * (tail_size + 1), sizeof(float));
+        cv->w_fdl_im = calloc((size_t)w_fdl_size * (tail_size + 1), sizeof(float));
+        if (!cv->ring || !cv->w_re || !cv->w_cos_table || !cv->w_bitrev || !cv->w_fdl_re || !cv->w_fdl_im)
+            goto fail;
+        cv->w_im = cv->w_re + 2 * tail_size;
+        cv->w_acc_re = cv->w_im + 2 * tail_size;
+        cv->w_acc_im = cv->w_acc_re + tail_size + 1;
+        cv->w_prev = cv->w_acc_im + tail_size + 1;
+        cv->w_sin_table = cv->w_cos_table + tail_size;
+        fft_tables(2 * tail_size, cv->w_cos_table, cv->w_sin_table, cv->w_bitrev);
+    }
+
+    if (kernel_build(client, cv, &cv->kernels[0], ir, length) < 0) {
+        convolver_free(client, cv);
         return NULL;
+    }
+    if (cv->max_tail_parts) {
+        cv->running = 1;
+        if (pthread_create(&cv->thread, NULL, convolver_thread, cv)) {
+            cv->running = 0;
+            convolver_free(client, cv);
+            return NULL;
+        }
+        // ahead of everything but the process thread, if we may
+        if (jack_is_realtime(client->pjc)) {
+            struct sched_param param;
+            param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+            pthread_setschedparam(cv->thread, SCHED_FIFO, &param);
+        }
+    }
+    return cv;
+
+fail:
+    free(ir);
+    convolver_free(client, cv);
+    return NULL;
+}
+
+// Rebuild the convolvers for a new period size, with the latest of their responses (the RT thread must be held)
+static void convolvers_resize(pyjack_client_t * client)
+{
+    int i;
+    for (i = 0; i < PYJACK_MAX_CONVOLVERS; i++) {
+        pyjack_convolver_t * cv = client->convolvers[i], * next;
+        pyjack_kernel_t * k;
+        float * ir;
+        if (!cv || cv->size == client->buffer_size) continue;
+        // the RT thread skips convolvers of another period size, so this one stays silent
+        if (client->buffer_size & (client->buffer_size - 1)) continue;
+        k = &cv->kernels[cv->swap != PYJACK_SWAP_NONE ? !cv->active : cv->active];
+        ir = malloc(k->length * sizeof(float));
+        if (!ir) continue;
+        memcpy(ir, k->ir, k->length * sizeof(float));
+        // a convolver that cannot be rebuilt stays silent
+        next = convolver_new(client, cv->in_port, cv->in_is_output, cv->out_port, cv->mix, ir, k->length, cv->max_length);
+        if (!next) continue;
+        next->id = cv->id;
+        client->convolvers[i] = next;
+        convolver_free(client, cv);
+    }
+}
+
+// Fill frames [offset, n) of the output ports when python did not deliver in time (RT)
+static void output_underrun(pyjack_client_t * client, jack_nframes_t offset, jack_nframes_t n)
+{
+    int i;
+    jack_nframes_t j;
+
+    if (!client->output_started) {
+        // python has not started sending yet; that is not an underrun
+        for(i = 0; i < client->num_outputs; i++)
+            memset((float*)jack_port_get_buffer(client->output_ports[i], n) + offset, 0, (n - offset) * sizeof(float));
+        return;
+    }
+
+    client->underrun_periods++;
+    TRACE(client, PYJACK_TRACE_UNDERRUN, 'i', PYJACK_THREAD_RT, n - offset);
+    if (!client->underrun) {
+        client->underrun = 1;
+        client->underrun_events++;
+        client->underrun_fade_pos = 0;
+        client->underrun_fade_in = client->underrun_fade;
+        client->underrun_frame_time = jack_last_frame_time(client->pjc) + offset;
+        client->underrun_usecs = jack_get_time();
+    }
+
+    for(i = 0; i < client->num_outputs; i++) {
+        float * out = jack_port_get_buffer(client->output_ports[i], n);
+        float * last = client->output_last + client->buffer_size * i;
+        switch (client->underrun_policy) {
+        case PYJACK_UNDERRUN_REPEAT:
+            // repeat the last period, but do not loop it forever if python is stuck
+            for (j = offset; j < n; j++)
+                out[j] = (client->underrun_fade_pos + (int)(j - offset) < client->underrun_repeat) ? last[j] : 0.f;
+            break;
+        case PYJACK_UNDERRUN_FADE:
+            // ramp the last sample played down to silence, so the output stays continuous across periods;
+            // that sample is kept at the end of output_last for the rest of the dropout
+            if (client->underrun_fade_pos == 0 && offset)
+                last[client->buffer_size - 1] = out[offset - 1];
+            for (j = offset; j < n; j++) {
+                int pos = client->underrun_fade_pos + (j - offset);
+                out[j] = (pos < client->underrun_fade)
+                    ? last[client->buffer_size - 1] * (1.f - (float)(pos + 1) / client->underrun_fade)
+                    : 0.f;
+            }
+            break;
+        default:
+            memset(out + offset, 0, (n - offset) * sizeof(float));
+            break;
+        }
+    }
+    client->underrun_fade_pos += n - offset;
+}
+
+// An output block has been taken off the socket (RT)
+static void output_received(pyjack_client_t * client)
+{
+    client->output_read++;
+    TRACE(client, PYJACK_TRACE_OUTPUT_READ, 'i', PYJACK_THREAD_RT, client->output_frames);
+    client->output_queue = __atomic_load_n(&client->output_written, __ATOMIC_ACQUIRE) - client->output_read;
+}
+
+// A full period of output has been delivered (RT)
+static void output_complete(pyjack_client_t * client, jack_nframes_t n)
+{
+    int i;
+    jack_nframes_t j;
+
+    for(i = 0; i < client->num_outputs; i++) {
+        float * out = jack_port_get_buffer(client->output_ports[i], n);
+        // fade back in after a dropout; the fade may span several periods
+        if (client->underrun_fade_in > 0 && client->underrun_policy == PYJACK_UNDERRUN_FADE) {
+            int pos = client->underrun_fade - client->underrun_fade_in;
+            if (pos < 0)
+                pos = 0;
+            for (j = 0; j < n && pos + (int)j < client->underrun_fade; j++)
+                out[j] *= (float)(pos + j + 1) / client->underrun_fade;
+        }
+        if (client->underrun_policy != PYJACK_UNDERRUN_SILENCE)
+            memcpy(client->output_last + client->buffer_size * i, out, n * sizeof(float));
+    }
+    if (client->underrun_fade_in > 0)
+        client->underrun_fade_in = (client->underrun_fade_in > (int)n) ? client->underrun_fade_in - (int)n : 0;
+    client->underrun = 0;
+    client->output_started = 1;
+}
+
+// Send the block in input_buffer_0 to python, leaving out channels that have been silent
+// for longer than the hold time (RT, non-blocking!)
+static void input_write(pyjack_client_t * client, jack_nframes_t frame_time)
+{
+    pyjack_block_header_t * hdr = &client->input_header;
+    const int frames = client->input_frames;
+    const float threshold = client->silence_threshold;
+    float * block = client->input_buffer_0;
+    struct iovec iov[2];
+    struct msghdr msg;
+    int i, j, size, r, active = 0;
+
+    memset(hdr->active, 0, sizeof(hdr->active));
+    for(i = 0; i < client->num_inputs; i++) {
+        const float * src = block + frames * i;
+        if (threshold > 0.f) {
+            float peak = 0.f;
+            for (j = 0; j < frames; j++)
+                peak = fmaxf(peak, fabsf(src[j]));
+            if (peak > threshold)
+                client->silence_countdown[i] = client->silence_hold;
+            else if (client->silence_countdown[i] > 0)
+                client->silence_countdown[i] -= frames;
+            else
+                continue;
+        }
+        hdr->active[i >> 5] |= 1u << (i & 31);
+        // pack the active channels
+        if (active != i)
+            memcpy(block + frames * active, src, frames * sizeof(float));
+        active++;
+    }
+    hdr->nframes = frames;
+    hdr->frame_time = frame_time;
+    hdr->channels = client->num_inputs;
+    hdr->active_count = active;
+
+    size = frames * active * sizeof(float);
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = sizeof(*hdr);
+    iov[1].iov_base = block;
+    iov[1].iov_len = size;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    r = sendmsg(client->input_pipe[W], &msg, 0);
+    TRACE(client, r == (int)sizeof(*hdr) + size ? PYJACK_TRACE_INPUT_WRITE : PYJACK_TRACE_INPUT_OVERFLOW,
+          'i', PYJACK_THREAD_RT, frames);
+
+    if(r < 0) {
+        __atomic_store_n(&client->iosync, 0, __ATOMIC_RELAXED);
+    } else if(r == (int)sizeof(*hdr) + size) {
+        __atomic_store_n(&client->iosync, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Send one JACK period of input to python, resampling it if needed (RT, non-blocking!)
+static void input_send(pyjack_client_t * client, jack_nframes_t n, const float ** in)
+{
+    int i;
+
+    if (client->input_resampler) {
+        pyjack_resampler_t * rs = client->input_resampler;
+        float * out[PYJACK_MAX_PORTS];
+        int done = 0, used;
+        // fill the python-side block, and send it whenever it is complete
+        while (done < (int)n) {
+            for(i = 0; i < client->num_inputs; i++)
+                out[i] = client->input_buffer_0 + client->input_frames * i + rs->block_pos;
+            rs->block_pos += resampler_run(rs, client->num_inputs, in, n - done, &used,
+                                           out, client->input_frames - rs->block_pos);
+            done += used;
+            for(i = 0; i < client->num_inputs; i++)
+                in[i] += used;
+            if (rs->block_pos == client->input_frames) {
+                input_write(client, jack_last_frame_time(client->pjc) + done);
+                rs->block_pos = 0;
+            }
+        }
+        return;
+    }
+
+    for(i = 0; i < client->num_inputs; i++) {
+        float * dst = &client->input_buffer_0[client->buffer_size * i];
+        if (in[i] != dst)
+            memcpy(dst, in[i], (client->buffer_size * sizeof(float)));
+    }
+
+    input_write(client, jack_last_frame_time(client->pjc) + n);
+}
+
+// Fill the output ports with data from python, resampling it if needed (RT, non-blocking!)
+static void output_receive(pyjack_client_t * client, jack_nframes_t n)
+{
+    int i, r;
+
+    if (client->output_resampler) {
+        pyjack_resampler_t * rs = client->output_resampler;
+        const float * in[PYJACK_MAX_PORTS];
+        float * out[PYJACK_MAX_PORTS];
+        int done = 0, used;
+        for(i = 0; i < client->num_outputs; i++)
+            out[i] = jack_port_get_buffer(client->output_ports[i], n);
+        // drain the python-side blocks, fetching the next one whenever the current one is used up
+        while (done < (int)n) {
+            if (rs->block_pos == client->output_frames) {
+                r = read(client->output_pipe[R], client->output_buffer_0, client->output_buffer_size);
+                if (r != client->output_buffer_size) {
+                    // not enough data; fill the rest of the period according to the policy
+                    output_underrun(client, done, n);
+                    return;
+                }
+                output_received(client);
+                rs->block_pos = 0;
+            }
+            for(i = 0; i < client->num_outputs; i++)
+                in[i] = client->output_buffer_0 + client->output_frames * i + rs->block_pos;
+            r = resampler_run(rs, client->num_outputs, in, client->output_frames - rs->block_pos, &used,
+                              out, n - done);
+            rs->block_pos += used;
+            done += r;
+            for(i = 0; i < client->num_outputs; i++)
+                out[i] += r;
+        }
+        output_complete(client, n);
+        return;
+    }
+
+    r = read(client->output_pipe[R], client->output_buffer_0, client->output_buffer_size);
+    if(r != client->buffer_size * sizeof(float) * client->num_outputs) {
+        // not enough data; fill the period according to the policy
+        output_underrun(client, 0, n);
+        return;
+    }
+    output_received(client);
+    for(i = 0; i < client->num_outputs; i++) {
+        memcpy(
+            jack_port_get_buffer(client->output_ports[i], client->buffer_size), 
+            client->output_buffer_0 + (client->buffer_size * i),
+            client->buffer_size * sizeof(float)
+        );
+    }
+    output_complete(client, n);
+}
+
+// Raise the peak level of a tap channel (RT)
+static void tap_peak_update(pyjack_tap_t * tap, int c, const float * data, jack_nframes_t n)
+{
+    float peak = 0.f;
+    uint32_t bits, old;
+    jack_nframes_t j;
+    for (j = 0; j < n; j++)
+        peak = fmaxf(peak, fabsf(data[j]));
+    memcpy(&bits, &peak, sizeof(bits));
+    // non-negative floats order like their bit patterns
+    old = __atomic_load_n(&tap->peaks[c], __ATOMIC_RELAXED);
+    while (bits > old && !__atomic_compare_exchange_n(&tap->peaks[c], &old, bits, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// Publish the RT side's position of a tap together with its frame time (RT)
+static void tap_publish(pyjack_tap_t * tap, uint64_t * position, uint64_t value, jack_nframes_t frame_time)
+{
+    __atomic_store_n(&tap->seq, tap->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(position, value, __ATOMIC_RELAXED);
+    tap->frame_time = frame_time;
+    __atomic_store_n(&tap->seq, tap->seq + 1, __ATOMIC_RELEASE);
+}
+
+// Copy the ports of the input taps into their rings, dropping the period if one is full (RT)
+static void taps_feed(pyjack_client_t * client, jack_nframes_t n, const float * stage)
+{
+    int i, c;
+    for (i = 0; i < PYJACK_MAX_TAPS; i++) {
+        pyjack_tap_t * tap = __atomic_load_n(&client->taps[i], __ATOMIC_ACQUIRE);
+        if (!tap || tap->direction != PYJACK_TAP_INPUT) continue;
+        uint64_t w = tap->write_frames;
+        if (tap->ring_size - (w - __atomic_load_n(&tap->read_frames, __ATOMIC_ACQUIRE)) < n) {
+            tap->xruns++;
+            continue;
+        }
+        uint32_t pos = w & (tap->ring_size - 1);
+        uint32_t first = (n < tap->ring_size - pos) ? n : tap->ring_size - pos;
+        for (c = 0; c < tap->channels; c++) {
+            float * dst = tap->ring + (size_t)tap->ring_size * c;
+            const float * src = input_source(client, __atomic_load_n(&tap->ports[c], __ATOMIC_ACQUIRE), n, stage);
+            if (src) {
+                memcpy(dst + pos, src, first * sizeof(float));
+                memcpy(dst, src + first, (n - first) * sizeof(float));
+                tap_peak_update(tap, c, src, n);
+            } else {
+                memset(dst + pos, 0, first * sizeof(float));
+                memset(dst, 0, (n - first) * sizeof(float));
+            }
+        }
+        tap_publish(tap, &tap->write_frames, w + n, jack_last_frame_time(client->pjc) + n);
+    }
+}
+
+// Mix what the output taps hold into their ports (RT)
+static void taps_mix(pyjack_client_t * client, jack_nframes_t n)
+{
+    int i, c;
+    jack_nframes_t j;
+    for (i = 0; i < PYJACK_MAX_TAPS; i++) {
+        pyjack_tap_t * tap = __atomic_load_n(&client->taps[i], __ATOMIC_ACQUIRE);
+        if (!tap || tap->direction != PYJACK_TAP_OUTPUT) continue;
+        uint64_t r = tap->read_frames;
+        uint64_t w = __atomic_load_n(&tap->write_frames, __ATOMIC_ACQUIRE);
+        uint32_t count = (w - r < n) ? w - r : n;
+        if (count < n && w)
+            tap->xruns++;
+        uint32_t pos = r & (tap->ring_size - 1);
+        uint32_t first = (count < tap->ring_size - pos) ? count : tap->ring_size - pos;
+        for (c = 0; c < tap->channels && count; c++) {
+            jack_port_t * port = __atomic_load_n(&tap->ports[c], __ATOMIC_ACQUIRE);
+            const float * src = tap->ring + (size_t)tap->ring_size * c;
+            float * out;
+            if (!port) continue;
+            out = jack_port_get_buffer(port, n);
+            for (j = 0; j < first; j++)
+                out[j] += src[pos + j];
+            for (; j < count; j++)
+                out[j] += src[j - first];
+            tap_peak_update(tap, c, src + pos, first);
+            tap_peak_update(tap, c, src, count - first);
+        }
+        tap_publish(tap, &tap->read_frames, r + count, jack_last_frame_time(client->pjc) + n);
+    }
+}
+
+// Take over a new target of a parameter, if python published one (RT)
+static void param_take_target(pyjack_param_t * p)
+{
+    uint32_t seq = __atomic_load_n(&p->seq, __ATOMIC_ACQUIRE);
+    float target;
+    uint32_t frames;
+    int exponential;
+
+    // python is writing: pick it up next cycle
+    if (seq == p->seen || (seq & 1)) return;
+    target = p->target;
+    frames = p->ramp_frames;
+    exponential = p->exponential;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (seq != __atomic_load_n(&p->seq, __ATOMIC_RELAXED)) return;
+    p->seen = seq;
+
+    p->end = target;
+    p->remaining = frames;
+    p->ramp_exponential = exponential && p->current * target > 0.f;
+    if (!frames)
+        p->current = target;
+    else if (p->ramp_exponential)
+        p->step = powf(target / p->current, 1.f / frames);
+    else
+        p->step = (target - p->current) / frames;
+}
+
+// Move the parameters towards their targets over this period, sample by sample (RT)
+static void params_update(pyjack_client_t * client, jack_nframes_t n)
+{
+    int i;
+    jack_nframes_t j;
+    for (i = 0; i < PYJACK_MAX_PARAMS; i++) {
+        pyjack_param_t * p = &client->params[i];
+        float value;
+        if (!__atomic_load_n(&p->active, __ATOMIC_ACQUIRE)) continue;
+        param_take_target(p);
+        if (!p->remaining || !p->curve || n > p->curve_size) {
+            if (p->remaining) {
+                // no room for the curve: jump
+                p->current = p->end;
+                p->remaining = 0;
+            }
+            p->constant = 1;
+            __atomic_store(&p->value, &p->current, __ATOMIC_RELAXED);
+            continue;
+        }
+        value = p->current;
+        for (j = 0; j < n; j++) {
+            if (p->remaining) {
+                value = p->ramp_exponential ? value * p->step : value + p->step;
+                if (!--p->remaining) value = p->end;
+            }
+            p->curve[j] = value;
+        }
+        p->current = value;
+        p->constant = 0;
+        __atomic_store(&p->value, &value, __ATOMIC_RELAXED);
+    }
+}
+
+// Multiply the output ports by the parameters bound to them (RT)
+static void gains_apply(pyjack_client_t * client, jack_nframes_t n)
+{
+    int i;
+    jack_nframes_t j;
+    for (i = 0; i < PYJACK_MAX_GAINS; i++) {
+        jack_port_t * port = __atomic_load_n(&client->gains[i].port, __ATOMIC_ACQUIRE);
+        pyjack_param_t * p;
+        float * out;
+        if (!port) continue;
+        p = &client->params[client->gains[i].param];
+        out = jack_port_get_buffer(port, n);
+        if (!p->constant) {
+            for (j = 0; j < n; j++)
+                out[j] *= p->curve[j];
+        } else if (p->current != 1.f) {
+            for (j = 0; j < n; j++)
+                out[j] *= p->current;
+        }
+    }
+}
+
+// Start a round-trip measurement at the beginning of a cycle, so that playing and recording
+// start in the same one whatever order they run in (RT)
+static void measure_start(pyjack_client_t * client)
+{
+    pyjack_measure_t * m = __atomic_load_n(&client->measure, __ATOMIC_ACQUIRE);
+    if (m && __atomic_load_n(&m->state, __ATOMIC_ACQUIRE) == PYJACK_MEASURE_ARMED)
+        __atomic_store_n(&m->state, PYJACK_MEASURE_RUNNING, __ATOMIC_RELEASE);
+}
+
+// Play the test signal of a round-trip measurement, then silence until the recording is done (RT)
+static void measure_play(pyjack_client_t * client, jack_nframes_t n)
+{
+    pyjack_measure_t * m = __atomic_load_n(&client->measure, __ATOMIC_ACQUIRE);
+    uint32_t count = 0;
+    float * out;
+    if (!m || __atomic_load_n(&m->state, __ATOMIC_ACQUIRE) != PYJACK_MEASURE_RUNNING) return;
+
+    out = jack_port_get_buffer(m->out_port, n);
+    if (m->played < m->length) {
+        count = m->length - m->played;
+        if (count > n) count = n;
+        memcpy(out, m->signal + m->played, count * sizeof(float));
+        m->played += count;
+    }
+    memset(out + count, 0, (n - count) * sizeof(float));
+}
+
+// Record the input port of a round-trip measurement (RT)
+static void measure_record(pyjack_client_t * client, jack_nframes_t n, const float * stage)
+{
+    pyjack_measure_t * m = __atomic_load_n(&client->measure, __ATOMIC_ACQUIRE);
+    uint32_t count;
+    const float * in;
+    if (!m || __atomic_load_n(&m->state, __ATOMIC_ACQUIRE) != PYJACK_MEASURE_RUNNING) return;
+
+    count = m->capacity - m->recorded;
+    if (count > n) count = n;
+    in = input_source(client, m->in_port, n, stage);
+    if (in)
+        memcpy(m->record + m->recorded, in, count * sizeof(float));
+    else
+        memset(m->record + m->recorded, 0, count * sizeof(float));
+    m->recorded += count;
+    if (m->recorded == m->capacity)
+        __atomic_store_n(&m->state, PYJACK_MEASURE_DONE, __ATOMIC_RELEASE);
+}
+
+// Move a clip from state (QUEUED or PLAYING) to next, or release it if python cancelled it meanwhile (RT)
+static void voice_advance(pyjack_voice_t * v, uint32_t state, uint32_t next)
+{
+    if (!__atomic_compare_exchange_n(&v->state, &state, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        __atomic_store_n(&v->state, PYJACK_VOICE_DONE, __ATOMIC_RELEASE);
+}
+
+// Mix the scheduled clips that overlap this period into their output ports (RT)
+static void voices_mix(pyjack_client_t * client, jack_nframes_t n)
+{
+    jack_nframes_t frame = jack_last_frame_time(client->pjc);
+    int i;
+    for (i = 0; i < PYJACK_MAX_VOICES; i++) {
+        pyjack_voice_t * v = &client->voices[i];
+        uint32_t state = __atomic_load_n(&v->state, __ATOMIC_ACQUIRE);
+        int32_t pos, start;
+        uint32_t count, j;
+        float * out;
+
+        if (state == PYJACK_VOICE_CANCEL) {
+            __atomic_store_n(&v->state, PYJACK_VOICE_DONE, __ATOMIC_RELEASE);
+            continue;
+        }
+        if (state != PYJACK_VOICE_QUEUED && state != PYJACK_VOICE_PLAYING) continue;
+        // from here on python may cancel the clip: the state only moves on if it did not
+
+        // clip frame at the start of the period, and where in the period it starts
+        pos = (int32_t)(frame - v->at_frame);
+        if (pos < 0 && (uint32_t)-pos >= n) continue;
+        start = pos < 0 ? -pos : 0;
+        if (pos < 0) pos = 0;
+        if ((uint32_t)pos >= v->length) {
+            voice_advance(v, state, PYJACK_VOICE_DONE);
+            continue;
+        }
+
+        count = n - start;
+        if (count > v->length - pos) count = v->length - pos;
+        out = (float*)jack_port_get_buffer(v->port, n) + start;
+        for (j = 0; j < count; j++)
+            out[j] += v->gain * v->data[pos + j];
+        voice_advance(v, state, pos + count >= v->length ? PYJACK_VOICE_DONE : PYJACK_VOICE_PLAYING);
+    }
+}
+
+// Copy the tail of a kernel for the period starting at frame; returns 0 if the worker has not delivered it (RT)
+static int convolver_take_tail(pyjack_convolver_t * cv, pyjack_kernel_t * k, uint64_t frame)
+{
+    uint64_t block = (frame - cv->head_length) / cv->tail_size;
+    uint32_t s = block % PYJACK_CONVOLVER_SLOTS;
+    uint32_t offset = (frame - cv->head_length) % cv->tail_size;
+    uint64_t tag = __atomic_load_n(&k->tags[s], __ATOMIC_ACQUIRE);
+    if (tag != block + 1) return 0;
+    memcpy(cv->copy, k->out + (size_t)s * cv->tail_size + offset, cv->size * sizeof(float));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&k->tags[s], __ATOMIC_RELAXED) == tag;
+}
+
+// Convolve the period starting at frame with a kernel: the head here, plus the tail from the worker (RT)
+static void convolver_output(pyjack_convolver_t * cv, pyjack_kernel_t * k, uint64_t frame, float * y)
+{
+    int j;
+    convolve_partitions(cv->size + 1, cv->fdl_re, cv->fdl_im, cv->fdl_mask, cv->blocks,
+                        k->head_re, k->head_im, k->head_parts, cv->acc_re, cv->acc_im);
+    convolve_inverse(cv->size, cv->cos_table, cv->sin_table, cv->bitrev, cv->acc_re, cv->acc_im, cv->re, cv->im, y);
+    if (!k->tail_parts || frame < cv->head_length) return;
+    if (!convolver_take_tail(cv, k, frame)) {
+        __atomic_add_fetch(&cv->late, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    for (j = 0; j < cv->size; j++)
+        y[j] += cv->copy[j];
+}
+
+// Run the convolvers over this period, crossfading into new responses (RT).
+// If stage is given, the input ports are read from there instead of from jack.
+static void convolvers_run(pyjack_client_t * client, jack_nframes_t n, const float * stage)
+{
+    int i;
+    jack_nframes_t j;
+    for (i = 0; i < PYJACK_MAX_CONVOLVERS; i++) {
+        pyjack_convolver_t * cv = __atomic_load_n(&client->convolvers[i], __ATOMIC_ACQUIRE);
+        const float * in;
+        float * out;
+        size_t slot;
+        uint64_t frame;
+        uint32_t active, swap;
+        if (!cv || n != (jack_nframes_t)cv->size) continue;
+
+        // transform the period, and hand it to the worker
+        in = cv->in_is_output ? jack_port_get_buffer(cv->in_port, n) : input_source(client, cv->in_port, n, stage);
+        if (!in) {
+            memset(cv->copy, 0, n * sizeof(float));
+            in = cv->copy;
+        }
+        slot = (size_t)(cv->blocks & cv->fdl_mask) * (n + 1);
+        convolve_forward(n, cv->cos_table, cv->sin_table, cv->bitrev, cv->re, cv->im, cv->prev, in,
+                         cv->fdl_re + slot, cv->fdl_im + slot);
+        memcpy(cv->prev, in, n * sizeof(float));
+        frame = cv->frames;
+        if (cv->ring)
+            memcpy(cv->ring + (frame & (cv->ring_size - 1)), in, n * sizeof(float));
+        __atomic_store_n(&cv->frames, frame + n, __ATOMIC_RELEASE);
+        if (cv->ring && (frame + n) % cv->tail_size == 0)
+            sem_post(&cv->wakeup);
+
+        // a new response fades in once the worker has caught up with it
+        active = cv->active;
+        swap = __atomic_load_n(&cv->swap, __ATOMIC_ACQUIRE);
+        if (swap == PYJACK_SWAP_PENDING) {
+            pyjack_kernel_t * k = &cv->kernels[!active];
+            if (!k->tail_parts || frame < cv->head_length || convolver_take_tail(cv, k, frame)) {
+                cv->fade_pos = 0;
+                swap = PYJACK_SWAP_FADING;
+                __atomic_store_n(&cv->swap, swap, __ATOMIC_RELEASE);
+            }
+        }
+        convolver_output(cv, &cv->kernels[active], frame, cv->y[0]);
+        if (swap == PYJACK_SWAP_FADING) {
+            convolver_output(cv, &cv->kernels[!active], frame, cv->y[1]);
+            for (j = 0; j < n; j++) {
+                uint32_t pos = cv->fade_pos + j + 1;
+                float g = pos >= cv->fade_length ? 1.f : (float)pos / cv->fade_length;
+                cv->y[0][j] += g * (cv->y[1][j] - cv->y[0][j]);
+            }
+            cv->fade_pos += n;
+            if (cv->fade_pos >= cv->fade_length) {
+                __atomic_store_n(&cv->active, !active, __ATOMIC_RELEASE);
+                __atomic_store_n(&cv->swap, PYJACK_SWAP_NONE, __ATOMIC_RELEASE);
+            }
+        }
+        cv->blocks++;
+
+        out = jack_port_get_buffer(cv->out_port, n);
+        if (cv->mix) {
+            for (j = 0; j < n; j++)
+                out[j] += cv->y[0][j];
+        } else {
+            memcpy(out, cv->y[0], n * sizeof(float));
+        }
+    }
+}
+
+#ifdef HAVE_LADSPA
+// Run the plugins over this period, in the order they were added (RT).
+// If stage is given, the input ports are read from there instead of from jack.
+static void plugins_run(pyjack_client_t * client, jack_nframes_t n, const float * stage)
+{
+    pyjack_chain_t * chain = __atomic_load_n(&client->chain, __ATOMIC_ACQUIRE);
+    int i, k;
+    jack_nframes_t j;
+    if (!chain) return;
+    for (i = 0; i < chain->count; i++) {
+        pyjack_plugin_t * pl = chain->plugins[i];
+        const LADSPA_Descriptor * d = pl->descriptor;
+        if (n > pl->scratch_size) continue;
+
+        // control inputs change once per period
+        for (k = 0; k < pl->num_controls; k++) {
+            pyjack_control_t * c = &pl->controls[k];
+            int param;
+            if (c->output) continue;
+            param = __atomic_load_n(&c->param, __ATOMIC_ACQUIRE);
+            if (param >= 0)
+                c->value = client->params[param].current;
+            else
+                __atomic_load(&c->target, &c->value, __ATOMIC_RELAXED);
+        }
+        // port buffers may move from one cycle to the next; the outputs go to scratch first,
+        // so that plugins may read a port they write to
+        for (k = 0; k < pl->inputs; k++) {
+            const float * in = pl->input_is_output[k] ? jack_port_get_buffer(pl->input_ports[k], n)
+                                                      : input_source(client, pl->input_ports[k], n, stage);
+            d->connect_port(pl->instance, pl->input_index[k],
+                            (LADSPA_Data*)(in ? in : pl->scratch + pl->outputs * pl->scratch_size));
+        }
+        for (k = 0; k < pl->outputs; k++)
+            d->connect_port(pl->instance, pl->output_index[k], pl->scratch + k * pl->scratch_size);
+        d->run(pl->instance, n);
+
+        for (k = 0; k < pl->outputs; k++) {
+            float * out = jack_port_get_buffer(pl->output_ports[k], n);
+            const float * src = pl->scratch + k * pl->scratch_size;
+            if (pl->mix) {
+                for (j = 0; j < n; j++)
+                    out[j] += src[j];
+            } else {
+                memcpy(out, src, n * sizeof(float));
+            }
+        }
+        for (k = 0; k < pl->num_controls; k++)
+            __atomic_store(&pl->controls[k].published, &pl->controls[k].value, __ATOMIC_RELAXED);
+    }
+}
+#endif
+
+// RT function called by jack
+int pyjack_process(jack_nframes_t n, void* arg) {
+
+    pyjack_client_t * client = (pyjack_client_t*) arg;
+    const float * in[PYJACK_MAX_PORTS];
+    int i;
+
+    __atomic_add_fetch(&client->cycles, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&client->ports_held, __ATOMIC_SEQ_CST))
+        return 0;
+    TRACE(client, PYJACK_TRACE_CYCLE, 'B', PYJACK_THREAD_RT, n);
+    cycle_times_update(client, n);
+    params_update(client, n);
+    measure_start(client);
+
+    // Feed the shared memory streams, the analyzer and the history
+    export_streams(client, n, NULL);
+    analyzer_feed(client, n, NULL);
+    history_feed(client, n, NULL);
+    taps_feed(client, n, NULL);
+    measure_record(client, n, NULL);
+
+    // Send input data to python side
+    if (client->num_inputs) {
+        for(i = 0; i < client->num_inputs; i++)
+            in[i] = jack_port_get_buffer(client->input_ports[i], n);
+        input_send(client, n, in);
+    }
+
+    // Read data from python side, mix in the scheduled clips, run the convolvers and plugins and apply the gains
+    if (client->num_outputs) {
+        output_receive(client, n);
+        voices_mix(client, n);
+        taps_mix(client, n);
+        convolvers_run(client, n, NULL);
+    }
+#ifdef HAVE_LADSPA
+    plugins_run(client, n, NULL);
+#endif
+    if (client->num_outputs) {
+        gains_apply(client, n);
+        measure_play(client, n);
+    }
+
+    TRACE(client, PYJACK_TRACE_CYCLE, 'E', PYJACK_THREAD_RT, n);
+    return 0;
+}
+
+// RT thread run by jack when the client owns its cycle loop (set_process_thread).
+// Only the port I/O happens between jack_cycle_wait() and jack_cycle_signal();
+// everything else runs after the graph has been released.
+void * pyjack_process_thread(void * arg)
+{
+    pyjack_client_t * client = (pyjack_client_t*) arg;
+    const float * in[PYJACK_MAX_PORTS];
+    float * stage;
+    jack_nframes_t n;
+    int i;
+
+    for (;;) {
+        n = jack_cycle_wait(client->pjc);
+        __atomic_add_fetch(&client->cycles, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&client->ports_held, __ATOMIC_SEQ_CST)) {
+            jack_cycle_signal(client->pjc, 0);
+            continue;
+        }
+        TRACE(client, PYJACK_TRACE_CYCLE, 'B', PYJACK_THREAD_RT, n);
+        cycle_times_update(client, n);
+        params_update(client, n);
+        measure_start(client);
+
+        // take a copy of the inputs: the port buffers are gone once the cycle is signalled
+        stage = client->input_resampler ? client->input_stage : client->input_buffer_0;
+        for(i = 0; i < client->num_inputs; i++) {
+            in[i] = stage + client->buffer_size * i;
+            memcpy(stage + client->buffer_size * i,
+                   jack_port_get_buffer(client->input_ports[i], n),
+                   client->buffer_size * sizeof(float));
+        }
+        if (client->num_outputs) {
+            output_receive(client, n);
+            voices_mix(client, n);
+            taps_mix(client, n);
+            convolvers_run(client, n, client->num_inputs ? stage : NULL);
+        }
+#ifdef HAVE_LADSPA
+        plugins_run(client, n, client->num_inputs ? stage : NULL);
+#endif
+        if (client->num_outputs) {
+            gains_apply(client, n);
+            measure_play(client, n);
+        }
+
+        TRACE(client, PYJACK_TRACE_CYCLE, 'E', PYJACK_THREAD_RT, n);
+        jack_cycle_signal(client->pjc, 0);
+
+        // post-cycle work
+        TRACE(client, PYJACK_TRACE_POST_CYCLE, 'B', PYJACK_THREAD_RT, n);
+        export_streams(client, n, client->num_inputs ? stage : NULL);
+        analyzer_feed(client, n, client->num_inputs ? stage : NULL);
+        history_feed(client, n, client->num_inputs ? stage : NULL);
+        taps_feed(client, n, client->num_inputs ? stage : NULL);
+        measure_record(client, n, client->num_inputs ? stage : NULL);
+        if (client->num_inputs)
+            input_send(client, n, in);
+        TRACE(client, PYJACK_TRACE_POST_CYCLE, 'E', PYJACK_THREAD_RT, n);
+    }
+    return NULL;
+}
+
+// Event notification of buffer size change
+// JACK runs no process cycle until this returns, so the RT buffers can be swapped here.
+// Blocks of the old size still queued, for the RT thread or for python, are dropped.
+int pyjack_buffer_size_changed(jack_nframes_t n, void* arg) {
+    pyjack_client_t * client = (pyjack_client_t*) arg;
+    pyjack_gil_t gil;
+    pyjack_gil_ensure(client, &gil);
+    TRACE(client, PYJACK_TRACE_BUFFER_SIZE, 'i', PYJACK_THREAD_NOTIFY, n);
+
+    Py_BEGIN_CRITICAL_SECTION(client_object(client));
+    if (client->buffer_size != (int)n) {
+        client->buffer_size = n;
+        init_pipe_buffers(client);
+        params_resize(client);
+        convolvers_resize(client);
+#ifdef HAVE_LADSPA
+        plugins_resize(client);
+#endif
+        while (recv(client->output_pipe[R], NULL, 0, MSG_DONTWAIT) >= 0)
+            client->output_read++;
+        // (left queued, the input blocks could fill the socket and drop those of the new size)
+        while (recv(client->input_pipe[R], NULL, 0, MSG_DONTWAIT) >= 0)
+            ;
+        client->output_queue = 0;
+        client->output_started = 0;
+        client->underrun = 0;
+        client->underrun_fade_in = 0;
+    }
+    __atomic_store_n(&client->event_buffer_size, n, __ATOMIC_RELAXED);
+    __atomic_fetch_or(&client->session_events, PYJACK_EVENT_BUFFER_SIZE, __ATOMIC_RELAXED);
+
+    if(client->callback_buffer_size) {
+      PyObject *result = NULL;
+      PyObject *arglist= Py_BuildValue("(I)", n);
+      result = PyObject_CallObject(client->callback_buffer_size, arglist);
+      Py_DECREF(arglist);
+      if (result != NULL) // LATER: shouldn't we pass the result to jack?
+          Py_DECREF(result);
+      else
+          PyErr_Print();
+    }
+    Py_END_CRITICAL_SECTION();
+    pyjack_gil_release(&gil);
+    return 0;
+}
+
+// Event notification of sample rate change
+// JACK only changes the rate of a stopped graph (or the client is not connected, when
+// it comes back after a server restart), so the resamplers can be swapped here.
+int pyjack_sample_rate_changed(jack_nframes_t n, void* arg) {
+    pyjack_client_t * client = (pyjack_client_t*) arg;
+    pyjack_gil_t gil;
+    pyjack_gil_ensure(client, &gil);
+
+    Py_BEGIN_CRITICAL_SECTION(client_object(client));
+    client->resampling_failed = (resamplers_rebuild(client, n) < 0) ? (int)n : 0;
+    Py_END_CRITICAL_SECTION();
+    __atomic_store_n(&client->event_sample_rate, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_or(&client->session_events, PYJACK_EVENT_SAMPLE_RATE, __ATOMIC_RELAXED);
+
+    if(client->callback_sample_rate) {
+      PyObject *result = NULL;
+      PyObject *arglist= Py_BuildValue("(I)", n);
+      PyObject *callback = client_callback(client, &client->callback_sample_rate);
+      result = callback ? PyObject_CallObject(callback, arglist) : NULL;
+      Py_XDECREF(callback);
+      Py_DECREF(arglist);
+      if (result != NULL) // LATER: shouldn't we pass the result to jack?
+          Py_DECREF(result);
+    }
+    pyjack_gil_release(&gil);
+    return 0;
+}
+
+// Event notification of graph connect/disconnection
+int pyjack_graph_order(void* arg) {
+    pyjack_client_t * client = (pyjack_client_t*) arg;
+    __atomic_store_n(&client->event_graph_ordering, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_or(&client->session_events, PYJACK_EVENT_GRAPH_ORDER, __ATOMIC_RELAXED);
+    TRACE(client, PYJACK_TRACE_GRAPH_ORDER, 'i', PYJACK_THREAD_NOTIFY, 0);
+
+    if(client->callback_graph_order) {
+      pyjack_gil_t gil;
+      pyjack_gil_ensure(client, &gil);
+      PyObject *result = NULL;
+      PyObject *callback = client_callback(client, &client->callback_graph_order);
+      result = callback ? PyObject_CallObject(callback, NULL) : NULL;
+      Py_XDECREF(callback);
+      if (result != NULL) // LATER: shouldn't we pass the result to jack?
+          Py_DECREF(result);
+      pyjack_gil_release(&gil);
+    }
+    return 0;
+}
+
+// Event notification of xrun
+int pyjack_xrun(void* arg) {
+    pyjack_client_t * client = (pyjack_client_t*) arg;
+    __atomic_store_n(&client->event_xrun, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_or(&client->session_events, PYJACK_EVENT_XRUN, __ATOMIC_RELAXED);
+    TRACE(client, PYJACK_TRACE_XRUN, 'i', PYJACK_THREAD_NOTIFY, 0);
+
+    if(client->callback_xrun) {
+      pyjack_gil_t gil;
+      pyjack_gil_ensure(client, &gil);
+      PyObject *result = NULL;
+      PyObject *callback = client_callback(client, &client->callback_xrun);
+      result = callback ? PyObject_CallObject(callback, NULL) : NULL;
+      Py_XDECREF(callback);
+      if (result != NULL) // LATER: shouldn't we pass the result to jack?
+          Py_DECREF(result);
+      pyjack_gil_release(&gil);
+    }
+    return 0;
+}
+
+// Event notification of port registration or drop
+void pyjack_port_registration(jack_port_id_t pid, int action, void* arg) {
+    pyjack_client_t * client = (pyjack_client_t*) arg;
+    __atomic_store_n(&client->event_port_registration, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_or(&client->session_events, PYJACK_EVENT_PORT_REGISTRATION, __ATOMIC_RELAXED);
+
+    if(client->callback_port_registration) {
+      pyjack_gil_t gil;
+      pyjack_gil_ensure(client, &gil);
+      PyObject *result = NULL;
+      PyObject *arglist= Py_BuildValue("(Ii)", pid, action);
+      PyObject *callback = client_callback(client, &client->callback_port_registration);
+      result = callback ? PyObject_CallObject(callback, arglist) : NULL;
+      Py_XDECREF(callback);
+      Py_DECREF(arglist);
+      if (result != NULL)
+          Py_DECREF(result);
+      pyjack_gil_release(&gil);
+    }
+}
+
+// Remember the names and flags of our ports, to register them again after a server restart
+static void reconnect_remember_ports(pyjack_client_t * client)
+{
+    pyjack_reconnect_t * rc = client->reconnect;
+    int i;
+    if (!rc) return;
+    for (i = 0; i < client->num_inputs; i++) {
+        snprintf(rc->input_names[i], PYJACK_PORT_NAME_SIZE, "%s", jack_port_short_name(client->input_ports[i]));
+        rc->input_flags[i] = jack_port_flags(client->input_ports[i]);
+    }
+    for (i = 0; i < client->num_outputs; i++) {
+        snprintf(rc->output_names[i], PYJACK_PORT_NAME_SIZE, "%s", jack_port_short_name(client->output_ports[i]));
+        rc->output_flags[i] = jack_port_flags(client->output_ports[i]);
+    }
+}
+
+// Add (connect) or remove a remembered connection; the caller holds rc->lock
+static void reconnect_link(pyjack_reconnect_t * rc, const char * src, const char * dst, int connect)
+{
+    int i;
+    for (i = 0; i < rc->num_connections; i++) {
+        if (strcmp(rc->connections[i][0], src) || strcmp(rc->connections[i][1], dst)) continue;
+        if (!connect)
+            memcpy(rc->connections[i], rc->connections[--rc->num_connections], sizeof(rc->connections[i]));
+        return;
+    }
+    if (!connect) return;
+    if (rc->num_connections == rc->max_connections) {
+        int max = rc->max_connections ? 2 * rc->max_connections : 16;
+        void * connections = realloc(rc->connections, max * sizeof(rc->connections[0]));
+        if (!connections) return;
+        rc->connections = connections;
+        rc->max_connections = max;
+    }
+    snprintf(rc->connections[rc->num_connections][0], PYJACK_PORT_NAME_SIZE, "%s", src);
+    snprintf(rc->connections[rc->num_connections][1], PYJACK_PORT_NAME_SIZE, "%s", dst);
+    rc->num_connections++;
+}
+
+// Take the current connections of our ports as the ones to restore
+static void reconnect_remember_connections(pyjack_client_t * client)
+{
+    pyjack_reconnect_t * rc = client->reconnect;
+    const char ** names;
+    int i, k;
+    pthread_mutex_lock(&rc->lock);
+    rc->num_connections = 0;
+    for (i = 0; i < client->num_inputs; i++) {
+        names = jack_port_get_all_connections(client->pjc, client->input_ports[i]);
+        for (k = 0; names && names[k]; k++)
+            reconnect_link(rc, names[k], jack_port_name(client->input_ports[i]), 1);
+        jack_free(names);
+    }
+    for (i = 0; i < client->num_outputs; i++) {
+        names = jack_port_get_all_connections(client->pjc, client->output_ports[i]);
+        for (k = 0; names && names[k]; k++)
+            reconnect_link(rc, jack_port_name(client->output_ports[i]), names[k], 1);
+        jack_free(names);
+    }
+    pthread_mutex_unlock(&rc->lock);
+}
+
+// Follow a connection change involving one of our ports (notification thread)
+static void reconnect_track(pyjack_client_t * client, jack_port_id_t a, jack_port_id_t b, int connect)
+{
+    pyjack_reconnect_t * rc = client->reconnect;
+    jack_client_t * pjc = __atomic_load_n(&client->pjc, __ATOMIC_ACQUIRE);
+    jack_port_t * src;
+    jack_port_t * dst;
+    if (!rc || !pjc || !__atomic_load_n(&rc->running, __ATOMIC_ACQUIRE)) return;
+    src = jack_port_by_id(pjc, a);
+    dst = jack_port_by_id(pjc, b);
+    if (!src || !dst || !(jack_port_is_mine(pjc, src) || jack_port_is_mine(pjc, dst))) return;
+    pthread_mutex_lock(&rc->lock);
+    reconnect_link(rc, jack_port_name(src), jack_port_name(dst), connect);
+    pthread_mutex_unlock(&rc->lock);
+}
+
+// Stop polling for the server
+static void reconnect_stop(pyjack_client_t * client)
+{
+    pyjack_reconnect_t * rc = client->reconnect;
+    if (!rc || !rc->running) return;
+    __atomic_store_n(&rc->running, 0, __ATOMIC_RELEASE);
+    sem_post(&rc->wakeup);
+    // the worker may be waiting for the GIL to restore the client
+    Py_BEGIN_ALLOW_THREADS
+    pthread_join(rc->thread, NULL);
+    Py_END_ALLOW_THREADS
+}
+
+// Shutdown handler
+// The handle is kept to be closed later; with auto-reconnect, the worker starts polling for the server.
+void pyjack_shutdown(void * arg) {
+    pyjack_client_t * client = (pyjack_client_t*) arg;
+    __atomic_store_n(&client->event_shutdown, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_or(&client->session_events, PYJACK_EVENT_SHUTDOWN, __ATOMIC_RELAXED);
+    TRACE(client, PYJACK_TRACE_SHUTDOWN, 'i', PYJACK_THREAD_NOTIFY, 0);
+    __atomic_store_n(&client->zombie, __atomic_exchange_n(&client->pjc, NULL, __ATOMIC_ACQ_REL), __ATOMIC_RELEASE);
+    if (client->reconnect)
+        __atomic_store_n(&client->reconnect->down_usecs, jack_get_time(), __ATOMIC_RELEASE);
+}
+
+// SIGHUP handler
+// Signals are per process: the global client attached last gets them
+static pyjack_client_t * hangup_client;
+void pyjack_hangup(int signal) {
+    // TODO: what to do with non global clients
+    pyjack_client_t * client = __atomic_load_n(&hangup_client, __ATOMIC_ACQUIRE);
+    if (!client) return;
+    __atomic_store_n(&client->event_hangup, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_or(&client->session_events, PYJACK_EVENT_HANGUP, __ATOMIC_RELAXED);
+    client->pjc = NULL;
+}
+
+
+// Make the calling thread flush denormal floats to zero; returns true on success
+static int flush_denormals(void)
+{
+#if defined(__SSE__) || defined(__x86_64__)
+    _mm_setcsr(_mm_getcsr() | 0x8040); // FTZ | DAZ
+    return 1;
+#elif defined(__aarch64__)
+    uint64_t fpcr;
+    __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+    __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr | (1 << 24))); // FZ
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+// Apply the thread options to the calling (process) thread and record the outcome
+static void apply_thread_options(pyjack_client_t * client)
+{
+    pthread_t thread = pthread_self();
+    struct sched_param param;
+    int policy;
+
+    client->thread_affinity_error = 0;
+    client->thread_priority_error = 0;
+    if (client->thread_affinity_set)
+        client->thread_affinity_error = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &client->thread_affinity);
+    if (client->thread_rt_priority > 0) {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = client->thread_rt_priority;
+        client->thread_priority_error = pthread_setschedparam(thread, SCHED_FIFO, &param);
+    }
+    if (client->thread_flush_denormals && flush_denormals())
+        client->thread_denormals = 1;
+
+    if (pthread_getschedparam(thread, &policy, &param) == 0) {
+        client->thread_policy = policy;
+        client->thread_priority = param.sched_priority;
+    }
+    client->thread_id = syscall(SYS_gettid);
+}
+
+// callback handles
+void pyjack_thread_init(void* arg)
+{
+    pyjack_client_t * client = (pyjack_client_t*) arg;
+    if (!client) return;
+    client->thread_denormals = 0;
+    apply_thread_options(client);
+    if(client->callback_thread_init) {
+      pyjack_gil_t gil;
+      pyjack_gil_ensure(client, &gil);
+      PyObject *result = NULL;
+      PyObject *callback = client_callback(client, &client->callback_thread_init);
+      result = callback ? PyObject_CallObject(callback, NULL) : NULL;
+      Py_XDECREF(callback);
+      if (result != NULL)
+          Py_DECREF(result);
+      pyjack_gil_release(&gil);
+    }
+}
+static void pyjack_client_registration(const char *name, int reg, void *arg)
+{
+    pyjack_client_t * client = (pyjack_client_t*) arg;
+    if(client && client->callback_client_registration) {
+      pyjack_gil_t gil;
+      pyjack_gil_ensure(client, &gil);
+      PyObject *result = NULL;
+      PyObject *arglist= Py_BuildValue("(si)", name, reg);
+      PyObject *callback = client_callback(client, &client->callback_client_registration);
+      result = callback ? PyObject_CallObject(callback, arglist) : NULL;
+      Py_XDECREF(callback);
+      Py_DECREF(arglist);
+      if (result != NULL)
+          Py_DECREF(result);
+      pyjack_gil_release(&gil);
+    }
+}
+static void pyjack_freewheel(int starting, void *arg)
+{
+    pyjack_client_t * client = (pyjack_client_t*) arg;
+    if(client && client->callback_freewheel) {
+      pyjack_gil_t gil;
+      pyjack_gil_ensure(client, &gil);
+      PyObject *result = NULL;
+      PyObject *arglist= Py_BuildValue("(i)", starting);
+      PyObject *callback = client_callback(client, &client->callback_freewheel);
+      result = callback ? PyObject_CallObject(callback, arglist) : NULL;
+      Py_XDECREF(callback);
+      Py_DECREF(arglist);
+      if (result != NULL)
+          Py_DECREF(result);
+      pyjack_gil_release(&gil);
+    }
+}
+// Delay added by pyjack between its input and output ports, in JACK frames
+static jack_nframes_t pyjack_pipeline_delay(pyjack_client_t * client)
+{
+    double delay = 0.0;
+    if (!client->buffer_size) return 0;
+
+    // one period for the round trip through the sockets...
+    delay += client->buffer_size;
+    // ...plus however many output blocks python keeps queued ahead of the RT thread...
+    if (client->output_queue) {
+        double block = client->output_frames;
+        if (client->output_resampler)
+            block = block * client->output_resampler->L / client->output_resampler->M;
+        delay += client->output_queue * block;
+    }
+    // ...plus the resampling filters...
+    delay += resampler_latency(client->input_resampler, 1);
+    delay += resampler_latency(client->output_resampler, 0);
+    // ...plus the time it takes to fill a python-side input block that is longer than a period
+    if (client->input_resampler) {
+        double block = (double)client->input_frames * client->input_resampler->M / client->input_resampler->L;
+        if (block > client->buffer_size) delay += block - client->buffer_size;
+    }
+    return (jack_nframes_t)ceil(delay);
+}
+
+#ifdef WANT_LATENCY_CALLBACK
+// Report the pipeline delay to JACK, so that latency compensation downstream accounts for it
+static void pyjack_latency(jack_latency_callback_mode_t mode, void *arg)
+{
+    pyjack_client_t * client = (pyjack_client_t*) arg;
+    jack_latency_range_t range, r;
+    jack_port_t ** from;
+    jack_port_t ** to;
+    int num_from, num_to, i;
+
+    if (!client) return;
+    jack_nframes_t delay = pyjack_pipeline_delay(client);
+
+    // capture latency flows from our inputs to our outputs, playback latency the other way round
+    if (mode == JackCaptureLatency) {
+        from = client->input_ports;
+        num_from = client->num_inputs;
+        to = client->output_ports;
+        num_to = client->num_outputs;
+    } else {
+        from = client->output_ports;
+        num_from = client->num_outputs;
+        to = client->input_ports;
+        num_to = client->num_inputs;
+    }
+
+    range.min = range.max = 0;
+    for (i = 0; i < num_from; i++) {
+        jack_port_get_latency_range(from[i], mode, &r);
+        if (i == 0 || r.min < range.min) range.min = r.min;
+        if (i == 0 || r.max > range.max) range.max = r.max;
+    }
+    if (num_from) {
+        range.min += delay;
+        range.max += delay;
+    }
+    for (i = 0; i < num_to; i++)
+        jack_port_set_latency_range(to[i], mode, &range);
+
+    if(client->callback_latency) {
+      pyjack_gil_t gil;
+      pyjack_gil_ensure(client, &gil);
+      PyObject *result = NULL;
+      PyObject *arglist= Py_BuildValue("(i)", (int)mode);
+      PyObject *callback = client_callback(client, &client->callback_latency);
+      result = callback ? PyObject_CallObject(callback, arglist) : NULL;
+      Py_XDECREF(callback);
+      Py_DECREF(arglist);
+      if (result != NULL)
+          Py_DECREF(result);
+      pyjack_gil_release(&gil);
+    }
+}
+#endif /* WANT_LATENCY_CALLBACK */
+void pyjack_port_connect(jack_port_id_t a, jack_port_id_t b, int connect, void *arg)
+{
+    pyjack_client_t * client = (pyjack_client_t*) arg;
+    if (client)
+        reconnect_track(client, a, b, connect);
+    if(client && client->callback_port_connect) {
+      pyjack_gil_t gil;
+      pyjack_gil_ensure(client, &gil);
+      PyObject *result = NULL;
+      PyObject *arglist= NULL;
+      arglist= Py_BuildValue("(IIi)", (unsigned int)a, (unsigned int)b, connect);
+      PyObject *callback = client_callback(client, &client->callback_port_connect);
+      result = callback ? PyObject_CallObject(callback, arglist) : NULL;
+      Py_XDECREF(callback);
+      Py_DECREF(arglist);
+      if (result != NULL)
+          Py_DECREF(result);
+      pyjack_gil_release(&gil);
+    }
+}
+
+
+// ------------- Python module stuff ---------------------
+
+// Hand our callbacks to jack; returns 0, or -1 with an exception set
+static int attach_callbacks(pyjack_client_t * client)
+{
+    jack_on_shutdown(client->pjc, pyjack_shutdown, client);
+
+    if(jack_set_buffer_size_callback(client->pjc, pyjack_buffer_size_changed, client) != 0) {
+        PyErr_SetString(client->state->Error, "Failed to set jack buffer size callback.");
+        return -1;
+    }
+
+    if(jack_set_sample_rate_callback(client->pjc, pyjack_sample_rate_changed, client) != 0) {
+        PyErr_SetString(client->state->Error, "Failed to set jack sample rate callback.");
+        return -1;
+    }
+
+    if(jack_set_port_registration_callback(client->pjc, pyjack_port_registration, client) != 0) {
+        PyErr_SetString(client->state->Error, "Failed to set jack port registration callback.");
+        return -1;
+    }
+
+    if(jack_set_graph_order_callback(client->pjc, pyjack_graph_order, client) != 0) {
+        PyErr_SetString(client->state->Error, "Failed to set jack graph order callback.");
+        return -1;
+    }
+
+    if(jack_set_xrun_callback(client->pjc, pyjack_xrun, client) != 0) {
+        PyErr_SetString(client->state->Error, "Failed to set jack xrun callback.");
+        return -1;
+    }
+
+    if(jack_set_thread_init_callback(client->pjc, pyjack_thread_init, client) != 0) {
+        PyErr_SetString(client->state->Error, "Failed to set jack thread-init callback.");
+        return -1;
+    }
+
+    if(jack_set_client_registration_callback(client->pjc, pyjack_client_registration, client) != 0) {
+        PyErr_SetString(client->state->Error, "Failed to set jack client-registraion callback.");
+        return -1;
+    }
+    if(jack_set_freewheel_callback(client->pjc, pyjack_freewheel, client) != 0) {
+        PyErr_SetString(client->state->Error, "Failed to set jack freewheel callback.");
+        return -1;
+    }
+#ifdef WANT_LATENCY_CALLBACK
+    if(jack_set_latency_callback(client->pjc, pyjack_latency, client) != 0) {
+        PyErr_SetString(client->state->Error, "Failed to set jack latency callback.");
+        return -1;
+    }
+#endif /* WANT_LATENCY_CALLBACK */
+    if(jack_set_port_connect_callback(client->pjc, pyjack_port_connect, client) != 0) {
+        PyErr_SetString(client->state->Error, "Failed to set jack port-connect callback.");
+        return -1;
+    }
+    return 0;
+}
+
+// Attempt to connect to the Jack server
+static PyObject* attach(PyObject* self, PyObject* args)
+{
+    char* cname;
+    if (! PyArg_ParseTuple(args, "s", &cname))
+        return NULL;
+
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc != NULL) {
+        PyErr_SetString(client->state->UsageError, "A connection is already established.");
+        return NULL;
+    }
+
+    // the ports and RT structures of a client the server shut down still refer to its old
+    // handle; detach() closes it and frees them
+    if (__atomic_load_n(&client->zombie, __ATOMIC_ACQUIRE)) {
+        PyErr_SetString(client->state->UsageError, "The server shut the client down; call detach() before attaching again.");
+        return NULL;
+    }
+
+    jack_status_t status;
+    client->pjc = jack_client_open(cname, JackNoStartServer, &status);
+    if(client->pjc == NULL) {
+        //TODO check status
+        PyErr_SetString(client->state->NotConnectedError, "Failed to connect to Jack audio server.");
+        return NULL;
+    }
+
+    if (is_global_client(client))
+        __atomic_store_n(&hangup_client, client, __ATOMIC_RELEASE);
+    signal(SIGHUP, pyjack_hangup); // TODO: This just works with global clients
+
+    if (attach_callbacks(client) < 0)
+        return NULL;
+
+    // Get buffer size
+    client->buffer_size = jack_get_buffer_size(client->pjc);
+
+    // Success!
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// Detach client from the jack server (also destroys all connections)
+static PyObject* detach(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    if (__atomic_load_n(&client->input_waiting, __ATOMIC_ACQUIRE)) {
+        PyErr_SetString(client->state->UsageError, "process() is waiting for input in another thread.");
+        return NULL;
+    }
+    session_close(client);
+    reconnect_stop(client);
+
+    if(client->pjc != NULL) {
+        jack_client_close(client->pjc);
+        pyjack_final(client);
+    }
+    // a client the server shut down has kept its ports and buffers until now
+    if(client->zombie != NULL) {
+        jack_client_close(client->zombie);
+        client->zombie = NULL;
+        pyjack_final(client);
+    }
+    // a client that only replayed sessions never connected, but has its buffers too
+    if(client->replayed)
+        pyjack_final(client);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// Replace port by NULL in the taps; returns 1 if any of them used it
+static int taps_forget_port(pyjack_client_t * client, jack_port_t * port)
+{
+    int i, c, found = 0;
+    for (i = 0; i < PYJACK_MAX_TAPS; i++) {
+        if (!client->taps[i]) continue;
+        for (c = 0; c < client->taps[i]->channels; c++) {
+            if (client->taps[i]->ports[c] != port) continue;
+            __atomic_store_n(&client->taps[i]->ports[c], NULL, __ATOMIC_RELEASE);
+            found = 1;
+        }
+    }
+    return found;
+}
+
+// Find a port again after waiting for the RT thread: other threads may have called into the
+// client meanwhile (see PYJACK_LOCKED). Sets an error and returns -1 if it is gone.
+static int port_refind(pyjack_client_t * client, jack_port_t ** ports, int count, jack_port_t * port)
+{
+    int i;
+    for (i = 0; client->pjc && i < count; i++)
+        if (ports[i] == port) return i;
+    PyErr_SetString(client->state->UsageError, "The port was unregistered by another thread.");
+    return -1;
+}
+
+static PyObject* unregister_port(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    char* port_name;
+    if (! PyArg_ParseTuple(args, "s", &port_name))
+        return NULL;
+
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    if (client->measure) {
+        PyErr_SetString(client->state->UsageError, "A round-trip measurement is running.");
+        return NULL;
+    }
+
+//     if(client->active) {
+//         PyErr_SetString(client->state->UsageError, "Cannot unregister ports while client is active.");
+//         return NULL;
+//     }
+
+    int i = 0;
+    for (i=0;i<client->num_inputs;i++) {
+        if (strcmp(port_name, jack_port_short_name(client->input_ports[i]))) continue;
+        if (convolvers_use_port(client, client->input_ports[i])) {
+            PyErr_SetString(client->state->UsageError, "A convolver uses this port.");
+            return NULL;
+        }
+#ifdef HAVE_LADSPA
+        if (plugins_use_port(client, client->input_ports[i])) {
+            PyErr_SetString(client->state->UsageError, "A plugin uses this port.");
+            return NULL;
+        }
+#endif
+        // exported streams keep running, with silence in place of the port
+        int e, c;
+        for (e = 0; e < PYJACK_MAX_EXPORTS; e++) {
+            if (!client->exports[e]) continue;
+            for (c = 0; c < client->exports[e]->channels; c++) {
+                if (client->exports[e]->ports[c] == client->input_ports[i])
+                    __atomic_store_n(&client->exports[e]->ports[c], NULL, __ATOMIC_RELEASE);
+            }
+        }
+        if (client->analyzer) {
+            for (c = 0; c < client->analyzer->channels; c++) {
+                if (client->analyzer->ports[c] == client->input_ports[i])
+                    __atomic_store_n(&client->analyzer->ports[c], NULL, __ATOMIC_RELEASE);
+            }
+        }
+        if (client->history) {
+            for (c = 0; c < client->history->channels; c++) {
+                if (client->history->ports[c] == client->input_ports[i])
+                    __atomic_store_n(&client->history->ports[c], NULL, __ATOMIC_RELEASE);
+            }
+        }
+        taps_forget_port(client, client->input_ports[i]);
+        // once held, the RT thread is done with the port, in the streams as well
+        jack_port_t * port = client->input_ports[i];
+        ports_hold(client);
+        if ((i = port_refind(client, client->input_ports, client->num_inputs, port)) < 0) {
+            ports_release(client);
+            return NULL;
+        }
+        int error = jack_port_unregister(client->pjc, client->input_ports[i]);
+        if (error) {
+            ports_release(client);
+            PyErr_SetString(client->state->Error, "Unable to unregister input port.");
+            return NULL;
+        }
+        client->num_inputs--;
+        for (;i<client->num_inputs;i++) {
+            client->input_ports[i] = client->input_ports[i+1];
+        }
+        init_pipe_buffers(client);
+        ports_release(client);
+        reconnect_remember_ports(client);
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+
+    for (i=0;i<client->num_outputs;i++) {
+        if (strcmp(port_name, jack_port_short_name(client->output_ports[i]))) continue;
+        if (convolvers_use_port(client, client->output_ports[i])) {
+            PyErr_SetString(client->state->UsageError, "A convolver uses this port.");
+            return NULL;
+        }
+#ifdef HAVE_LADSPA
+        if (plugins_use_port(client, client->output_ports[i])) {
+            PyErr_SetString(client->state->UsageError, "A plugin uses this port.");
+            return NULL;
+        }
+#endif
+        // clips scheduled on the port are cancelled, and released by the RT thread before the port goes
+        int v, scheduled = 0;
+        for (v = 0; v < PYJACK_MAX_VOICES; v++) {
+            if (client->voices[v].port == client->output_ports[i] && voice_cancel(&client->voices[v]))
+                scheduled = 1;
+        }
+        jack_port_t * port = client->output_ports[i];
+        if (scheduled) voices_wait_cancelled(client);
+        taps_forget_port(client, port);
+        gains_unbind(client, port, -1);
+        ports_hold(client);
+        if ((i = port_refind(client, client->output_ports, client->num_outputs, port)) < 0) {
+            ports_release(client);
+            return NULL;
+        }
+        voices_reclaim(client, 0);
+        int error = jack_port_unregister(client->pjc, client->output_ports[i]);
+        if (error) {
+            ports_release(client);
+            PyErr_SetString(client->state->Error, "Unable to unregister output port.");
+            return NULL;
+        }
+        client->num_outputs--;
+        for (;i<client->num_outputs;i++) {
+            client->output_ports[i] = client->output_ports[i+1];
+        }
+        init_pipe_buffers(client);
+        ports_release(client);
+        reconnect_remember_ports(client);
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    PyErr_SetString(client->state->UsageError, "Port not found.");
+    return NULL;
+}
+
+
+// Create a new port for this client
+// Unregistration of ports is not supported; you must disconnect, reconnect, re-reg all ports instead.
+static PyObject* register_port(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+
+    int flags;
+    char* pname;
+    if (! PyArg_ParseTuple(args, "si", &pname, &flags))
+        return NULL;
+
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+//     if(client->active) {
+//         PyErr_SetString(client->state->UsageError, "Cannot register ports while client is active.");
+//         return NULL;
+//     }
+
+    if(client->num_inputs >= PYJACK_MAX_PORTS) {
+        PyErr_SetString(client->state->UsageError, "Cannot create more than 256 ports. Sorry.");
+        return NULL;
+    }
+
+    jack_port_t* jp = jack_port_register(client->pjc, pname, JACK_DEFAULT_AUDIO_TYPE, flags, 0);
+    if(jp == NULL) {
+        PyErr_SetString(client->state->Error, "Failed to create port.");
+        return NULL;
+    }
+
+    // other threads may have added ports while this one waited for the RT thread
+    ports_hold(client);
+    if(client->pjc == NULL) {
+        ports_release(client);
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+    if(client->num_inputs >= PYJACK_MAX_PORTS || client->num_outputs >= PYJACK_MAX_PORTS) {
+        ports_release(client);
+        jack_port_unregister(client->pjc, jp);
+        PyErr_SetString(client->state->UsageError, "Cannot create more than 256 ports. Sorry.");
+        return NULL;
+    }
+
+    // Store pointer to this port and increment counter
+    if(flags & JackPortIsInput) {
+        client->input_ports[client->num_inputs] = jp;
+        client->num_inputs++;
+    }
+    if(flags & JackPortIsOutput) {
+        client->output_ports[client->num_outputs] = jp;
+        client->num_outputs++;
+    }
+
+    init_pipe_buffers(client);
+    ports_release(client);
+    reconnect_remember_ports(client);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// Returns a list of all port names registered in the Jack system
+static PyObject* get_ports(PyObject* self, PyObject* args, PyObject*kwds)
+{
+    static char *kwlist[] = {"port_name_pattern", "type_name_pattern", "flags", NULL};
+    PyObject* plist;
+    const char** jplist;
+    unsigned int count, i;
+    char*portpattern=NULL;
+    char*typepattern=NULL;
+    unsigned long flags=0;
+
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "|ssk", kwlist,
+                                      &portpattern, &typepattern, &flags))
+      return NULL;
+
+    jplist = jack_get_ports(client->pjc, portpattern, typepattern, flags);
+
+    count = 0;
+    if(jplist != NULL) {
+      while(jplist[count] != NULL) count += 1;
+    }
+
+    plist = PyList_New(count);
+    if(jplist != NULL) {
+        i = 0;
+        while(jplist[i] != NULL) {
+            PyList_SET_ITEM(plist, i, Py_BuildValue("s", jplist[i])); // FIXXXME: this leaks memory
+            i++;
+        }
+    }
+    jack_free(jplist);
+    return plist;
+}
+
+// Return port flags (an integer)
+static PyObject* get_port_flags(PyObject* self, PyObject* args)
+{
+    char* pname;
+    jack_port_t* jp;
+    int i;
+
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    if (! PyArg_ParseTuple(args, "s", &pname))
+        return NULL;
+
+    jp = jack_port_by_name(client->pjc, pname);
+    if(jp == NULL) {
+        PyErr_SetString(client->state->Error, "Bad port name.");
+        return NULL;
+    }
+
+    i = jack_port_flags(jp);
+    if(i < 0) {
+        PyErr_SetString(client->state->Error, "Error getting port flags.");
+        return NULL;
+    }
+
+    return Py_BuildValue("i", i);
+}
+
+// Return a list of full port names connected to the named port
+// Port does not need to be owned by this client.
+static PyObject* get_connections(PyObject* self, PyObject* args)
+{
+    char* pname;
+    const char** jplist;
+    jack_port_t* jp;
+    PyObject* plist;
+    unsigned int count, i;
+
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    if (! PyArg_ParseTuple(args, "s", &pname))
+        return NULL;
+
+    jp = jack_port_by_name(client->pjc, pname);
+    if(jp == NULL) {
+        PyErr_SetString(client->state->Error, "Bad port name.");
+        return NULL;
+    }
+
+    jplist = jack_port_get_all_connections(client->pjc, jp);
+    count = 0;
+    if(jplist != NULL) {
+      while(jplist[count] != NULL) count += 1;
+    }
+
+    plist = PyList_New(count);
+    if(jplist != NULL) {
+        i = 0;
+        while(jplist[i] != NULL) {
+            PyList_SET_ITEM(plist, i, Py_BuildValue("s", jplist[i]));
+            i++;
+        }
+    }
+    jack_free(jplist);
+    return plist;
+}
+
+// connect_port
+static PyObject* port_connect(PyObject* self, PyObject* args)
+{
+    char* src_name;
+    char* dst_name;
+
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    if (! PyArg_ParseTuple(args, "ss", &src_name, &dst_name))
+        return NULL;
+
+    jack_port_t * src = jack_port_by_name(client->pjc, src_name);
+    if (!src) {
+        PyErr_SetString(client->state->UsageError, "Non existing source port.");
+        return NULL;
+        }
+    jack_port_t * dst = jack_port_by_name(client->pjc, dst_name);
+    if (!dst) {
+        PyErr_SetString(client->state->UsageError, "Non existing destination port.");
+        return NULL;
+        }
+    if(! client->active) {
+        if(jack_port_is_mine(client->pjc, src) || jack_port_is_mine(client->pjc, dst)) {
+            PyErr_SetString(client->state->UsageError, "Jack client must be activated to connect own ports.");
+            return NULL;
+        }
+    }
+    int error = jack_connect(client->pjc, src_name, dst_name);
+    if (error !=0 && error != EEXIST) {
+        PyErr_SetString(client->state->Error, "Failed to connect ports.");
+        return NULL;
+    }
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static int jack_port_connected_to_extern(const pyjack_client_t * client, 
+                                         const jack_port_t * src, 
+                                         const char* dst_name)
+{
+    // finds connections of src, then checks if dst is in there
+    const char ** existing_connections = jack_port_get_all_connections(client->pjc, src);
+    if (existing_connections) {
+        int i; // non C99 nonsense
+        for (i = 0; existing_connections[i]; i++) {
+            if (strcmp(existing_connections[i], dst_name) == 0) {
+                jack_free(existing_connections);
+                return 1;
+            }
+        }
+    }
+    jack_free(existing_connections);
+    return 0;
+}
+
+// disconnect_port
+static PyObject* port_disconnect(PyObject* self, PyObject* args)
+{
+    char* src_name;
+    char* dst_name;
+    pyjack_client_t * client = self_or_global_client(self);
+
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    if (! PyArg_ParseTuple(args, "ss", &src_name, &dst_name))
+        return NULL;
+
+    jack_port_t * src = jack_port_by_name(client->pjc, src_name);
+    if (!src) {
+        PyErr_SetString(client->state->UsageError, "Non existing source port.");
+        return NULL;
+    }
+
+    jack_port_t * dst = jack_port_by_name(client->pjc, dst_name);
+    if (!dst) {
+        PyErr_SetString(client->state->UsageError, "Non existing destination port.");
+        return NULL;
+    }
+
+    if(jack_port_connected_to_extern(client, src, dst_name)) {
+        if (jack_disconnect(client->pjc, src_name, dst_name)) {
+            PyErr_SetString(client->state->Error, "Failed to disconnect ports.");
+            return NULL;
+        }
+    }
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// get_buffer_size
+static PyObject* get_buffer_size(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    if (client->replay)
+        return Py_BuildValue("i", client->buffer_size);
+
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    int bs = jack_get_buffer_size(client->pjc);
+    return Py_BuildValue("i", bs);
+}
+
+// get_sample_rate
+static PyObject* get_sample_rate(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    if (client->replay)
+        return Py_BuildValue("i", client->replay_sample_rate);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    int sr = jack_get_sample_rate(client->pjc);
+    return Py_BuildValue("i", sr);
+}
+
+// Hand the process callback to jack if needed, and activate the client;
+// returns 0, or -1 with an exception set
+static int activate_jack(pyjack_client_t * client)
+{
+    // the process callback (or thread) is handed to jack on the first activation,
+    // so that set_process_thread() can still choose between them
+    if(client->doProcessing && !client->process_registered) {
+        int error = client->process_thread
+            ? jack_set_process_thread(client->pjc, pyjack_process_thread, client)
+            : jack_set_process_callback(client->pjc, pyjack_process, client);
+        if (error) {
+            PyErr_SetString(client->state->Error, "Failed to set jack process callback.");
+            return -1;
+        }
+        client->process_registered = 1;
+    }
+
+    // jack may call back into us (e.g. the buffer size callback) before this returns
+    int error;
+    Py_BEGIN_ALLOW_THREADS
+    error = jack_activate(client->pjc);
+    Py_END_ALLOW_THREADS
+    if(error != 0) {
+        PyErr_SetString(client->state->UsageError, "Could not activate client.");
+        return -1;
+    }
+    return 0;
+}
+
+// activate
+static PyObject* activate(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    if(client->active) {
+        PyErr_SetString(client->state->UsageError, "Client is already active.");
+        return NULL;
+    }
+
+    if (activate_jack(client) < 0)
+        return NULL;
+
+    client->active = 1;
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// deactivate
+static PyObject* deactivate(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    if(! client->active) {
+        PyErr_SetString(client->state->UsageError, "Client is not active.");
+        return NULL;
+    }
+
+    int error;
+    Py_BEGIN_ALLOW_THREADS
+    error = jack_deactivate(client->pjc);
+    Py_END_ALLOW_THREADS
+    if(error != 0) {
+        PyErr_SetString(client->state->Error, "Could not deactivate client.");
+        return NULL;
+    }
+
+    client->active = 0;
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject * get_client_name(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+    return Py_BuildValue("s", jack_get_client_name(client->pjc));
+}
+
+// Port of the restored client taking the place of port (one of ours), or NULL
+static jack_port_t * port_remap(pyjack_client_t * client, jack_port_t ** inputs, jack_port_t ** outputs, jack_port_t * port)
+{
+    int i;
+    if (!port) return NULL;
+    for (i = 0; i < client->num_inputs; i++)
+        if (client->input_ports[i] == port) return inputs[i];
+    for (i = 0; i < client->num_outputs; i++)
+        if (client->output_ports[i] == port) return outputs[i];
+    return NULL;
+}
+
+// Point everything the RT thread reads at the ports of the restored client
+// (the RT thread is not running: the new client is not active yet)
+static void ports_remap(pyjack_client_t * client, jack_port_t ** inputs, jack_port_t ** outputs)
+{
+    int i, c;
+#define REMAP(port) (port) = port_remap(client, inputs, outputs, (port))
+    for (i = 0; i < PYJACK_MAX_EXPORTS; i++)
+        for (c = 0; client->exports[i] && c < client->exports[i]->channels; c++)
+            REMAP(client->exports[i]->ports[c]);
+    for (c = 0; client->analyzer && c < client->analyzer->channels; c++)
+        REMAP(client->analyzer->ports[c]);
+    for (c = 0; client->history && c < client->history->channels; c++)
+        REMAP(client->history->ports[c]);
+    for (i = 0; i < PYJACK_MAX_TAPS; i++)
+        for (c = 0; client->taps[i] && c < client->taps[i]->channels; c++)
+            REMAP(client->taps[i]->ports[c]);
+    for (i = 0; i < PYJACK_MAX_VOICES; i++)
+        REMAP(client->voices[i].port);
+    for (i = 0; i < PYJACK_MAX_GAINS; i++)
+        REMAP(client->gains[i].port);
+    if (client->measure) {
+        REMAP(client->measure->in_port);
+        REMAP(client->measure->out_port);
+    }
+    for (i = 0; i < PYJACK_MAX_CONVOLVERS; i++) {
+        if (!client->convolvers[i]) continue;
+        REMAP(client->convolvers[i]->in_port);
+        REMAP(client->convolvers[i]->out_port);
+    }
+#ifdef HAVE_LADSPA
+    for (i = 0; client->chain && i < client->chain->count; i++) {
+        for (c = 0; c < client->chain->plugins[i]->inputs; c++)
+            REMAP(client->chain->plugins[i]->input_ports[c]);
+        for (c = 0; c < client->chain->plugins[i]->outputs; c++)
+            REMAP(client->chain->plugins[i]->output_ports[c]);
+    }
+#endif
+#undef REMAP
+    memcpy(client->input_ports, inputs, client->num_inputs * sizeof(jack_port_t*));
+    memcpy(client->output_ports, outputs, client->num_outputs * sizeof(jack_port_t*));
+}
+
+// Restore the client on a new connection to the server, in one go: callbacks, ports,
+// activation and connections. Returns 0, or -1 (pjc closed) if the server refused any of it.
+// Connections the server refuses (e.g. to ports of clients that are not back yet) are skipped.
+static int reconnect_restore(pyjack_client_t * client, jack_client_t * pjc)
+{
+    pyjack_reconnect_t * rc = client->reconnect;
+    jack_port_t * inputs[PYJACK_MAX_PORTS];
+    jack_port_t * outputs[PYJACK_MAX_PORTS];
+    char (*connections)[2][PYJACK_PORT_NAME_SIZE] = NULL;
+    jack_client_t * zombie;
+    jack_nframes_t n;
+    int i, count;
+
+    client->pjc = pjc;
+    // the server may have come back with another buffer size or sample rate
+    // (the handlers resize what the client already has with the new handle)
+    n = jack_get_buffer_size(pjc);
+    if ((int)n != client->buffer_size)
+        pyjack_buffer_size_changed(n, client);
+    n = jack_get_sample_rate(pjc);
+    if (client->resampling_rate && (int)n != client->resampling_rate)
+        pyjack_sample_rate_changed(n, client);
+    if (attach_callbacks(client) < 0)
+        goto fail;
+    for (i = 0; i < client->num_inputs; i++) {
+        inputs[i] = jack_port_register(pjc, rc->input_names[i], JACK_DEFAULT_AUDIO_TYPE, rc->input_flags[i], 0);
+        if (!inputs[i]) goto fail;
+    }
+    for (i = 0; i < client->num_outputs; i++) {
+        outputs[i] = jack_port_register(pjc, rc->output_names[i], JACK_DEFAULT_AUDIO_TYPE, rc->output_flags[i], 0);
+        if (!outputs[i]) goto fail;
+    }
+    ports_remap(client, inputs, outputs);
+
+    client->process_registered = 0;
+    if (client->active && activate_jack(client) < 0)
+        goto fail;
+
+    // the port connect notifications of the restored connections update the list meanwhile
+    pthread_mutex_lock(&rc->lock);
+    count = rc->num_connections;
+    if (count) connections = malloc(count * sizeof(connections[0]));
+    if (connections) memcpy(connections, rc->connections, count * sizeof(connections[0]));
+    pthread_mutex_unlock(&rc->lock);
+    zombie = __atomic_exchange_n(&client->zombie, NULL, __ATOMIC_ACQ_REL);
+    Py_BEGIN_ALLOW_THREADS
+    for (i = 0; connections && i < count; i++)
+        jack_connect(pjc, connections[i][0], connections[i][1]);
+    if (zombie)
+        jack_client_close(zombie);
+    Py_END_ALLOW_THREADS
+    free(connections);
+    return 0;
+
+fail:
+    PyErr_Clear();
+    client->pjc = NULL;
+    Py_BEGIN_ALLOW_THREADS
+    jack_client_close(pjc);
+    Py_END_ALLOW_THREADS
+    return -1;
+}
+
+// Try to restore the client once, if the server is back
+static void reconnect_attempt(pyjack_client_t * client)
+{
+    pyjack_reconnect_t * rc = client->reconnect;
+    jack_client_t * pjc;
+    jack_status_t status;
+    jack_time_t down, up;
+    pyjack_gil_t gil;
+    int restored = -1;
+
+    rc->attempts++;
+    pjc = jack_client_open(rc->name, JackNoStartServer | JackUseExactName, &status);
+    if (!pjc) return;
+
+    pyjack_gil_ensure(client, &gil);
+    Py_BEGIN_CRITICAL_SECTION(client_object(client));
+    // detach() or attach() may have been called meanwhile
+    if (client->pjc == NULL && __atomic_load_n(&rc->running, __ATOMIC_ACQUIRE)) {
+        restored = reconnect_restore(client, pjc);
+    } else {
+        Py_BEGIN_ALLOW_THREADS
+        jack_client_close(pjc);
+        Py_END_ALLOW_THREADS
+    }
+    Py_END_CRITICAL_SECTION();
+
+    if (restored == 0) {
+        down = __atomic_exchange_n(&rc->down_usecs, 0, __ATOMIC_ACQ_REL);
+        up = jack_get_time();
+        rc->last_downtime = up - down;
+        rc->reconnects++;
+        __atomic_add_fetch(&client->event_reconnect, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_or(&client->session_events, PYJACK_EVENT_RECONNECT, __ATOMIC_RELAXED);
+        if (client->trace)
+            trace_event(client, PYJACK_TRACE_RECONNECT, 'X', PYJACK_THREAD_NOTIFY, down, (uint32_t)(up - down));
+
+        PyObject *callback = client_callback(client, &client->callback_reconnect);
+        if (callback) {
+            PyObject *result = PyObject_CallFunction(callback, "d", rc->last_downtime / 1e6);
+            if (result != NULL)
+                Py_DECREF(result);
+            else
+                PyErr_Print();
+            Py_DECREF(callback);
+        }
+    }
+    pyjack_gil_release(&gil);
+}
+
+// Worker polling for the server while it is down
+static void * reconnect_thread(void * arg)
+{
+    pyjack_client_t * client = (pyjack_client_t*) arg;
+    pyjack_reconnect_t * rc = client->reconnect;
+    struct timespec ts;
+    double interval;
+
+    while (__atomic_load_n(&rc->running, __ATOMIC_ACQUIRE)) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        interval = ts.tv_nsec / 1e9 + rc->interval;
+        ts.tv_sec += (time_t)interval;
+        ts.tv_nsec = (long)((interval - floor(interval)) * 1e9);
+        sem_timedwait(&rc->wakeup, &ts);
+        if (!__atomic_load_n(&rc->running, __ATOMIC_ACQUIRE)) break;
+        if (__atomic_load_n(&rc->down_usecs, __ATOMIC_ACQUIRE) && !__atomic_load_n(&client->pjc, __ATOMIC_ACQUIRE))
+            reconnect_attempt(client);
+    }
+    return NULL;
+}
+
+// Turn auto-reconnect on or off
+static PyObject* set_auto_reconnect(PyObject* self, PyObject* args, PyObject* kwds)
+{
+    static char *kwlist[] = {"enable", "interval", NULL};
+    pyjack_client_t * client = self_or_global_client(self);
+    pyjack_reconnect_t * rc;
+    int enable;
+    double interval = 0.25;
+
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "i|d", kwlist, &enable, &interval))
+        return NULL;
+    if (!enable) {
+        reconnect_stop(client);
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    if (!(interval > 0.0 && interval <= 60.0)) {
+        PyErr_SetString(PyExc_ValueError, "interval must be in (0, 60] seconds");
+        return NULL;
+    }
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    rc = client->reconnect;
+    if (!rc) {
+        rc = calloc(1, sizeof(*rc));
+        if (!rc)
+            return PyErr_NoMemory();
+        pthread_mutex_init(&rc->lock, NULL);
+        sem_init(&rc->wakeup, 0, 0);
+        client->reconnect = rc;
+    }
+    rc->interval = interval;
+    snprintf(rc->name, sizeof(rc->name), "%s", jack_get_client_name(client->pjc));
+    reconnect_remember_ports(client);
+    reconnect_remember_connections(client);
+    if (!rc->running) {
+        rc->running = 1;
+        if (pthread_create(&rc->thread, NULL, reconnect_thread, client)) {
+            rc->running = 0;
+            PyErr_SetString(client->state->Error, "Failed to start the reconnect thread.");
+            return NULL;
+        }
+    }
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// State of auto-reconnect, as a dict
+static PyObject* get_reconnect_stats(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    pyjack_reconnect_t * rc = client->reconnect;
+    jack_time_t down;
+    int connections = 0;
+
+    if (!rc)
+        return Py_BuildValue("{s:i,s:d,s:k,s:k,s:d,s:i}", "enabled", 0, "down", 0.0, "reconnects", 0UL,
+                             "attempts", 0UL, "last_downtime", 0.0, "connections", 0);
+    pthread_mutex_lock(&rc->lock);
+    connections = rc->num_connections;
+    pthread_mutex_unlock(&rc->lock);
+    down = __atomic_load_n(&rc->down_usecs, __ATOMIC_ACQUIRE);
+    return Py_BuildValue("{s:i,s:d,s:k,s:k,s:d,s:i}",
+                         "enabled", __atomic_load_n(&rc->running, __ATOMIC_ACQUIRE),
+                         "down", down ? (jack_get_time() - down) / 1e6 : 0.0,
+                         "reconnects", rc->reconnects,
+                         "attempts", rc->attempts,
+                         "last_downtime", rc->last_downtime / 1e6,
+                         "connections", connections);
+}
+
+/** Commit a chunk of audio for the outgoing stream, if any.
+  * Return the next chunk of audio from the incoming stream, if any
+  */
+// A (channels, frames) block of samples in any object exporting the buffer protocol
+typedef struct {
+    Py_buffer      view;
+    int            is_double;                       // format 'd' rather than 'f'
+    Py_ssize_t     rows;                            // channels
+    Py_ssize_t     cols;                            // frames
+    Py_ssize_t     row_stride;                      // bytes between channels
+    Py_ssize_t     col_stride;                      // bytes between frames
+} pyjack_block_t;
+
+// Get a float or double block with the given number of rows and columns from obj.
+// Two dimensional buffers may have any strides; flat ones hold the channels one after the other.
+// With rows < 0, any two dimensional shape is accepted, and a flat buffer is a single row.
+static int block_get(PyObject * obj, pyjack_block_t * b, int writable, Py_ssize_t rows, Py_ssize_t cols, const char * what)
+{
+    const char * format;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    const char native = '<';
+#else
+    const char native = '>';
+#endif
+
+    if (PyObject_GetBuffer(obj, &b->view, PyBUF_STRIDES | PyBUF_FORMAT | (writable ? PyBUF_WRITABLE : 0)) < 0)
+        return -1;
+
+    format = b->view.format ? b->view.format : "B";
+    if (*format == '@' || *format == '=' || *format == native) format++;
+    if (!strcmp(format, "f") && b->view.itemsize == sizeof(float)) {
+        b->is_double = 0;
+    } else if (!strcmp(format, "d") && b->view.itemsize == sizeof(double)) {
+        b->is_double = 1;
+    } else {
+        PyErr_SetString(PyExc_ValueError, "arrays must be of type float");
+        goto fail;
+    }
+
+    if (b->view.ndim == 2) {
+        b->rows = b->view.shape[0];
+        b->cols = b->view.shape[1];
+        b->row_stride = b->view.strides[0];
+        b->col_stride = b->view.strides[1];
+    } else if (b->view.ndim == 1 && rows < 0) {
+        b->rows = 1;
+        b->cols = b->view.shape[0];
+        b->col_stride = b->view.strides[0];
+        b->row_stride = b->cols * b->col_stride;
+    } else if (b->view.ndim == 1 && rows > 0 && b->view.shape[0] == rows * cols) {
+        b->rows = rows;
+        b->cols = cols;
+        b->col_stride = b->view.strides[0];
+        b->row_stride = cols * b->col_stride;
+    } else {
+        PyErr_SetString(PyExc_ValueError, "arrays must be two dimensional (or flat, with one channel after the other)");
+        goto fail;
+    }
+    if (rows > 0 && b->cols != cols) {
+        PyErr_SetString(PyExc_ValueError, "columns of arrays must match buffer size.");
+        goto fail;
+    }
+    if (rows > 0 && b->rows != rows) {
+        PyErr_Format(PyExc_ValueError, "rows for %s array must match number of %s ports", what, what);
+        goto fail;
+    }
+    return 0;
+
+fail:
+    PyBuffer_Release(&b->view);
+    return -1;
+}
+
+// Copy channel row of the block into n floats
+static void block_read_row(const pyjack_block_t * b, Py_ssize_t row, float * dst, int n)
+{
+    const char * src = (const char*)b->view.buf + row * b->row_stride;
+    int j;
+    if (!b->is_double && b->col_stride == sizeof(float)) {
+        memcpy(dst, src, n * sizeof(float));
+    } else if (!b->is_double) {
+        for (j = 0; j < n; j++, src += b->col_stride)
+            memcpy(dst + j, src, sizeof(float));
+    } else {
+        for (j = 0; j < n; j++, src += b->col_stride) {
+            double v;
+            memcpy(&v, src, sizeof(double));
+            dst[j] = v;
+        }
+    }
+}
+
+// Copy n floats (or zeros, if src is NULL) into channel row of the block
+static void block_write_row(pyjack_block_t * b, Py_ssize_t row, const float * src, int n)
+{
+    char * dst = (char*)b->view.buf + row * b->row_stride;
+    int j;
+    if (!b->is_double && b->col_stride == sizeof(float)) {
+        if (src) memcpy(dst, src, n * sizeof(float));
+        else memset(dst, 0, n * sizeof(float));
+    } else if (!b->is_double) {
+        for (j = 0; j < n; j++, dst += b->col_stride) {
+            float v = src ? src[j] : 0.f;
+            memcpy(dst, &v, sizeof(float));
+        }
+    } else {
+        for (j = 0; j < n; j++, dst += b->col_stride) {
+            double v = src ? src[j] : 0.0;
+            memcpy(dst, &v, sizeof(double));
+        }
+    }
+}
+
+// Append what the current process() call returned to the captured session;
+// a failed write (e.g. a full disk) ends the capture
+static void session_write(pyjack_client_t * client, PyObject * result, int input_frames, int output_frames)
+{
+    pyjack_session_record_t rec;
+    size_t size;
+    memset(&rec, 0, sizeof(rec));
+    if (client->input_buffer_size)
+        rec.block = client->input_header_1;
+    else if (client->pjc)
+        rec.block.frame_time = jack_frame_time(client->pjc);
+    rec.events = __atomic_exchange_n(&client->session_events, 0, __ATOMIC_RELAXED);
+    if (!result && PyErr_ExceptionMatches(client->state->InputSyncError))
+        rec.status |= PYJACK_SESSION_INPUT_SYNC;
+    if (!result && PyErr_ExceptionMatches(client->state->OutputSyncError))
+        rec.status |= PYJACK_SESSION_OUTPUT_SYNC;
+    rec.buffer_size = client->buffer_size;
+    rec.input_frames = input_frames;
+    rec.output_frames = output_frames;
+    size = (size_t)rec.block.active_count * rec.block.nframes;
+    if (fwrite(&rec, sizeof(rec), 1, client->capture) != 1
+        || fwrite(client->input_buffer_1, sizeof(float), size, client->capture) != size) {
+        client->capture_error = errno ? errno : EIO;
+        session_close(client);
+        return;
+    }
+    client->session_records++;
+}
+
+// Raise the error that ended the capture of a session, once
+static int session_error(pyjack_client_t * client)
+{
+    if (!client->capture_error)
+        return 0;
+    PyErr_Format(PyExc_IOError, "Capturing the session failed: %s", strerror(client->capture_error));
+    client->capture_error = 0;
+    return -1;
+}
+
+// process() served from a session file: returns the next recorded input, as fast as it is asked for
+static PyObject* replay_process(pyjack_client_t * client, PyObject *args)
+{
+    pyjack_session_record_t * rec = &client->replay_record;
+    PyObject *input_obj;
+    PyObject *output_obj;
+    pyjack_block_t input_block;
+    pyjack_block_t output_block;
+    size_t size;
+    int c, active = 0;
+
+    if (! PyArg_ParseTuple(args, "OO", &output_obj, &input_obj))
+        return NULL;
+
+    // read ahead, so that the arrays can be checked against the recorded sizes
+    if (!client->replay_pending) {
+        if (fread(rec, sizeof(*rec), 1, client->replay) != 1) {
+            PyErr_SetString(PyExc_EOFError, "End of the replayed session.");
+            return NULL;
+        }
+        if (rec->block.active_count > (uint32_t)client->num_inputs || rec->block.nframes > (1u << 24)) {
+            PyErr_SetString(PyExc_ValueError, "Corrupt session record.");
+            return NULL;
+        }
+        size = (size_t)rec->block.active_count * rec->block.nframes * sizeof(float);
+        if (client->input_buffer_1_size < (int)size) {
+            float * buffer = realloc(client->input_buffer_1, size);
+            if (!buffer) return PyErr_NoMemory();
+            client->input_buffer_1 = buffer;
+            client->input_buffer_1_size = size;
+        }
+        if (fread(client->input_buffer_1, 1, size, client->replay) != size) {
+            PyErr_SetString(PyExc_EOFError, "End of the replayed session.");
+            return NULL;
+        }
+        client->buffer_size = rec->buffer_size;
+        client->input_frames = rec->input_frames;
+        client->output_frames = rec->output_frames;
+        client->replay_pending = 1;
+    }
+
+    if (block_get(output_obj, &output_block, 0, client->num_outputs, client->output_frames, "output") < 0)
+        return NULL;
+    if (block_get(input_obj, &input_block, 1, client->num_inputs, client->input_frames, "input") < 0) {
+        PyBuffer_Release(&output_block.view);
+        return NULL;
+    }
+    client->replay_pending = 0;
+    client->session_records++;
+
+    // the notifications the live client saw before this call
+    if (rec->events & PYJACK_EVENT_GRAPH_ORDER) client->event_graph_ordering = 1;
+    if (rec->events & PYJACK_EVENT_PORT_REGISTRATION) client->event_port_registration = 1;
+    if (rec->events & PYJACK_EVENT_BUFFER_SIZE) client->event_buffer_size = rec->buffer_size;
+    if (rec->events & PYJACK_EVENT_SAMPLE_RATE) client->event_sample_rate = 1;
+    if (rec->events & PYJACK_EVENT_XRUN) client->event_xrun = 1;
+    if (rec->events & PYJACK_EVENT_SHUTDOWN) client->event_shutdown = 1;
+    if (rec->events & PYJACK_EVENT_HANGUP) client->event_hangup = 1;
+    if (rec->events & PYJACK_EVENT_RECONNECT) client->event_reconnect = 1;
+
+    client->input_header_1 = rec->block;
+    for(c = 0; c < client->num_inputs; c++) {
+        if (rec->block.nframes == (uint32_t)client->input_frames && ((rec->block.active[c >> 5] >> (c & 31)) & 1))
+            block_write_row(&input_block, c, client->input_buffer_1 + (active++ * client->input_frames), client->input_frames);
+        else
+            block_write_row(&input_block, c, NULL, client->input_frames);
+    }
+    PyBuffer_Release(&input_block.view);
+    PyBuffer_Release(&output_block.view);
+
+    if (rec->status & PYJACK_SESSION_INPUT_SYNC) {
+        PyErr_SetString(client->state->InputSyncError, "Input data stream is not synchronized.");
+        return NULL;
+    }
+    if (rec->status & PYJACK_SESSION_OUTPUT_SYNC) {
+        PyErr_SetString(client->state->OutputSyncError, "Failed to write output data.");
+        return NULL;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject* process(PyObject* self, PyObject *args)
+{
+    int c, r;
+    PyObject *input_obj;
+    PyObject *output_obj;
+    pyjack_block_t input_block;
+    pyjack_block_t output_block;
+    PyObject *result = NULL;
+    int called = 0;
+
+    pyjack_client_t * client = self_or_global_client(self);
+    if (client->replay)
+        return replay_process(client, args);
+    if (session_error(client) < 0)
+        return NULL;
+    if(! client->active) {
+        PyErr_SetString(client->state->UsageError, "Client is not active.");
+        return NULL;
+    }
+    if (client->resampling_failed) {
+        PyErr_Format(client->state->Error, "The resampling ratios are not supported at the new JACK rate of %d Hz; "
+                     "deactivate and call set_resampling() again.", client->resampling_failed);
+        return NULL;
+    }
+    // input_buffer_1 must stay put while a call waits for input
+    if (__atomic_load_n(&client->input_waiting, __ATOMIC_ACQUIRE)) {
+        PyErr_SetString(client->state->UsageError, "process() is already waiting for input in another thread.");
+        return NULL;
+    }
+
+    // Any objects supporting the buffer protocol with float or double items will do
+    if (! PyArg_ParseTuple(args, "OO", &output_obj, &input_obj))
+        return NULL;
+    if (block_get(output_obj, &output_block, 0, client->num_outputs, client->output_frames, "output") < 0)
+        return NULL;
+    if (block_get(input_obj, &input_block, 1, client->num_inputs, client->input_frames, "input") < 0) {
+        PyBuffer_Release(&output_block.view);
+        return NULL;
+    }
+
+    TRACE(client, PYJACK_TRACE_PROCESS, 'B', PYJACK_THREAD_PYTHON, 0);
+
+    // The python-side buffers only ever grow, and only here
+    if (client->input_buffer_1_size < client->input_buffer_size) {
+        float * buffer = realloc(client->input_buffer_1, client->input_buffer_size);
+        if (!buffer) {
+            PyErr_NoMemory();
+            goto done;
+        }
+        client->input_buffer_1 = buffer;
+        client->input_buffer_1_size = client->input_buffer_size;
+    }
+    if (client->output_buffer_1_size < client->output_buffer_size) {
+        float * buffer = realloc(client->output_buffer_1, client->output_buffer_size);
+        if (!buffer) {
+            PyErr_NoMemory();
+            goto done;
+        }
+        client->output_buffer_1 = buffer;
+        client->output_buffer_1_size = client->output_buffer_size;
+    }
+    called = 1;
+
+    // Get input data
+    // If we are out of sync, there might be bad data in the buffer
+    // So we have to throw that away first...
+    if (client->input_buffer_size) {
+        pyjack_block_header_t * hdr = &client->input_header_1;
+        jack_time_t waited = 0, woken = 0;
+        struct iovec iov[2];
+        struct msghdr msg;
+        iov[0].iov_base = hdr;
+        iov[0].iov_len = sizeof(*hdr);
+        iov[1].iov_base = client->input_buffer_1;
+        iov[1].iov_len = client->input_buffer_1_size;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+        // let other python threads run while we wait for the RT thread;
+        // blocks sent before a buffer size change are skipped
+        __atomic_store_n(&client->input_waiting, 1, __ATOMIC_RELEASE);
+        Py_BEGIN_ALLOW_THREADS
+        if (client->trace) waited = jack_get_time();
+        do {
+            r = recvmsg(client->input_pipe[R], &msg, 0);
+        } while (r >= (int)sizeof(*hdr) && hdr->nframes != (uint32_t)input_block.cols
+                 && hdr->nframes != (uint32_t)__atomic_load_n(&client->input_frames, __ATOMIC_RELAXED));
+        if (client->trace) woken = jack_get_time();
+        Py_END_ALLOW_THREADS
+        __atomic_store_n(&client->input_waiting, 0, __ATOMIC_RELEASE);
+        if (waited && woken && client->trace) {
+            trace_event(client, PYJACK_TRACE_INPUT_WAIT, 'X', PYJACK_THREAD_PYTHON, waited, woken - waited);
+            trace_event(client, PYJACK_TRACE_GIL_WAIT, 'X', PYJACK_THREAD_PYTHON, woken, jack_get_time() - woken);
+        }
+
+        // a block that does not match the arrays (the buffer size changed while we waited),
+        // or the current layout, is treated as empty
+        if (r < (int)sizeof(*hdr) || hdr->nframes != (uint32_t)input_block.cols ||
+            hdr->channels != (uint32_t)client->num_inputs ||
+            r != (int)(sizeof(*hdr) + hdr->active_count * hdr->nframes * sizeof(float))) {
+            memset(hdr, 0, sizeof(*hdr));
+            __atomic_store_n(&client->iosync, 0, __ATOMIC_RELAXED);
+        }
+
+        // Copy data into array, zero-filling silent channels...
+        int active = 0;
+        for(c = 0; c < client->num_inputs; c++) {
+            if ((hdr->active[c >> 5] >> (c & 31)) & 1)
+                block_write_row(&input_block, c, client->input_buffer_1 + (active++ * input_block.cols), input_block.cols);
+            else
+                block_write_row(&input_block, c, NULL, input_block.cols);
+        }
+
+        if(!__atomic_load_n(&client->iosync, __ATOMIC_RELAXED)) {
+            TRACE(client, PYJACK_TRACE_INPUT_SYNC, 'i', PYJACK_THREAD_PYTHON, 0);
+            PyErr_SetString(client->state->InputSyncError, "Input data stream is not synchronized.");
+            goto done;
+        }
+    }
+
+    if (client->output_buffer_size && output_block.cols != client->output_frames) {
+        // the buffer size changed while we waited for input
+        TRACE(client, PYJACK_TRACE_OUTPUT_SYNC, 'i', PYJACK_THREAD_PYTHON, 0);
+        PyErr_SetString(client->state->OutputSyncError, "Buffer size changed; output data was dropped.");
+        goto done;
+    }
+    if (client->output_buffer_size) {
+        // Copy output data into output buffer...
+        for(c = 0; c < client->num_outputs; c++)
+            block_read_row(&output_block, c, client->output_buffer_1 + (c * client->output_frames), client->output_frames);
+
+        // Send... raise an exception if the output data stream is full.
+        r = write(client->output_pipe[W], client->output_buffer_1, client->output_buffer_size);
+
+        if(r != client->output_buffer_size) {
+            TRACE(client, PYJACK_TRACE_OUTPUT_SYNC, 'i', PYJACK_THREAD_PYTHON, 0);
+            PyErr_SetString(client->state->OutputSyncError, "Failed to write output data.");
+            goto done;
+        }
+        __atomic_add_fetch(&client->output_written, 1, __ATOMIC_ACQ_REL);
+    }
+
+    // Okay...    
+    Py_INCREF(Py_None);
+    result = Py_None;
+
+done:
+    if (called && client->capture)
+        session_write(client, result, input_block.cols, output_block.cols);
+    TRACE(client, PYJACK_TRACE_PROCESS, 'E', PYJACK_THREAD_PYTHON, 0);
+    PyBuffer_Release(&input_block.view);
+    PyBuffer_Release(&output_block.view);
+    return result;
+}
+
+// Return event status numbers...
+static PyObject* check_events(PyObject* self, PyObject *args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+
+    PyObject* d;
+    d = PyDict_New();
+    if(d == NULL) return NULL;
+
+    // read and reset each flag at once, the notification threads may set them meanwhile
+#define TAKE_EVENT(x) Py_BuildValue("i", __atomic_exchange_n(&client->event_##x, 0, __ATOMIC_RELAXED))
+    PyDict_SetItemString(d, "graph_ordering", TAKE_EVENT(graph_ordering));
+    PyDict_SetItemString(d, "port_registration", TAKE_EVENT(port_registration));
+    PyDict_SetItemString(d, "xrun", TAKE_EVENT(xrun));
+    PyDict_SetItemString(d, "shutdown", TAKE_EVENT(shutdown));
+    PyDict_SetItemString(d, "hangup", TAKE_EVENT(hangup));
+    PyDict_SetItemString(d, "reconnect", TAKE_EVENT(reconnect));
+    PyDict_SetItemString(d, "buffer_size", TAKE_EVENT(buffer_size));
+#undef TAKE_EVENT
+
+    return d;
+}
+
+static PyObject* get_frame_time(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    if (client->replay)
+        return Py_BuildValue("I", client->input_header_1.frame_time);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    jack_nframes_t frt = jack_frame_time(client->pjc);
+    return Py_BuildValue("I", frt);
+}
+
+static PyObject* get_current_transport_frame(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    jack_nframes_t ftr = jack_get_current_transport_frame(client->pjc);
+    return Py_BuildValue("I", ftr);
+}
+
+// Consistent copy of the timing of the last cycle; asks jack if no cycle has run yet
+static int get_cycle_snapshot(pyjack_client_t * client, pyjack_cycle_times_t * ct)
+{
+    uint32_t seq;
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return -1;
+    }
+    do {
+        seq = __atomic_load_n(&client->cycle_times.seq, __ATOMIC_ACQUIRE);
+        *ct = client->cycle_times;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&client->cycle_times.seq, __ATOMIC_RELAXED));
+
+    if (!seq) {
+        ct->nframes = jack_get_buffer_size(client->pjc);
+        if (jack_get_cycle_times(client->pjc, &ct->current_frames, &ct->current_usecs, &ct->next_usecs, &ct->period_usecs)) {
+            PyErr_SetString(client->state->Error, "Failed to get the cycle times.");
+            return -1;
+        }
+    }
+    // the estimate spans no time before jack has timed a cycle, and while freewheeling:
+    // convert with the nominal period then
+    if (ct->next_usecs <= ct->current_usecs) {
+        jack_nframes_t rate = jack_get_sample_rate(client->pjc);
+        if (!rate || !ct->nframes) {
+            PyErr_SetString(client->state->Error, "The cycle times are not known yet.");
+            return -1;
+        }
+        ct->period_usecs = 1e6f * ct->nframes / rate;
+        ct->next_usecs = ct->current_usecs + (jack_time_t)llrint(1e6 * ct->nframes / rate);
+    }
+    return 0;
+}
+
+// Same arithmetic as jack_frames_to_time() / jack_time_to_frames(), against a snapshot
+static jack_time_t snapshot_frames_to_time(const pyjack_cycle_times_t * ct, jack_nframes_t frames)
+{
+    double delta = (double)(int32_t)(frames - ct->current_frames);
+    return ct->current_usecs + (int64_t)llrint(delta * (double)(int64_t)(ct->next_usecs - ct->current_usecs) / ct->nframes);
+}
+
+static jack_nframes_t snapshot_time_to_frames(const pyjack_cycle_times_t * ct, jack_time_t usecs)
+{
+    double delta = (double)(int64_t)(usecs - ct->current_usecs);
+    return ct->current_frames + (int32_t)llrint(delta / (double)(int64_t)(ct->next_usecs - ct->current_usecs) * ct->nframes);
+}
+
+static PyObject* get_cycle_times(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    pyjack_cycle_times_t ct;
+    if (get_cycle_snapshot(client, &ct) < 0)
+        return NULL;
+    return Py_BuildValue("{s:I,s:K,s:K,s:f,s:I}",
+                         "current_frames", ct.current_frames,
+                         "current_usecs", (unsigned PY_LONG_LONG)ct.current_usecs,
+                         "next_usecs", (unsigned PY_LONG_LONG)ct.next_usecs,
+                         "period_usecs", ct.period_usecs,
+                         "buffer_size", ct.nframes);
+}
+
+// Convert a number, or every element of an array, between frame times and microseconds
+static PyObject* convert_times(PyObject* self, PyObject* args, int to_time)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    pyjack_cycle_times_t ct;
+    PyObject * values;
+    PyArrayObject * in, * out;
+    npy_intp i, n;
+
+    if (! PyArg_ParseTuple(args, "O", &values))
+        return NULL;
+    if (get_cycle_snapshot(client, &ct) < 0)
+        return NULL;
+
+    if (PyLong_Check(values)
+#if PY_MAJOR_VERSION < 3
+        || PyInt_Check(values)
+#endif
+        ) {
+        if (to_time) {
+            unsigned long frames = PyLong_AsUnsignedLongMask(values);
+            if (PyErr_Occurred()) return NULL;
+            return Py_BuildValue("K", (unsigned PY_LONG_LONG)snapshot_frames_to_time(&ct, (jack_nframes_t)frames));
+        } else {
+            unsigned PY_LONG_LONG usecs = PyLong_AsUnsignedLongLongMask(values);
+            if (PyErr_Occurred()) return NULL;
+            return Py_BuildValue("I", snapshot_time_to_frames(&ct, usecs));
+        }
+    }
+
+    if (pyjack_numpy() < 0)
+        return NULL;
+    in = (PyArrayObject*)PyArray_FROM_OTF(values, to_time ? NPY_UINT32 : NPY_UINT64,
+                                          NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    if (!in) return NULL;
+    out = (PyArrayObject*)PyArray_SimpleNew(PyArray_NDIM(in), PyArray_DIMS(in), to_time ? NPY_UINT64 : NPY_UINT32);
+    if (!out) {
+        Py_DECREF(in);
+        return NULL;
+    }
+    n = PyArray_SIZE(in);
+    if (to_time) {
+        const uint32_t * src = PyArray_DATA(in);
+        uint64_t * dst = PyArray_DATA(out);
+        for (i = 0; i < n; i++)
+            dst[i] = snapshot_frames_to_time(&ct, src[i]);
+    } else {
+        const uint64_t * src = PyArray_DATA(in);
+        uint32_t * dst = PyArray_DATA(out);
+        for (i = 0; i < n; i++)
+            dst[i] = snapshot_time_to_frames(&ct, src[i]);
+    }
+    Py_DECREF(in);
+    return (PyObject*)out;
+}
+
+static PyObject* frames_to_time(PyObject* self, PyObject* args)
+{
+    return convert_times(self, args, 1);
+}
+
+static PyObject* time_to_frames(PyObject* self, PyObject* args)
+{
+    return convert_times(self, args, 0);
+}
+
+static PyObject* transport_locate (PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    jack_nframes_t newfr;
+
+    if (! PyArg_ParseTuple(args, "i", &newfr))
+        return NULL;
+
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    jack_transport_locate (client->pjc,newfr);
+    return Py_None;
+}
+
+static PyObject* get_transport_state (PyObject* self, PyObject* args)
+{
+    //int state;
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    jack_transport_state_t transport_state;
+    transport_state = jack_transport_query (client->pjc, NULL);
+
+    return Py_BuildValue("i", transport_state);
+}
+
+#ifdef JACK2
+static PyObject* get_version(PyObject* self, PyObject* args)
+{
+    int major, minor, micro, proto;
+    jack_get_version(&major, &minor, &micro, &proto);
+    return Py_BuildValue("iiii", major, minor, micro, proto);
+}
+#endif
+
+#ifdef JACK2
+static PyObject* get_version_string(PyObject* self, PyObject* args)
+{
+    const char* version;
+    version = jack_get_version_string();
+    return Py_BuildValue("s", version);
+}
+#endif
+
+static PyObject* get_cpu_load(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    float cpu_load = jack_cpu_load(client->pjc);
+
+    return Py_BuildValue("f", cpu_load);
+}
+
+static PyObject* get_port_short_name(PyObject* self, PyObject* args)
+{
+    char * port_name;
+
+    if (! PyArg_ParseTuple(args, "s", &port_name))
+        return NULL;
+
+    if (port_name == NULL) {
+        PyErr_SetString(pyjack_state_of(self)->Error, "Port name cannot be empty.");
+        return NULL;
+    }
+
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    jack_port_t * port = jack_port_by_name(client->pjc, port_name);
+    if (!port) {
+        PyErr_SetString(client->state->Error, "Port name cannot be empty.");
+        return NULL;
+    }
+    const char * port_short_name = jack_port_short_name(port);
+
+    return Py_BuildValue("s", port_short_name);
+}
+
+static PyObject* get_port_type(PyObject* self, PyObject* args)
+{
+    char * port_name;
+
+    if (! PyArg_ParseTuple(args, "s", &port_name))
+        return NULL;
+
+    if (port_name == NULL) {
+        PyErr_SetString(pyjack_state_of(self)->Error, "Port name cannot be empty.");
+        return NULL;
+    }
+
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    jack_port_t * port = jack_port_by_name(client->pjc, port_name);
+    if (!port) {
+        PyErr_SetString(client->state->Error, "Port name cannot be empty.");
+        return NULL;
+    }
+    const char * port_type = jack_port_type(port);
+
+    return Py_BuildValue("s", port_type);
+}
+
+#ifdef JACK2
+static PyObject* get_port_type_id(PyObject* self, PyObject* args)
+{
+    char * port_name;
+
+    if (! PyArg_ParseTuple(args, "s", &port_name))
+        return NULL;
+
+    if (port_name == NULL) {
+        PyErr_SetString(pyjack_state_of(self)->Error, "Port name cannot be empty.");
+        return NULL;
+    }
+
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    jack_port_t * port = jack_port_by_name(client->pjc, port_name);
+    if (!port) {
+        PyErr_SetString(client->state->Error, "Port name cannot be empty.");
+        return NULL;
+    }
+
+    jack_port_type_id_t port_type_id = jack_port_type_id(port);
+
+    int ret = port_type_id;
+    return Py_BuildValue("i", ret);
+}
+#endif
+
+static PyObject* is_realtime(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    int realtime = jack_is_realtime(client->pjc);
+    return Py_BuildValue("i", realtime);
+}
+
+static PyObject* port_is_mine(PyObject* self, PyObject* args)
+{
+    char * port_name;
+
+    if (! PyArg_ParseTuple(args, "s", &port_name))
+        return NULL;
+
+    if (port_name == NULL) {
+        PyErr_SetString(pyjack_state_of(self)->Error, "Port name cannot be empty.");
+        return NULL;
+    }
+
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    jack_port_t * port = jack_port_by_name(client->pjc, port_name);
+    if (!port) {
+        PyErr_SetString(client->state->Error, "Port name cannot be empty.");
+        return NULL;
+    }
+
+    int port_mine = jack_port_is_mine(client->pjc, port);
+    return Py_BuildValue("i", port_mine);
+}
+
+
+static PyObject* transport_stop (PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    jack_transport_stop (client->pjc);
+
+    return Py_None;
+}
+
+static PyObject* transport_start (PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    jack_transport_start (client->pjc);
+
+    return Py_None;
+}
+
+static PyObject* set_buffer_size(PyObject* self, PyObject* args)
+{
+    int size;
+
+    if (! PyArg_ParseTuple(args, "i", &size))
+        return NULL;
+
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    // the buffer size callback needs the GIL to swap our buffers
+    jack_nframes_t nsize = size;
+    int error;
+    Py_BEGIN_ALLOW_THREADS
+    error = jack_set_buffer_size(client->pjc, nsize);
+    Py_END_ALLOW_THREADS
+    if (error) {
+        PyErr_SetString(client->state->Error, "Failed to set the buffer size.");
+        return NULL;
+    }
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// Set the python-side working rates of the input and output streams
+static PyObject* set_resampling(PyObject* self, PyObject* args, PyObject* kwds)
+{
+    static char *kwlist[] = {"input_rate", "output_rate", NULL};
+    int input_rate = 0, output_rate = 0;
+    pyjack_resampler_t * input_rs = NULL;
+    pyjack_resampler_t * output_rs = NULL;
+
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "|ii", kwlist, &input_rate, &output_rate))
+        return NULL;
+
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+    if(client->active) {
+        PyErr_SetString(client->state->UsageError, "Cannot change resampling while client is active.");
+        return NULL;
+    }
+    if(input_rate < 0 || output_rate < 0) {
+        PyErr_SetString(PyExc_ValueError, "sample rates must not be negative");
+        return NULL;
+    }
+
+    // a rate of 0 (or the JACK rate itself) disables resampling in that direction
+    int sr = jack_get_sample_rate(client->pjc);
+    if(input_rate && input_rate != sr) {
+        input_rs = resampler_new(client, sr, input_rate);
+        if(!input_rs) {
+            PyErr_SetString(client->state->UsageError, "Unsupported input resampling ratio.");
+            return NULL;
+        }
+    }
+    if(output_rate && output_rate != sr) {
+        output_rs = resampler_new(client, output_rate, sr);
+        if(!output_rs) {
+            resampler_free(client, &input_rs);
+            PyErr_SetString(client->state->UsageError, "Unsupported output resampling ratio.");
+            return NULL;
+        }
+    }
+
+    resampler_free(client, &client->input_resampler);
+    resampler_free(client, &client->output_resampler);
+    client->input_resampler = input_rs;
+    client->output_resampler = output_rs;
+    client->input_rate = input_rate;
+    client->output_rate = output_rate;
+    client->resampling_rate = (input_rate || output_rate) ? sr : 0;
+    client->resampling_failed = 0;
+    init_pipe_buffers(client);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// Return the resampling setup, including the block sizes seen by process()
+static PyObject* get_resampling(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+
+    int sr = jack_get_sample_rate(client->pjc);
+    return Py_BuildValue("{s:i,s:i,s:i,s:i,s:d,s:d}",
+                         "input_rate", client->input_rate ? client->input_rate : sr,
+                         "output_rate", client->output_rate ? client->output_rate : sr,
+                         "input_frames", client->input_resampler ? client->input_frames : client->buffer_size,
+                         "output_frames", client->output_resampler ? client->output_frames : client->buffer_size,
+                         "input_latency", resampler_latency(client->input_resampler, 1),
+                         "output_latency", resampler_latency(client->output_resampler, 0));
+}
+
+// Return the delay pyjack adds between its input and output ports
+static PyObject* get_latency(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+    return Py_BuildValue("{s:i,s:I,s:d,s:I}",
+                         "transport", client->buffer_size,
+                         "queued_blocks", client->output_queue,
+                         "resampling", resampler_latency(client->input_resampler, 1) + resampler_latency(client->output_resampler, 0),
+                         "total", pyjack_pipeline_delay(client));
+}
+
+// Ask JACK to recompute the latencies of the graph (e.g. after python changed its queue depth)
+static PyObject* recompute_latencies(PyObject* self, PyObject* args)
+{
+    int error;
+    pyjack_client_t * client = self_or_global_client(self);
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+    // the latency callback may need the GIL
+    Py_BEGIN_ALLOW_THREADS
+    error = jack_recompute_total_latencies(client->pjc);
+    Py_END_ALLOW_THREADS
+    if (error) {
+        PyErr_SetString(client->state->Error, "Failed to recompute latencies.");
+        return NULL;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// Configure how buffers used by the RT thread are allocated
+static PyObject* set_memory_options(PyObject* self, PyObject* args, PyObject* kwds)
+{
+    static char *kwlist[] = {"lock", "hugepages", NULL};
+    pyjack_client_t * client = self_or_global_client(self);
+    int lock = client->mem_lock;
+    int hugepages = client->mem_hugepages;
+
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "|ii", kwlist, &lock, &hugepages))
+        return NULL;
+
+    // only affects buffers allocated from now on (i.e. register ports afterwards)
+    client->mem_lock = lock;
+    client->mem_hugepages = hugepages;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// Return how much memory the RT thread uses, and how much of it is resident and locked
+static PyObject* get_memory_stats(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    pyjack_rtmem_t * block;
+    size_t allocated = client->mem_allocated;
+    size_t resident = 0;
+    size_t hugepages = 0;
+    int i;
+
+    for (block = client->mem_blocks; block; block = block->next) {
+        resident += resident_bytes(block, block->span);
+        if (block->huge) hugepages += block->span;
+    }
+    for (i = 0; i < PYJACK_MAX_EXPORTS; i++) {
+        if (!client->exports[i]) continue;
+        allocated += client->exports[i]->map_size;
+        resident += resident_bytes(client->exports[i]->header, client->exports[i]->map_size);
+    }
+
+    return Py_BuildValue("{s:n,s:n,s:n,s:n,s:k}",
+                         "allocated", (Py_ssize_t)allocated,
+                         "resident", (Py_ssize_t)resident,
+                         "locked", (Py_ssize_t)client->mem_locked,
+                         "hugepages", (Py_ssize_t)hugepages,
+                         "lock_failures", client->mem_lock_failures);
+}
+
+// Store the process thread options; they are applied when JACK (re)starts the thread
+static int store_thread_options(pyjack_client_t * client, PyObject * affinity, int rt_priority, int denormals)
+{
+    cpu_set_t set;
+    Py_ssize_t i, n;
+
+    CPU_ZERO(&set);
+    if (affinity && affinity != Py_None) {
+        PyObject * seq = PySequence_Fast(affinity, "thread_affinity must be a sequence of CPU numbers");
+        if (!seq) return -1;
+        n = PySequence_Fast_GET_SIZE(seq);
+        for (i = 0; i < n; i++) {
+            long cpu = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+            if (cpu == -1 && PyErr_Occurred()) {
+                Py_DECREF(seq);
+                return -1;
+            }
+            if (cpu < 0 || cpu >= CPU_SETSIZE) {
+                Py_DECREF(seq);
+                PyErr_SetString(PyExc_ValueError, "CPU number out of range");
+                return -1;
+            }
+            CPU_SET(cpu, &set);
+        }
+        Py_DECREF(seq);
+        if (n == 0) {
+            PyErr_SetString(PyExc_ValueError, "thread_affinity must name at least one CPU");
+            return -1;
+        }
+    }
+    if (rt_priority != 0 && (rt_priority < sched_get_priority_min(SCHED_FIFO) ||
+                             rt_priority > sched_get_priority_max(SCHED_FIFO))) {
+        PyErr_SetString(PyExc_ValueError, "rt_priority out of range for SCHED_FIFO");
+        return -1;
+    }
+
+    client->thread_affinity = set;
+    client->thread_affinity_set = (affinity && affinity != Py_None);
+    client->thread_rt_priority = rt_priority;
+    client->thread_flush_denormals = denormals;
+    return 0;
+}
+
+// Configure CPU affinity, priority and denormal handling of the process thread
+static PyObject* set_thread_options(PyObject* self, PyObject* args, PyObject* kwds)
+{
+    static char *kwlist[] = {"affinity", "rt_priority", "flush_denormals", NULL};
+    pyjack_client_t * client = self_or_global_client(self);
+    PyObject * affinity = Py_None;
+    int rt_priority = 0;
+    int denormals = 0;
+
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "|Oii", kwlist, &affinity, &rt_priority, &denormals))
+        return NULL;
+    if (store_thread_options(client, affinity, rt_priority, denormals) < 0)
+        return NULL;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// Choose between a process callback and a client-owned cycle loop
+static PyObject* set_process_thread(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    int enable;
+
+    if (! PyArg_ParseTuple(args, "i", &enable))
+        return NULL;
+    if (client->process_registered) {
+        PyErr_SetString(client->state->UsageError, "The process mode can only be changed before the client is first activated.");
+        return NULL;
+    }
+
+    client->process_thread = enable ? 1 : 0;
+    if (client->pjc)
+        init_pipe_buffers(client);
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// Report what the process thread ended up with
+static PyObject* get_thread_info(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    cpu_set_t set;
+    PyObject * cpus;
+    const char * policy;
+    int cpu;
+
+    if (!client->thread_id) {
+        PyErr_SetString(client->state->UsageError, "The process thread has not been started yet.");
+        return NULL;
+    }
+
+    // the thread may have been moved since, so ask the kernel
+    cpus = PyList_New(0);
+    if (!cpus) return NULL;
+    if (sched_getaffinity((pid_t)client->thread_id, sizeof(set), &set) == 0) {
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (!CPU_ISSET(cpu, &set)) continue;
+            PyObject * item = PyLong_FromLong(cpu);
+            if (!item || PyList_Append(cpus, item) < 0) {
+                Py_XDECREF(item);
+                Py_DECREF(cpus);
+                return NULL;
+            }
+            Py_DECREF(item);
+        }
+    }
+
+    switch (client->thread_policy) {
+    case SCHED_FIFO:  policy = "SCHED_FIFO";  break;
+    case SCHED_RR:    policy = "SCHED_RR";    break;
+    case SCHED_OTHER: policy = "SCHED_OTHER"; break;
+    default:          policy = "unknown";     break;
+    }
+
+    return Py_BuildValue("{s:l,s:s,s:i,s:N,s:O,s:i,s:i}",
+                         "tid", client->thread_id,
+                         "policy", policy,
+                         "priority", client->thread_priority,
+                         "affinity", cpus,
+                         "flush_denormals", client->thread_denormals ? Py_True : Py_False,
+                         "affinity_error", client->thread_affinity_error,
+                         "priority_error", client->thread_priority_error);
+}
+
+// Leave silent input channels out of the blocks sent to python
+static PyObject* set_silence_detection(PyObject* self, PyObject* args, PyObject* kwds)
+{
+    static char *kwlist[] = {"threshold", "hold_time", NULL};
+    pyjack_client_t * client = self_or_global_client(self);
+    float threshold;
+    float hold_time = 0.5f;
+
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "f|f", kwlist, &threshold, &hold_time))
+        return NULL;
+    if (threshold < 0.f || hold_time < 0.f) {
+        PyErr_SetString(PyExc_ValueError, "threshold and hold_time must not be negative");
+        return NULL;
+    }
+
+    client->silence_hold_time = hold_time;
+    if (client->pjc)
+        init_pipe_buffers(client);
+    client->silence_threshold = threshold;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// Which input channels were part of the last block received by process()
+static PyObject* get_input_activity(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    const pyjack_block_header_t * hdr = &client->input_header_1;
+    PyObject * activity = PyList_New(client->num_inputs);
+    int c;
+
+    if (!activity) return NULL;
+    for (c = 0; c < client->num_inputs; c++) {
+        PyObject * on = ((uint32_t)c < hdr->channels && ((hdr->active[c >> 5] >> (c & 31)) & 1)) ? Py_True : Py_False;
+        Py_INCREF(on);
+        PyList_SET_ITEM(activity, c, on);
+    }
+    return activity;
+}
+
+// Look up one of this client's ports by short or full name; returns its index or -1
+static int find_client_port(jack_port_t ** ports, int count, const char * name)
+{
+    int i;
+    for (i = 0; i < count; i++) {
+        if (!strcmp(name, jack_port_short_name(ports[i])) || !strcmp(name, jack_port_name(ports[i])))
+            return i;
+    }
+    return -1;
+}
 
+// Have the RT thread mix a clip into one of the output ports, starting at the given frame time
+static PyObject* schedule(PyObject* self, PyObject* args, PyObject* kwds)
+{
+    static char *kwlist[] = {"buffer", "port", "at_frame", "gain", NULL};
     pyjack_client_t * client = self_or_global_client(self);
-    if(client->pjc != NULL) {
-        PyErr_SetString(JackUsageError, "A connection is already established.");
+    PyObject * buffer;
+    const char * pname;
+    unsigned long at_frame;
+    float gain = 1.f;
+    pyjack_block_t b;
+    pyjack_voice_t * v = NULL;
+    int i, index;
+
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "Osk|f", kwlist, &buffer, &pname, &at_frame, &gain))
         return NULL;
-    }
-
-    jack_status_t status;
-    client->pjc = jack_client_open(cname, JackNoStartServer, &status);
     if(client->pjc == NULL) {
-        //TODO check status
-        PyErr_SetString(JackNotConnectedError, "Failed to connect to Jack audio server.");
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
         return NULL;
     }
-
-    jack_on_shutdown(client->pjc, pyjack_shutdown, client);
-    signal(SIGHUP, pyjack_hangup); // TODO: This just works with global clients
-
-    if(client->doProcessing && jack_set_process_callback(client->pjc, pyjack_process, client) != 0) {
-        PyErr_SetString(JackError, "Failed to set jack process callback.");
+    index = find_client_port(client->output_ports, client->num_outputs, pname);
+    if (index < 0) {
+        PyErr_SetString(client->state->UsageError, "Port not found.");
         return NULL;
     }
 
-    if(jack_set_buffer_size_callback(client->pjc, pyjack_buffer_size_changed, client) != 0) {
-        PyErr_SetString(JackError, "Failed to set jack buffer size callback.");
-        return NULL;
+    voices_reclaim(client, 0);
+    for (i = 0; i < PYJACK_MAX_VOICES && !v; i++) {
+        if (__atomic_load_n(&client->voices[i].state, __ATOMIC_ACQUIRE) == PYJACK_VOICE_FREE)
+            v = &client->voices[i];
     }
-
-    if(jack_set_port_registration_callback(client->pjc, pyjack_port_registration, client) != 0) {
-        PyErr_SetString(JackError, "Failed to set jack port registration callback.");
+    if (!v) {
+        PyErr_SetString(client->state->UsageError, "Too many scheduled clips.");
         return NULL;
     }
 
-    if(jack_set_graph_order_callback(client->pjc, pyjack_graph_order, client) != 0) {
-        PyErr_SetString(JackError, "Failed to set jack graph order callback.");
+    if (block_get(buffer, &b, 0, -1, 0, "clip") < 0)
         return NULL;
+    if (b.rows != 1 || b.cols < 1 || b.cols > UINT32_MAX) {
+        PyBuffer_Release(&b.view);
+        PyErr_SetString(PyExc_ValueError, "clips must be a single, non-empty channel");
+        return NULL;
+    }
+    v->data = rt_alloc(client, b.cols * sizeof(float));
+    if (!v->data) {
+        PyBuffer_Release(&b.view);
+        return PyErr_NoMemory();
     }
+    block_read_row(&b, 0, v->data, b.cols);
+    PyBuffer_Release(&b.view);
+
+    v->length = b.cols;
+    v->port = client->output_ports[index];
+    v->at_frame = (jack_nframes_t)at_frame;
+    v->gain = gain;
+    v->id = ++client->voice_next_id;
+    __atomic_store_n(&v->state, PYJACK_VOICE_QUEUED, __ATOMIC_RELEASE);
+    return Py_BuildValue("I", v->id);
+}
 
-    if(jack_set_xrun_callback(client->pjc, pyjack_xrun, client) != 0) {
-        PyErr_SetString(JackError, "Failed to set jack xrun callback.");
+// Stop a scheduled clip
+static PyObject* cancel(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    unsigned int id;
+    int i, cancelled = 0;
+
+    if (! PyArg_ParseTuple(args, "I", &id))
         return NULL;
+    for (i = 0; i < PYJACK_MAX_VOICES; i++) {
+        if (client->voices[i].id == id && voice_cancel(&client->voices[i]))
+            cancelled = 1;
     }
+    voices_reclaim(client, 0);
+    return PyBool_FromLong(cancelled);
+}
 
-    if(jack_set_thread_init_callback(client->pjc, pyjack_thread_init, client) != 0) {
-        PyErr_SetString(JackError, "Failed to set jack thread-init callback.");
-        return NULL;
+// Index of the parameter with the given name, or -1
+static int find_param(pyjack_client_t * client, const char * name)
+{
+    int i;
+    for (i = 0; i < PYJACK_MAX_PARAMS; i++) {
+        if (client->params[i].active && !strcmp(client->params[i].name, name))
+            return i;
     }
+    return -1;
+}
 
-    if(jack_set_client_registration_callback(client->pjc, pyjack_client_registration, client) != 0) {
-        PyErr_SetString(JackError, "Failed to set jack client-registraion callback.");
+// Publish a new target for the RT thread (python is the only writer)
+static void param_set_target(pyjack_param_t * p, float target, uint32_t frames, int exponential)
+{
+    __atomic_store_n(&p->seq, p->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    p->target = target;
+    p->ramp_frames = frames;
+    p->exponential = exponential;
+    __atomic_store_n(&p->seq, p->seq + 1, __ATOMIC_RELEASE);
+}
+
+// Create a control parameter
+static PyObject* add_param(PyObject* self, PyObject* args, PyObject* kwds)
+{
+    static char *kwlist[] = {"name", "value", "ramp", "exponential", NULL};
+    pyjack_client_t * client = self_or_global_client(self);
+    const char * name;
+    float value = 0.f, ramp = 0.01f;
+    int exponential = 0, i;
+    pyjack_param_t * p = NULL;
+
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "s|ffi", kwlist, &name, &value, &ramp, &exponential))
+        return NULL;
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
         return NULL;
     }
-    if(jack_set_freewheel_callback(client->pjc, pyjack_freewheel, client) != 0) {
-        PyErr_SetString(JackError, "Failed to set jack freewheel callback.");
+    if (!*name || strlen(name) >= PYJACK_PARAM_NAME || ramp < 0.f) {
+        PyErr_SetString(PyExc_ValueError, "the name must have 1 to 31 characters, and ramp must not be negative");
         return NULL;
     }
-#ifdef WANT_LATENCY_CALLBACK
-    if(jack_set_latency_callback(client->pjc, pyjack_latency, client) != 0) {
-        PyErr_SetString(JackError, "Failed to set jack latency callback.");
+    if (find_param(client, name) >= 0) {
+        PyErr_SetString(client->state->UsageError, "A parameter with this name already exists.");
         return NULL;
     }
-#endif /* WANT_LATENCY_CALLBACK */
-    if(jack_set_port_connect_callback(client->pjc, pyjack_port_connect, client) != 0) {
-        PyErr_SetString(JackError, "Failed to set jack port-connect callback.");
+    for (i = 0; i < PYJACK_MAX_PARAMS && !p; i++) {
+        if (!client->params[i].active)
+            p = &client->params[i];
+    }
+    if (!p) {
+        PyErr_SetString(client->state->UsageError, "Too many parameters.");
         return NULL;
     }
 
-    // Get buffer size
-    client->buffer_size = jack_get_buffer_size(client->pjc);
-
-    // Success!
+    memset(p, 0, sizeof(*p));
+    p->curve = rt_alloc(client, client->buffer_size * sizeof(float));
+    if (!p->curve)
+        return PyErr_NoMemory();
+    p->curve_size = client->buffer_size;
+    strcpy(p->name, name);
+    p->default_ramp = ramp;
+    p->default_exponential = exponential;
+    p->target = p->end = p->current = p->value = value;
+    p->constant = 1;
+    __atomic_store_n(&p->active, 1, __ATOMIC_RELEASE);
     Py_INCREF(Py_None);
     return Py_None;
 }
 
-// Detach client from the jack server (also destroys all connections)
-static PyObject* detach(PyObject* self, PyObject* args)
+// Move a parameter to a new value, sample by sample in the RT thread
+static PyObject* set_param(PyObject* self, PyObject* args, PyObject* kwds)
 {
+    static char *kwlist[] = {"name", "value", "ramp", "exponential", NULL};
     pyjack_client_t * client = self_or_global_client(self);
+    const char * name;
+    float value;
+    PyObject * ramp_obj = Py_None;
+    PyObject * exp_obj = Py_None;
+    double ramp;
+    int exponential, index;
+    pyjack_param_t * p;
+
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "sf|OO", kwlist, &name, &value, &ramp_obj, &exp_obj))
+        return NULL;
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+    index = find_param(client, name);
+    if (index < 0) {
+        PyErr_SetString(client->state->UsageError, "Parameter not found.");
+        return NULL;
+    }
+    p = &client->params[index];
 
-    if(client->pjc != NULL) {
-        jack_client_close(client->pjc);
-        pyjack_final(client);
+    ramp = p->default_ramp;
+    if (ramp_obj != Py_None) {
+        ramp = PyFloat_AsDouble(ramp_obj);
+        if (ramp == -1.0 && PyErr_Occurred())
+            return NULL;
+        if (ramp < 0.0) {
+            PyErr_SetString(PyExc_ValueError, "ramp must not be negative");
+            return NULL;
+        }
     }
+    exponential = p->default_exponential;
+    if (exp_obj != Py_None && (exponential = PyObject_IsTrue(exp_obj)) < 0)
+        return NULL;
 
+    param_set_target(p, value, (uint32_t)lrint(ramp * jack_get_sample_rate(client->pjc)), exponential);
     Py_INCREF(Py_None);
     return Py_None;
 }
 
-static PyObject* unregister_port(PyObject* self, PyObject* args)
+// Value of a parameter at the end of the last cycle
+static PyObject* get_param(PyObject* self, PyObject* args)
 {
     pyjack_client_t * client = self_or_global_client(self);
-    char* port_name;
-    if (! PyArg_ParseTuple(args, "s", &port_name))
-        return NULL;
+    const char * name;
+    float value;
+    int index;
 
-    if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
+    if (! PyArg_ParseTuple(args, "s", &name))
+        return NULL;
+    index = find_param(client, name);
+    if (index < 0) {
+        PyErr_SetString(client->state->UsageError, "Parameter not found.");
         return NULL;
     }
+    __atomic_load(&client->params[index].value, &value, __ATOMIC_RELAXED);
+    return PyFloat_FromDouble(value);
+}
 
-//     if(client->active) {
-//         PyErr_SetString(JackUsageError, "Cannot unregister ports while client is active.");
-//         return NULL;
-//     }
-
-    int i = 0;
-    for (i=0;i<client->num_inputs;i++) {
-        if (strcmp(port_name, jack_port_short_name(client->input_ports[i]))) continue;
-        int error = jack_port_unregister(client->pjc, client->input_ports[i]);
-        if (error) {
-            PyErr_SetString(JackError, "Unable to unregister input port.");
-            return NULL;
-        }
-        client->num_inputs--;
-        for (;i<client->num_inputs;i++) {
-            client->input_ports[i] = client->input_ports[i+1];
-        }
-        init_pipe_buffers(client);
-        Py_INCREF(Py_None);
-        return Py_None;
-    }
+// Delete a parameter, and the gains and plugin controls bound to it
+static PyObject* remove_param(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    const char * name;
+    int index;
 
-    for (i=0;i<client->num_outputs;i++) {
-        if (strcmp(port_name, jack_port_short_name(client->output_ports[i]))) continue;
-        int error = jack_port_unregister(client->pjc, client->output_ports[i]);
-        if (error) {
-            PyErr_SetString(JackError, "Unable to unregister output port.");
-            return NULL;
-        }
-        client->num_outputs--;
-        for (;i<client->num_outputs;i++) {
-            client->output_ports[i] = client->output_ports[i+1];
-        }
-        init_pipe_buffers(client);
-        Py_INCREF(Py_None);
-        return Py_None;
+    if (! PyArg_ParseTuple(args, "s", &name))
+        return NULL;
+    index = find_param(client, name);
+    if (index < 0) {
+        PyErr_SetString(client->state->UsageError, "Parameter not found.");
+        return NULL;
     }
-    PyErr_SetString(JackUsageError, "Port not found.");
-    return NULL;
+    gains_unbind(client, NULL, index);
+#ifdef HAVE_LADSPA
+    plugins_unbind(client, index);
+#endif
+    __atomic_store_n(&client->params[index].active, 0, __ATOMIC_RELEASE);
+    pyjack_wait_cycle(client);
+    param_free(client, &client->params[index]);
+    Py_INCREF(Py_None);
+    return Py_None;
 }
 
-
-// Create a new port for this client
-// Unregistration of ports is not supported; you must disconnect, reconnect, re-reg all ports instead.
-static PyObject* register_port(PyObject* self, PyObject* args)
+// Have the RT thread multiply an output port by a parameter
+static PyObject* bind_port_gain(PyObject* self, PyObject* args)
 {
     pyjack_client_t * client = self_or_global_client(self);
+    const char * pname;
+    const char * name = NULL;
+    int i, index, param = -1;
+    pyjack_gain_t * g = NULL;
 
-    int flags;
-    char* pname;
-    if (! PyArg_ParseTuple(args, "si", &pname, &flags))
+    if (! PyArg_ParseTuple(args, "sz", &pname, &name))
         return NULL;
-
     if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
         return NULL;
     }
-
-//     if(client->active) {
-//         PyErr_SetString(JackUsageError, "Cannot register ports while client is active.");
-//         return NULL;
-//     }
-
-    if(client->num_inputs >= PYJACK_MAX_PORTS) {
-        PyErr_SetString(JackUsageError, "Cannot create more than 256 ports. Sorry.");
+    index = find_client_port(client->output_ports, client->num_outputs, pname);
+    if (index < 0) {
+        PyErr_SetString(client->state->UsageError, "Port not found.");
         return NULL;
     }
-
-    jack_port_t* jp = jack_port_register(client->pjc, pname, JACK_DEFAULT_AUDIO_TYPE, flags, 0);
-    if(jp == NULL) {
-        PyErr_SetString(JackError, "Failed to create port.");
+    if (name && (param = find_param(client, name)) < 0) {
+        PyErr_SetString(client->state->UsageError, "Parameter not found.");
         return NULL;
     }
 
-    // Store pointer to this port and increment counter
-    if(flags & JackPortIsInput) {
-        client->input_ports[client->num_inputs] = jp;
-        client->num_inputs++;
+    // the port keeps its slot when it is bound to another parameter
+    for (i = 0; i < PYJACK_MAX_GAINS; i++) {
+        if (client->gains[i].port == client->output_ports[index])
+            g = &client->gains[i];
     }
-    if(flags & JackPortIsOutput) {
-        client->output_ports[client->num_outputs] = jp;
-        client->num_outputs++;
+    if (!name) {
+        if (g) __atomic_store_n(&g->port, NULL, __ATOMIC_RELEASE);
+        Py_INCREF(Py_None);
+        return Py_None;
     }
-
-    init_pipe_buffers(client);
+    for (i = 0; i < PYJACK_MAX_GAINS && !g; i++) {
+        if (!client->gains[i].port)
+            g = &client->gains[i];
+    }
+    if (!g) {
+        PyErr_SetString(client->state->UsageError, "Too many gains.");
+        return NULL;
+    }
+    __atomic_store_n(&g->param, param, __ATOMIC_RELEASE);
+    __atomic_store_n(&g->port, client->output_ports[index], __ATOMIC_RELEASE);
     Py_INCREF(Py_None);
     return Py_None;
 }
 
-// Returns a list of all port names registered in the Jack system
-static PyObject* get_ports(PyObject* self, PyObject* args, PyObject*kwds)
+// Read an impulse response into a new (malloc'ed) array; returns NULL with an exception set
+static float * convolver_read_ir(PyObject * obj, uint32_t * length)
 {
-    static char *kwlist[] = {"port_name_pattern", "type_name_pattern", "flags", NULL};
-    PyObject* plist;
-    const char** jplist;
-    unsigned int count, i;
-    char*portpattern=NULL;
-    char*typepattern=NULL;
-    unsigned long flags=0;
-
-    pyjack_client_t * client = self_or_global_client(self);
-    if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
+    pyjack_block_t b;
+    float * ir;
+    if (block_get(obj, &b, 0, -1, 0, "impulse response") < 0)
+        return NULL;
+    if (b.rows != 1 || b.cols < 1 || b.cols > (1 << 28)) {
+        PyBuffer_Release(&b.view);
+        PyErr_SetString(PyExc_ValueError, "impulse responses must be a single, non-empty channel");
         return NULL;
     }
-    if (! PyArg_ParseTupleAndKeywords(args, kwds, "|ssk", kwlist,
-                                      &portpattern, &typepattern, &flags))
-      return NULL;
-
-    jplist = jack_get_ports(client->pjc, portpattern, typepattern, flags);
-
-    count = 0;
-    if(jplist != NULL) {
-      while(jplist[count] != NULL) count += 1;
-    }
-
-    plist = PyList_New(count);
-    if(jplist != NULL) {
-        i = 0;
-        while(jplist[i] != NULL) {
-            PyList_SET_ITEM(plist, i, Py_BuildValue("s", jplist[i])); // FIXXXME: this leaks memory
-            i++;
-        }
+    ir = malloc(b.cols * sizeof(float));
+    if (!ir) {
+        PyBuffer_Release(&b.view);
+        PyErr_NoMemory();
+        return NULL;
     }
-    jack_free(jplist);
-    return plist;
+    block_read_row(&b, 0, ir, b.cols);
+    PyBuffer_Release(&b.view);
+    *length = b.cols;
+    return ir;
 }
 
-// Return port flags (an integer)
-static PyObject* get_port_flags(PyObject* self, PyObject* args)
+// Index of the convolver with the given id, or -1 with an exception set
+static int find_convolver(pyjack_client_t * client, unsigned int id)
 {
-    char* pname;
-    jack_port_t* jp;
     int i;
+    for (i = 0; i < PYJACK_MAX_CONVOLVERS; i++) {
+        if (client->convolvers[i] && client->convolvers[i]->id == id)
+            return i;
+    }
+    PyErr_SetString(client->state->UsageError, "Convolver not found.");
+    return -1;
+}
 
+// Have the RT thread (and a worker thread) convolve a port with an impulse response
+static PyObject* add_convolver(PyObject* self, PyObject* args, PyObject* kwds)
+{
+    static char *kwlist[] = {"in_port", "out_port", "ir", "max_length", "mix", NULL};
     pyjack_client_t * client = self_or_global_client(self);
+    const char * in_name, * out_name;
+    PyObject * ir_obj;
+    unsigned int max_length = 0;
+    int mix = 0, i, slot = -1, in_index, out_index, in_is_output = 0;
+    float * ir;
+    uint32_t length;
+    pyjack_convolver_t * cv;
+
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "ssO|Ii", kwlist, &in_name, &out_name, &ir_obj, &max_length, &mix))
+        return NULL;
     if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
         return NULL;
     }
-
-    if (! PyArg_ParseTuple(args, "s", &pname))
+    in_index = find_client_port(client->input_ports, client->num_inputs, in_name);
+    if (in_index < 0) {
+        in_index = find_client_port(client->output_ports, client->num_outputs, in_name);
+        in_is_output = 1;
+    }
+    out_index = find_client_port(client->output_ports, client->num_outputs, out_name);
+    if (in_index < 0 || out_index < 0) {
+        PyErr_SetString(client->state->UsageError, "Port not found.");
         return NULL;
-
-    jp = jack_port_by_name(client->pjc, pname);
-    if(jp == NULL) {
-        PyErr_SetString(JackError, "Bad port name.");
+    }
+    for (i = 0; i < PYJACK_MAX_CONVOLVERS && slot < 0; i++) {
+        if (!client->convolvers[i])
+            slot = i;
+    }
+    if (slot < 0) {
+        PyErr_SetString(client->state->UsageError, "Too many convolvers.");
         return NULL;
     }
-
-    i = jack_port_flags(jp);
-    if(i < 0) {
-        PyErr_SetString(JackError, "Error getting port flags.");
+    if (client->buffer_size & (client->buffer_size - 1)) {
+        PyErr_SetString(client->state->UsageError, "Convolvers need a buffer size that is a power of two.");
         return NULL;
     }
 
-    return Py_BuildValue("i", i);
+    ir = convolver_read_ir(ir_obj, &length);
+    if (!ir) return NULL;
+    cv = convolver_new(client, in_is_output ? client->output_ports[in_index] : client->input_ports[in_index],
+                       in_is_output, client->output_ports[out_index], mix, ir, length, max_length);
+    if (!cv) {
+        PyErr_SetString(client->state->Error, "Unable to set up the convolver.");
+        return NULL;
+    }
+    cv->id = ++client->convolver_next_id;
+    __atomic_store_n(&client->convolvers[slot], cv, __ATOMIC_RELEASE);
+    return Py_BuildValue("I", cv->id);
 }
 
-// Return a list of full port names connected to the named port
-// Port does not need to be owned by this client.
-static PyObject* get_connections(PyObject* self, PyObject* args)
+// Replace the impulse response of a convolver, crossfading into it in the RT thread
+static PyObject* set_convolver_ir(PyObject* self, PyObject* args, PyObject* kwds)
 {
-    char* pname;
-    const char** jplist;
-    jack_port_t* jp;
-    PyObject* plist;
-    unsigned int count, i;
-
+    static char *kwlist[] = {"id", "ir", "fade", NULL};
     pyjack_client_t * client = self_or_global_client(self);
+    unsigned int id;
+    PyObject * ir_obj;
+    double fade = 0.05;
+    pyjack_convolver_t * cv;
+    pyjack_kernel_t k;
+    float * ir;
+    uint32_t length, active;
+    int index, running;
+
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "IO|d", kwlist, &id, &ir_obj, &fade))
+        return NULL;
     if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+    if ((index = find_convolver(client, id)) < 0)
+        return NULL;
+    cv = client->convolvers[index];
+    if (fade < 0.0) {
+        PyErr_SetString(PyExc_ValueError, "fade must not be negative");
         return NULL;
     }
 
-    if (! PyArg_ParseTuple(args, "s", &pname))
+    running = client->active && client->doProcessing;
+    if (__atomic_load_n(&cv->swap, __ATOMIC_ACQUIRE) != PYJACK_SWAP_NONE) {
+        if (running) {
+            PyErr_SetString(client->state->UsageError, "The previous impulse response is still fading in.");
+            return NULL;
+        }
+        // nothing runs the crossfade: complete it
+        cv->active = !cv->active;
+        cv->swap = PYJACK_SWAP_NONE;
+    }
+    ir = convolver_read_ir(ir_obj, &length);
+    if (!ir) return NULL;
+    if (length > cv->max_length) {
+        free(ir);
+        PyErr_SetString(PyExc_ValueError, "the impulse response is longer than the max_length of the convolver");
         return NULL;
+    }
+    if (kernel_build(client, cv, &k, ir, length) < 0)
+        return PyErr_NoMemory();
+
+    // neither the RT thread nor the worker look at the spare kernel until swap is set
+    active = cv->active;
+    pthread_mutex_lock(&cv->lock);
+    kernel_free(client, &cv->kernels[!active]);
+    cv->kernels[!active] = k;
+    pthread_mutex_unlock(&cv->lock);
+    if (running) {
+        cv->fade_length = (uint32_t)lrint(fade * jack_get_sample_rate(client->pjc));
+        if (!cv->fade_length) cv->fade_length = 1;
+        __atomic_store_n(&cv->swap, PYJACK_SWAP_PENDING, __ATOMIC_RELEASE);
+    } else {
+        __atomic_store_n(&cv->active, !active, __ATOMIC_RELEASE);
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
 
-    jp = jack_port_by_name(client->pjc, pname);
-    if(jp == NULL) {
-        PyErr_SetString(JackError, "Bad port name.");
+// Stop a convolver and free it
+static PyObject* remove_convolver(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    unsigned int id;
+    pyjack_convolver_t * cv;
+    int index;
+
+    if (! PyArg_ParseTuple(args, "I", &id))
         return NULL;
+    if ((index = find_convolver(client, id)) < 0)
+        return NULL;
+    cv = client->convolvers[index];
+    __atomic_store_n(&client->convolvers[index], NULL, __ATOMIC_RELEASE);
+    pyjack_wait_cycle(client);
+    convolver_free(client, cv);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// Partitioning and counters of a convolver
+static PyObject* get_convolver_stats(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    unsigned int id;
+    pyjack_convolver_t * cv;
+    int index;
+
+    if (! PyArg_ParseTuple(args, "I", &id))
+        return NULL;
+    if ((index = find_convolver(client, id)) < 0)
+        return NULL;
+    cv = client->convolvers[index];
+    pthread_mutex_lock(&cv->lock);
+    PyObject * result = Py_BuildValue("{s:i,s:i,s:I,s:I,s:I,s:K,s:K,s:i}",
+                         "partition_size", cv->size,
+                         "tail_partition_size", cv->tail_size,
+                         "head_length", cv->head_length,
+                         "length", cv->kernels[__atomic_load_n(&cv->active, __ATOMIC_ACQUIRE)].length,
+                         "max_length", cv->max_length,
+                         "late", (unsigned long long)__atomic_load_n(&cv->late, __ATOMIC_RELAXED),
+                         "overruns", (unsigned long long)cv->overruns,
+                         "swapping", __atomic_load_n(&cv->swap, __ATOMIC_ACQUIRE) != PYJACK_SWAP_NONE);
+    pthread_mutex_unlock(&cv->lock);
+    return result;
+}
+
+#ifdef HAVE_LADSPA
+// Default value of a LADSPA control input, from its range hints
+static float plugin_control_default(const LADSPA_PortRangeHint * h, unsigned long rate)
+{
+    LADSPA_PortRangeHintDescriptor hint = h->HintDescriptor;
+    float lo = h->LowerBound, hi = h->UpperBound, w;
+    if (LADSPA_IS_HINT_SAMPLE_RATE(hint)) {
+        lo *= rate;
+        hi *= rate;
+    }
+    switch (hint & LADSPA_HINT_DEFAULT_MASK) {
+    case LADSPA_HINT_DEFAULT_MINIMUM: return lo;
+    case LADSPA_HINT_DEFAULT_LOW:     w = 0.25f; break;
+    case LADSPA_HINT_DEFAULT_MIDDLE:  w = 0.5f; break;
+    case LADSPA_HINT_DEFAULT_HIGH:    w = 0.75f; break;
+    case LADSPA_HINT_DEFAULT_MAXIMUM: return hi;
+    case LADSPA_HINT_DEFAULT_0:       return 0.f;
+    case LADSPA_HINT_DEFAULT_1:       return 1.f;
+    case LADSPA_HINT_DEFAULT_100:     return 100.f;
+    case LADSPA_HINT_DEFAULT_440:     return 440.f;
+    default:
+        // no default: 0, within the bounds
+        if (LADSPA_IS_HINT_BOUNDED_BELOW(hint) && lo > 0.f) return lo;
+        if (LADSPA_IS_HINT_BOUNDED_ABOVE(hint) && hi < 0.f) return hi;
+        return 0.f;
     }
+    if (LADSPA_IS_HINT_LOGARITHMIC(hint) && lo > 0.f && hi > 0.f)
+        return expf(logf(lo) * (1.f - w) + logf(hi) * w);
+    return lo * (1.f - w) + hi * w;
+}
 
-    jplist = jack_port_get_all_connections(client->pjc, jp);
-    count = 0;
-    if(jplist != NULL) {
-      while(jplist[count] != NULL) count += 1;
+// Load a LADSPA library, given by its path or by a file name looked up in LADSPA_PATH
+static void * plugin_open(const char * path)
+{
+    const char * dirs = getenv("LADSPA_PATH");
+    char file[4096];
+    void * library;
+
+    if (strchr(path, '/'))
+        return dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!dirs || !*dirs)
+        dirs = "/usr/local/lib/ladspa:/usr/lib/ladspa";
+    while (*dirs) {
+        size_t len = strcspn(dirs, ":");
+        if (len && snprintf(file, sizeof(file), "%.*s/%s", (int)len, dirs, path) < (int)sizeof(file)
+            && (library = dlopen(file, RTLD_NOW | RTLD_LOCAL)))
+            return library;
+        dirs += len;
+        if (*dirs) dirs++;
+    }
+    return NULL;
+}
+
+// Look up the client ports a plugin reads (inputs) or writes; returns -1 with an exception set on failure.
+// Plugins may read output ports too, as mixed by the time they run.
+static int plugin_map_ports(pyjack_client_t * client, PyObject * portlist, int count, int inputs,
+                            jack_port_t ** ports, int * is_output)
+{
+    PyObject * seq = PySequence_Fast(portlist, "ports must be a sequence of port names");
+    Py_ssize_t i;
+    if (!seq) return -1;
+    if (PySequence_Fast_GET_SIZE(seq) != count) {
+        Py_DECREF(seq);
+        PyErr_Format(PyExc_ValueError, "the plugin has %d audio %s", count, inputs ? "inputs" : "outputs");
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+#if PY_MAJOR_VERSION >= 3
+        const char* pname = PyUnicode_AsUTF8(PySequence_Fast_GET_ITEM(seq, i));
+#else
+        const char* pname = PyString_AsString(PySequence_Fast_GET_ITEM(seq, i));
+#endif
+        int index = -1, output = 0;
+        if (pname && inputs)
+            index = find_client_port(client->input_ports, client->num_inputs, pname);
+        if (pname && index < 0) {
+            index = find_client_port(client->output_ports, client->num_outputs, pname);
+            output = 1;
+        }
+        if (index < 0) {
+            if (!PyErr_Occurred())
+                PyErr_SetString(client->state->UsageError, "Port not found.");
+            Py_DECREF(seq);
+            return -1;
+        }
+        ports[i] = output ? client->output_ports[index] : client->input_ports[index];
+        if (is_output) is_output[i] = output;
+    }
+    Py_DECREF(seq);
+    return 0;
+}
+
+// The plugin with the given id, or NULL with an exception set
+static pyjack_plugin_t * find_plugin(pyjack_client_t * client, unsigned int id)
+{
+    int i;
+    for (i = 0; client->chain && i < client->chain->count; i++) {
+        if (client->chain->plugins[i]->id == id)
+            return client->chain->plugins[i];
     }
+    PyErr_SetString(client->state->UsageError, "Plugin not found.");
+    return NULL;
+}
 
-    plist = PyList_New(count);
-    if(jplist != NULL) {
-        i = 0;
-        while(jplist[i] != NULL) {
-            PyList_SET_ITEM(plist, i, Py_BuildValue("s", jplist[i]));
-            i++;
+// The control port of a plugin with the given name, or NULL with an exception set
+static pyjack_control_t * find_plugin_control(pyjack_client_t * client, pyjack_plugin_t * pl, const char * name, int input)
+{
+    int k;
+    for (k = 0; k < pl->num_controls; k++) {
+        if (strcmp(pl->controls[k].name, name)) continue;
+        if (input && pl->controls[k].output) {
+            PyErr_SetString(client->state->UsageError, "This control is an output of the plugin.");
+            return NULL;
         }
+        return &pl->controls[k];
     }
-    jack_free(jplist);
-    return plist;
+    PyErr_SetString(client->state->UsageError, "Control not found.");
+    return NULL;
 }
 
-// connect_port
-static PyObject* port_connect(PyObject* self, PyObject* args)
+// Load a LADSPA plugin and have the RT thread run it on some of the client's ports
+static PyObject* add_plugin(PyObject* self, PyObject* args, PyObject* kwds)
 {
-    char* src_name;
-    char* dst_name;
-
+    static char *kwlist[] = {"path", "inputs", "outputs", "label", "controls", "mix", "realtime_unsafe", NULL};
     pyjack_client_t * client = self_or_global_client(self);
+    const char * path;
+    const char * label = NULL;
+    PyObject * inputs, * outputs;
+    PyObject * controls = Py_None;
+    int mix = 0, realtime_unsafe = 0, ins = 0, outs = 0, k;
+    unsigned long i;
+    LADSPA_Descriptor_Function descriptors;
+    const LADSPA_Descriptor * d = NULL;
+    pyjack_plugin_t * pl;
+    pyjack_chain_t * chain, * old;
+
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "sOO|zOii", kwlist, &path, &inputs, &outputs, &label, &controls, &mix,
+                                      &realtime_unsafe))
+        return NULL;
     if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
         return NULL;
     }
-
-    if (! PyArg_ParseTuple(args, "ss", &src_name, &dst_name))
-        return NULL;
-
-    jack_port_t * src = jack_port_by_name(client->pjc, src_name);
-    if (!src) {
-        PyErr_SetString(JackUsageError, "Non existing source port.");
+    if (controls != Py_None && !PyDict_Check(controls)) {
+        PyErr_SetString(PyExc_ValueError, "controls must be a dict of control names and values");
         return NULL;
-        }
-    jack_port_t * dst = jack_port_by_name(client->pjc, dst_name);
-    if (!dst) {
-        PyErr_SetString(JackUsageError, "Non existing destination port.");
+    }
+    if (client->chain && client->chain->count >= PYJACK_MAX_PLUGINS) {
+        PyErr_SetString(client->state->UsageError, "Too many plugins.");
         return NULL;
+    }
+
+    pl = rt_alloc(client, sizeof(*pl));
+    if (!pl)
+        return PyErr_NoMemory();
+    pl->library = plugin_open(path);
+    if (!pl->library) {
+        const char * error = dlerror();
+        PyErr_Format(client->state->Error, "Unable to load %s: %s", path, error ? error : "not found");
+        goto fail;
+    }
+    descriptors = (LADSPA_Descriptor_Function)dlsym(pl->library, "ladspa_descriptor");
+    if (!descriptors) {
+        PyErr_Format(client->state->Error, "%s is not a LADSPA library", path);
+        goto fail;
+    }
+    for (i = 0; (d = descriptors(i)); i++) {
+        if (!label || !strcmp(d->Label, label)) break;
+    }
+    if (!d) {
+        PyErr_SetString(client->state->UsageError, "Plugin not found.");
+        goto fail;
+    }
+    pl->descriptor = d;
+    // run() must not block or allocate in the RT thread unless the caller accepts the risk
+    if (!LADSPA_IS_HARD_RT_CAPABLE(d->Properties) && !realtime_unsafe) {
+        PyErr_SetString(client->state->UsageError, "The plugin is not hard RT capable (pass realtime_unsafe=True to run it anyway).");
+        goto fail;
+    }
+
+    // sort the ports out
+    for (i = 0; i < d->PortCount; i++) {
+        LADSPA_PortDescriptor pd = d->PortDescriptors[i];
+        if (LADSPA_IS_PORT_CONTROL(pd)) {
+            pl->num_controls++;
+        } else if (LADSPA_IS_PORT_INPUT(pd)) {
+            if (ins < PYJACK_PLUGIN_AUDIO) pl->input_index[ins] = i;
+            ins++;
+        } else {
+            if (outs < PYJACK_PLUGIN_AUDIO) pl->output_index[outs] = i;
+            outs++;
         }
-    if(! client->active) {
-        if(jack_port_is_mine(client->pjc, src) || jack_port_is_mine(client->pjc, dst)) {
-            PyErr_SetString(JackUsageError, "Jack client must be activated to connect own ports.");
-            return NULL;
+    }
+    if (ins > PYJACK_PLUGIN_AUDIO || outs > PYJACK_PLUGIN_AUDIO) {
+        PyErr_SetString(client->state->UsageError, "The plugin has too many audio ports.");
+        goto fail;
+    }
+    pl->inputs = ins;
+    pl->outputs = outs;
+    pl->mix = mix;
+    if (plugin_map_ports(client, inputs, ins, 1, pl->input_ports, pl->input_is_output) < 0
+        || plugin_map_ports(client, outputs, outs, 0, pl->output_ports, NULL) < 0)
+        goto fail;
+
+    pl->scratch = rt_alloc(client, (outs + 1) * client->buffer_size * sizeof(float));
+    pl->controls = rt_alloc(client, (pl->num_controls ? pl->num_controls : 1) * sizeof(pyjack_control_t));
+    if (!pl->scratch || !pl->controls) {
+        PyErr_NoMemory();
+        goto fail;
+    }
+    pl->scratch_size = client->buffer_size;
+    for (i = 0, k = 0; i < d->PortCount; i++) {
+        pyjack_control_t * c;
+        if (!LADSPA_IS_PORT_CONTROL(d->PortDescriptors[i])) continue;
+        c = &pl->controls[k++];
+        c->name = d->PortNames[i];
+        c->index = i;
+        c->output = !LADSPA_IS_PORT_INPUT(d->PortDescriptors[i]);
+        c->param = -1;
+        if (!c->output)
+            c->value = c->target = c->published
+                = plugin_control_default(&d->PortRangeHints[i], jack_get_sample_rate(client->pjc));
+    }
+    if (controls != Py_None) {
+        PyObject * key, * value;
+        Py_ssize_t pos = 0;
+        while (PyDict_Next(controls, &pos, &key, &value)) {
+#if PY_MAJOR_VERSION >= 3
+            const char * name = PyUnicode_AsUTF8(key);
+#else
+            const char * name = PyString_AsString(key);
+#endif
+            double v = name ? PyFloat_AsDouble(value) : -1.0;
+            pyjack_control_t * c;
+            if (v == -1.0 && PyErr_Occurred())
+                goto fail;
+            c = find_plugin_control(client, pl, name, 1);
+            if (!c) goto fail;
+            c->value = c->target = c->published = (float)v;
         }
     }
-    int error = jack_connect(client->pjc, src_name, dst_name);
-    if (error !=0 && error != EEXIST) {
-        PyErr_SetString(JackError, "Failed to connect ports.");
-        return NULL;
+
+    pl->instance = d->instantiate(d, jack_get_sample_rate(client->pjc));
+    if (!pl->instance) {
+        PyErr_SetString(client->state->Error, "Unable to instantiate the plugin.");
+        goto fail;
     }
+    for (k = 0; k < pl->num_controls; k++)
+        d->connect_port(pl->instance, pl->controls[k].index, &pl->controls[k].value);
+    if (d->activate) d->activate(pl->instance);
+
+    // append the plugin to a copy of the chain, and swap it in
+    chain = rt_alloc(client, sizeof(*chain));
+    if (!chain) {
+        PyErr_NoMemory();
+        goto fail;
+    }
+    old = client->chain;
+    if (old) memcpy(chain, old, sizeof(*chain));
+    pl->id = ++client->plugin_next_id;
+    chain->plugins[chain->count++] = pl;
+    __atomic_store_n(&client->chain, chain, __ATOMIC_RELEASE);
+    if (old) {
+        pyjack_wait_cycle(client);
+        rt_free(client, old);
+    }
+    return Py_BuildValue("I", pl->id);
 
-    Py_INCREF(Py_None);
-    return Py_None;
+fail:
+    plugin_free(client, pl);
+    return NULL;
 }
 
-static int jack_port_connected_to_extern(const pyjack_client_t * client, 
-                                         const jack_port_t * src, 
-                                         const char* dst_name)
+// Stop running a plugin and unload it
+static PyObject* remove_plugin(PyObject* self, PyObject* args)
 {
-    // finds connections of src, then checks if dst is in there
-    const char ** existing_connections = jack_port_get_all_connections(client->pjc, src);
-    if (existing_connections) {
-        int i; // non C99 nonsense
-        for (i = 0; existing_connections[i]; i++) {
-            if (strcmp(existing_connections[i], dst_name) == 0) {
-                jack_free(existing_connections);
-                return 1;
-            }
+    pyjack_client_t * client = self_or_global_client(self);
+    unsigned int id;
+    pyjack_plugin_t * pl;
+    pyjack_chain_t * chain = NULL, * old;
+    int i;
+
+    if (! PyArg_ParseTuple(args, "I", &id))
+        return NULL;
+    pl = find_plugin(client, id);
+    if (!pl) return NULL;
+
+    old = client->chain;
+    if (old->count > 1) {
+        chain = rt_alloc(client, sizeof(*chain));
+        if (!chain)
+            return PyErr_NoMemory();
+        for (i = 0; i < old->count; i++) {
+            if (old->plugins[i] != pl)
+                chain->plugins[chain->count++] = old->plugins[i];
         }
     }
-    jack_free(existing_connections);
-    return 0;
+    __atomic_store_n(&client->chain, chain, __ATOMIC_RELEASE);
+    pyjack_wait_cycle(client);
+    rt_free(client, old);
+    plugin_free(client, pl);
+    Py_INCREF(Py_None);
+    return Py_None;
 }
 
-// disconnect_port
-static PyObject* port_disconnect(PyObject* self, PyObject* args)
+// Set a control input of a plugin, taken over by the RT thread at the next period
+static PyObject* set_plugin_control(PyObject* self, PyObject* args)
 {
-    char* src_name;
-    char* dst_name;
     pyjack_client_t * client = self_or_global_client(self);
+    unsigned int id;
+    const char * name;
+    float value;
+    pyjack_plugin_t * pl;
+    pyjack_control_t * c;
 
-    if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
+    if (! PyArg_ParseTuple(args, "Isf", &id, &name, &value))
         return NULL;
-    }
-
-    if (! PyArg_ParseTuple(args, "ss", &src_name, &dst_name))
+    if (!(pl = find_plugin(client, id)) || !(c = find_plugin_control(client, pl, name, 1)))
         return NULL;
+    __atomic_store(&c->target, &value, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->param, -1, __ATOMIC_RELEASE);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
 
-    jack_port_t * src = jack_port_by_name(client->pjc, src_name);
-    if (!src) {
-        PyErr_SetString(JackUsageError, "Non existing source port.");
+// Have a control input of a plugin follow a parameter
+static PyObject* bind_plugin_control(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    unsigned int id;
+    const char * name;
+    const char * param_name = NULL;
+    int param = -1;
+    pyjack_plugin_t * pl;
+    pyjack_control_t * c;
+
+    if (! PyArg_ParseTuple(args, "Isz", &id, &name, &param_name))
         return NULL;
-    }
-
-    jack_port_t * dst = jack_port_by_name(client->pjc, dst_name);
-    if (!dst) {
-        PyErr_SetString(JackUsageError, "Non existing destination port.");
+    if (!(pl = find_plugin(client, id)) || !(c = find_plugin_control(client, pl, name, 1)))
+        return NULL;
+    if (param_name && (param = find_param(client, param_name)) < 0) {
+        PyErr_SetString(client->state->UsageError, "Parameter not found.");
         return NULL;
     }
-
-    if(jack_port_connected_to_extern(client, src, dst_name)) {
-        if (jack_disconnect(client->pjc, src_name, dst_name)) {
-            PyErr_SetString(JackError, "Failed to disconnect ports.");
-            return NULL;
-        }
-    }
-
+    // unbound, the control keeps the parameter's last value
+    if (c->param >= 0)
+        __atomic_store(&c->target, &client->params[c->param].value, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->param, param, __ATOMIC_RELEASE);
     Py_INCREF(Py_None);
     return Py_None;
 }
 
-// get_buffer_size
-static PyObject* get_buffer_size(PyObject* self, PyObject* args)
+// Values of the control ports of a plugin, as of the end of the last period
+static PyObject* get_plugin_controls(PyObject* self, PyObject* args)
 {
     pyjack_client_t * client = self_or_global_client(self);
+    unsigned int id;
+    pyjack_plugin_t * pl;
+    PyObject * d;
+    int k;
 
-    if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
+    if (! PyArg_ParseTuple(args, "I", &id))
         return NULL;
+    if (!(pl = find_plugin(client, id)))
+        return NULL;
+    d = PyDict_New();
+    if (!d) return NULL;
+    for (k = 0; k < pl->num_controls; k++) {
+        float value;
+        PyObject * v;
+        __atomic_load(&pl->controls[k].published, &value, __ATOMIC_RELAXED);
+        v = PyFloat_FromDouble(value);
+        if (!v || PyDict_SetItemString(d, pl->controls[k].name, v) < 0) {
+            Py_XDECREF(v);
+            Py_DECREF(d);
+            return NULL;
+        }
+        Py_DECREF(v);
     }
+    return d;
+}
+#endif
 
-    int bs = jack_get_buffer_size(client->pjc);
-    return Py_BuildValue("i", bs);
+// Feedback taps of maximum length sequences of orders 10 to 18
+static const uint32_t mls_taps[] = { 0x240, 0x500, 0xe08, 0x1c80, 0x3802, 0x6000, 0xd008, 0x12000, 0x20400 };
+
+static void measure_free(pyjack_client_t * client, pyjack_measure_t * m)
+{
+    rt_free(client, m->signal);
+    rt_free(client, m->record);
+    rt_free(client, m);
 }
 
-// get_sample_rate
-static PyObject* get_sample_rate(PyObject* self, PyObject* args)
+// Find the test signal in the recording: cross-correlate them with FFTs, take the strongest
+// lag (either polarity) and refine it with a parabola through its neighbours.
+// Returns -1 when out of memory.
+static int measure_correlate(pyjack_measure_t * m, double * lag, double * correlation, double * snr)
 {
-    pyjack_client_t * client = self_or_global_client(self);
-    if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
-        return NULL;
+    uint32_t maxlag = m->capacity - m->length, k, best = 0;
+    int N = 1, i;
+    double es = 0.0, ex = 0.0, noise = 0.0, peak, sign, y0, y1, y2, d, delta = 0.0;
+    float * xr, * xi, * sr, * si, * cos_table, * sin_table, * r;
+    int * bitrev;
+
+    while ((uint32_t)N < m->capacity) N <<= 1;
+    xr = calloc(N, sizeof(float));
+    xi = calloc(N, sizeof(float));
+    sr = calloc(N, sizeof(float));
+    si = calloc(N, sizeof(float));
+    cos_table = malloc(N / 2 * sizeof(float));
+    sin_table = malloc(N / 2 * sizeof(float));
+    bitrev = malloc(N * sizeof(int));
+    if (!xr || !xi || !sr || !si || !cos_table || !sin_table || !bitrev) {
+        free(xr); free(xi); free(sr); free(si); free(cos_table); free(sin_table); free(bitrev);
+        return -1;
     }
 
-    int sr = jack_get_sample_rate(client->pjc);
-    return Py_BuildValue("i", sr);
+    // r[k] = sum x[n + k] s[n] = IFFT(X conj(S)), the inverse taken as conj(FFT(conj(.))) / N
+    memcpy(xr, m->record, m->capacity * sizeof(float));
+    memcpy(sr, m->signal, m->length * sizeof(float));
+    fft_tables(N, cos_table, sin_table, bitrev);
+    fft(N, cos_table, sin_table, bitrev, xr, xi);
+    fft(N, cos_table, sin_table, bitrev, sr, si);
+    for (i = 0; i < N; i++) {
+        float re = xr[i] * sr[i] + xi[i] * si[i];
+        float im = xi[i] * sr[i] - xr[i] * si[i];
+        xr[i] = re;
+        xi[i] = -im;
+    }
+    fft(N, cos_table, sin_table, bitrev, xr, xi);
+    r = xr;
+    for (i = 0; i < N; i++)
+        r[i] /= N;
+
+    for (k = 1; k <= maxlag; k++) {
+        if (fabsf(r[k]) > fabsf(r[best])) best = k;
+    }
+    peak = r[best];
+    sign = peak < 0.0 ? -1.0 : 1.0;
+    if (best > 0 && best < maxlag) {
+        y0 = sign * r[best - 1];
+        y1 = sign * r[best];
+        y2 = sign * r[best + 1];
+        d = y0 - 2.0 * y1 + y2;
+        if (d < 0.0) delta = 0.5 * (y0 - y2) / d;
+        if (delta > 0.5) delta = 0.5;
+        if (delta < -0.5) delta = -0.5;
+    }
+    *lag = best + delta;
+
+    for (k = 0; k < m->length; k++) {
+        es += (double)m->signal[k] * m->signal[k];
+        ex += (double)m->record[best + k] * m->record[best + k];
+    }
+    *correlation = (es > 0.0 && ex > 0.0) ? peak / sqrt(es * ex) : 0.0;
+    // mean power of the correlation away from the peak
+    for (k = 0, i = 0; k <= maxlag; k++) {
+        if (k + 2 >= best && k <= best + 2) continue;
+        noise += (double)r[k] * r[k];
+        i++;
+    }
+    noise = i ? noise / i : 0.0;
+    *snr = noise > 0.0 ? 10.0 * log10(peak * peak / noise) : INFINITY;
+
+    free(xr); free(xi); free(sr); free(si); free(cos_table); free(sin_table); free(bitrev);
+    return 0;
 }
 
-// activate
-static PyObject* activate(PyObject* self, PyObject* args)
+// Measure the latency from an output port to an input port with a maximum length sequence
+static PyObject* measure_roundtrip(PyObject* self, PyObject* args, PyObject* kwds)
 {
+    static char *kwlist[] = {"out_port", "in_port", "max_latency", "order", "level", NULL};
     pyjack_client_t * client = self_or_global_client(self);
+    const char * out_name, * in_name;
+    double max_latency = 0.5;
+    int order = 14;
+    float level = 0.5f;
+    int out_index, in_index, interrupted = 0;
+    uint32_t i, lfsr = 1, state;
+    jack_nframes_t rate;
+    pyjack_measure_t * m;
+    double lag, correlation, snr, timeout, waited = 0.0;
+
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "ss|dif", kwlist, &out_name, &in_name, &max_latency, &order, &level))
+        return NULL;
     if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
         return NULL;
     }
-
-    if(client->active) {
-        PyErr_SetString(JackUsageError, "Client is already active.");
+    if (order < 10 || order > 18 || max_latency <= 0.0 || max_latency > 10.0 || !(level > 0.f && level <= 1.f)) {
+        PyErr_SetString(PyExc_ValueError, "order must be between 10 and 18, max_latency between 0 and 10 seconds, and level in (0, 1]");
         return NULL;
     }
-
-    if(jack_activate(client->pjc) != 0) {
-        PyErr_SetString(JackUsageError, "Could not activate client.");
+    if (!client->active || !client->doProcessing) {
+        PyErr_SetString(client->state->UsageError, "The client must be active, with processing enabled.");
+        return NULL;
+    }
+    if (client->measure) {
+        PyErr_SetString(client->state->UsageError, "A round-trip measurement is running.");
+        return NULL;
+    }
+    out_index = find_client_port(client->output_ports, client->num_outputs, out_name);
+    in_index = find_client_port(client->input_ports, client->num_inputs, in_name);
+    if (out_index < 0 || in_index < 0) {
+        PyErr_SetString(client->state->UsageError, "Port not found.");
         return NULL;
     }
 
-    client->active = 1;
-    Py_INCREF(Py_None);
-    return Py_None;
-}
+    rate = jack_get_sample_rate(client->pjc);
+    m = rt_alloc(client, sizeof(*m));
+    if (!m)
+        return PyErr_NoMemory();
+    memset(m, 0, sizeof(*m));
+    m->out_port = client->output_ports[out_index];
+    m->in_port = client->input_ports[in_index];
+    m->length = (1u << order) - 1;
+    m->capacity = m->length + (uint32_t)ceil(max_latency * rate);
+    m->signal = rt_alloc(client, m->length * sizeof(float));
+    m->record = rt_alloc(client, m->capacity * sizeof(float));
+    if (!m->signal || !m->record) {
+        measure_free(client, m);
+        return PyErr_NoMemory();
+    }
+    for (i = 0; i < m->length; i++) {
+        m->signal[i] = (lfsr & 1) ? level : -level;
+        lfsr = ((lfsr << 1) | (__builtin_popcount(lfsr & mls_taps[order - 10]) & 1)) & m->length;
+    }
 
-// deactivate
-static PyObject* deactivate(PyObject* self, PyObject* args)
-{
-    pyjack_client_t * client = self_or_global_client(self);
-    if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
+    // wait for the RT thread (twice the expected time, plus some slack for the first cycle)
+    timeout = 2.0 * m->capacity / rate + 1.0;
+    __atomic_store_n(&client->measure, m, __ATOMIC_RELEASE);
+    do {
+        Py_BEGIN_ALLOW_THREADS
+        usleep(10000);
+        Py_END_ALLOW_THREADS
+        waited += 0.01;
+        state = __atomic_load_n(&m->state, __ATOMIC_ACQUIRE);
+        if (PyErr_CheckSignals() < 0) interrupted = 1;
+    } while (state != PYJACK_MEASURE_DONE && !interrupted && waited < timeout && client->pjc);
+    __atomic_store_n(&client->measure, NULL, __ATOMIC_RELEASE);
+    pyjack_wait_cycle(client);
+
+    if (interrupted) {
+        measure_free(client, m);
         return NULL;
     }
-
-    if(! client->active) {
-        PyErr_SetString(JackUsageError, "Client is not active.");
+    if (state != PYJACK_MEASURE_DONE) {
+        measure_free(client, m);
+        PyErr_SetString(client->state->Error, "The measurement did not complete (is the client still running?)");
         return NULL;
     }
+    if (measure_correlate(m, &lag, &correlation, &snr) < 0) {
+        measure_free(client, m);
+        return PyErr_NoMemory();
+    }
+    measure_free(client, m);
+
+    return Py_BuildValue("{s:d,s:i,s:d,s:d,s:O}",
+                         "latency", lag,
+                         "frames", (int)floor(lag + 0.5),
+                         "correlation", fabs(correlation),
+                         "snr", snr,
+                         "inverted", correlation < 0.0 ? Py_True : Py_False);
+}
 
-    if(jack_deactivate(client->pjc) != 0) {
-        PyErr_SetString(JackError, "Could not deactivate client.");
+// Start recording into a trace ring of the given number of records (replacing any previous one)
+static PyObject* enable_trace(PyObject* self, PyObject* args, PyObject* kwds)
+{
+    static char *kwlist[] = {"capacity", NULL};
+    pyjack_client_t * client = self_or_global_client(self);
+    int capacity = PYJACK_TRACE_DEFAULT_CAPACITY;
+    uint32_t size = 16;
+    pyjack_trace_t * t;
+
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "|i", kwlist, &capacity))
+        return NULL;
+    if (capacity <= 0 || capacity > (1 << 24)) {
+        PyErr_SetString(PyExc_ValueError, "capacity must be between 1 and 16777216 records");
         return NULL;
     }
+    while (size < (uint32_t)capacity)
+        size <<= 1;
+
+    t = rt_alloc(client, sizeof(pyjack_trace_t) + size * sizeof(pyjack_trace_record_t));
+    if (!t) return PyErr_NoMemory();
+    t->mask = size - 1;
+
+    trace_free(client);
+    __atomic_store_n(&client->trace, t, __ATOMIC_RELEASE);
 
-    client->active = 0;
     Py_INCREF(Py_None);
     return Py_None;
 }
 
-static PyObject * get_client_name(PyObject* self, PyObject* args)
+// Stop recording and drop the trace ring
+static PyObject* disable_trace(PyObject* self, PyObject* args)
 {
     pyjack_client_t * client = self_or_global_client(self);
-    if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
-        return NULL;
-    }
-    return Py_BuildValue("s", jack_get_client_name(client->pjc));
+    trace_free(client);
+    Py_INCREF(Py_None);
+    return Py_None;
 }
 
-/** Commit a chunk of audio for the outgoing stream, if any.
-  * Return the next chunk of audio from the incoming stream, if any
-  */
-static PyObject* process(PyObject* self, PyObject *args)
+// Write the trace ring as Chrome/Perfetto JSON; returns the number of events written
+static PyObject* dump_trace(PyObject* self, PyObject* args)
 {
-    int j, c, r;
-    PyArrayObject *input_array;
-    PyArrayObject *output_array;
-
+    static const char * names[PYJACK_TRACE_TYPES] = {
+        "cycle", "post_cycle", "input_write", "input_overflow", "output_read", "underrun",
+        "process", "input_wait", "gil_wait", "input_sync_error", "output_sync_error",
+        "xrun", "buffer_size", "graph_order", "shutdown", "reconnect"
+    };
+    static const char * threads[] = { NULL, "jack process", "jack notification", "python" };
     pyjack_client_t * client = self_or_global_client(self);
-    if(! client->active) {
-        PyErr_SetString(JackUsageError, "Client is not active.");
+    pyjack_trace_t * t = client->trace;
+    pyjack_trace_record_t * copy;
+    uint32_t head, first, index, count = 0, i;
+    const char * path;
+    FILE * f;
+    int pid = getpid();
+
+    if (! PyArg_ParseTuple(args, "s", &path))
+        return NULL;
+    if (!t) {
+        PyErr_SetString(client->state->UsageError, "Tracing is not enabled.");
         return NULL;
     }
 
-    // Import the first and only arg...
-    if (! PyArg_ParseTuple(args, "O!O!", &PyArray_Type, &output_array, &PyArray_Type, &input_array))
-        return NULL;
+    // take a consistent copy of the complete records, skipping those being overwritten
+    copy = malloc((t->mask + 1) * sizeof(pyjack_trace_record_t));
+    if (!copy) return PyErr_NoMemory();
+    head = __atomic_load_n(&t->head, __ATOMIC_ACQUIRE);
+    first = (head > t->mask + 1) ? head - (t->mask + 1) : 0;
+    for (index = first; index != head; index++) {
+        pyjack_trace_record_t * rec = &t->records[index & t->mask];
+        if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != index + 1) continue;
+        copy[count] = *rec;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&rec->seq, __ATOMIC_RELAXED) != index + 1) continue;
+        if (copy[count].type >= PYJACK_TRACE_TYPES) continue;
+        count++;
+    }
 
-    if(!PyArray_ISFLOAT(input_array) || !PyArray_ISFLOAT(output_array)) {
-        PyErr_SetString(PyExc_ValueError, "arrays must be of type float");
+    f = fopen(path, "w");
+    if (!f) {
+        free(copy);
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+    }
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (i = PYJACK_THREAD_RT; i <= PYJACK_THREAD_PYTHON; i++)
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                (i == PYJACK_THREAD_RT) ? "" : ",\n", pid, i, threads[i]);
+    for (i = 0; i < count; i++) {
+        const pyjack_trace_record_t * rec = &copy[i];
+        fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"pyjack\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":%d,\"tid\":%u",
+                names[rec->type], rec->phase, (unsigned long long)rec->time, pid, rec->thread);
+        if (rec->phase == 'X')
+            fprintf(f, ",\"dur\":%u", rec->arg);
+        else if (rec->phase == 'i')
+            fprintf(f, ",\"s\":\"%c\",\"args\":{\"value\":%u}", rec->type == PYJACK_TRACE_XRUN ? 'g' : 't', rec->arg);
+        else
+            fprintf(f, ",\"args\":{\"frames\":%u}", rec->arg);
+        fprintf(f, "}");
+    }
+    fprintf(f, "\n]}\n");
+    free(copy);
+    if (fclose(f))
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+
+    return Py_BuildValue("I", count);
+}
+
+// Start analyzing some of the input ports in a worker thread
+static PyObject* enable_analyzer(PyObject* self, PyObject* args, PyObject* kwds)
+{
+    static char *kwlist[] = {"ports", "fft_size", "hop", "window", "averaging", NULL};
+    pyjack_client_t * client = self_or_global_client(self);
+    PyObject * portlist;
+    int fft_size = 2048;
+    int hop = 0;
+    const char * window = "hann";
+    float averaging = 0.f;
+    pyjack_analyzer_t * an, * old;
+    double sum = 0.0;
+    int i;
+
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "O|iisf", kwlist, &portlist, &fft_size, &hop, &window, &averaging))
+        return NULL;
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
         return NULL;
     }
-    if(PyArray_NDIM(input_array) != 2 || PyArray_NDIM(output_array) != 2) {
-        printf("%d, %d\n", PyArray_NDIM(input_array), PyArray_NDIM(output_array));
-        PyErr_SetString(PyExc_ValueError, "arrays must be two dimensional");
+    if (fft_size < PYJACK_ANALYZER_MIN_FFT || fft_size > PYJACK_ANALYZER_MAX_FFT || (fft_size & (fft_size - 1))) {
+        PyErr_SetString(PyExc_ValueError, "fft_size must be a power of two between 16 and 65536");
         return NULL;
     }
-    if((client->num_inputs > 0 && PyArray_DIM(input_array, 1) != client->buffer_size) ||
-       (client->num_outputs > 0 && PyArray_DIM(output_array, 1) != client->buffer_size)) {
-        PyErr_SetString(PyExc_ValueError, "columns of arrays must match buffer size.");
+    if (!hop) hop = fft_size / 2;
+    if (hop < 1 || hop > fft_size) {
+        PyErr_SetString(PyExc_ValueError, "hop must be between 1 and fft_size");
         return NULL;
     }
-    if(client->num_inputs > 0 && PyArray_DIM(input_array, 0) != client->num_inputs) {
-        PyErr_SetString(PyExc_ValueError, "rows for input array must match number of input ports");
+    if (averaging < 0.f || averaging >= 1.f) {
+        PyErr_SetString(PyExc_ValueError, "averaging must be in [0, 1)");
         return NULL;
     }
-    if(client->num_outputs > 0 && PyArray_DIM(output_array, 0) != client->num_outputs) {
-        PyErr_SetString(PyExc_ValueError, "rows for output array must match number of output ports");
+    if (strcmp(window, "hann") && strcmp(window, "hamming") && strcmp(window, "blackman") && strcmp(window, "rectangular")) {
+        PyErr_SetString(PyExc_ValueError, "window must be one of 'hann', 'hamming', 'blackman' or 'rectangular'");
         return NULL;
     }
 
-    // Get input data
-    // If we are out of sync, there might be bad data in the buffer
-    // So we have to throw that away first...
-    if (client->input_buffer_size) {
-        r = read(client->input_pipe[R], client->input_buffer_1, client->input_buffer_size);
-
-        // Copy data into array...
-        for(c = 0; c < client->num_inputs; c++) {
-            for(j = 0; j < client->buffer_size; j++) {
-                memcpy(
-                    PyArray_DATA(input_array) + (c*PyArray_STRIDE(input_array, 0) + j*PyArray_STRIDE(input_array, 1)),
-                    client->input_buffer_1 + j + (c*client->buffer_size), 
-                    sizeof(float)
-                );
-            }
-        }
+    PyObject* seq = PySequence_Fast(portlist, "ports must be a sequence of port names");
+    if (!seq) return NULL;
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+    if (count < 1 || count > PYJACK_MAX_PORTS) {
+        Py_DECREF(seq);
+        PyErr_SetString(PyExc_ValueError, "need between 1 and 256 ports");
+        return NULL;
+    }
 
-        if(!client->iosync) {
-            PyErr_SetString(JackInputSyncError, "Input data stream is not synchronized.");
+    an = rt_alloc(client, sizeof(*an));
+    if (!an) {
+        Py_DECREF(seq);
+        return PyErr_NoMemory();
+    }
+    an->channels = count;
+    for (i = 0; i < count; i++) {
+#if PY_MAJOR_VERSION >= 3
+        const char* pname = PyUnicode_AsUTF8(PySequence_Fast_GET_ITEM(seq, i));
+#else
+        const char* pname = PyString_AsString(PySequence_Fast_GET_ITEM(seq, i));
+#endif
+        int index = pname ? find_client_port(client->input_ports, client->num_inputs, pname) : -1;
+        if (index < 0) {
+            if (!PyErr_Occurred())
+                PyErr_SetString(client->state->UsageError, "Only input ports of this client can be analyzed.");
+            Py_DECREF(seq);
+            rt_free(client, an);
             return NULL;
         }
+        an->ports[i] = client->input_ports[index];
+    }
+    Py_DECREF(seq);
+
+    an->fft_size = fft_size;
+    an->bins = fft_size / 2 + 1;
+    an->hop = hop;
+    an->averaging = averaging;
+    an->ring_size = 1;
+    while (an->ring_size < 4 * (uint32_t)(fft_size + client->buffer_size)) an->ring_size <<= 1;
+    an->ring = rt_alloc(client, (size_t)an->ring_size * count * sizeof(float));
+    an->window = malloc(fft_size * sizeof(float));
+    an->re = malloc(fft_size * sizeof(float));
+    an->im = malloc(fft_size * sizeof(float));
+    an->cos_table = malloc(fft_size / 2 * sizeof(float));
+    an->sin_table = malloc(fft_size / 2 * sizeof(float));
+    an->bitrev = malloc(fft_size * sizeof(int));
+    an->average = calloc((size_t)an->bins * count, sizeof(float));
+    an->spectra[0] = calloc((size_t)an->bins * count, sizeof(float));
+    an->spectra[1] = calloc((size_t)an->bins * count, sizeof(float));
+    sem_init(&an->wakeup, 0, 0);
+    if (!an->ring || !an->window || !an->re || !an->im || !an->cos_table || !an->sin_table ||
+        !an->bitrev || !an->average || !an->spectra[0] || !an->spectra[1]) {
+        analyzer_free(client, an);
+        return PyErr_NoMemory();
     }
 
-    if (client->output_buffer_size) {
-        // Copy output data into output buffer...
-        for(c = 0; c < client->num_outputs; c++) {
-            for(j = 0; j < client->buffer_size; j++) {
-                memcpy(&client->output_buffer_1[j + (c*client->buffer_size)],
-                       PyArray_DATA(output_array) + c*PyArray_STRIDE(output_array, 0) + j*PyArray_STRIDE(output_array, 1),
-                       sizeof(float)
-                );
-            }
-        }
-
-        // Send... raise an exception if the output data stream is full.
-        r = write(client->output_pipe[W], client->output_buffer_1, client->output_buffer_size);
+    // periodic window, scaled so that a full-scale sine shows up with magnitude 1
+    for (i = 0; i < fft_size; i++) {
+        double x = 2.0 * M_PI * i / fft_size;
+        double w = 1.0;
+        if (!strcmp(window, "hann")) w = 0.5 - 0.5 * cos(x);
+        else if (!strcmp(window, "hamming")) w = 0.54 - 0.46 * cos(x);
+        else if (!strcmp(window, "blackman")) w = 0.42 - 0.5 * cos(x) + 0.08 * cos(2.0 * x);
+        an->window[i] = w;
+        sum += w;
+    }
+    for (i = 0; i < fft_size; i++)
+        an->window[i] *= 2.0 / sum;
+    fft_tables(fft_size, an->cos_table, an->sin_table, an->bitrev);
+
+    an->running = 1;
+    if (pthread_create(&an->thread, NULL, analyzer_thread, an)) {
+        an->running = 0;
+        analyzer_free(client, an);
+        PyErr_SetString(client->state->Error, "Failed to start the analyzer thread.");
+        return NULL;
+    }
 
-        if(r != client->output_buffer_size) {
-            PyErr_SetString(JackOutputSyncError, "Failed to write output data.");
-            return NULL;
-        }
+    // replace the previous analyzer, if any
+    old = __atomic_exchange_n(&client->analyzer, an, __ATOMIC_ACQ_REL);
+    if (old) {
+        pyjack_wait_cycle(client);
+        analyzer_free(client, old);
     }
 
-    // Okay...    
     Py_INCREF(Py_None);
     return Py_None;
 }
 
-// Return event status numbers...
-static PyObject* check_events(PyObject* self, PyObject *args)
+// Stop the analyzer
+static PyObject* disable_analyzer(PyObject* self, PyObject* args)
 {
     pyjack_client_t * client = self_or_global_client(self);
-
-    PyObject* d;
-    d = PyDict_New();
-    if(d == NULL) return NULL;
-
-    PyDict_SetItemString(d, "graph_ordering", Py_BuildValue("i", client->event_graph_ordering));
-    PyDict_SetItemString(d, "port_registration", Py_BuildValue("i", client->event_port_registration));
-    PyDict_SetItemString(d, "xrun", Py_BuildValue("i", client->event_xrun));
-    PyDict_SetItemString(d, "shutdown", Py_BuildValue("i", client->event_shutdown));
-    PyDict_SetItemString(d, "hangup", Py_BuildValue("i", client->event_hangup));
-
-    // Reset all
-    client->event_graph_ordering = 0;
-    client->event_port_registration = 0;
-    client->event_xrun = 0;
-    client->event_shutdown = 0;
-    client->event_hangup = 0;
-
-    return d;
+    pyjack_analyzer_t * an = __atomic_exchange_n(&client->analyzer, NULL, __ATOMIC_ACQ_REL);
+    if (an) {
+        pyjack_wait_cycle(client);
+        analyzer_free(client, an);
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
 }
 
-static PyObject* get_frame_time(PyObject* self, PyObject* args)
+// Return the latest magnitude spectra, or None before the first one is ready
+static PyObject* get_spectrum(PyObject* self, PyObject* args)
 {
     pyjack_client_t * client = self_or_global_client(self);
-    if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
+    pyjack_analyzer_t * an = client->analyzer;
+    PyArrayObject * spectrum;
+    npy_intp dims[2];
+    uint32_t generation;
+    jack_nframes_t frame_time;
+    int tries = 0;
+
+    if (!an) {
+        PyErr_SetString(client->state->UsageError, "The analyzer is not enabled.");
         return NULL;
     }
-
-    int frt = jack_frame_time(client->pjc);
-    return Py_BuildValue("i", frt);
-}
-
-static PyObject* get_current_transport_frame(PyObject* self, PyObject* args)
-{
-    pyjack_client_t * client = self_or_global_client(self);
-    if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
+    if (pyjack_numpy() < 0)
         return NULL;
+    if (!__atomic_load_n(&an->generation, __ATOMIC_ACQUIRE)) {
+        Py_INCREF(Py_None);
+        return Py_None;
     }
 
-    int ftr = jack_get_current_transport_frame(client->pjc);
-    return Py_BuildValue("i", ftr);
+    dims[0] = an->channels;
+    dims[1] = an->bins;
+    spectrum = (PyArrayObject*)PyArray_SimpleNew(2, dims, NPY_FLOAT32);
+    if (!spectrum) return NULL;
+
+    // the worker writes the other buffer until it publishes, then starts on this one:
+    // retry if it published anything while we copied (a few times; it publishes once per hop)
+    do {
+        if (tries++ == 100) {
+            Py_DECREF(spectrum);
+            PyErr_SetString(client->state->Error, "The analyzer publishes spectra faster than they can be copied.");
+            return NULL;
+        }
+        generation = __atomic_load_n(&an->generation, __ATOMIC_ACQUIRE);
+        memcpy(PyArray_DATA(spectrum), an->spectra[generation & 1], (size_t)an->channels * an->bins * sizeof(float));
+        frame_time = an->frame_time[generation & 1];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&an->generation, __ATOMIC_RELAXED) != generation);
+
+    return Py_BuildValue("(NI)", spectrum, frame_time);
 }
 
-static PyObject* transport_locate (PyObject* self, PyObject* args)
+// Keep the last seconds of some input ports in a ring written by the RT thread
+static PyObject* enable_history(PyObject* self, PyObject* args)
 {
     pyjack_client_t * client = self_or_global_client(self);
-    jack_nframes_t newfr;
+    PyObject * portlist;
+    double seconds;
+    pyjack_history_t * h, * old;
+    double frames;
+    int i;
 
-    if (! PyArg_ParseTuple(args, "i", &newfr))
+    if (! PyArg_ParseTuple(args, "Od", &portlist, &seconds))
         return NULL;
-
     if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+    // a quarter of the ring is the guard, and the RT thread writes at most an eighth of it per cycle
+    frames = seconds * jack_get_sample_rate(client->pjc);
+    if (frames < 1.0 || frames > (1u << 30)) {
+        PyErr_SetString(PyExc_ValueError, "seconds must be positive, and less than 2^30 frames");
         return NULL;
     }
 
-    jack_transport_locate (client->pjc,newfr);
+    PyObject* seq = PySequence_Fast(portlist, "ports must be a sequence of port names");
+    if (!seq) return NULL;
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+    if (count < 1 || count > PYJACK_MAX_PORTS) {
+        Py_DECREF(seq);
+        PyErr_SetString(PyExc_ValueError, "need between 1 and 256 ports");
+        return NULL;
+    }
+
+    h = rt_alloc(client, sizeof(*h));
+    if (!h) {
+        Py_DECREF(seq);
+        return PyErr_NoMemory();
+    }
+    h->channels = count;
+    for (i = 0; i < count; i++) {
+#if PY_MAJOR_VERSION >= 3
+        const char* pname = PyUnicode_AsUTF8(PySequence_Fast_GET_ITEM(seq, i));
+#else
+        const char* pname = PyString_AsString(PySequence_Fast_GET_ITEM(seq, i));
+#endif
+        int index = pname ? find_client_port(client->input_ports, client->num_inputs, pname) : -1;
+        if (index < 0) {
+            if (!PyErr_Occurred())
+                PyErr_SetString(client->state->UsageError, "Only input ports of this client can be recorded.");
+            Py_DECREF(seq);
+            rt_free(client, h);
+            return NULL;
+        }
+        h->ports[i] = client->input_ports[index];
+    }
+    Py_DECREF(seq);
+
+    h->ring_size = 1;
+    while (h->ring_size - h->ring_size / 4 < frames || h->ring_size < 8 * (uint32_t)client->buffer_size)
+        h->ring_size <<= 1;
+    h->ring = rt_alloc(client, (size_t)h->ring_size * count * sizeof(float));
+    if (!h->ring) {
+        rt_free(client, h);
+        return PyErr_NoMemory();
+    }
+
+    // replace the previous history, if any
+    old = __atomic_exchange_n(&client->history, h, __ATOMIC_ACQ_REL);
+    if (old) {
+        pyjack_wait_cycle(client);
+        rt_free(client, old->ring);
+        rt_free(client, old);
+    }
+
+    Py_INCREF(Py_None);
     return Py_None;
 }
 
-static PyObject* get_transport_state (PyObject* self, PyObject* args)
+// Stop recording the history
+static PyObject* disable_history(PyObject* self, PyObject* args)
 {
-    //int state;
     pyjack_client_t * client = self_or_global_client(self);
-    if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
-        return NULL;
+    pyjack_history_t * h = __atomic_exchange_n(&client->history, NULL, __ATOMIC_ACQ_REL);
+    if (h) {
+        pyjack_wait_cycle(client);
+        rt_free(client, h->ring);
+        rt_free(client, h);
     }
-
-    jack_transport_state_t transport_state;
-    transport_state = jack_transport_query (client->pjc, NULL);
-
-    return Py_BuildValue("i", transport_state);
+    Py_INCREF(Py_None);
+    return Py_None;
 }
 
-#ifdef JACK2
-static PyObject* get_version(PyObject* self, PyObject* args)
+// Consistent copy of the write position of the history
+static void history_position(pyjack_history_t * h, uint64_t * write_frames, uint64_t * valid_from, jack_nframes_t * frame_time)
 {
-    int major, minor, micro, proto;
-    jack_get_version(&major, &minor, &micro, &proto);
-    return Py_BuildValue("iiii", major, minor, micro, proto);
+    uint32_t seq;
+    do {
+        seq = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+        *write_frames = h->write_frames;
+        *valid_from = h->valid_from;
+        *frame_time = h->write_frame_time;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&h->seq, __ATOMIC_RELAXED));
 }
-#endif
 
-#ifdef JACK2
-static PyObject* get_version_string(PyObject* self, PyObject* args)
+static void wav_put(unsigned char ** p, uint32_t value, int bytes)
 {
-    const char* version;
-    version = jack_get_version_string();
-    return Py_BuildValue("s", version);
+    int i;
+    for (i = 0; i < bytes; i++)
+        *(*p)++ = (value >> (8 * i)) & 0xff;
 }
-#endif
 
-static PyObject* get_cpu_load(PyObject* self, PyObject* args)
+// Write channel-major float data to path as an IEEE float WAV file
+static int history_write_wav(const char * path, const float * data, int channels, uint32_t frames, uint32_t sample_rate)
 {
-    pyjack_client_t * client = self_or_global_client(self);
-    if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
-        return NULL;
+    unsigned char header[58], * p = header;
+    uint32_t data_size = frames * channels * sizeof(float);
+    float block[1024];
+    uint32_t i, k;
+    int c, failed;
+    FILE * f = fopen(path, "wb");
+    if (!f) return -1;
+
+    memcpy(p, "RIFF", 4); p += 4;
+    wav_put(&p, 50 + data_size, 4);
+    memcpy(p, "WAVEfmt ", 8); p += 8;
+    wav_put(&p, 18, 4);
+    wav_put(&p, 3, 2);                              // WAVE_FORMAT_IEEE_FLOAT
+    wav_put(&p, channels, 2);
+    wav_put(&p, sample_rate, 4);
+    wav_put(&p, sample_rate * channels * sizeof(float), 4);
+    wav_put(&p, channels * sizeof(float), 2);
+    wav_put(&p, 32, 2);
+    wav_put(&p, 0, 2);
+    memcpy(p, "fact", 4); p += 4;
+    wav_put(&p, 4, 4);
+    wav_put(&p, frames, 4);
+    memcpy(p, "data", 4); p += 4;
+    wav_put(&p, data_size, 4);
+    fwrite(header, sizeof(header), 1, f);
+
+    // interleave
+    k = 0;
+    for (i = 0; i < frames; i++) {
+        for (c = 0; c < channels; c++) {
+            float v = data[(size_t)frames * c + i];
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            uint32_t u;
+            memcpy(&u, &v, sizeof(u));
+            u = __builtin_bswap32(u);
+            memcpy(&v, &u, sizeof(u));
+#endif
+            block[k++] = v;
+            if (k == sizeof(block) / sizeof(block[0])) {
+                fwrite(block, sizeof(float), k, f);
+                k = 0;
+            }
+        }
     }
-
-    float cpu_load = jack_cpu_load(client->pjc);
-
-    return Py_BuildValue("f", cpu_load);
+    fwrite(block, sizeof(float), k, f);
+    failed = ferror(f);
+    if (fclose(f) || failed) return -1;
+    return 0;
 }
 
-static PyObject* get_port_short_name(PyObject* self, PyObject* args)
+// Copy [start_frame, end_frame) of the history into an array, or into a WAV file
+static PyObject* snapshot_history(PyObject* self, PyObject* args, PyObject* kwds)
 {
-    char * port_name;
-
-    if (! PyArg_ParseTuple(args, "s", &port_name))
+    static char *kwlist[] = {"start_frame", "end_frame", "path", NULL};
+    pyjack_client_t * client = self_or_global_client(self);
+    pyjack_history_t * h = client->history;
+    unsigned long start_frame, end_frame;
+    const char * path = NULL;
+    PyArrayObject * array = NULL;
+    uint64_t w, valid_from, oldest, first, start;
+    jack_nframes_t frame_time;
+    uint32_t frames, back, pos, part, sample_rate;
+    float * data;
+    int c, channels, error;
+
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "kk|z", kwlist, &start_frame, &end_frame, &path))
         return NULL;
-
-    if (port_name == NULL) {
-        PyErr_SetString(JackError, "Port name cannot be empty.");
+    if (!h) {
+        PyErr_SetString(client->state->UsageError, "The history is not enabled.");
         return NULL;
     }
 
-    pyjack_client_t * client = self_or_global_client(self);
-    if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
+    // map the frame times onto the ring
+    frames = (jack_nframes_t)end_frame - (jack_nframes_t)start_frame;
+    history_position(h, &w, &valid_from, &frame_time);
+    oldest = (w > h->ring_size - h->ring_size / 4) ? w - (h->ring_size - h->ring_size / 4) : 0;
+    if (oldest < valid_from) oldest = valid_from;
+    // frames from before the history started would wrap start round
+    back = frame_time - (jack_nframes_t)start_frame;
+    start = ((int32_t)back >= 0 && back <= w) ? w - back : 0;
+    if ((int32_t)frames <= 0 || (int32_t)back < 0 || back > w
+        || start < oldest || start + frames > w) {
+        PyErr_Format(PyExc_ValueError, "frames [%u, %u) are not in the history (it holds [%u, %u))",
+                     (jack_nframes_t)start_frame, (jack_nframes_t)end_frame,
+                     (jack_nframes_t)(frame_time - (w - oldest)), frame_time);
         return NULL;
     }
 
-    jack_port_t * port = jack_port_by_name(client->pjc, port_name);
-    if (!port) {
-        PyErr_SetString(JackError, "Port name cannot be empty.");
-        return NULL;
+    if (path) {
+        data = malloc((size_t)frames * h->channels * sizeof(float));
+        if (!data) return PyErr_NoMemory();
+    } else {
+        npy_intp dims[2];
+        if (pyjack_numpy() < 0)
+            return NULL;
+        dims[0] = h->channels;
+        dims[1] = frames;
+        array = (PyArrayObject*)PyArray_SimpleNew(2, dims, NPY_FLOAT32);
+        if (!array) return NULL;
+        data = PyArray_DATA(array);
     }
-    const char * port_short_name = jack_port_short_name(port);
 
-    return Py_BuildValue("s", port_short_name);
+    pos = start & (h->ring_size - 1);
+    part = (frames < h->ring_size - pos) ? frames : h->ring_size - pos;
+    for (c = 0; c < h->channels; c++) {
+        const float * src = h->ring + (size_t)h->ring_size * c;
+        memcpy(data + (size_t)frames * c, src + pos, part * sizeof(float));
+        memcpy(data + (size_t)frames * c + part, src, (frames - part) * sizeof(float));
+    }
+
+    // the RT thread must not have overwritten what we copied in the meantime
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    history_position(h, &w, &valid_from, &frame_time);
+    first = (w > h->ring_size - h->ring_size / 4) ? w - (h->ring_size - h->ring_size / 4) : 0;
+    if (start < first || start < valid_from) {
+        if (path) free(data);
+        else Py_DECREF(array);
+        PyErr_SetString(PyExc_ValueError, "the frames were overwritten while they were copied");
+        return NULL;
+    }
+    if (!path)
+        return (PyObject*)array;
+
+    // disable_history() may free h once the critical section is released
+    channels = h->channels;
+    sample_rate = jack_get_sample_rate(client->pjc);
+    Py_BEGIN_ALLOW_THREADS
+    error = history_write_wav(path, data, channels, frames, sample_rate);
+    Py_END_ALLOW_THREADS
+    free(data);
+    if (error)
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+    return Py_BuildValue("I", frames);
 }
 
-static PyObject* get_port_type(PyObject* self, PyObject* args)
+// Record the input blocks and notifications process() returns into a session file
+static PyObject* capture_session(PyObject* self, PyObject* args)
 {
-    char * port_name;
+    pyjack_client_t * client = self_or_global_client(self);
+    pyjack_session_header_t header;
+    const char * path;
+    FILE * f;
 
-    if (! PyArg_ParseTuple(args, "s", &port_name))
+    if (! PyArg_ParseTuple(args, "s", &path))
         return NULL;
-
-    if (port_name == NULL) {
-        PyErr_SetString(JackError, "Port name cannot be empty.");
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
         return NULL;
     }
-
-    pyjack_client_t * client = self_or_global_client(self);
-    if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
+    if (client->capture) {
+        PyErr_SetString(client->state->UsageError, "A session is already being captured.");
         return NULL;
     }
 
-    jack_port_t * port = jack_port_by_name(client->pjc, port_name);
-    if (!port) {
-        PyErr_SetString(JackError, "Port name cannot be empty.");
-        return NULL;
+    f = fopen(path, "wb");
+    if (!f) return PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PYJACK_SESSION_MAGIC, sizeof(header.magic));
+    header.version = PYJACK_SESSION_VERSION;
+    header.sample_rate = jack_get_sample_rate(client->pjc);
+    header.inputs = client->num_inputs;
+    header.outputs = client->num_outputs;
+    header.buffer_size = client->buffer_size;
+    if (fwrite(&header, sizeof(header), 1, f) != 1) {
+        fclose(f);
+        return PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
     }
-    const char * port_type = jack_port_type(port);
 
-    return Py_BuildValue("s", port_type);
+    // notifications not yet picked up by check_events() belong to the first record
+    __atomic_store_n(&client->session_events,
+                     (client->event_graph_ordering ? PYJACK_EVENT_GRAPH_ORDER : 0) |
+                     (client->event_port_registration ? PYJACK_EVENT_PORT_REGISTRATION : 0) |
+                     (client->event_buffer_size ? PYJACK_EVENT_BUFFER_SIZE : 0) |
+                     (client->event_sample_rate ? PYJACK_EVENT_SAMPLE_RATE : 0) |
+                     (client->event_xrun ? PYJACK_EVENT_XRUN : 0) |
+                     (client->event_shutdown ? PYJACK_EVENT_SHUTDOWN : 0) |
+                     (client->event_hangup ? PYJACK_EVENT_HANGUP : 0) |
+                     (client->event_reconnect ? PYJACK_EVENT_RECONNECT : 0), __ATOMIC_RELAXED);
+    client->session_records = 0;
+    client->capture = f;
+    Py_INCREF(Py_None);
+    return Py_None;
 }
 
-#ifdef JACK2
-static PyObject* get_port_type_id(PyObject* self, PyObject* args)
+// Serve process() and check_events() from a session file instead of jack
+static PyObject* replay_session(PyObject* self, PyObject* args)
 {
-    char * port_name;
-
-    if (! PyArg_ParseTuple(args, "s", &port_name))
-        return NULL;
+    pyjack_client_t * client = self_or_global_client(self);
+    pyjack_session_header_t header;
+    const char * path;
+    FILE * f;
 
-    if (port_name == NULL) {
-        PyErr_SetString(JackError, "Port name cannot be empty.");
+    if (! PyArg_ParseTuple(args, "s", &path))
         return NULL;
-    }
-
-    pyjack_client_t * client = self_or_global_client(self);
-    if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
+    if (client->pjc || client->replay) {
+        PyErr_SetString(client->state->UsageError, "Sessions can only be replayed by a client that is not connected.");
         return NULL;
     }
 
-    jack_port_t * port = jack_port_by_name(client->pjc, port_name);
-    if (!port) {
-        PyErr_SetString(JackError, "Port name cannot be empty.");
+    f = fopen(path, "rb");
+    if (!f) return PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+    if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, PYJACK_SESSION_MAGIC, sizeof(header.magic))
+        || header.version != PYJACK_SESSION_VERSION || header.inputs > PYJACK_MAX_PORTS || header.outputs > PYJACK_MAX_PORTS) {
+        fclose(f);
+        PyErr_Format(PyExc_ValueError, "%s is not a pyjack session file", path);
         return NULL;
     }
 
-    jack_port_type_id_t port_type_id = jack_port_type_id(port);
-
-    int ret = port_type_id;
-    return Py_BuildValue("i", ret);
+    client->num_inputs = header.inputs;
+    client->num_outputs = header.outputs;
+    client->replay_sample_rate = header.sample_rate;
+    client->buffer_size = header.buffer_size;
+    client->replay_pending = 0;
+    client->session_records = 0;
+    memset(&client->input_header_1, 0, sizeof(client->input_header_1));
+    client->replay = f;
+    client->replayed = 1;
+    Py_INCREF(Py_None);
+    return Py_None;
 }
-#endif
 
-static PyObject* is_realtime(PyObject* self, PyObject* args)
+// Stop capturing or replaying
+static PyObject* stop_session(PyObject* self, PyObject* args)
 {
     pyjack_client_t * client = self_or_global_client(self);
-    if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
+    if (!client->capture && !client->replay && !client->capture_error) {
+        PyErr_SetString(client->state->UsageError, "No session is being captured or replayed.");
         return NULL;
     }
-
-    int realtime = jack_is_realtime(client->pjc);
-    return Py_BuildValue("i", realtime);
+    unsigned long records = session_close(client);
+    if (session_error(client) < 0)
+        return NULL;
+    return Py_BuildValue("k", records);
 }
 
-static PyObject* port_is_mine(PyObject* self, PyObject* args)
+// Choose what the output ports play when process() is late
+static PyObject* set_underrun_policy(PyObject* self, PyObject* args, PyObject* kwds)
 {
-    char * port_name;
+    static char *kwlist[] = {"policy", "fade_frames", "repeat_frames", NULL};
+    pyjack_client_t * client = self_or_global_client(self);
+    int policy;
+    int fade = client->underrun_fade;
+    int repeat = client->underrun_repeat;
 
-    if (! PyArg_ParseTuple(args, "s", &port_name))
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "i|ii", kwlist, &policy, &fade, &repeat))
         return NULL;
-
-    if (port_name == NULL) {
-        PyErr_SetString(JackError, "Port name cannot be empty.");
+    if (policy != PYJACK_UNDERRUN_SILENCE && policy != PYJACK_UNDERRUN_REPEAT && policy != PYJACK_UNDERRUN_FADE) {
+        PyErr_SetString(PyExc_ValueError, "policy must be one of UnderrunSilence, UnderrunRepeat, UnderrunFade");
         return NULL;
     }
-
-    pyjack_client_t * client = self_or_global_client(self);
-    if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
+    if (fade < 1) {
+        PyErr_SetString(PyExc_ValueError, "fade_frames must be positive");
         return NULL;
     }
-
-    jack_port_t * port = jack_port_by_name(client->pjc, port_name);
-    if (!port) {
-        PyErr_SetString(JackError, "Port name cannot be empty.");
+    if (repeat < 0) {
+        PyErr_SetString(PyExc_ValueError, "repeat_frames must not be negative");
         return NULL;
     }
 
-    int port_mine = jack_port_is_mine(client->pjc, port);
-    return Py_BuildValue("i", port_mine);
+    client->underrun_fade = fade;
+    client->underrun_repeat = repeat;
+    client->underrun_policy = policy;
+
+    Py_INCREF(Py_None);
+    return Py_None;
 }
 
+// Return the output underrun counters
+static PyObject* get_underrun_stats(PyObject* self, PyObject* args)
+{
+    pyjack_client_t * client = self_or_global_client(self);
+    return Py_BuildValue("{s:i,s:k,s:k,s:I,s:K,s:i}",
+                         "policy", client->underrun_policy,
+                         "periods", client->underrun_periods,
+                         "events", client->underrun_events,
+                         "last_frame_time", client->underrun_frame_time,
+                         "last_usecs", (unsigned long long)client->underrun_usecs,
+                         "active", client->underrun);
+}
 
-static PyObject* transport_stop (PyObject* self, PyObject* args)
+// Export input ports into a shared memory ring, for other processes to read with jack.StreamReader
+static PyObject* export_stream(PyObject* self, PyObject* args, PyObject* kwds)
 {
+    static char *kwlist[] = {"name", "ports", "frames", NULL};
+    char* name;
+    PyObject* portlist;
+    unsigned int frames = 0;
+    int i, slot;
+
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "sO|I", kwlist, &name, &portlist, &frames))
+        return NULL;
+
     pyjack_client_t * client = self_or_global_client(self);
     if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+    if(!*name || strchr(name, '/') || strlen(name) >= sizeof(((pyjack_export_t*)0)->name)) {
+        PyErr_SetString(PyExc_ValueError, "invalid stream name");
         return NULL;
     }
 
-    jack_transport_stop (client->pjc);
+    for (slot = 0; slot < PYJACK_MAX_EXPORTS; slot++) {
+        if (client->exports[slot] && !strcmp(client->exports[slot]->name, name)) {
+            PyErr_SetString(client->state->UsageError, "Stream is already exported.");
+            return NULL;
+        }
+    }
+    for (slot = 0; slot < PYJACK_MAX_EXPORTS && client->exports[slot]; slot++);
+    if (slot == PYJACK_MAX_EXPORTS) {
+        PyErr_SetString(client->state->UsageError, "Cannot export more than 8 streams. Sorry.");
+        return NULL;
+    }
 
-    return Py_None;
-}
+    PyObject* seq = PySequence_Fast(portlist, "ports must be a sequence of port names");
+    if (!seq) return NULL;
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+    if (count < 1 || count > PYJACK_MAX_PORTS) {
+        Py_DECREF(seq);
+        PyErr_SetString(PyExc_ValueError, "need between 1 and 256 ports");
+        return NULL;
+    }
 
-static PyObject* transport_start (PyObject* self, PyObject* args)
-{
-    pyjack_client_t * client = self_or_global_client(self);
-    if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
+    pyjack_export_t * ex = rt_alloc(client, sizeof(*ex));
+    if (!ex) {
+        Py_DECREF(seq);
+        return PyErr_NoMemory();
+    }
+    strcpy(ex->name, name);
+    ex->channels = count;
+    for (i = 0; i < count; i++) {
+#if PY_MAJOR_VERSION >= 3
+        const char* pname = PyUnicode_AsUTF8(PySequence_Fast_GET_ITEM(seq, i));
+#else
+        const char* pname = PyString_AsString(PySequence_Fast_GET_ITEM(seq, i));
+#endif
+        int index = pname ? find_client_port(client->input_ports, client->num_inputs, pname) : -1;
+        if (index < 0) {
+            if (!PyErr_Occurred())
+                PyErr_SetString(client->state->UsageError, "Only input ports of this client can be exported.");
+            Py_DECREF(seq);
+            rt_free(client, ex);
+            return NULL;
+        }
+        ex->ports[i] = client->input_ports[index];
+    }
+    Py_DECREF(seq);
+
+    // ring size: a power of two, one second by default, and at least a few periods
+    unsigned int capacity = 1;
+    if (!frames) frames = jack_get_sample_rate(client->pjc);
+    if (frames < 4 * (unsigned int)client->buffer_size) frames = 4 * client->buffer_size;
+    while (capacity < frames) capacity <<= 1;
+
+    char shmname[258];
+    snprintf(shmname, sizeof(shmname), "/%s", name);
+    int fd = shm_open(shmname, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        rt_free(client, ex);
+        PyErr_SetFromErrnoWithFilename(client->state->Error, shmname);
+        return NULL;
+    }
+    ex->map_size = sizeof(pyjack_stream_header_t) + (size_t)capacity * count * sizeof(float);
+    if (ftruncate(fd, ex->map_size) == 0)
+        ex->header = mmap(NULL, ex->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (!ex->header || ex->header == MAP_FAILED) {
+        ex->header = NULL;
+        shm_unlink(shmname);
+        export_free(client, ex);
+        PyErr_SetString(client->state->Error, "Failed to map shared memory for the stream.");
         return NULL;
     }
+    // touch every page now, rather than in the RT thread
+    memset(ex->header, 0, ex->map_size);
+    if (client->mem_lock) {
+        ex->locked = (mlock(ex->header, ex->map_size) == 0);
+        if (ex->locked)
+            client->mem_locked += ex->map_size;
+        else
+            client->mem_lock_failures++;
+    }
+    ex->data = (float*)(ex->header + 1);
+    ex->header->version = PYJACK_STREAM_VERSION;
+    ex->header->channels = count;
+    ex->header->capacity = capacity;
+    ex->header->sample_rate = jack_get_sample_rate(client->pjc);
+    ex->header->period = client->buffer_size;
+    memcpy(ex->header->magic, PYJACK_STREAM_MAGIC, sizeof(ex->header->magic));
 
-    jack_transport_start (client->pjc);
+    __atomic_store_n(&client->exports[slot], ex, __ATOMIC_RELEASE);
 
+    Py_INCREF(Py_None);
     return Py_None;
 }
 
-static PyObject* set_buffer_size(PyObject* self, PyObject* args)
+// Stop exporting a stream; readers that still have it mapped see no further data
+static PyObject* unexport_stream(PyObject* self, PyObject* args)
 {
-    int size;
+    char* name;
+    int slot;
 
-    if (! PyArg_ParseTuple(args, "i", &size))
+    if (! PyArg_ParseTuple(args, "s", &name))
         return NULL;
 
     pyjack_client_t * client = self_or_global_client(self);
-    if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
-        return NULL;
+    for (slot = 0; slot < PYJACK_MAX_EXPORTS; slot++) {
+        pyjack_export_t * ex = client->exports[slot];
+        if (!ex || strcmp(ex->name, name)) continue;
+        __atomic_store_n(&client->exports[slot], NULL, __ATOMIC_RELEASE);
+        pyjack_wait_cycle(client);
+        char shmname[258];
+        snprintf(shmname, sizeof(shmname), "/%s", ex->name);
+        shm_unlink(shmname);
+        export_free(client, ex);
+        Py_INCREF(Py_None);
+        return Py_None;
     }
-
-    jack_nframes_t nsize = size;
-    jack_set_buffer_size(client->pjc, nsize);
-
-    return Py_None;
+    PyErr_SetString(client->state->UsageError, "Stream not found.");
+    return NULL;
 }
 
 static PyObject* set_sync_timeout(PyObject* self, PyObject* args)
@@ -1317,7 +7386,7 @@ static PyObject* set_sync_timeout(PyObject* self, PyObject* args)
 
     pyjack_client_t * client = self_or_global_client(self);
     if(client->pjc == NULL) {
-        PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established.");
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
         return NULL;
     }
 
@@ -1333,7 +7402,7 @@ static PyObject* set_sync_timeout(PyObject* self, PyObject* args)
     PyObject *temp = NULL;                                              \
     pyjack_client_t * client = self_or_global_client(self);             \
     if(client->pjc == NULL) {                                           \
-      PyErr_SetString(JackNotConnectedError, "Jack connection has not yet been established."); \
+      PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established."); \
       return result;                                                    \
     }                                                                   \
     if (PyArg_ParseTuple(args, "O:"#x"_callback", &temp)) {             \
@@ -1350,69 +7419,387 @@ static PyObject* set_sync_timeout(PyObject* self, PyObject* args)
     }                                                                   \
     return result;                                                      \
   }
-ADD_SETCALLBACK(thread_init);
-ADD_SETCALLBACK(freewheel);
-ADD_SETCALLBACK(buffer_size);
-ADD_SETCALLBACK(client_registration);
-ADD_SETCALLBACK(port_registration);
-ADD_SETCALLBACK(port_connect);
-ADD_SETCALLBACK(graph_order);
-ADD_SETCALLBACK(xrun);
+ADD_SETCALLBACK(thread_init);
+ADD_SETCALLBACK(freewheel);
+ADD_SETCALLBACK(buffer_size);
+ADD_SETCALLBACK(client_registration);
+ADD_SETCALLBACK(port_registration);
+ADD_SETCALLBACK(port_connect);
+ADD_SETCALLBACK(graph_order);
+ADD_SETCALLBACK(xrun);
+#ifdef WANT_LATENCY_CALLBACK
+ADD_SETCALLBACK(latency);
+#endif /* WANT_LATENCY_CALLBACK */
+ADD_SETCALLBACK(reconnect);
+
+#ifdef PYJACK_MOCK
+// Control functions of the mock server (see jackmock.h)
+static PyObject* mock_run(PyObject* self, PyObject* args, PyObject* kwds)
+{
+    static char *kwlist[] = {"cycles", "speed", NULL};
+    unsigned int cycles;
+    double speed = 0.0;
+    int done;
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "I|d", kwlist, &cycles, &speed))
+        return NULL;
+    Py_BEGIN_ALLOW_THREADS
+    done = jackmock_run(cycles, speed);
+    Py_END_ALLOW_THREADS
+    return Py_BuildValue("i", done);
+}
+
+static PyObject* mock_set_speed(PyObject* self, PyObject* args)
+{
+    double speed;
+    if (! PyArg_ParseTuple(args, "d", &speed))
+        return NULL;
+    jackmock_set_speed(speed);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject* mock_xrun(PyObject* self, PyObject* args)
+{
+    jackmock_xrun();
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject* mock_set_buffer_size(PyObject* self, PyObject* args)
+{
+    unsigned int n;
+    if (! PyArg_ParseTuple(args, "I", &n))
+        return NULL;
+    if (jackmock_set_buffer_size(n)) {
+        PyErr_SetString(PyExc_ValueError, "buffer size must be between 1 and 8192");
+        return NULL;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject* mock_set_sample_rate(PyObject* self, PyObject* args)
+{
+    unsigned int rate;
+    if (! PyArg_ParseTuple(args, "I", &rate))
+        return NULL;
+    jackmock_set_sample_rate(rate);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject* mock_shutdown(PyObject* self, PyObject* args)
+{
+    Py_BEGIN_ALLOW_THREADS
+    jackmock_shutdown();
+    Py_END_ALLOW_THREADS
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject* mock_restart(PyObject* self, PyObject* args)
+{
+    jackmock_restart();
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject* mock_set_loopback(PyObject* self, PyObject* args)
+{
+    unsigned int latency;
+    if (! PyArg_ParseTuple(args, "I", &latency))
+        return NULL;
+    jackmock_set_loopback(latency);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+#ifdef WANT_LATENCY_CALLBACK
+static PyObject* mock_get_latency_range(PyObject* self, PyObject* args)
+{
+    char* name;
+    int mode;
+    jack_port_t* port;
+    jack_latency_range_t range;
+    if (! PyArg_ParseTuple(args, "si", &name, &mode))
+        return NULL;
+    // the mock finds ports without a client
+    if (!(port = jack_port_by_name(NULL, name))) {
+        PyErr_SetString(PyExc_ValueError, "no such port");
+        return NULL;
+    }
+    jack_port_get_latency_range(port, mode ? JackPlaybackLatency : JackCaptureLatency, &range);
+    return Py_BuildValue("(II)", range.min, range.max);
+}
+#endif
+
+static PyObject* mock_set_freewheel(PyObject* self, PyObject* args)
+{
+    int onoff;
+    if (! PyArg_ParseTuple(args, "i", &onoff))
+        return NULL;
+    jackmock_set_freewheel(onoff);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject* mock_add_port(PyObject* self, PyObject* args)
+{
+    char* name;
+    unsigned long flags = JackPortIsOutput | JackPortIsPhysical;
+    if (! PyArg_ParseTuple(args, "s|k", &name, &flags))
+        return NULL;
+    if (!jackmock_add_port(name, flags)) {
+        PyErr_SetString(pyjack_state_of(self)->Error, "Failed to add the port.");
+        return NULL;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+#endif
+
+// Python Module definition ---------------------------------------------------
+
+// Every method runs in a critical section on its object (the module for the global
+// client), so that free-threaded builds serialize the calls made on one client while
+// other clients run in parallel. The section is taken for the whole call on purpose,
+// including the long waits for the RT thread (pyjack_wait_cycle(), measure_roundtrip());
+// but those release the thread state, which suspends it, just like the GIL is released
+// there with a GIL. So a method that waits unlinks what it frees beforehand, and looks
+// up again what it still needs afterwards (port_refind()).
+#define PYJACK_LOCKED(fn)                                                   \
+  static PyObject* fn##_locked(PyObject* self, PyObject* args) {            \
+    PyObject* result;                                                       \
+    Py_BEGIN_CRITICAL_SECTION(self);                                        \
+    result = fn(self, args);                                                \
+    Py_END_CRITICAL_SECTION();                                              \
+    return result;                                                          \
+  }
+#define PYJACK_LOCKED_KW(fn)                                                \
+  static PyObject* fn##_locked(PyObject* self, PyObject* args, PyObject* kwds) { \
+    PyObject* result;                                                       \
+    Py_BEGIN_CRITICAL_SECTION(self);                                        \
+    result = fn(self, args, kwds);                                          \
+    Py_END_CRITICAL_SECTION();                                              \
+    return result;                                                          \
+  }
+PYJACK_LOCKED(attach)
+PYJACK_LOCKED(detach)
+PYJACK_LOCKED(activate)
+PYJACK_LOCKED(deactivate)
+PYJACK_LOCKED(port_connect)
+PYJACK_LOCKED(port_disconnect)
+PYJACK_LOCKED(process)
+PYJACK_LOCKED(get_client_name)
+PYJACK_LOCKED(register_port)
+PYJACK_LOCKED(unregister_port)
+PYJACK_LOCKED(get_port_flags)
+PYJACK_LOCKED(get_connections)
+PYJACK_LOCKED(get_buffer_size)
+PYJACK_LOCKED(get_sample_rate)
+PYJACK_LOCKED(check_events)
+PYJACK_LOCKED(get_frame_time)
+PYJACK_LOCKED(get_current_transport_frame)
+PYJACK_LOCKED(get_cycle_times)
+PYJACK_LOCKED(frames_to_time)
+PYJACK_LOCKED(time_to_frames)
+PYJACK_LOCKED(transport_locate)
+PYJACK_LOCKED(get_transport_state)
+PYJACK_LOCKED(transport_stop)
+PYJACK_LOCKED(transport_start)
+#ifdef JACK2
+PYJACK_LOCKED(get_version)
+PYJACK_LOCKED(get_version_string)
+#endif
+PYJACK_LOCKED(get_cpu_load)
+PYJACK_LOCKED(get_port_short_name)
+PYJACK_LOCKED(get_port_type)
+#ifdef JACK2
+PYJACK_LOCKED(get_port_type_id)
+#endif
+PYJACK_LOCKED(is_realtime)
+PYJACK_LOCKED(port_is_mine)
+PYJACK_LOCKED(set_buffer_size)
+PYJACK_LOCKED(set_sync_timeout)
+PYJACK_LOCKED(get_input_activity)
+PYJACK_LOCKED(capture_session)
+PYJACK_LOCKED(replay_session)
+PYJACK_LOCKED(stop_session)
+PYJACK_LOCKED(enable_history)
+PYJACK_LOCKED(disable_history)
+PYJACK_LOCKED(cancel)
+PYJACK_LOCKED(get_param)
+PYJACK_LOCKED(remove_param)
+PYJACK_LOCKED(bind_port_gain)
+PYJACK_LOCKED(disable_trace)
+PYJACK_LOCKED(dump_trace)
+PYJACK_LOCKED(disable_analyzer)
+PYJACK_LOCKED(get_spectrum)
+PYJACK_LOCKED(set_process_thread)
+PYJACK_LOCKED(get_thread_info)
+PYJACK_LOCKED(get_memory_stats)
+PYJACK_LOCKED(get_latency)
+PYJACK_LOCKED(recompute_latencies)
+PYJACK_LOCKED(get_underrun_stats)
+PYJACK_LOCKED(unexport_stream)
+PYJACK_LOCKED(get_resampling)
+PYJACK_LOCKED(set_thread_init_callback)
+PYJACK_LOCKED(set_freewheel_callback)
+PYJACK_LOCKED(set_buffer_size_callback)
+PYJACK_LOCKED(set_client_registration_callback)
+PYJACK_LOCKED(set_port_registration_callback)
+PYJACK_LOCKED(set_port_connect_callback)
+PYJACK_LOCKED(set_graph_order_callback)
+PYJACK_LOCKED(set_xrun_callback)
 #ifdef WANT_LATENCY_CALLBACK
-ADD_SETCALLBACK(latency);
-#endif /* WANT_LATENCY_CALLBACK */
+PYJACK_LOCKED(set_latency_callback)
+#endif
+PYJACK_LOCKED(set_reconnect_callback)
+PYJACK_LOCKED_KW(get_ports)
+PYJACK_LOCKED_KW(set_resampling)
+PYJACK_LOCKED_KW(set_memory_options)
+PYJACK_LOCKED_KW(set_silence_detection)
+PYJACK_LOCKED_KW(snapshot_history)
+PYJACK_LOCKED_KW(schedule)
+PYJACK_LOCKED_KW(add_param)
+PYJACK_LOCKED_KW(set_param)
+PYJACK_LOCKED_KW(measure_roundtrip)
+PYJACK_LOCKED_KW(add_convolver)
+PYJACK_LOCKED_KW(set_convolver_ir)
+PYJACK_LOCKED(remove_convolver)
+PYJACK_LOCKED(get_convolver_stats)
+#ifdef HAVE_LADSPA
+PYJACK_LOCKED_KW(add_plugin)
+PYJACK_LOCKED(remove_plugin)
+PYJACK_LOCKED(set_plugin_control)
+PYJACK_LOCKED(bind_plugin_control)
+PYJACK_LOCKED(get_plugin_controls)
+#endif
+PYJACK_LOCKED_KW(set_auto_reconnect)
+PYJACK_LOCKED(get_reconnect_stats)
+PYJACK_LOCKED_KW(enable_trace)
+PYJACK_LOCKED_KW(enable_analyzer)
+PYJACK_LOCKED_KW(set_thread_options)
+PYJACK_LOCKED_KW(set_underrun_policy)
+PYJACK_LOCKED_KW(export_stream)
 
-// Python Module definition ---------------------------------------------------
 
 static PyMethodDef pyjack_methods[] = {
-  {"attach",             attach,                  METH_VARARGS, "attach(name):\n  Attach client to the Jack server"},
-  {"detach",             detach,                  METH_VARARGS, "detach():\n  Detach client from the Jack server"},
-  {"activate",           activate,                METH_VARARGS, "activate():\n  Activate audio processing"},
-  {"deactivate",         deactivate,              METH_VARARGS, "deactivate():\n  Deactivate audio processing"},
-  {"connect",            port_connect,            METH_VARARGS, "connect(source, destination):\n  Connect two ports, given by name"},
-  {"disconnect",         port_disconnect,         METH_VARARGS, "disconnect(source, destination):\n  Disconnect two ports, given by name"},
-  {"process",            process,                 METH_VARARGS, "process(output_array, input_array):\n  Exchange I/O data with RT Jack thread"},
-  {"get_client_name",    get_client_name,         METH_VARARGS, "client_name():\n  Returns the actual name of the client"},
-  {"register_port",      register_port,           METH_VARARGS, "register_port(name, flags):\n  Register a new port for this client"},
-  {"unregister_port",    unregister_port,         METH_VARARGS, "unregister_port(name):\n  Unregister an existing port for this client"},
-  {"get_ports",          (PyCFunction)get_ports,  METH_VARARGS|METH_KEYWORDS, "get_ports(port_name_pattern='', type_name_pattern='',flags=0):\n  Get a list of all ports in the Jack graph"},
-  {"get_port_flags",     get_port_flags,          METH_VARARGS, "get_port_flags(port):\n  Return flags of a port (flags are bits in an integer)"},
-  {"get_connections",    get_connections,         METH_VARARGS, "get_connections(port):\n  Get a list of all ports connected to a port"},
-  {"get_buffer_size",    get_buffer_size,         METH_VARARGS, "get_buffer_size():\n  Get the buffer size currently in use"},
-  {"get_sample_rate",    get_sample_rate,         METH_VARARGS, "get_sample_rate():\n  Get the sample rate currently in use"},
-  {"check_events",       check_events,            METH_VARARGS, "check_events():\n  Check for event notifications"},
-  {"get_frame_time",     get_frame_time,          METH_VARARGS, "get_frame_time():\n  Returns the current frame time"},
-  {"get_current_transport_frame", get_current_transport_frame,  METH_VARARGS, "get_current_transport_frame():\n  Returns the current transport frame"},
-  {"transport_locate",   transport_locate,        METH_VARARGS, "transport_locate(frame):\n  Sets the current transport frame"},
-  {"get_transport_state",get_transport_state,     METH_VARARGS, "get_transport_state():\n  Returns the current transport state"},
-  {"transport_stop",     transport_stop,          METH_VARARGS, "transport_stop():\n  Stopping transport"},
-  {"transport_start",    transport_start,         METH_VARARGS, "transport_start():\n  Starting transport"},
+  {"attach",             attach_locked,           METH_VARARGS, "attach(name):\n  Attach client to the Jack server"},
+  {"detach",             detach_locked,           METH_VARARGS, "detach():\n  Detach client from the Jack server"},
+  {"activate",           activate_locked,         METH_VARARGS, "activate():\n  Activate audio processing"},
+  {"deactivate",         deactivate_locked,       METH_VARARGS, "deactivate():\n  Deactivate audio processing"},
+  {"connect",            port_connect_locked,     METH_VARARGS, "connect(source, destination):\n  Connect two ports, given by name"},
+  {"disconnect",         port_disconnect_locked,  METH_VARARGS, "disconnect(source, destination):\n  Disconnect two ports, given by name"},
+  {"process",            process_locked,          METH_VARARGS, "process(output_array, input_array):\n  Exchange I/O data with RT Jack thread; the arrays can be any (ports, frames) or flat buffers of float or double"},
+  {"get_client_name",    get_client_name_locked,  METH_VARARGS, "client_name():\n  Returns the actual name of the client"},
+  {"register_port",      register_port_locked,    METH_VARARGS, "register_port(name, flags):\n  Register a new port for this client"},
+  {"unregister_port",    unregister_port_locked,  METH_VARARGS, "unregister_port(name):\n  Unregister an existing port for this client"},
+  {"get_ports",          (PyCFunction)get_ports_locked, METH_VARARGS|METH_KEYWORDS, "get_ports(port_name_pattern='', type_name_pattern='',flags=0):\n  Get a list of all ports in the Jack graph"},
+  {"get_port_flags",     get_port_flags_locked,   METH_VARARGS, "get_port_flags(port):\n  Return flags of a port (flags are bits in an integer)"},
+  {"get_connections",    get_connections_locked,  METH_VARARGS, "get_connections(port):\n  Get a list of all ports connected to a port"},
+  {"get_buffer_size",    get_buffer_size_locked,  METH_VARARGS, "get_buffer_size():\n  Get the buffer size currently in use"},
+  {"get_sample_rate",    get_sample_rate_locked,  METH_VARARGS, "get_sample_rate():\n  Get the sample rate currently in use"},
+  {"check_events",       check_events_locked,     METH_VARARGS, "check_events():\n  Check for event notifications"},
+  {"get_frame_time",     get_frame_time_locked,   METH_VARARGS, "get_frame_time():\n  Returns the current frame time"},
+  {"get_current_transport_frame", get_current_transport_frame_locked, METH_VARARGS, "get_current_transport_frame():\n  Returns the current transport frame"},
+  {"get_cycle_times",    get_cycle_times_locked,  METH_VARARGS, "get_cycle_times():\n  Returns a dict with the frame time and estimated start time (in usecs) of the last cycle, the start time of the next one and the period"},
+  {"frames_to_time",     frames_to_time_locked,   METH_VARARGS, "frames_to_time(frames):\n  Converts a frame time, or an array of them, to usecs (uint64), using one snapshot of the cycle timing"},
+  {"time_to_frames",     time_to_frames_locked,   METH_VARARGS, "time_to_frames(usecs):\n  Converts a time in usecs, or an array of them, to frame times (uint32), using one snapshot of the cycle timing"},
+  {"transport_locate",   transport_locate_locked, METH_VARARGS, "transport_locate(frame):\n  Sets the current transport frame"},
+  {"get_transport_state",get_transport_state_locked, METH_VARARGS, "get_transport_state():\n  Returns the current transport state"},
+  {"transport_stop",     transport_stop_locked,   METH_VARARGS, "transport_stop():\n  Stopping transport"},
+  {"transport_start",    transport_start_locked,  METH_VARARGS, "transport_start():\n  Starting transport"},
 #ifdef JACK2
-  {"get_version",        get_version,             METH_VARARGS, "get_version():\n  Returns the version of JACK, in form of several numbers"},
-  {"get_version_string", get_version_string,      METH_VARARGS, "get_version_string():\n  Returns the version of JACK, in form of a string"},
+  {"get_version",        get_version_locked,      METH_VARARGS, "get_version():\n  Returns the version of JACK, in form of several numbers"},
+  {"get_version_string", get_version_string_locked, METH_VARARGS, "get_version_string():\n  Returns the version of JACK, in form of a string"},
 #endif
-  {"get_cpu_load",       get_cpu_load,            METH_VARARGS, "get_cpu_load():\n  Returns the current CPU load estimated by JACK"},
-  {"get_port_short_name",get_port_short_name,     METH_VARARGS, "get_port_short_name(port):\n  Returns the short name of the port (not including the \"client_name:\" prefix)"},
-  {"get_port_type",      get_port_type,           METH_VARARGS, "get_port_type(port):\n  Returns the port type (in a string)"},
+  {"get_cpu_load",       get_cpu_load_locked,     METH_VARARGS, "get_cpu_load():\n  Returns the current CPU load estimated by JACK"},
+  {"get_port_short_name",get_port_short_name_locked, METH_VARARGS, "get_port_short_name(port):\n  Returns the short name of the port (not including the \"client_name:\" prefix)"},
+  {"get_port_type",      get_port_type_locked,    METH_VARARGS, "get_port_type(port):\n  Returns the port type (in a string)"},
 #ifdef JACK2
-  {"get_port_type_id",   get_port_type_id,        METH_VARARGS, "get_port_type_id(port):\n  Returns the port type id"},
+  {"get_port_type_id",   get_port_type_id_locked, METH_VARARGS, "get_port_type_id(port):\n  Returns the port type id"},
+#endif
+  {"is_realtime",        is_realtime_locked,      METH_VARARGS, "is_realtime():\n  Returns 1 if the JACK subsystem is running with -R (--realtime)"},
+  {"port_is_mine",       port_is_mine_locked,     METH_VARARGS, "port_is_mine(port):\n  Returns 1 if port belongs to the running client"},
+  {"set_buffer_size",    set_buffer_size_locked,  METH_VARARGS, "set_buffer_size(size):\n  Sets Jack Buffer Size (minimum appears to be 16)."},
+  {"set_sync_timeout",   set_sync_timeout_locked, METH_VARARGS, "set_sync_timeout(time):\n  Sets the delay (in microseconds) before the timeout expires."},
+  {"set_resampling",     (PyCFunction)set_resampling_locked, METH_VARARGS|METH_KEYWORDS, "set_resampling(input_rate=0, output_rate=0):\n  Resample the input/output streams between the JACK rate and the given python-side rates (0 disables).\n  The filters delay each direction by 16 samples at the lower of the two rates; see get_resampling().\n  The filters follow changes of the JACK rate; process() raises jack.Error if a new ratio is not supported."},
+  {"set_memory_options", (PyCFunction)set_memory_options_locked, METH_VARARGS|METH_KEYWORDS, "set_memory_options(lock=True, hugepages=False):\n  Lock buffers used by the RT thread into RAM, and/or back large ones with huge pages (applies to buffers allocated afterwards)"},
+  {"set_silence_detection", (PyCFunction)set_silence_detection_locked, METH_VARARGS|METH_KEYWORDS, "set_silence_detection(threshold, hold_time=0.5):\n  Do not transfer input channels whose peak level stayed below threshold (linear, 0 disables) for hold_time seconds; process() fills them with zeros"},
+  {"get_input_activity", get_input_activity_locked, METH_VARARGS, "get_input_activity():\n  Returns a list telling for each input port whether it carried signal in the last block returned by process()"},
+  {"capture_session",    capture_session_locked,  METH_VARARGS, "capture_session(path):\n  Record the input blocks, frame times, errors and notifications process() returns into a session file\n  (a failed write ends the capture; the next process() or stop_session() raises IOError)"},
+  {"replay_session",     replay_session_locked,   METH_VARARGS, "replay_session(path):\n  Serve process(), check_events(), get_frame_time(), get_buffer_size() and get_sample_rate() from a session file, without a server\n  (on a client that is not connected; process() raises EOFError at the end)"},
+  {"stop_session",       stop_session_locked,     METH_VARARGS, "stop_session():\n  Stop capturing or replaying; returns the number of process() calls recorded or replayed"},
+  {"enable_history",     enable_history_locked,   METH_VARARGS, "enable_history(ports, seconds):\n  Keep (at least) the last seconds of the given input ports in a ring written by the RT thread (replacing any previous history)"},
+  {"disable_history",    disable_history_locked,  METH_VARARGS, "disable_history():\n  Stop recording the history and free it"},
+  {"snapshot_history",   (PyCFunction)snapshot_history_locked, METH_VARARGS|METH_KEYWORDS, "snapshot_history(start_frame, end_frame, path=None):\n  Returns frame times [start_frame, end_frame) of the history as a (ports, frames) float32 array,\n  or writes them to path as a float WAV file and returns the number of frames"},
+  {"schedule",           (PyCFunction)schedule_locked, METH_VARARGS|METH_KEYWORDS, "schedule(buffer, port, at_frame, gain=1.0):\n  Mix a clip (one channel of float or double samples) into the given output port, starting exactly at frame time at_frame; returns an id for cancel().\n  Clips that start late have their head cut off. At most 64 clips can be scheduled at a time."},
+  {"cancel",             cancel_locked,           METH_VARARGS, "cancel(id):\n  Stop a scheduled clip; returns True if it had not finished yet"},
+  {"add_param",          (PyCFunction)add_param_locked, METH_VARARGS|METH_KEYWORDS, "add_param(name, value=0.0, ramp=0.01, exponential=False):\n  Create a control parameter; set_param() moves it to new values over ramp seconds by default, in equal steps or equal ratios"},
+  {"set_param",          (PyCFunction)set_param_locked, METH_VARARGS|METH_KEYWORDS, "set_param(name, value, ramp=None, exponential=None):\n  Set the target of a parameter; the RT thread moves to it sample by sample (None: the parameter's defaults).\n  Exponential ramps fall back to linear ones across zero or a change of sign."},
+  {"get_param",          get_param_locked,        METH_VARARGS, "get_param(name):\n  Returns the value of a parameter at the end of the last cycle"},
+  {"remove_param",       remove_param_locked,     METH_VARARGS, "remove_param(name):\n  Delete a parameter and unbind the gains and plugin controls following it"},
+  {"bind_port_gain",     bind_port_gain_locked,   METH_VARARGS, "bind_port_gain(port, name):\n  Multiply an output port, sample by sample, by the given parameter (None: unbind)"},
+  {"add_convolver",      (PyCFunction)add_convolver_locked, METH_VARARGS|METH_KEYWORDS, "add_convolver(in_port, out_port, ir, max_length=0, mix=False):\n  Convolve a port (input, or output as mixed so far) with an impulse response (one channel of float or double samples), into an output port (replacing or adding to it). The buffer size must be a power of two.\n  The head of the response is convolved by the RT thread in partitions of one period, the tail by a worker thread in longer ones, without added latency.\n  max_length: longest response set_convolver_ir() will take (default: this one). Returns an id."},
+  {"set_convolver_ir",   (PyCFunction)set_convolver_ir_locked, METH_VARARGS|METH_KEYWORDS, "set_convolver_ir(id, ir, fade=0.05):\n  Replace the impulse response of a convolver, crossfading into the new one over fade seconds"},
+  {"remove_convolver",   remove_convolver_locked, METH_VARARGS, "remove_convolver(id):\n  Stop a convolver and free it"},
+  {"get_convolver_stats", get_convolver_stats_locked, METH_VARARGS, "get_convolver_stats(id):\n  Returns a dict with the partitioning of a convolver, the periods played without their tail (late) and whether a new response is fading in"},
+#ifdef HAVE_LADSPA
+  {"add_plugin",         (PyCFunction)add_plugin_locked, METH_VARARGS|METH_KEYWORDS, "add_plugin(path, inputs, outputs, label=None, controls=None, mix=False, realtime_unsafe=False):\n  Load a LADSPA plugin (path, or a file name in LADSPA_PATH; label: which plugin of the library, default the first) and run it in the RT thread\n  after the output of process() is in, reading the given ports (input or output ports) and replacing (or adding to) the given output ports.\n  controls maps control input names to initial values (default: the plugin's). Plugins run in the order they were added; returns an id.\n  Plugins without the LADSPA_PROPERTY_HARD_RT_CAPABLE property are refused unless realtime_unsafe is true."},
+  {"remove_plugin",      remove_plugin_locked,    METH_VARARGS, "remove_plugin(id):\n  Stop running a plugin and unload it"},
+  {"set_plugin_control", set_plugin_control_locked, METH_VARARGS, "set_plugin_control(id, name, value):\n  Set a control input of a plugin from the next period on (unbinding it from any parameter)"},
+  {"bind_plugin_control", bind_plugin_control_locked, METH_VARARGS, "bind_plugin_control(id, name, param):\n  Have a control input of a plugin follow the given parameter, once per period (None: unbind)"},
+  {"get_plugin_controls", get_plugin_controls_locked, METH_VARARGS, "get_plugin_controls(id):\n  Returns a dict with the values of the control inputs and outputs of a plugin at the end of the last period"},
 #endif
-  {"is_realtime",        is_realtime,             METH_VARARGS, "is_realtime():\n  Returns 1 if the JACK subsystem is running with -R (--realtime)"},
-  {"port_is_mine",       port_is_mine,            METH_VARARGS, "port_is_mine(port):\n  Returns 1 if port belongs to the running client"},
-  {"set_buffer_size",    set_buffer_size,         METH_VARARGS, "set_buffer_size(size):\n  Sets Jack Buffer Size (minimum appears to be 16)."},
-  {"set_sync_timeout",   set_sync_timeout,        METH_VARARGS, "set_sync_timeout(time):\n  Sets the delay (in microseconds) before the timeout expires."},
+  {"set_auto_reconnect", (PyCFunction)set_auto_reconnect_locked, METH_VARARGS|METH_KEYWORDS, "set_auto_reconnect(enable, interval=0.25):\n  After a server shutdown, poll for the server every interval seconds and restore the client under the same name:\n  its ports, their connections and the callbacks, activated again if it was active. Each restoration is reported\n  by check_events()[\"reconnect\"] and the reconnect callback"},
+  {"get_reconnect_stats", get_reconnect_stats_locked, METH_VARARGS, "get_reconnect_stats():\n  Returns a dict with whether auto-reconnect is on, for how long the server has been down, the number of restorations\n  and polls, the downtime (in seconds) before the last restoration and the number of connections remembered"},
+  {"enable_trace",       (PyCFunction)enable_trace_locked, METH_VARARGS|METH_KEYWORDS, "enable_trace(capacity=65536):\n  Record cycles, transport reads/writes, sync misses, xruns and GIL waits into a lock-free ring of the given number of records"},
+  {"disable_trace",      disable_trace_locked,    METH_VARARGS, "disable_trace():\n  Stop recording and free the trace ring"},
+  {"dump_trace",         dump_trace_locked,       METH_VARARGS, "dump_trace(path):\n  Write the recorded events to path as Chrome/Perfetto trace JSON; returns the number of events"},
+  {"enable_analyzer",    (PyCFunction)enable_analyzer_locked, METH_VARARGS|METH_KEYWORDS, "enable_analyzer(ports, fft_size=2048, hop=fft_size/2, window='hann', averaging=0.0):\n  Compute magnitude spectra of the given input ports in a worker thread ('hann', 'hamming', 'blackman' or 'rectangular' window; averaging is the weight of the previous spectrum)"},
+  {"disable_analyzer",   disable_analyzer_locked, METH_VARARGS, "disable_analyzer():\n  Stop the spectrum analyzer"},
+  {"get_spectrum",       get_spectrum_locked,     METH_VARARGS, "get_spectrum():\n  Returns (spectra, frame_time) with the latest (ports, fft_size/2+1) magnitude array and the frame time just after the analyzed block, or None if none is ready yet"},
+  {"set_thread_options", (PyCFunction)set_thread_options_locked, METH_VARARGS|METH_KEYWORDS, "set_thread_options(affinity=None, rt_priority=0, flush_denormals=False):\n  Pin the process thread to the given CPUs, run it SCHED_FIFO at rt_priority and/or flush denormals to zero (applied when the thread starts, i.e. on activate)"},
+  {"set_process_thread", set_process_thread_locked, METH_VARARGS, "set_process_thread(enable):\n  Run pyjack's own cycle loop (jack_cycle_wait/jack_cycle_signal) instead of a process callback, doing all work but the port I/O after the cycle has been signalled (call before the first activate)"},
+  {"get_thread_info",    get_thread_info_locked,  METH_VARARGS, "get_thread_info():\n  Returns a dict with the id, scheduling policy, priority, CPU affinity and denormal mode of the process thread"},
+  {"get_memory_stats",   get_memory_stats_locked, METH_VARARGS, "get_memory_stats():\n  Returns a dict with the bytes allocated for the RT thread, and how many of them are resident, locked and on huge pages"},
+  {"get_latency",        get_latency_locked,      METH_VARARGS, "get_latency():\n  Returns a dict with the delay (in JACK frames) pyjack adds between its input and output ports, as reported to JACK"},
+  {"recompute_latencies", recompute_latencies_locked, METH_VARARGS, "recompute_latencies():\n  Ask JACK to recompute the graph latencies (e.g. after changing how far ahead process() runs)"},
+  {"measure_roundtrip",  (PyCFunction)measure_roundtrip_locked, METH_VARARGS|METH_KEYWORDS, "measure_roundtrip(out_port, in_port, max_latency=0.5, order=14, level=0.5):\n  Play a maximum length sequence of 2^order-1 frames on out_port (muting it otherwise) and find it in what in_port records.\n  Returns a dict with the latency in frames (with sub-sample precision), the normalized correlation, its peak-to-sidelobe ratio (dB) and whether the polarity is inverted"},
+  {"set_underrun_policy", (PyCFunction)set_underrun_policy_locked, METH_VARARGS|METH_KEYWORDS, "set_underrun_policy(policy, fade_frames=64, repeat_frames=16384):\n  Choose what the output ports play when process() is late: UnderrunSilence, UnderrunRepeat (the last period, for at most repeat_frames, then silence) or UnderrunFade (fade out from the last sample played and back in over fade_frames, which may span several periods)"},
+  {"get_underrun_stats", get_underrun_stats_locked, METH_VARARGS, "get_underrun_stats():\n  Returns a dict with the number of late periods and dropouts, and when the last dropout started"},
+  {"export_stream",      (PyCFunction)export_stream_locked, METH_VARARGS|METH_KEYWORDS, "export_stream(name, ports, frames=0):\n  Copy the given input ports into a shared memory ring (default: one second), readable from other processes with jack.StreamReader(name)"},
+  {"unexport_stream",    unexport_stream_locked,  METH_VARARGS, "unexport_stream(name):\n  Stop exporting a stream"},
+  {"get_resampling",     get_resampling_locked,   METH_VARARGS, "get_resampling():\n  Returns a dict with the python-side rates, block sizes and the resampling latencies (in JACK frames)"},
   //  {"on_shutdown",                     on_shutdown,                     METH_VARARGS, "on_shutdown(fun):\n fun() gets called when server shuts down"},
   //  {"on_info_shutdown",                on_info_shutdown,                METH_VARARGS, "on_info_shutdown(fun):\n fun(code, reason) gets called when server shuts down"},
-  {"set_thread_init_callback",         set_thread_init_callback,         METH_VARARGS, "set_thread_init_callback(fun):\n fun() gets called when thread is ready"},
-  {"set_freewheel_callback",           set_freewheel_callback,           METH_VARARGS, "set_freewheel_callback(fun):\n fun(state) gets called when freewheel mode is entered/left"},
-  {"set_buffer_size_callback",         set_buffer_size_callback,         METH_VARARGS, "set_buffer_size_callback(fun):\n fun(bufsize) gets called when buffer size changes"},
-  {"set_client_registration_callback", set_client_registration_callback, METH_VARARGS, "set_client_registration_callback(fun):\n fun(name, state) gets called when a client is (un)registered"},
-  {"set_port_registration_callback",   set_port_registration_callback,   METH_VARARGS, "set_port_registration_callback(fun):\n fun(port, state) gets called when a port is (un)registered"},
-  {"set_port_connect_callback",        set_port_connect_callback,        METH_VARARGS, "set_port_connect_callback(fun):\n fun(from, to, state) gets called when two ports are (dis)connected"},
-  {"set_graph_order_callback",         set_graph_order_callback,         METH_VARARGS, "set_graph_order_callback(fun):\n fun() gets called when graph order changes"},
-  {"set_xrun_callback",                set_xrun_callback,                METH_VARARGS, "set_xrun_callback(fun):\n fun() gets called when an xrun occurs"},
+  {"set_thread_init_callback",         set_thread_init_callback_locked,  METH_VARARGS, "set_thread_init_callback(fun):\n fun() gets called when thread is ready"},
+  {"set_freewheel_callback",           set_freewheel_callback_locked,    METH_VARARGS, "set_freewheel_callback(fun):\n fun(state) gets called when freewheel mode is entered/left"},
+  {"set_buffer_size_callback",         set_buffer_size_callback_locked,  METH_VARARGS, "set_buffer_size_callback(fun):\n fun(bufsize) gets called when buffer size changes"},
+  {"set_client_registration_callback", set_client_registration_callback_locked, METH_VARARGS, "set_client_registration_callback(fun):\n fun(name, state) gets called when a client is (un)registered"},
+  {"set_port_registration_callback",   set_port_registration_callback_locked, METH_VARARGS, "set_port_registration_callback(fun):\n fun(port, state) gets called when a port is (un)registered"},
+  {"set_port_connect_callback",        set_port_connect_callback_locked, METH_VARARGS, "set_port_connect_callback(fun):\n fun(from, to, state) gets called when two ports are (dis)connected"},
+  {"set_graph_order_callback",         set_graph_order_callback_locked,  METH_VARARGS, "set_graph_order_callback(fun):\n fun() gets called when graph order changes"},
+  {"set_xrun_callback",                set_xrun_callback_locked,         METH_VARARGS, "set_xrun_callback(fun):\n fun() gets called when an xrun occurs"},
 #ifdef WANT_LATENCY_CALLBACK
-  {"set_latency_callback",             set_latency_callback,             METH_VARARGS, "set_latency_callback(fun):\n fun() gets called when the latency should be re-evaluated"},
+  {"set_latency_callback",             set_latency_callback_locked,      METH_VARARGS, "set_latency_callback(fun):\n fun(mode) gets called after pyjack has updated the latencies of its ports"},
+#endif
+  {"set_reconnect_callback",           set_reconnect_callback_locked,    METH_VARARGS, "set_reconnect_callback(fun):\n fun(downtime) gets called when the client was restored after a server restart (see set_auto_reconnect)"},
+#ifdef PYJACK_MOCK
+  {"mock_run",             (PyCFunction)mock_run, METH_VARARGS|METH_KEYWORDS, "mock_run(cycles, speed=0):\n  Run cycles of the mock server now, at speed times realtime (0: as fast as possible); returns the number of cycles run"},
+  {"mock_set_speed",       mock_set_speed,        METH_VARARGS, "mock_set_speed(speed):\n  Run the mock server's clock at speed times realtime (0: stop it)"},
+  {"mock_xrun",            mock_xrun,             METH_VARARGS, "mock_xrun():\n  Report an xrun to all active clients"},
+  {"mock_set_buffer_size", mock_set_buffer_size,  METH_VARARGS, "mock_set_buffer_size(n):\n  Change the mock server's buffer size"},
+  {"mock_set_sample_rate", mock_set_sample_rate,  METH_VARARGS, "mock_set_sample_rate(rate):\n  Change the mock server's sample rate"},
+  {"mock_shutdown",        mock_shutdown,         METH_VARARGS, "mock_shutdown():\n  Shut the mock server down"},
+  {"mock_restart",         mock_restart,          METH_VARARGS, "mock_restart():\n  Let the mock server accept clients again"},
+  {"mock_set_loopback",    mock_set_loopback,     METH_VARARGS, "mock_set_loopback(latency):\n  Feed system:playback_N back into system:capture_N, latency frames later (0: off)"},
+  {"mock_set_freewheel",   mock_set_freewheel,    METH_VARARGS, "mock_set_freewheel(onoff):\n  Start or stop freewheeling; the cycle times stand still meanwhile"},
+#ifdef WANT_LATENCY_CALLBACK
+  {"mock_get_latency_range", mock_get_latency_range, METH_VARARGS, "mock_get_latency_range(port, mode):\n  Returns the (min, max) capture (mode 0) or playback (mode 1) latency range of a port"},
+#endif
+  {"mock_add_port",        mock_add_port,         METH_VARARGS, "mock_add_port(name, flags=IsOutput|IsPhysical):\n  Register a port that belongs to no client"},
 #endif
   {NULL, NULL}
 };
@@ -1421,9 +7808,11 @@ static PyObject *
 Client_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
 {
     pyjack_client_t *self = NULL;
+    pyjack_state_t *state = pyjack_state_of_type(type);
+    if (state == NULL) return NULL;
     self = (pyjack_client_t *)type->tp_alloc(type, 0);
     if (self == NULL) return NULL;
-    pyjack_init(self);
+    pyjack_init(self, state);
 
     return (PyObject *)self;
 }
@@ -1433,24 +7822,70 @@ Client_init(PyObject *self, PyObject *args, PyObject *kwds)
 {	
     int status = 0;
     pyjack_client_t * client = self_or_global_client(self);
-    static char *kwlist[] = {"name", "processing", NULL};
+    static char *kwlist[] = {"name", "processing", "thread_affinity", "rt_priority", "flush_denormals", "process_thread", "replay", NULL};
     char*name;
-    if (! PyArg_ParseTupleAndKeywords(args, kwds, "s|i", kwlist,
-                                      &name, // dummy to keep the parser happy
-                                      &client->doProcessing))
+    char*replay = NULL;
+    PyObject*affinity = Py_None;
+    int rt_priority = 0;
+    int denormals = 0;
+    PyObject*attach_args;
+    PyObject*result;
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "s|iOiiiz", kwlist,
+                                      &name,
+                                      &client->doProcessing,
+                                      &affinity, &rt_priority, &denormals,
+                                      &client->process_thread,
+                                      &replay))
+      return -1;
+    if (store_thread_options(client, affinity, rt_priority, denormals) < 0)
       return -1;
-    if (!attach(self, args)) status = -1;
+    // a replaying client never connects to jack
+    attach_args = replay ? Py_BuildValue("(s)", replay) : Py_BuildValue("(s)", name);
+    if (!attach_args) return -1;
+    result = replay ? replay_session(self, attach_args) : attach(self, attach_args);
+    Py_DECREF(attach_args);
+    if (!result) status = -1;
+    Py_XDECREF(result);
     return status;
 }
 
 static void
 Client_dealloc(PyObject* self)
 {
+    PyTypeObject *type = Py_TYPE(self);
+    pyjack_client_t * client = (pyjack_client_t*) self;
     detach(self, Py_None);
-    Py_TYPE(self)->tp_free(self);
+    if (client->mem_client_locked)
+        pages_unlock(self, sizeof(pyjack_client_t));
+    type->tp_free(self);
+#ifdef PYJACK_MULTI_PHASE
+    // instances of heap types own a reference to their type
+    Py_DECREF(type);
+#endif
 }
 
 
+#define PYJACK_CLIENT_DOC "JACK client object.\n" \
+                          "Instatiate a jack.Client to interact with a jack server.\n"
+
+#ifdef PYJACK_MULTI_PHASE
+static PyType_Slot pyjack_client_slots[] = {
+  {Py_tp_dealloc, Client_dealloc},
+  {Py_tp_doc,     PYJACK_CLIENT_DOC},
+  {Py_tp_methods, pyjack_methods},
+  {Py_tp_init,    Client_init},
+  {Py_tp_new,     Client_new},
+  {0, NULL}
+};
+
+static PyType_Spec pyjack_client_spec = {
+  "jack.Client",
+  sizeof(pyjack_client_t),
+  0,
+  Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+  pyjack_client_slots
+};
+#else
 static PyTypeObject pyjack_ClientType = {
   PyVarObject_HEAD_INIT(NULL, 0)
     /*tp_name*/             "jack.Client",
@@ -1472,9 +7907,7 @@ static PyTypeObject pyjack_ClientType = {
     /*tp_setattro*/         0,
     /*tp_as_buffer*/        0,
     /*tp_flags*/            Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
-    /* tp_doc */            "JACK client object.\n"
-                            "Instatiate a jack.Client to interact with a jack server.\n"
-                            ,
+    /* tp_doc */            PYJACK_CLIENT_DOC,
     /* tp_traverse */       0,
     /* tp_clear */          0,
     /* tp_richcompare */    0,
@@ -1493,36 +7926,554 @@ static PyTypeObject pyjack_ClientType = {
     /* tp_alloc */          0,
     /* tp_new */            Client_new,
 };
+#endif
 
-static PyObject *
-do_initpyjack(void)
+// Reader side of exported streams -----------------------------------------
+
+typedef struct {
+    PyObject_HEAD
+    pyjack_stream_header_t* header;                 // read-only mapping of the stream
+    size_t         map_size;                        // size of the mapping
+    const float*   data;                            // ring data
+    int            channels;                        // number of channels in the stream
+    unsigned int   capacity;                        // ring size in frames
+    unsigned int   sample_rate;                     // JACK sample rate of the stream
+    unsigned long long position;                    // read cursor, in frames since the export started
+    unsigned long  overruns;                        // number of times the writer overtook the reader
+} pyjack_reader_t;
+
+static int
+StreamReader_init(PyObject *self, PyObject *args, PyObject *kwds)
 {
-  PyObject *m=NULL, *d=NULL;
+    pyjack_reader_t * reader = (pyjack_reader_t*) self;
+    static char *kwlist[] = {"name", NULL};
+    char* name;
+    char shmname[258];
+    struct stat st;
+
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "s", kwlist, &name))
+        return -1;
+    if (reader->header) {
+        PyErr_SetString(pyjack_state_of(self)->UsageError, "StreamReader is already open.");
+        return -1;
+    }
 
-  if (PyType_Ready(&pyjack_ClientType) < 0)
+    snprintf(shmname, sizeof(shmname), "/%s", name);
+    int fd = shm_open(shmname, O_RDONLY, 0);
+    if (fd < 0) {
+        PyErr_SetFromErrnoWithFilename(pyjack_state_of(self)->Error, shmname);
+        return -1;
+    }
+    void * map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(pyjack_stream_header_t))
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        PyErr_SetString(pyjack_state_of(self)->Error, "Failed to map stream.");
+        return -1;
+    }
+
+    pyjack_stream_header_t * hdr = map;
+    if (memcmp(hdr->magic, PYJACK_STREAM_MAGIC, sizeof(hdr->magic)) || hdr->version != PYJACK_STREAM_VERSION ||
+        (size_t)st.st_size < sizeof(*hdr) + (size_t)hdr->capacity * hdr->channels * sizeof(float)) {
+        munmap(map, st.st_size);
+        PyErr_SetString(pyjack_state_of(self)->Error, "Not a pyjack stream (or an incompatible version).");
+        return -1;
+    }
+    reader->header = hdr;
+    reader->map_size = st.st_size;
+    reader->data = (const float*)(hdr + 1);
+    reader->channels = hdr->channels;
+    reader->capacity = hdr->capacity;
+    reader->sample_rate = hdr->sample_rate;
+    // only data written from now on
+    reader->position = __atomic_load_n(&hdr->write_frames, __ATOMIC_ACQUIRE);
+    return 0;
+}
+
+static void
+StreamReader_dealloc(PyObject* self)
+{
+    pyjack_reader_t * reader = (pyjack_reader_t*) self;
+    PyTypeObject *type = Py_TYPE(self);
+    if (reader->header) munmap(reader->header, reader->map_size);
+    type->tp_free(self);
+#ifdef PYJACK_MULTI_PHASE
+    Py_DECREF(type);
+#endif
+}
+
+static PyObject* reader_available(PyObject* self, PyObject* args)
+{
+    pyjack_reader_t * reader = (pyjack_reader_t*) self;
+    if (!reader->header) {
+        PyErr_SetString(pyjack_state_of(self)->UsageError, "StreamReader is closed.");
+        return NULL;
+    }
+    uint64_t w = __atomic_load_n(&reader->header->write_frames, __ATOMIC_ACQUIRE);
+    return Py_BuildValue("K", (unsigned long long)(w - reader->position));
+}
+
+// Whether the writer may already be overwriting frames from the read position on, given write_frames w;
+// if so, skip to the oldest frames that are safe to read and raise InputSyncError.
+static int reader_overrun(pyjack_reader_t * reader, uint64_t w)
+{
+    uint32_t period = __atomic_load_n(&reader->header->period, __ATOMIC_ACQUIRE);
+    if (period > reader->capacity) period = reader->capacity;
+    // the period being written now lands on the frames capacity - period behind write_frames
+    if (w + period - reader->position <= reader->capacity)
+        return 0;
+    reader->overruns++;
+    reader->position = w + period - reader->capacity;
+    PyErr_SetString(pyjack_state_of((PyObject*)reader)->InputSyncError, "Stream reader overrun; skipped to the oldest available data.");
+    return 1;
+}
+
+/** Return the next frames of the stream as a (channels, frames) float32 array.
+  * Unless copy is true, the array is a view into the shared ring whenever the block does not wrap;
+  * such views are only valid until the writer comes round again (capacity frames later).
+  */
+static PyObject* reader_read(PyObject* self, PyObject* args, PyObject* kwds)
+{
+    static char *kwlist[] = {"frames", "copy", NULL};
+    pyjack_reader_t * reader = (pyjack_reader_t*) self;
+    long long frames = -1;
+    int copy = 0;
+    int c;
+
+    if (! PyArg_ParseTupleAndKeywords(args, kwds, "|Li", kwlist, &frames, &copy))
+        return NULL;
+    if (!reader->header) {
+        PyErr_SetString(pyjack_state_of(self)->UsageError, "StreamReader is closed.");
+        return NULL;
+    }
+
+    uint64_t w = __atomic_load_n(&reader->header->write_frames, __ATOMIC_ACQUIRE);
+    if (reader_overrun(reader, w))
+        return NULL;
+    if (frames < 0) frames = w - reader->position;
+    if (frames > reader->capacity - __atomic_load_n(&reader->header->period, __ATOMIC_RELAXED)) {
+        PyErr_SetString(PyExc_ValueError, "cannot read more frames than the stream holds");
+        return NULL;
+    }
+    if ((uint64_t)frames > w - reader->position) {
+        // not there yet
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+
+    if (pyjack_numpy() < 0)
+        return NULL;
+
+    uint32_t pos = (uint32_t)reader->position & (reader->capacity - 1);
+    npy_intp dims[2] = { reader->channels, frames };
+    PyObject * array;
+    if (!copy && pos + frames <= reader->capacity) {
+        npy_intp strides[2] = { reader->capacity * sizeof(float), sizeof(float) };
+        array = PyArray_New(&PyArray_Type, 2, dims, NPY_FLOAT32, strides,
+                            (void*)(reader->data + pos), 0, NPY_ARRAY_ALIGNED, NULL);
+        if (!array) return NULL;
+        Py_INCREF(self);
+        if (PyArray_SetBaseObject((PyArrayObject*)array, self) < 0) {
+            Py_DECREF(array);
+            return NULL;
+        }
+    } else {
+        uint32_t first = (frames < reader->capacity - pos) ? frames : reader->capacity - pos;
+        array = PyArray_SimpleNew(2, dims, NPY_FLOAT32);
+        if (!array) return NULL;
+        for (c = 0; c < reader->channels; c++) {
+            const float * src = reader->data + (size_t)reader->capacity * c;
+            float * dst = (float*)PyArray_GETPTR2((PyArrayObject*)array, c, 0);
+            memcpy(dst, src + pos, first * sizeof(float));
+            memcpy(dst + first, src, (frames - first) * sizeof(float));
+        }
+        // the writer must not have overtaken us while we were copying
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        w = __atomic_load_n(&reader->header->write_frames, __ATOMIC_ACQUIRE);
+        if (reader_overrun(reader, w)) {
+            Py_DECREF(array);
+            return NULL;
+        }
+    }
+    reader->position += frames;
+    return array;
+}
+
+static PyObject* reader_get_frame_time(PyObject* self, PyObject* args)
+{
+    pyjack_reader_t * reader = (pyjack_reader_t*) self;
+    if (!reader->header) {
+        PyErr_SetString(pyjack_state_of(self)->UsageError, "StreamReader is closed.");
+        return NULL;
+    }
+    // frame time of the next frame to read, from a consistent write_frames/frame_time pair
+    pyjack_stream_header_t * hdr = reader->header;
+    uint32_t seq, frame_time;
+    uint64_t w;
+    do {
+        seq = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+        w = __atomic_load_n(&hdr->write_frames, __ATOMIC_RELAXED);
+        frame_time = __atomic_load_n(&hdr->frame_time, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&hdr->seq, __ATOMIC_RELAXED));
+    uint32_t ft = frame_time - (uint32_t)(w - reader->position);
+    return Py_BuildValue("I", ft);
+}
+
+static PyObject* reader_close(PyObject* self, PyObject* args)
+{
+    pyjack_reader_t * reader = (pyjack_reader_t*) self;
+    if (reader->header) munmap(reader->header, reader->map_size);
+    reader->header = NULL;
+    reader->data = NULL;
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PYJACK_LOCKED(reader_available)
+PYJACK_LOCKED_KW(reader_read)
+PYJACK_LOCKED(reader_get_frame_time)
+PYJACK_LOCKED(reader_close)
+
+static PyMethodDef pyjack_reader_methods[] = {
+  {"available",      reader_available_locked, METH_NOARGS,  "available():\n  Returns the number of frames that can be read"},
+  {"read",           (PyCFunction)reader_read_locked, METH_VARARGS|METH_KEYWORDS, "read(frames=-1, copy=False):\n  Returns the next frames as a (channels, frames) array, or None if not enough data is available yet.\n  Raises InputSyncError if the writer overtook the reader."},
+  {"get_frame_time", reader_get_frame_time_locked, METH_NOARGS,  "get_frame_time():\n  Returns the JACK frame time of the next frame to be read"},
+  {"close",          reader_close_locked,     METH_NOARGS,  "close():\n  Unmap the stream"},
+  {NULL, NULL}
+};
+
+static PyMemberDef pyjack_reader_members[] = {
+  {"channels",    T_INT,       offsetof(pyjack_reader_t, channels),    READONLY, "number of channels"},
+  {"capacity",    T_UINT,      offsetof(pyjack_reader_t, capacity),    READONLY, "ring size in frames"},
+  {"sample_rate", T_UINT,      offsetof(pyjack_reader_t, sample_rate), READONLY, "JACK sample rate"},
+  {"position",    T_ULONGLONG, offsetof(pyjack_reader_t, position),    READONLY, "read cursor, in frames since the export started"},
+  {"overruns",    T_ULONG,     offsetof(pyjack_reader_t, overruns),    READONLY, "number of overruns so far"},
+  {NULL}
+};
+
+#define PYJACK_READER_DOC "Reader for a stream exported with export_stream().\n" \
+                          "StreamReader(name) maps the stream; no JACK connection is needed.\n"
+
+#ifdef PYJACK_MULTI_PHASE
+static PyType_Slot pyjack_reader_slots[] = {
+  {Py_tp_dealloc, StreamReader_dealloc},
+  {Py_tp_doc,     PYJACK_READER_DOC},
+  {Py_tp_methods, pyjack_reader_methods},
+  {Py_tp_members, pyjack_reader_members},
+  {Py_tp_init,    StreamReader_init},
+  {Py_tp_new,     PyType_GenericNew},
+  {0, NULL}
+};
+
+static PyType_Spec pyjack_reader_spec = {
+  "jack.StreamReader",
+  sizeof(pyjack_reader_t),
+  0,
+  Py_TPFLAGS_DEFAULT,
+  pyjack_reader_slots
+};
+#else
+static PyTypeObject pyjack_StreamReaderType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+    /*tp_name*/             "jack.StreamReader",
+    /*tp_basicsize*/        sizeof(pyjack_reader_t),
+    /*tp_itemsize*/         0,
+    /*tp_dealloc*/          StreamReader_dealloc,
+    /*tp_print*/            0,
+    /*tp_getattr*/          0,
+    /*tp_setattr*/          0,
+    /*tp_compare*/          0,
+    /*tp_repr*/             0,
+    /*tp_as_number*/        0,
+    /*tp_as_sequence*/      0,
+    /*tp_as_mapping*/       0,
+    /*tp_hash */            0,
+    /*tp_call*/             0,
+    /*tp_str*/              0,
+    /*tp_getattro*/         0,
+    /*tp_setattro*/         0,
+    /*tp_as_buffer*/        0,
+    /*tp_flags*/            Py_TPFLAGS_DEFAULT,
+    /* tp_doc */            PYJACK_READER_DOC,
+    /* tp_traverse */       0,
+    /* tp_clear */          0,
+    /* tp_richcompare */    0,
+    /* tp_weaklistoffset */ 0,
+    /* tp_iter */           0,
+    /* tp_iternext */       0,
+    /* tp_methods */        pyjack_reader_methods,
+    /* tp_members */        pyjack_reader_members,
+    /* tp_getset */         0,
+    /* tp_base */           0,
+    /* tp_dict */           0,
+    /* tp_descr_get */      0,
+    /* tp_descr_set */      0,
+    /* tp_dictoffset */     0,
+    /* tp_init */           StreamReader_init,
+    /* tp_alloc */          0,
+    /* tp_new */            PyType_GenericNew,
+};
+#endif
+
+// C API (see pyjack_capi.h)
+
+// The client behind a jack.Client, or the global client for the jack module
+static pyjack_client_t * capi_client(PyObject * obj)
+{
+    if (!obj || PyModule_Check(obj)) {
+#ifdef PYJACK_MULTI_PHASE
+        if (obj && PyModule_GetDef(obj) == &pyjack_moduledef)
+#endif
+            return &pyjack_state_of_module(obj)->global_client;
+    } else {
+        pyjack_state_t * state = pyjack_state_of_type(Py_TYPE(obj));
+        if (state && PyObject_TypeCheck(obj, state->ClientType)) return (pyjack_client_t*)obj;
+        PyErr_Clear();
+    }
+    PyErr_SetString(PyExc_TypeError, "expected a jack.Client or the jack module");
     return NULL;
-  PYJACK_MOD_DEF(m, "jack", "This module provides bindings to manage clients for the Jack Audio Connection Kit architecture", pyjack_methods);
-  if (m == NULL)
-    goto fail;
-  d = PyModule_GetDict(m);
-  if (d == NULL)
-    goto fail;
+}
+
+static pyjack_tap_t * tap_open(PyObject * obj, int direction, const char * const * ports, int count, jack_nframes_t frames)
+{
+    pyjack_client_t * client = capi_client(obj);
+    pyjack_tap_t * tap;
+    int i, slot;
+
+    if (!client) return NULL;
+    if(client->pjc == NULL) {
+        PyErr_SetString(client->state->NotConnectedError, "Jack connection has not yet been established.");
+        return NULL;
+    }
+    if (direction != PYJACK_TAP_INPUT && direction != PYJACK_TAP_OUTPUT) {
+        PyErr_SetString(PyExc_ValueError, "direction must be PYJACK_TAP_INPUT or PYJACK_TAP_OUTPUT");
+        return NULL;
+    }
+    if (count < 1 || count > PYJACK_MAX_PORTS || frames > (1u << 30)) {
+        PyErr_SetString(PyExc_ValueError, "need between 1 and 256 ports, and less than 2^30 frames");
+        return NULL;
+    }
+    for (slot = 0; slot < PYJACK_MAX_TAPS && client->taps[slot]; slot++);
+    if (slot == PYJACK_MAX_TAPS) {
+        PyErr_SetString(client->state->UsageError, "Too many taps.");
+        return NULL;
+    }
+
+    tap = rt_alloc(client, sizeof(*tap));
+    if (!tap) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    tap->client = client;
+    tap->direction = direction;
+    tap->channels = count;
+    for (i = 0; i < count; i++) {
+        int index = (direction == PYJACK_TAP_INPUT)
+            ? find_client_port(client->input_ports, client->num_inputs, ports[i])
+            : find_client_port(client->output_ports, client->num_outputs, ports[i]);
+        if (index < 0) {
+            PyErr_SetString(client->state->UsageError, direction == PYJACK_TAP_INPUT
+                            ? "Only input ports of this client can be tapped."
+                            : "Only output ports of this client can be fed.");
+            rt_free(client, tap);
+            return NULL;
+        }
+        tap->ports[i] = (direction == PYJACK_TAP_INPUT) ? client->input_ports[index] : client->output_ports[index];
+    }
+    tap->ring_size = 1;
+    while (tap->ring_size < frames || tap->ring_size < 2 * (uint32_t)client->buffer_size)
+        tap->ring_size <<= 1;
+    tap->ring = rt_alloc(client, (size_t)tap->ring_size * count * sizeof(float));
+    if (!tap->ring) {
+        rt_free(client, tap);
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    if (!is_global_client(client))
+        Py_INCREF((PyObject*)client);
+    __atomic_store_n(&client->taps[slot], tap, __ATOMIC_RELEASE);
+    return tap;
+}
+
+static pyjack_tap_t * capi_tap_open(PyObject * obj, int direction, const char * const * ports, int count, jack_nframes_t frames)
+{
+    pyjack_client_t * client = capi_client(obj);
+    pyjack_tap_t * tap;
+    if (!client) return NULL;
+    Py_BEGIN_CRITICAL_SECTION(client_object(client));
+    tap = tap_open(obj, direction, ports, count, frames);
+    Py_END_CRITICAL_SECTION();
+    return tap;
+}
+
+static void capi_tap_close(pyjack_tap_t * tap)
+{
+    pyjack_client_t * client;
+    int i, found = 0;
+    if (!tap) return;
+    client = tap->client;
+    Py_BEGIN_CRITICAL_SECTION(client_object(client));
+    for (i = 0; i < PYJACK_MAX_TAPS; i++) {
+        if (client->taps[i] != tap) continue;
+        __atomic_store_n(&client->taps[i], NULL, __ATOMIC_RELEASE);
+        found = 1;
+    }
+    if (found) pyjack_wait_cycle(client);
+    Py_END_CRITICAL_SECTION();
+    rt_free(client, tap->ring);
+    rt_free(client, tap);
+    if (!is_global_client(client))
+        Py_DECREF((PyObject*)client);
+}
+
+static int capi_tap_channels(const pyjack_tap_t * tap)
+{
+    return tap->channels;
+}
+
+static jack_nframes_t capi_tap_acquire(pyjack_tap_t * tap, float ** channels, jack_nframes_t * frame_time)
+{
+    uint64_t own, other;
+    jack_nframes_t ft;
+    uint32_t seq, pos, count;
+    int c;
+
+    // consistent copy of the RT side's position and frame time
+    do {
+        seq = __atomic_load_n(&tap->seq, __ATOMIC_ACQUIRE);
+        other = (tap->direction == PYJACK_TAP_INPUT) ? tap->write_frames : tap->read_frames;
+        ft = tap->frame_time;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&tap->seq, __ATOMIC_RELAXED));
+
+    if (tap->direction == PYJACK_TAP_INPUT) {
+        own = tap->read_frames;
+        count = other - own;
+        if (frame_time) *frame_time = ft - (jack_nframes_t)(other - own);
+    } else {
+        own = tap->write_frames;
+        count = tap->ring_size - (own - other);
+        if (frame_time) *frame_time = ft + (jack_nframes_t)(own - other);
+    }
+    pos = own & (tap->ring_size - 1);
+    if (count > tap->ring_size - pos) count = tap->ring_size - pos;
+    for (c = 0; c < tap->channels; c++)
+        channels[c] = tap->ring + (size_t)tap->ring_size * c + pos;
+    return count;
+}
 
-  Py_INCREF(&pyjack_ClientType);
-  PyModule_AddObject(m, "Client", (PyObject *)&pyjack_ClientType);
+static void capi_tap_release(pyjack_tap_t * tap, jack_nframes_t frames)
+{
+    if (tap->direction == PYJACK_TAP_INPUT)
+        __atomic_store_n(&tap->read_frames, tap->read_frames + frames, __ATOMIC_RELEASE);
+    else
+        __atomic_store_n(&tap->write_frames, tap->write_frames + frames, __ATOMIC_RELEASE);
+}
+
+static float capi_tap_peak(pyjack_tap_t * tap, int channel)
+{
+    uint32_t bits;
+    float peak;
+    if (channel < 0 || channel >= tap->channels) return 0.f;
+    bits = __atomic_exchange_n(&tap->peaks[channel], 0, __ATOMIC_RELAXED);
+    memcpy(&peak, &bits, sizeof(peak));
+    return peak;
+}
+
+static uint64_t capi_tap_xruns(const pyjack_tap_t * tap)
+{
+    return __atomic_load_n(&tap->xruns, __ATOMIC_RELAXED);
+}
+
+static int capi_get_cycle_times(PyObject * obj, pyjack_capi_cycle_times_t * times)
+{
+    pyjack_client_t * client = capi_client(obj);
+    pyjack_cycle_times_t ct;
+    if (!client || get_cycle_snapshot(client, &ct) < 0)
+        return -1;
+    times->buffer_size = ct.nframes;
+    times->current_frames = ct.current_frames;
+    times->current_usecs = ct.current_usecs;
+    times->next_usecs = ct.next_usecs;
+    times->period_usecs = ct.period_usecs;
+    return 0;
+}
+
+static int capi_get_stats(PyObject * obj, pyjack_capi_stats_t * stats)
+{
+    pyjack_client_t * client = capi_client(obj);
+    if (!client) return -1;
+    stats->cycles = __atomic_load_n(&client->cycles, __ATOMIC_ACQUIRE);
+    stats->underrun_periods = client->underrun_periods;
+    stats->underrun_events = client->underrun_events;
+    stats->output_written = __atomic_load_n(&client->output_written, __ATOMIC_ACQUIRE);
+    stats->output_read = client->output_read;
+    return 0;
+}
+
+static pyjack_capi_t pyjack_capi = {
+    PYJACK_CAPI_VERSION,
+    sizeof(pyjack_capi_t),
+    capi_tap_open,
+    capi_tap_close,
+    capi_tap_channels,
+    capi_tap_acquire,
+    capi_tap_release,
+    capi_tap_peak,
+    capi_tap_xruns,
+    capi_get_cycle_times,
+    capi_get_stats,
+};
+
+// Fill the module of one interpreter: types, exceptions, constants and the C API
+static int
+pyjack_exec(PyObject *m)
+{
+  pyjack_state_t *state = pyjack_state_of_module(m);
+  PyObject *d = PyModule_GetDict(m);
+  if (d == NULL)
+    return -1;
+  state->module = m;
+
+#ifdef PYJACK_MULTI_PHASE
+  state->interp = PyInterpreterState_Get();
+  state->ClientType = (PyTypeObject *)PyType_FromModuleAndSpec(m, &pyjack_client_spec, NULL);
+  if (state->ClientType == NULL)
+    return -1;
+  state->StreamReaderType = (PyTypeObject *)PyType_FromModuleAndSpec(m, &pyjack_reader_spec, NULL);
+  if (state->StreamReaderType == NULL)
+    return -1;
+#else
+  if (PyType_Ready(&pyjack_ClientType) < 0)
+    return -1;
+  if (PyType_Ready(&pyjack_StreamReaderType) < 0)
+    return -1;
+  state->ClientType = &pyjack_ClientType;
+  state->StreamReaderType = &pyjack_StreamReaderType;
+  Py_INCREF(state->ClientType);
+  Py_INCREF(state->StreamReaderType);
+#endif
+  PyDict_SetItemString(d, "Client", (PyObject *)state->ClientType);
+  PyDict_SetItemString(d, "StreamReader", (PyObject *)state->StreamReaderType);
+  PyModule_AddObject(m, "_C_API", PyCapsule_New(&pyjack_capi, PYJACK_CAPI_NAME, NULL));
 
 // Jack errors 
-  JackError = PyErr_NewException("jack.Error", NULL, NULL);
-  JackNotConnectedError = PyErr_NewException("jack.NotConnectedError", NULL, NULL);
-  JackUsageError = PyErr_NewException("jack.UsageError", NULL, NULL);
-  JackInputSyncError = PyErr_NewException("jack.InputSyncError", NULL, NULL);
-  JackOutputSyncError = PyErr_NewException("jack.OutputSyncError", NULL, NULL);
-
-  PyDict_SetItemString(d, "Error", JackError);
-  PyDict_SetItemString(d, "NotConnectedError", JackNotConnectedError);
-  PyDict_SetItemString(d, "UsageError", JackUsageError);
-  PyDict_SetItemString(d, "InputSyncError", JackInputSyncError);
-  PyDict_SetItemString(d, "OutputSyncError", JackOutputSyncError);
+  state->Error = PyErr_NewException("jack.Error", NULL, NULL);
+  state->NotConnectedError = PyErr_NewException("jack.NotConnectedError", NULL, NULL);
+  state->UsageError = PyErr_NewException("jack.UsageError", NULL, NULL);
+  state->InputSyncError = PyErr_NewException("jack.InputSyncError", NULL, NULL);
+  state->OutputSyncError = PyErr_NewException("jack.OutputSyncError", NULL, NULL);
+  if (PyErr_Occurred())
+    return -1;
+
+  PyDict_SetItemString(d, "Error", state->Error);
+  PyDict_SetItemString(d, "NotConnectedError", state->NotConnectedError);
+  PyDict_SetItemString(d, "UsageError", state->UsageError);
+  PyDict_SetItemString(d, "InputSyncError", state->InputSyncError);
+  PyDict_SetItemString(d, "OutputSyncError", state->OutputSyncError);
 // Jack flags
   PyDict_SetItemString(d, "IsInput", Py_BuildValue("i", JackPortIsInput));
   PyDict_SetItemString(d, "IsOutput", Py_BuildValue("i", JackPortIsOutput));
@@ -1532,6 +8483,9 @@ do_initpyjack(void)
   PyDict_SetItemString(d, "TransportStopped", Py_BuildValue("i", JackTransportStopped));
   PyDict_SetItemString(d, "TransportRolling", Py_BuildValue("i", JackTransportRolling));
   PyDict_SetItemString(d, "TransportStarting", Py_BuildValue("i", JackTransportStarting));
+  PyDict_SetItemString(d, "UnderrunSilence", Py_BuildValue("i", PYJACK_UNDERRUN_SILENCE));
+  PyDict_SetItemString(d, "UnderrunRepeat", Py_BuildValue("i", PYJACK_UNDERRUN_REPEAT));
+  PyDict_SetItemString(d, "UnderrunFade", Py_BuildValue("i", PYJACK_UNDERRUN_FADE));
 
 // Jack status
   PyDict_SetItemString(d, "Failure",       Py_BuildValue("i", JackFailure));
@@ -1548,15 +8502,112 @@ do_initpyjack(void)
   PyDict_SetItemString(d, "BackendError",  Py_BuildValue("i", JackBackendError));
   PyDict_SetItemString(d, "ClientZombie",  Py_BuildValue("i", JackClientZombie));
 
-  // Enable Numeric module
-  pyjack_importarray();
-
   if (PyErr_Occurred())
-    goto fail;
+    return -1;
 
   // Init jack data structures
-  pyjack_init(&global_client);
+  pyjack_init(&state->global_client, state);
+  return 0;
+}
+
+#define PYJACK_MODULE_DOC "This module provides bindings to manage clients for the Jack Audio Connection Kit architecture"
+
+#ifdef PYJACK_MULTI_PHASE
+static int
+pyjack_traverse(PyObject *m, visitproc visit, void *arg)
+{
+  pyjack_state_t *state = pyjack_state_of_module(m);
+  Py_VISIT(state->ClientType);
+  Py_VISIT(state->StreamReaderType);
+  Py_VISIT(state->Error);
+  Py_VISIT(state->NotConnectedError);
+  Py_VISIT(state->UsageError);
+  Py_VISIT(state->InputSyncError);
+  Py_VISIT(state->OutputSyncError);
+  return 0;
+}
+
+static int
+pyjack_clear(PyObject *m)
+{
+  pyjack_state_t *state = pyjack_state_of_module(m);
+  Py_CLEAR(state->ClientType);
+  Py_CLEAR(state->StreamReaderType);
+  Py_CLEAR(state->Error);
+  Py_CLEAR(state->NotConnectedError);
+  Py_CLEAR(state->UsageError);
+  Py_CLEAR(state->InputSyncError);
+  Py_CLEAR(state->OutputSyncError);
+  return 0;
+}
+
+// The interpreter is going away: close its global client
+static void
+pyjack_free(void *m)
+{
+  pyjack_state_t *state = pyjack_state_of_module((PyObject *)m);
+  pyjack_client_t *client = &state->global_client;
+  if (client->state) {
+    pyjack_client_t *expected = client;
+    Py_XDECREF(detach((PyObject *)m, NULL));
+    __atomic_compare_exchange_n(&hangup_client, &expected, NULL, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    if (client->mem_client_locked)
+        pages_unlock(client, sizeof(*client));
+    Py_CLEAR(client->callback_buffer_size);
+    Py_CLEAR(client->callback_client_registration);
+    Py_CLEAR(client->callback_freewheel);
+    Py_CLEAR(client->callback_graph_order);
+    Py_CLEAR(client->callback_latency);
+    Py_CLEAR(client->callback_port_connect);
+    Py_CLEAR(client->callback_port_registration);
+    Py_CLEAR(client->callback_sample_rate);
+    Py_CLEAR(client->callback_thread_init);
+    Py_CLEAR(client->callback_xrun);
+    Py_CLEAR(client->callback_reconnect);
+  }
+  pyjack_clear((PyObject *)m);
+}
+
+static PyModuleDef_Slot pyjack_slots[] = {
+  {Py_mod_exec, pyjack_exec},
+#ifdef Py_mod_multiple_interpreters
+  // the state is per interpreter, but numpy's C API is not (see pyjack_numpy())
+  {Py_mod_multiple_interpreters, Py_MOD_MULTIPLE_INTERPRETERS_SUPPORTED},
+#endif
+#ifdef Py_GIL_DISABLED
+  // all state is per client and guarded by its critical section, or atomic
+  {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+  {0, NULL}
+};
 
+static struct PyModuleDef pyjack_moduledef = {
+  PyModuleDef_HEAD_INIT,
+  "jack",
+  PYJACK_MODULE_DOC,
+  sizeof(pyjack_state_t),
+  pyjack_methods,
+  pyjack_slots,
+  pyjack_traverse,
+  pyjack_clear,
+  pyjack_free,
+};
+
+PyMODINIT_FUNC PyInit_jack(void)
+{
+    return PyModuleDef_Init(&pyjack_moduledef);
+}
+
+#else
+
+static PyObject *
+do_initpyjack(void)
+{
+  PyObject *m=NULL;
+
+  PYJACK_MOD_DEF(m, "jack", PYJACK_MODULE_DOC, pyjack_methods);
+  if (m == NULL || pyjack_exec(m) < 0)
+    goto fail;
   return m;
 
 fail:
@@ -1564,8 +8615,6 @@ fail:
   return NULL;
 }
 
-
-
 #ifndef PyMODINIT_FUNC  /* declarations for DLL import/export */
 #define PyMODINIT_FUNC void
 #endif
@@ -1580,3 +8629,5 @@ fail:
         return do_initpyjack();
     }
 #endif
+
+#endif
@@ -0,0 +1,101 @@
+/**
+  * pyjack_capi - C API of the jack module, for other extension modules
+  *
+  * This source code is released under the terms of the GNU LGPL v2.1.
+  * See LICENSE for the full text of these terms.
+  *
+  * The jack module publishes a table of function pointers as the capsule
+  * jack._C_API. Extensions fetch it once with pyjack_capi_import(), then
+  * exchange audio with a client through taps: rings between the process
+  * thread and one thread of the extension, which need neither the GIL nor
+  * any python call per period.
+  *
+  * An input tap receives the periods of some input ports, an output tap
+  * is mixed into some output ports (on top of what process() delivers).
+  * The reading (input) or writing (output) side of a tap belongs to a
+  * single thread of the extension:
+  *
+  *   frames = api->tap_acquire(tap, channels, &frame_time);
+  *   ... read or write frames samples at channels[0..count-1] ...
+  *   api->tap_release(tap, frames);
+  *
+  * Functions taking a client need the GIL; the tap_* functions other
+  * than tap_open() and tap_close() do not.
+  */
+#ifndef PYJACK_CAPI_H
+#define PYJACK_CAPI_H
+
+#include <Python.h>
+#include <stdint.h>
+#include <jack/jack.h>
+
+#define PYJACK_CAPI_NAME "jack._C_API"
+#define PYJACK_CAPI_VERSION 1
+
+enum {
+    PYJACK_TAP_INPUT,                               // the process thread writes, the extension reads
+    PYJACK_TAP_OUTPUT                               // the extension writes, the process thread mixes it into the ports
+};
+
+typedef struct pyjack_tap pyjack_tap_t;
+
+// Timing of the last process cycle (see jack_get_cycle_times())
+typedef struct {
+    jack_nframes_t buffer_size;                     // frames in the cycle
+    jack_nframes_t current_frames;                  // frame time at the start of the cycle
+    jack_time_t    current_usecs;                   // estimated start time of the cycle
+    jack_time_t    next_usecs;                      // estimated start time of the next cycle
+    float          period_usecs;                    // filtered period duration
+} pyjack_capi_cycle_times_t;
+
+// Counters of a client
+typedef struct {
+    uint64_t       cycles;                          // process cycles started
+    uint64_t       underrun_periods;                // periods process() delivered too late
+    uint64_t       underrun_events;                 // dropouts (runs of late periods)
+    uint64_t       output_written;                  // output blocks sent by process()
+    uint64_t       output_read;                     // output blocks played by the process thread
+} pyjack_capi_stats_t;
+
+typedef struct {
+    unsigned int   version;                         // PYJACK_CAPI_VERSION
+    unsigned int   size;                            // sizeof(pyjack_capi_t); later versions only append
+
+    // Open a tap on ports of client (a jack.Client, or the jack module for the global client),
+    // holding at least frames frames; returns NULL with an exception set on failure
+    pyjack_tap_t * (*tap_open)(PyObject * client, int direction, const char * const * ports, int count, jack_nframes_t frames);
+    // Detach the tap from the process thread and free it
+    void           (*tap_close)(pyjack_tap_t * tap);
+    // Number of channels (ports) of the tap
+    int            (*tap_channels)(const pyjack_tap_t * tap);
+    // Contiguous frames that can be read (input) or written (output) now, at channels[c] for each
+    // channel; frame_time (if not NULL) gets the JACK frame time of the first one (for an output
+    // tap: assuming the ring does not run dry before they are played)
+    jack_nframes_t (*tap_acquire)(pyjack_tap_t * tap, float ** channels, jack_nframes_t * frame_time);
+    // Hand frames acquired frames back: consumed (input) or ready to be played (output)
+    void           (*tap_release)(pyjack_tap_t * tap, jack_nframes_t frames);
+    // Peak level of a channel since the previous call
+    float          (*tap_peak)(pyjack_tap_t * tap, int channel);
+    // Periods dropped because the ring was full (input), or played short because it was empty (output)
+    uint64_t       (*tap_xruns)(const pyjack_tap_t * tap);
+
+    // Timing of the last cycle of client; returns -1 with an exception set on failure
+    int            (*get_cycle_times)(PyObject * client, pyjack_capi_cycle_times_t * times);
+    // Counters of client; returns -1 with an exception set on failure
+    int            (*get_stats)(PyObject * client, pyjack_capi_stats_t * stats);
+} pyjack_capi_t;
+
+#ifndef PYJACK_CAPI_IMPLEMENTATION
+// Import the jack module and return its C API, or NULL with an exception set
+static pyjack_capi_t * pyjack_capi_import(void)
+{
+    pyjack_capi_t * api = (pyjack_capi_t*)PyCapsule_Import(PYJACK_CAPI_NAME, 0);
+    if (api && (api->version != PYJACK_CAPI_VERSION || api->size < sizeof(pyjack_capi_t))) {
+        PyErr_Format(PyExc_ImportError, "jack C API version %u, expected %u", api->version, PYJACK_CAPI_VERSION);
+        return NULL;
+    }
+    return api;
+}
+#endif
+
+#endif
@@ -20,6 +20,26 @@ if ("jack_get_version_string" in test):
   pyjack_macros+=[('JACK2', '1')]
 else:
   pyjack_macros+=[('JACK1', '1')]
+# latency ranges (JACK1 0.120 / JACK2 1.9.7 and later)
+if ("jack_set_latency_callback" in test):
+  pyjack_macros+=[('WANT_LATENCY_CALLBACK', '1')]
+#----------------------------------------------------#
+
+# PYJACK_MOCK=1 builds against an in-process mock server
+# (jackmock.c) instead of libjack, for tests without JACK
+#----------------------------------------------------#
+pyjack_sources=["pyjack.c"]
+pyjack_libraries=["jack", "dl", "rt", "m"]
+if os.environ.get("PYJACK_MOCK"):
+  pyjack_macros+=[('PYJACK_MOCK', '1')]
+  pyjack_sources+=["jackmock.c"]
+  pyjack_libraries=["pthread", "dl", "rt", "m"]
+#----------------------------------------------------#
+
+# LADSPA plugin hosting needs ladspa.h (plugins are loaded with dlopen)
+#----------------------------------------------------#
+if os.path.exists("/usr/local/include/ladspa.h") or os.path.exists("/usr/include/ladspa.h"):
+  pyjack_macros+=[('HAVE_LADSPA', '1')]
 #----------------------------------------------------#
 
 
@@ -40,9 +60,10 @@ For information about Jack see http://jackaudio.org.  This
 enables a Python program to connect to and interact with pro-audio
 applications which use the Jack Audio Server''',
     license = "GNU LGPL2.1",
+    headers = ["pyjack_capi.h"],
     ext_modules = [Extension("jack",
-                             ["pyjack.c"],
-                             libraries=["jack", "dl"],
+                             pyjack_sources,
+                             libraries=pyjack_libraries,
                              include_dirs=numpy_include_dirs,
                              define_macros=pyjack_macros,
                              )],
@@ -0,0 +1,652 @@
+#!/usr/bin/python
+# Exercise pyjack against the in-process mock server, without a JACK server:
+#   PYJACK_MOCK=1 python setup.py build_ext --inplace && python tests/mock.py
+import array
+import os
+os.environ["PYJACK_MOCK_SPEED"] = "0"   # cycles only run through mock_run()
+import json
+import platform
+import sys
+import sysconfig
+import tempfile
+import threading
+import time
+import numpy
+import jack
+
+if not hasattr(jack, "mock_run"):
+    print("jack was not built with PYJACK_MOCK=1")
+    exit(1)
+
+events = []
+jack.attach("mock")
+jack.register_port("in_1", jack.IsInput)
+jack.register_port("out_1", jack.IsOutput)
+jack.set_xrun_callback(lambda: events.append("xrun"))
+jack.activate()
+jack.connect("mock:out_1", "mock:in_1")
+jack.check_events()
+
+# send a block numbered k on every cycle, and see it come back after a fixed delay
+bs = jack.get_buffer_size()
+i = numpy.zeros((1, bs), 'f')
+delay = None
+for k in range(1, 100):
+    jack.mock_run(1)
+    jack.process(numpy.full((1, bs), k, 'f'), i)
+    if i[0, 0]:
+        assert (i == i[0, 0]).all()
+        if delay is None:
+            delay = k - int(i[0, 0])
+        assert k - i[0, 0] == delay
+print("round trip: %d periods" % delay)
+
+jack.mock_xrun()
+assert events == ["xrun"]
+jack.mock_add_port("other:out_1")
+e = jack.check_events()
+assert e["xrun"] and e["port_registration"]
+
+# a buffer size change drops the blocks of the old size still queued, even a full socket of them
+jack.mock_run(50)
+jack.mock_set_buffer_size(2 * bs)
+assert jack.check_events()["buffer_size"] == 2 * bs and jack.get_buffer_size() == 2 * bs
+i = numpy.zeros((1, 2 * bs), 'f')
+for k in range(1, 10):
+    jack.mock_run(1)
+    try:
+        jack.process(numpy.full((1, 2 * bs), k, 'f'), i)
+    except (jack.InputSyncError, jack.OutputSyncError):
+        pass
+assert (i == i[0, 0]).all() and 9 - i[0, 0] == delay
+jack.mock_set_buffer_size(bs)
+i = numpy.zeros((1, bs), 'f')
+for k in range(1, 10):
+    jack.mock_run(1)
+    try:
+        jack.process(numpy.full((1, bs), k, 'f'), i)
+    except (jack.InputSyncError, jack.OutputSyncError):
+        pass
+assert 9 - i[0, 0] == delay
+
+# pyjack adds its own delay to the latency ranges it passes on (with a jack.h that has them)
+if hasattr(jack, "set_latency_callback"):
+    modes = []
+    jack.set_latency_callback(lambda mode: modes.append(mode))
+    jack.recompute_latencies()
+    total = jack.get_latency()["total"]
+    assert modes == [0, 1] and total >= bs
+    assert jack.mock_get_latency_range("mock:out_1", 0) == (total, total)
+    assert jack.mock_get_latency_range("mock:in_1", 1) == (total, total)
+    jack.set_latency_callback(lambda mode: None)
+
+# the history holds what the input port received, one period after it was played
+jack.enable_history(["in_1"], 1.0)
+jack.mock_run(1)
+jack.process(numpy.zeros((1, bs), 'f'), i)
+f = jack.get_frame_time()
+try:
+    jack.snapshot_history(f - 10 * bs, f - bs)     # from before the history started
+    assert False
+except ValueError:
+    pass
+ramp = numpy.arange(1, 4 * bs + 1, dtype='f')
+start = jack.get_frame_time() + bs
+jack.schedule(ramp, "out_1", start)
+for k in range(8):
+    jack.mock_run(1)
+    jack.process(numpy.zeros((1, bs), 'f'), i)
+assert (jack.snapshot_history(start + bs, start + bs + len(ramp))[0] == ramp).all()
+wav = os.path.join(tempfile.mkdtemp(), "history.wav")
+assert jack.snapshot_history(start + bs, start + bs + len(ramp), wav) == len(ramp)
+assert os.path.getsize(wav) == 58 + 4 * len(ramp)
+jack.disable_history()
+
+# a captured session replays the same input blocks, without a server
+session = os.path.join(tempfile.mkdtemp(), "mock.pjs")
+jack.capture_session(session)
+live = []
+for k in range(1, 20):
+    jack.mock_run(1)
+    jack.process(numpy.full((1, bs), k, 'f'), i)
+    live.append(i.copy())
+assert jack.stop_session() == len(live)
+replay = jack.Client("replay", replay=session)
+for block in live:
+    replay.process(numpy.zeros((1, bs), 'f'), i)
+    assert (i == block).all()
+try:
+    replay.process(numpy.zeros((1, bs), 'f'), i)
+    assert False
+except EOFError:
+    pass
+replay.detach()
+# a session that cannot be written is reported, not silently truncated
+if os.path.exists("/dev/full"):
+    jack.capture_session("/dev/full")
+    jack.mock_run(1)
+    jack.process(numpy.zeros((1, bs), 'f'), i)
+    try:
+        jack.stop_session()
+        assert False
+    except IOError:
+        pass
+
+# LADSPA plugins run on the output ports (needs a build with ladspa.h, and a C compiler)
+plugin = os.path.join(tempfile.mkdtemp(), "testplug.so")
+if not hasattr(jack, "add_plugin"):
+    print("skipping LADSPA: jack was built without ladspa.h")
+elif os.system("%s %s -shared -fPIC -o %s %s" % (os.environ.get("CC", "cc"), os.environ.get("CFLAGS", ""), plugin,
+                                                 os.path.join(os.path.dirname(__file__), "testplug.c"))):
+    print("skipping LADSPA: cannot build tests/testplug.c")
+else:
+    amp = jack.add_plugin(plugin, ["out_1"], ["out_1"], label="amp", controls={"Gain": 2.0})
+    for k in range(8):
+        jack.mock_run(1)
+        jack.process(numpy.full((1, bs), 0.25, 'f'), i)
+    assert (i == 0.5).all()
+    assert jack.get_plugin_controls(amp)["Peak"] == 0.5
+    jack.remove_plugin(amp)
+    # plugins that may block in run() need an explicit opt-in
+    try:
+        jack.add_plugin(plugin, ["out_1"], ["out_1"], label="amp_unsafe")
+        assert False
+    except jack.UsageError:
+        pass
+    jack.remove_plugin(jack.add_plugin(plugin, ["out_1"], ["out_1"], label="amp_unsafe", realtime_unsafe=True))
+
+# a convolver matches numpy.convolve, also past the head the RT thread covers (the worker's tail),
+# and crossfades into a new response (unless its worker was late)
+for k in range(4):
+    jack.mock_run(1)
+    jack.process(numpy.zeros((1, bs), 'f'), i)
+rng = numpy.random.default_rng(1)
+ir = rng.standard_normal(12000).astype('f') * 0.05
+ir2 = rng.standard_normal(10000).astype('f') * 0.05
+cv = jack.add_convolver("out_1", "out_1", ir)
+assert jack.get_convolver_stats(cv)["head_length"] < len(ir)
+x = rng.standard_normal(120 * bs).astype('f')
+got = []
+for k in range(120 + delay):
+    if k == 60:
+        jack.set_convolver_ir(cv, ir2, fade=0.01)
+    jack.mock_run(1)
+    jack.process(x[None, k * bs:(k + 1) * bs] if k < 120 else numpy.zeros((1, bs), 'f'), i)
+    got.append(i[0].copy())
+    time.sleep(0.005)     # the worker's time to convolve the tail
+y = numpy.concatenate(got)[delay * bs:]
+if not jack.get_convolver_stats(cv)["late"]:
+    assert numpy.abs(y[:60 * bs] - numpy.convolve(x, ir)[:60 * bs]).max() < 1e-4
+    assert numpy.abs(y[100 * bs:] - numpy.convolve(x, ir2)[100 * bs:120 * bs]).max() < 1e-4
+jack.remove_convolver(cv)
+
+# the analyzer finds a tone in its bin
+jack.enable_analyzer(["in_1"], fft_size=256, window="rectangular")
+assert jack.get_spectrum() is None
+tone = numpy.sin(2 * numpy.pi * 8 * numpy.arange(bs) / 256).astype('f')
+for k in range(8):
+    jack.mock_run(1)
+    jack.process(tone[None], i)
+    time.sleep(0.002)     # the analyzer's time to publish
+spectra, frame_time = jack.get_spectrum()
+assert spectra.shape == (1, 129) and spectra.argmax() == 8 and abs(spectra[0, 8] - 1) < 1e-3
+jack.disable_analyzer()
+
+# the trace records the cycles, process() calls and xruns as Chrome trace JSON
+jack.enable_trace()
+for k in range(4):
+    jack.mock_run(1)
+    jack.process(numpy.zeros((1, bs), 'f'), i)
+jack.mock_xrun()
+trace = os.path.join(tempfile.mkdtemp(), "trace.json")
+assert jack.dump_trace(trace) > 0
+names = [e["name"] for e in json.load(open(trace))["traceEvents"]]
+assert names.count("input_write") == 4 and "cycle" in names and "process" in names and "xrun" in names
+jack.disable_trace()
+
+# an exported stream can be read back from shared memory, until the writer comes round again
+# (the period it is writing counts as overwritten already)
+jack.export_stream("pyjack-mock", ["in_1"], frames=4 * bs)
+reader = jack.StreamReader("pyjack-mock")
+live = []
+for k in range(1, 4):
+    jack.mock_run(1)
+    jack.process(numpy.full((1, bs), k, 'f'), i)
+    live.append(i.copy())
+assert (reader.read() == numpy.concatenate(live, axis=1)).all()
+for k in range(4):
+    jack.mock_run(1)
+    jack.process(numpy.zeros((1, bs), 'f'), i)
+try:
+    reader.read()
+    assert False
+except jack.InputSyncError:
+    pass
+assert reader.available() == 3 * bs
+reader.close()
+jack.unexport_stream("pyjack-mock")
+
+# when process() is late, UnderrunFade ramps the last sample played down to silence and back up
+jack.enable_history(["in_1"], 1.0)
+jack.set_underrun_policy(jack.UnderrunFade, fade_frames=2 * bs)
+for block in (numpy.full(bs, 0.5), numpy.full(bs, 0.5), numpy.linspace(0.5, 1, bs)):
+    jack.mock_run(1)
+    jack.process(numpy.array([block], 'f'), i)
+dropouts = jack.get_underrun_stats()["events"]
+f = jack.get_frame_time()
+jack.mock_run(3)
+stats = jack.get_underrun_stats()
+assert stats["active"] and stats["events"] == dropouts + 1 and stats["periods"] >= 2
+def catch_up(block):
+    for k in range(6):
+        jack.mock_run(1)
+        try:
+            jack.process(block, i)
+        except jack.InputSyncError:
+            pass
+catch_up(numpy.full((1, bs), 0.5, 'f'))
+assert not jack.get_underrun_stats()["active"]
+h = jack.snapshot_history(f - bs, f + 8 * bs)[0]
+assert numpy.abs(numpy.diff(h)).max() < 0.5 / (bs - 1) + 1e-6 and (h == 0).sum() >= bs
+# UnderrunRepeat plays the last period again, for repeat_frames only
+jack.set_underrun_policy(jack.UnderrunRepeat, repeat_frames=bs)
+f = jack.get_frame_time()
+jack.mock_run(3)
+catch_up(numpy.full((1, bs), 0.5, 'f'))
+h = jack.snapshot_history(f - bs, f + 8 * bs)[0]
+assert (h == 0.5).sum() >= 2 * bs and (h == 0).sum() >= bs
+assert jack.get_underrun_stats()["events"] == dropouts + 2
+jack.set_underrun_policy(jack.UnderrunSilence)
+jack.disable_history()
+
+# every interpreter has its own global client, closed when the interpreter goes away
+try:
+    import _interpreters as interpreters
+except ImportError:
+    import _xxsubinterpreters as interpreters
+sub = interpreters.create()
+interpreters.run_string(sub, "import jack\njack.attach('sub')\njack.register_port('in_1', jack.IsInput)\n")
+assert jack.get_client_name() == "mock" and "sub:in_1" in jack.get_ports()
+interpreters.destroy(sub)
+assert "sub:in_1" not in jack.get_ports()
+
+# measure_roundtrip finds the mock's loopback latency (plus the period it takes to come back)
+jack.disconnect("mock:out_1", "mock:in_1")
+jack.connect("mock:out_1", "system:playback_1")
+jack.connect("system:capture_1", "mock:in_1")
+for latency in (37, 1000):
+    jack.mock_set_loopback(latency)
+    measured = []
+    t = threading.Thread(target=lambda: measured.append(jack.measure_roundtrip("out_1", "in_1", max_latency=0.1, order=12)))
+    t.start()
+    while t.is_alive():
+        jack.mock_run(1)
+        time.sleep(0.0005)
+    assert measured[0]["frames"] == latency + bs and not measured[0]["inverted"]
+jack.mock_set_loopback(0)
+jack.disconnect("mock:out_1", "system:playback_1")
+jack.disconnect("system:capture_1", "mock:in_1")
+jack.connect("mock:out_1", "mock:in_1")
+
+# the mock clock runs cycles on its own once it is given a speed
+f = jack.get_frame_time()
+jack.mock_set_speed(8)
+time.sleep(0.05)
+assert jack.get_frame_time() - f >= 4 * bs
+
+# clients can be driven from several threads at once, each with its own ports and stream
+# (in a free-threaded build, in parallel)
+def drive(n, errors, received):
+    try:
+        c = jack.Client("stress%d" % n)
+        c.register_port("in_1", jack.IsInput)
+        c.register_port("out_1", jack.IsOutput)
+        c.activate()
+        c.connect("stress%d:out_1" % n, "stress%d:in_1" % n)
+        i = numpy.zeros((1, bs), 'f')
+        got = 0
+        # the RT thread skips its cycles while the ports change
+        for k in range(2000):
+            if got == 100:
+                break
+            try:
+                c.process(numpy.full((1, bs), n + 1, 'f'), i)
+            except (jack.InputSyncError, jack.OutputSyncError):
+                time.sleep(0.001)
+                continue
+            if i[0, 0]:
+                assert (i == n + 1).all()
+                got += 1
+            if k % 50 == 0:
+                c.register_port("extra", jack.IsInput)
+                c.unregister_port("extra")
+        received.append(got)
+        c.detach()
+    except Exception as e:
+        errors.append(e)
+errors, received = [], []
+threads = [threading.Thread(target=drive, args=(n, errors, received)) for n in range(8)]
+for t in threads:
+    t.start()
+for t in threads:
+    t.join()
+assert not errors and received == [100] * 8, (errors, received)
+assert not [p for p in jack.get_ports() if p.startswith("stress")]
+
+# the trace ring can come and go while the RT thread writes into it
+for k in range(50):
+    jack.enable_trace(64)
+    time.sleep(0.001)
+    jack.disable_trace()
+
+# the client comes back with its ports and connections once the server restarts
+# (which it shuts down while the clock is running)
+jack.set_auto_reconnect(True, interval=0.01)
+jack.mock_shutdown()
+assert jack.check_events()["shutdown"]
+try:
+    jack.attach("mock")     # the old ports are only released by detach()
+    assert False
+except jack.UsageError:
+    pass
+jack.mock_set_buffer_size(2 * bs)
+jack.mock_restart()
+for k in range(500):
+    if jack.check_events()["reconnect"]:
+        break
+    time.sleep(0.01)
+assert jack.get_connections("mock:in_1") == ["mock:out_1"]
+print("reconnected after %.3f s" % jack.get_reconnect_stats()["last_downtime"])
+jack.mock_set_speed(0)
+# ... with the server's new buffer size
+bs = jack.get_buffer_size()
+i = numpy.zeros((1, bs), 'f')
+for k in range(1, 10):
+    jack.mock_run(1)
+    try:
+        jack.process(numpy.full((1, bs), k, 'f'), i)
+    except jack.InputSyncError:
+        pass
+assert (i == i[0, 0]).all() and i[0, 0] > 0
+# convolvers run in partitions of one period, with radix 2 FFTs
+cv = jack.add_convolver("out_1", "out_1", numpy.ones(3000, 'f'))
+jack.mock_set_buffer_size(3 * bs // 4)
+try:
+    jack.add_convolver("out_1", "out_1", numpy.ones(3, 'f'))
+    assert False
+except jack.UsageError:
+    pass
+assert jack.get_convolver_stats(cv)["partition_size"] == bs     # not rebuilt, silent
+jack.remove_convolver(cv)
+bs = jack.get_buffer_size()
+
+# frame times convert to usecs and back with the timing of the last cycle
+jack.mock_run(1)
+ct = jack.get_cycle_times()
+f = ct["current_frames"]
+assert ct["buffer_size"] == bs and jack.frames_to_time(f + bs) == ct["next_usecs"]
+assert jack.time_to_frames(ct["next_usecs"]) == f + bs
+frames = numpy.arange(f, f + 10 * bs, bs, dtype='uint32')
+assert (jack.time_to_frames(jack.frames_to_time(frames)) == frames).all()
+# ... and with the nominal period while jack does not time the cycles
+jack.mock_set_freewheel(1)
+jack.mock_run(1)
+f = jack.get_cycle_times()["current_frames"]
+assert abs(jack.frames_to_time(f + bs) - jack.frames_to_time(f) - 1e6 * bs / jack.get_sample_rate()) <= 1
+jack.mock_set_freewheel(0)
+
+# the buffers of the RT thread are prefaulted, and locked into RAM unless that is turned off
+# (a lock that fails, over RLIMIT_MEMLOCK, is counted instead)
+c = jack.Client("memory")
+base = c.get_memory_stats()
+c.register_port("in_1", jack.IsInput)
+c.register_port("out_1", jack.IsOutput)
+m = c.get_memory_stats()
+grown = m["allocated"] - base["allocated"]
+assert grown > 0 and m["resident"] == m["allocated"]
+assert m["locked"] - base["locked"] == grown or m["lock_failures"] > base["lock_failures"]
+c.set_memory_options(lock=False)
+c.register_port("in_2", jack.IsInput)
+m2 = c.get_memory_stats()
+assert m2["locked"] < m["locked"] or m["lock_failures"] > base["lock_failures"]   # the input buffer moved
+c.unregister_port("in_2")
+assert c.get_memory_stats()["allocated"] == m["allocated"]
+c.detach()
+
+# the process thread gets the affinity, priority and denormal mode asked for, or reports why not
+# (with a thread of its own: the mock runs process callbacks on the thread calling mock_run)
+c = jack.Client("threads")
+try:
+    c.get_thread_info()
+    assert False
+except jack.UsageError:
+    pass
+for bad in ({"affinity": []}, {"affinity": [-1]}, {"rt_priority": 1000}):
+    try:
+        c.set_thread_options(**bad)
+        assert False
+    except ValueError:
+        pass
+cpu = min(os.sched_getaffinity(0))
+c.set_thread_options(affinity=[cpu], rt_priority=10, flush_denormals=True)
+c.set_process_thread(True)
+c.activate()
+jack.mock_run(1)
+info = c.get_thread_info()
+assert info["tid"] != threading.get_native_id() and info["affinity"] == [cpu] and not info["affinity_error"]
+assert info["flush_denormals"] or platform.machine() not in ("x86_64", "aarch64")
+assert info["priority_error"] or (info["policy"] == "SCHED_FIFO" and info["priority"] == 10)
+c.detach()
+
+# the resamplers size the python-side blocks by the ratio of the rates, and refuse the ratios
+# they cannot reduce
+c = jack.Client("resample")
+c.register_port("in_1", jack.IsInput)
+c.register_port("out_1", jack.IsOutput)
+for rate in (44100, 16000, 96000):
+    c.set_resampling(rate, rate)
+    r = c.get_resampling()
+    assert r["input_frames"] == r["output_frames"] == round(bs * rate / 48000)
+    assert r["input_latency"] > 0 and r["output_latency"] > 0
+try:
+    c.set_resampling(48001)
+    assert False
+except jack.UsageError:
+    pass
+# a tone comes back at its own pitch and level, before and after the JACK rate changes
+def roundtrip(rate, cycles=60):
+    n = c.get_resampling()["input_frames"]
+    i = numpy.zeros((1, n), 'f')
+    played, got = 0, []
+    for k in range(cycles):
+        jack.mock_run(1)
+        o = 0.5 * numpy.sin(2 * numpy.pi * 1000 * numpy.arange(played, played + n) / rate)
+        try:
+            c.process(numpy.array([o], 'f'), i)
+        except (jack.InputSyncError, jack.OutputSyncError):
+            continue
+        played += n
+        got.append(i[0].copy())
+    tail = numpy.concatenate(got)[-2048:]
+    assert abs(numpy.abs(tail).max() - 0.5) < 0.01
+    assert abs(numpy.argmax(numpy.abs(numpy.fft.rfft(tail))) * rate / len(tail) - 1000) < rate / len(tail)
+c.set_resampling(24000, 24000)
+c.activate()
+c.connect("resample:out_1", "resample:in_1")
+roundtrip(24000)
+jack.mock_set_sample_rate(96000)
+assert c.get_resampling()["input_frames"] == bs // 4
+roundtrip(24000)
+jack.mock_set_sample_rate(48001)
+try:
+    c.process(numpy.zeros((1, bs // 4), 'f'), numpy.zeros((1, bs // 4), 'f'))
+    assert False
+except jack.Error:
+    pass
+jack.mock_set_sample_rate(48000)
+assert c.get_resampling()["input_frames"] == bs // 2
+roundtrip(24000)
+c.detach()
+
+# pyjack's own cycle loop moves the same blocks, with the same delay, and resamples the inputs
+# it copied once the cycle is signalled
+c = jack.Client("cycle")
+c.register_port("in_1", jack.IsInput)
+c.register_port("out_1", jack.IsOutput)
+c.set_process_thread(True)
+c.activate()
+try:
+    c.set_process_thread(False)
+    assert False
+except jack.UsageError:
+    pass
+c.connect("cycle:out_1", "cycle:in_1")
+i = numpy.zeros((1, bs), 'f')
+for k in range(1, 10):
+    jack.mock_run(1)
+    c.process(numpy.full((1, bs), k, 'f'), i)
+assert (i == i[0, 0]).all() and 9 - i[0, 0] == delay
+c.detach()
+c = jack.Client("cycle")
+c.register_port("in_1", jack.IsInput)
+c.register_port("out_1", jack.IsOutput)
+c.set_process_thread(True)
+c.set_resampling(24000, 24000)
+c.activate()
+c.connect("cycle:out_1", "cycle:in_1")
+roundtrip(24000)
+c.detach()
+
+# silent input channels stay behind once the hold time has run out; process() fills in zeros
+c = jack.Client("quiet")
+for n in (1, 2):
+    c.register_port("in_%d" % n, jack.IsInput)
+    c.register_port("out_%d" % n, jack.IsOutput)
+c.set_silence_detection(0.01, hold_time=2 * bs / jack.get_sample_rate())
+c.activate()
+c.connect("quiet:out_1", "quiet:in_1")
+c.connect("quiet:out_2", "quiet:in_2")
+levels = [1 / 128] * 4 + [1] + [1 / 128] * 6
+i = numpy.zeros((2, bs), 'f')
+seen = []
+for k in range(len(levels) + delay):
+    jack.mock_run(1)
+    c.process(numpy.array([numpy.full(bs, 1), numpy.full(bs, levels[min(k, len(levels) - 1)])], 'f'), i)
+    if k >= delay:
+        assert (i[0] == 1).all() and c.get_input_activity()[0]
+        seen.append((c.get_input_activity()[1], float(i[1, 0])))
+assert seen == [(False, 0)] * 4 + [(True, 1)] + [(True, 1 / 128)] * 2 + [(False, 0)] * 4, seen
+c.detach()
+
+# process() takes any buffer of floats or doubles, (ports, frames) with any strides or flat
+c = jack.Client("buffers")
+for n in (1, 2):
+    c.register_port("in_%d" % n, jack.IsInput)
+    c.register_port("out_%d" % n, jack.IsOutput)
+c.activate()
+c.connect("buffers:out_1", "buffers:in_1")
+c.connect("buffers:out_2", "buffers:in_2")
+ramp = numpy.arange(2 * bs, dtype='f').reshape(2, bs) / (2 * bs)
+outputs = [array.array('f', ramp.ravel()), memoryview(ramp.astype('d').tobytes()).cast('d', (2, bs)),
+           numpy.asfortranarray(ramp), numpy.repeat(ramp, 2, axis=1)[:, ::2]]
+inputs = [array.array('d', bytes(16 * bs)), memoryview(bytearray(8 * bs)).cast('f', (2, bs)),
+          numpy.zeros((2, 2 * bs), 'd')[:, ::2], numpy.zeros((2, bs), 'f')]
+for k in range(len(outputs) + delay):
+    jack.mock_run(1)
+    c.process(outputs[k % len(outputs)], inputs[k % len(inputs)])
+    if k >= delay:
+        assert (numpy.asarray(inputs[k % len(inputs)], 'f').reshape(2, bs) == ramp).all(), k
+for o, i, error in ((array.array('i', bytes(8 * bs)), numpy.zeros((2, bs), 'f'), ValueError),
+                    (ramp, numpy.zeros((2, bs + 1), 'f'), ValueError),
+                    (ramp, numpy.zeros((3, bs), 'f'), ValueError),
+                    (ramp, bytes(8 * bs), BufferError)):
+    try:
+        c.process(o, i)
+        assert False
+    except error:
+        pass
+c.detach()
+
+# a parameter bound to a port's gain ramps sample by sample, in equal steps or equal ratios
+# (or in equal steps after all, across zero)
+c = jack.Client("params")
+c.register_port("in_1", jack.IsInput)
+c.register_port("out_1", jack.IsOutput)
+c.activate()
+c.connect("params:out_1", "params:in_1")
+c.add_param("gain", 1.0)
+c.bind_port_gain("out_1", "gain")
+def play(cycles):
+    i = numpy.zeros((1, bs), 'f')
+    got = []
+    for k in range(cycles):
+        jack.mock_run(1)
+        c.process(numpy.ones((1, bs), 'f'), i)
+        got.append(i[0].copy())
+    return numpy.concatenate(got)
+assert (play(1 + delay)[-bs:] == 1).all()
+try:
+    c.set_param("volume", 0.5)
+    assert False
+except jack.UsageError:
+    pass
+def ramp(value, exponential):
+    c.set_param("gain", value, ramp=2 * bs / jack.get_sample_rate(), exponential=exponential)
+    h = play(4 + delay)
+    assert c.get_param("gain") == value
+    start = numpy.flatnonzero(h != h[0])[0]
+    assert (h[start + 2 * bs - 1:] == value).all() and (h[start:start + 2 * bs - 1] != value).all()
+    return h[start - 1:start + 2 * bs].astype('d')
+h = ramp(0.0, False)
+assert h[0] == 1 and numpy.allclose(numpy.diff(h), -1 / (2 * bs), atol=1e-5)
+c.set_param("gain", 1.0, ramp=0)
+play(1 + delay)
+h = ramp(0.25, True)
+assert numpy.allclose(h[1:] / h[:-1], 0.25 ** (1 / (2 * bs)), atol=1e-5)
+h = ramp(-0.25, True)
+assert numpy.allclose(numpy.diff(h), -0.5 / (2 * bs), atol=1e-5)
+c.remove_param("gain")
+assert (play(1 + delay)[-bs:] == 1).all()
+c.detach()
+
+# extensions tap the ports through the C API, without process() (needs a C compiler)
+tapdir = tempfile.mkdtemp()
+if os.system("%s %s -shared -fPIC -I%s -I%s -o %s %s" % (
+        os.environ.get("CC", "cc"), os.environ.get("CFLAGS", ""), sysconfig.get_paths()["include"],
+        os.path.dirname(os.path.dirname(os.path.abspath(__file__))),
+        os.path.join(tapdir, "taptest" + sysconfig.get_config_var("EXT_SUFFIX")),
+        os.path.join(os.path.dirname(__file__), "taptest.c"))):
+    print("skipping the C API: cannot build tests/taptest.c")
+else:
+    sys.path.insert(0, tapdir)
+    import taptest
+    c = jack.Client("taps")
+    c.register_port("in_1", jack.IsInput)
+    c.register_port("out_1", jack.IsOutput)
+    c.activate()
+    c.connect("taps:out_1", "taps:in_1")
+    try:
+        taptest.open(c, 0, ["out_1"], bs)
+        assert False
+    except jack.UsageError:
+        pass
+    tap_in = taptest.open(c, 0, ["in_1"], 8 * bs)
+    tap_out = taptest.open(c, 1, ["out_1"], 4 * bs)
+    assert taptest.fill(tap_out, 0.25, 2 * bs) == 2 * bs
+    f = c.get_frame_time()
+    for k in range(4):
+        jack.mock_run(1)
+        c.process(numpy.zeros((1, bs), 'f'), numpy.zeros((1, bs), 'f'))
+        assert taptest.cycle_frames(c) == (f + k * bs, bs)
+    frame_time, samples = taptest.drain(tap_in)
+    assert frame_time == f and samples == [0] * bs + [0.25] * (2 * bs) + [0] * bs
+    assert taptest.peak(tap_in, 0) == 0.25 and taptest.xruns(tap_in) == 0
+    assert taptest.xruns(tap_out) == 2      # the periods it ran dry
+    stats = taptest.stats(c)
+    assert stats["cycles"] == 4 and stats["output_written"] == 4
+    taptest.close(tap_in)
+    taptest.close(tap_out)
+    c.detach()
+
+jack.detach()
+print("OK")
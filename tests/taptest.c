@@ -0,0 +1,159 @@
+/**
+  * taptest - an extension using the C API of jack, for tests/mock.py
+  *
+  * This source code is released under the terms of the GNU LGPL v2.1.
+  * See LICENSE for the full text of these terms.
+  *
+  *   open(client, direction, ports, frames): a tap (closed with close(tap))
+  *   fill(tap, value, frames): write frames samples of value to all channels of an output tap
+  *   drain(tap): (frame_time, samples of the first channel) of what an input tap holds
+  *   peak(tap, channel), xruns(tap), stats(client), cycle_frames(client)
+  *
+  * cc -shared -fPIC -I<python include dir> -I. -o taptest$(python3-config --extension-suffix) tests/taptest.c
+  */
+#include "pyjack_capi.h"
+
+static pyjack_capi_t * api;
+
+static pyjack_tap_t * tap_get(PyObject * obj)
+{
+    return PyCapsule_GetPointer(obj, "taptest.tap");
+}
+
+static PyObject * taptest_open(PyObject * self, PyObject * args)
+{
+    PyObject * client, * names, * seq;
+    const char * ports[8];
+    int direction, frames, count, i;
+    pyjack_tap_t * tap;
+
+    if (!PyArg_ParseTuple(args, "OiOi", &client, &direction, &names, &frames))
+        return NULL;
+    if (!(seq = PySequence_Fast(names, "ports must be a sequence")))
+        return NULL;
+    count = (int)PySequence_Fast_GET_SIZE(seq);
+    for (i = 0; i < count && i < 8; i++) {
+        if (!(ports[i] = PyUnicode_AsUTF8(PySequence_Fast_GET_ITEM(seq, i)))) {
+            Py_DECREF(seq);
+            return NULL;
+        }
+    }
+    tap = api->tap_open(client, direction, ports, i, frames);
+    Py_DECREF(seq);
+    return tap ? PyCapsule_New(tap, "taptest.tap", NULL) : NULL;
+}
+
+static PyObject * taptest_close(PyObject * self, PyObject * obj)
+{
+    pyjack_tap_t * tap = tap_get(obj);
+    if (!tap) return NULL;
+    api->tap_close(tap);
+    PyCapsule_SetName(obj, "taptest.closed");
+    Py_RETURN_NONE;
+}
+
+static PyObject * taptest_fill(PyObject * self, PyObject * args)
+{
+    PyObject * obj;
+    float value, * channels[8];
+    int frames, written = 0, c;
+    jack_nframes_t n, j;
+    pyjack_tap_t * tap;
+
+    if (!PyArg_ParseTuple(args, "Ofi", &obj, &value, &frames) || !(tap = tap_get(obj)))
+        return NULL;
+    // the ring may hand out its free space in two pieces
+    while (written < frames && (n = api->tap_acquire(tap, channels, NULL)) > 0) {
+        if (n > (jack_nframes_t)(frames - written)) n = frames - written;
+        for (c = 0; c < api->tap_channels(tap); c++)
+            for (j = 0; j < n; j++)
+                channels[c][j] = value;
+        api->tap_release(tap, n);
+        written += n;
+    }
+    return PyLong_FromLong(written);
+}
+
+static PyObject * taptest_drain(PyObject * self, PyObject * obj)
+{
+    pyjack_tap_t * tap = tap_get(obj);
+    PyObject * samples, * item;
+    float * channels[8];
+    jack_nframes_t n, j, frame_time, first = 0;
+    int got = 0;
+
+    if (!tap || !(samples = PyList_New(0))) return NULL;
+    while ((n = api->tap_acquire(tap, channels, &frame_time)) > 0) {
+        if (!got++) first = frame_time;
+        for (j = 0; j < n; j++) {
+            if (!(item = PyFloat_FromDouble(channels[0][j])) || PyList_Append(samples, item) < 0) {
+                Py_XDECREF(item);
+                Py_DECREF(samples);
+                return NULL;
+            }
+            Py_DECREF(item);
+        }
+        api->tap_release(tap, n);
+    }
+    return Py_BuildValue("(kN)", (unsigned long)first, samples);
+}
+
+static PyObject * taptest_peak(PyObject * self, PyObject * args)
+{
+    PyObject * obj;
+    int channel;
+    pyjack_tap_t * tap;
+    if (!PyArg_ParseTuple(args, "Oi", &obj, &channel) || !(tap = tap_get(obj)))
+        return NULL;
+    return PyFloat_FromDouble(api->tap_peak(tap, channel));
+}
+
+static PyObject * taptest_xruns(PyObject * self, PyObject * obj)
+{
+    pyjack_tap_t * tap = tap_get(obj);
+    return tap ? PyLong_FromUnsignedLongLong(api->tap_xruns(tap)) : NULL;
+}
+
+static PyObject * taptest_stats(PyObject * self, PyObject * client)
+{
+    pyjack_capi_stats_t stats;
+    if (api->get_stats(client, &stats) < 0)
+        return NULL;
+    return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K}",
+                         "cycles", (unsigned long long)stats.cycles,
+                         "underrun_periods", (unsigned long long)stats.underrun_periods,
+                         "underrun_events", (unsigned long long)stats.underrun_events,
+                         "output_written", (unsigned long long)stats.output_written,
+                         "output_read", (unsigned long long)stats.output_read);
+}
+
+static PyObject * taptest_cycle_frames(PyObject * self, PyObject * client)
+{
+    pyjack_capi_cycle_times_t times;
+    if (api->get_cycle_times(client, &times) < 0)
+        return NULL;
+    return Py_BuildValue("(kk)", (unsigned long)times.current_frames, (unsigned long)times.buffer_size);
+}
+
+static PyMethodDef taptest_methods[] = {
+    {"open",         taptest_open,         METH_VARARGS, NULL},
+    {"close",        taptest_close,        METH_O,       NULL},
+    {"fill",         taptest_fill,         METH_VARARGS, NULL},
+    {"drain",        taptest_drain,        METH_O,       NULL},
+    {"peak",         taptest_peak,         METH_VARARGS, NULL},
+    {"xruns",        taptest_xruns,        METH_O,       NULL},
+    {"stats",        taptest_stats,        METH_O,       NULL},
+    {"cycle_frames", taptest_cycle_frames, METH_O,       NULL},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef taptest_module = {
+    PyModuleDef_HEAD_INIT, "taptest", NULL, -1, taptest_methods
+};
+
+PyMODINIT_FUNC PyInit_taptest(void)
+{
+    if (!(api = pyjack_capi_import()))
+        return NULL;
+    return PyModule_Create(&taptest_module);
+}
@@ -0,0 +1,87 @@
+/**
+  * testplug - LADSPA plugins hosted by tests/mock.py
+  *
+  * This source code is released under the terms of the GNU LGPL v2.1.
+  * See LICENSE for the full text of these terms.
+  *
+  *   "amp": Input -> Output times the Gain control, Peak control out
+  *   "sum": In A + In B -> Out
+  *   "amp_unsafe": "amp" without the hard RT capable property
+  *
+  * cc -shared -fPIC -o testplug.so tests/testplug.c
+  */
+#include <ladspa.h>
+#include <stdlib.h>
+#include <math.h>
+
+typedef struct {
+    LADSPA_Data * port[4];
+} testplug_t;
+
+static LADSPA_Handle testplug_instantiate(const LADSPA_Descriptor * desc, unsigned long rate)
+{
+    return calloc(1, sizeof(testplug_t));
+}
+
+static void testplug_connect(LADSPA_Handle h, unsigned long port, LADSPA_Data * data)
+{
+    ((testplug_t*)h)->port[port] = data;
+}
+
+static void testplug_cleanup(LADSPA_Handle h)
+{
+    free(h);
+}
+
+static void amp_run(LADSPA_Handle h, unsigned long n)
+{
+    testplug_t * p = h;
+    LADSPA_Data peak = 0;
+    unsigned long i;
+    for (i = 0; i < n; i++) {
+        p->port[1][i] = p->port[0][i] * *p->port[2];
+        if (fabsf(p->port[1][i]) > peak)
+            peak = fabsf(p->port[1][i]);
+    }
+    *p->port[3] = peak;
+}
+
+static void sum_run(LADSPA_Handle h, unsigned long n)
+{
+    testplug_t * p = h;
+    unsigned long i;
+    for (i = 0; i < n; i++)
+        p->port[2][i] = p->port[0][i] + p->port[1][i];
+}
+
+static const LADSPA_PortDescriptor amp_ports[] = {
+    LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO, LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO,
+    LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL, LADSPA_PORT_OUTPUT | LADSPA_PORT_CONTROL
+};
+static const char * const amp_names[] = { "Input", "Output", "Gain", "Peak" };
+static const LADSPA_PortRangeHint amp_hints[] = {
+    {0, 0, 0}, {0, 0, 0},
+    {LADSPA_HINT_BOUNDED_BELOW | LADSPA_HINT_BOUNDED_ABOVE | LADSPA_HINT_DEFAULT_1, 0, 10},
+    {0, 0, 0}
+};
+
+static const LADSPA_PortDescriptor sum_ports[] = {
+    LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO, LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO,
+    LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO
+};
+static const char * const sum_names[] = { "In A", "In B", "Out" };
+static const LADSPA_PortRangeHint sum_hints[] = { {0, 0, 0}, {0, 0, 0}, {0, 0, 0} };
+
+static const LADSPA_Descriptor descriptors[] = {
+    { 9001, "amp", LADSPA_PROPERTY_HARD_RT_CAPABLE, "Amp", "pyjack", "LGPL", 4, amp_ports, amp_names, amp_hints, NULL,
+      testplug_instantiate, testplug_connect, NULL, amp_run, NULL, NULL, NULL, testplug_cleanup },
+    { 9002, "sum", LADSPA_PROPERTY_HARD_RT_CAPABLE, "Sum", "pyjack", "LGPL", 3, sum_ports, sum_names, sum_hints, NULL,
+      testplug_instantiate, testplug_connect, NULL, sum_run, NULL, NULL, NULL, testplug_cleanup },
+    { 9003, "amp_unsafe", 0, "Amp (not RT capable)", "pyjack", "LGPL", 4, amp_ports, amp_names, amp_hints, NULL,
+      testplug_instantiate, testplug_connect, NULL, amp_run, NULL, NULL, NULL, testplug_cleanup },
+};
+
+const LADSPA_Descriptor * ladspa_descriptor(unsigned long index)
+{
+    return index < sizeof(descriptors) / sizeof(descriptors[0]) ? &descriptors[index] : NULL;
+}